@@ -0,0 +1,119 @@
+#pragma once
+
+//          Copyright Jeremiah van Oosten 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+ /**
+  *  @file benchmark.hpp
+  *  @date October 16, 2026
+  *  @author Jeremiah van Oosten
+  *
+  *  @brief Minimal timing harness shared by the benchmarks.
+  *
+  *  Usage: <benchmark> [filter] [--n=<elements>] [--threads=<count>]
+  *  Only benchmarks whose name contains 'filter' are run.
+  */
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace bench
+{
+    struct options
+    {
+        std::string filter;
+        std::size_t n = 0;
+        std::size_t threads = 0;
+    };
+
+    // Parses the command line. 'default_n' is used if --n is not specified.
+    inline options parse_options(int argc, char* argv[], std::size_t default_n)
+    {
+        options opts;
+        opts.n = default_n;
+        opts.threads = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+
+        for (int i = 1; i < argc; ++i)
+        {
+            if (std::strncmp(argv[i], "--n=", 4) == 0)
+                opts.n = static_cast<std::size_t>(std::strtoull(argv[i] + 4, nullptr, 10));
+            else if (std::strncmp(argv[i], "--threads=", 10) == 0)
+                opts.threads = static_cast<std::size_t>(std::strtoull(argv[i] + 10, nullptr, 10));
+            else
+                opts.filter = argv[i];
+        }
+
+        return opts;
+    }
+
+    inline bool enabled(const options& opts, const char* name)
+    {
+        return opts.filter.empty() || std::strstr(name, opts.filter.c_str()) != nullptr;
+    }
+
+    // Prevents the compiler from optimizing away the computation of 'value'.
+    template<typename T>
+    void do_not_optimize(const T& value)
+    {
+#if defined(__GNUC__)
+        // The compiler must assume that the empty asm statement reads 'value' through its address.
+        asm volatile("" : : "g"(&value) : "memory");
+#else
+        static volatile unsigned char sink;
+        sink = *reinterpret_cast<const volatile unsigned char*>(&value);
+#endif
+    }
+
+    // Runs 'fn' 'repeats' times and returns the fastest run in seconds.
+    template<typename Fn>
+    double measure(Fn&& fn, int repeats = 5)
+    {
+        using clock = std::chrono::steady_clock;
+
+        double best = 1e300;
+        for (int r = 0; r < repeats; ++r)
+        {
+            auto start = clock::now();
+            fn();
+            std::chrono::duration<double> elapsed = clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        return best;
+    }
+
+    // Like measure, but calls 'setup' before every run of 'fn'. Only 'fn' is timed.
+    template<typename Setup, typename Fn>
+    double measure_with_setup(Setup&& setup, Fn&& fn, int repeats = 5)
+    {
+        using clock = std::chrono::steady_clock;
+
+        double best = 1e300;
+        for (int r = 0; r < repeats; ++r)
+        {
+            setup();
+            auto start = clock::now();
+            fn();
+            std::chrono::duration<double> elapsed = clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        return best;
+    }
+
+    // Prints one result line: name, time and throughput in elements and bytes.
+    inline void report(const char* name, std::size_t elements, std::size_t bytes, double seconds)
+    {
+        std::printf("%-48s %10.3f ms %10.1f Melem/s %8.2f GB/s\n",
+            name,
+            seconds * 1e3,
+            static_cast<double>(elements) / seconds * 1e-6,
+            static_cast<double>(bytes) / seconds * 1e-9);
+    }
+} // namespace bench
@@ -0,0 +1,444 @@
+#include "benchmark.hpp"
+
+#include <optional_algorithm.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace opt;
+
+template<typename T>
+static std::vector<optional<T>> make_input(std::size_t n, double fill, unsigned seed = 1)
+{
+    std::mt19937_64 rng(seed);
+    std::bernoulli_distribution engaged(fill);
+
+    std::vector<optional<T>> v(n);
+    for (auto& o : v)
+    {
+        if (engaged(rng))
+            o = static_cast<T>(rng());
+    }
+    return v;
+}
+
+template<typename T>
+static void bench_hash(const bench::options& opts, const char* type_name)
+{
+    const auto in = make_input<T>(opts.n, 0.9);
+    std::vector<std::uint64_t> out(opts.n);
+    const std::size_t bytes = opts.n * (sizeof(optional<T>) + sizeof(std::uint64_t));
+
+    std::string name = std::string("hash/std::hash/") + type_name;
+    double t = bench::measure([&]() {
+        std::hash<optional<T>> h;
+        for (std::size_t i = 0; i < in.size(); ++i)
+            out[i] = h(in[i]);
+    });
+    bench::do_not_optimize(out.back());
+    bench::report(name.c_str(), opts.n, bytes, t);
+
+    name = std::string("hash/hash_batch/") + type_name;
+    t = bench::measure([&]() {
+        hash_batch(make_span(in), out.data());
+    });
+    bench::do_not_optimize(out.back());
+    bench::report(name.c_str(), opts.n, bytes, t);
+}
+
+template<typename T>
+static void bench_radix_sort(const bench::options& opts, const char* type_name)
+{
+    const auto in = make_input<T>(opts.n, 0.9);
+    std::vector<optional<T>> data;
+    const std::size_t bytes = opts.n * sizeof(optional<T>);
+
+    std::string name = std::string("radix_sort/std::sort/") + type_name;
+    double t = bench::measure([&]() {
+        data = in;
+        std::sort(data.begin(), data.end());
+    }, 3);
+    bench::report(name.c_str(), opts.n, bytes, t);
+
+    name = std::string("radix_sort/std::stable_sort/") + type_name;
+    t = bench::measure([&]() {
+        data = in;
+        std::stable_sort(data.begin(), data.end());
+    }, 3);
+    bench::report(name.c_str(), opts.n, bytes, t);
+
+    name = std::string("radix_sort/radix_sort/") + type_name;
+    t = bench::measure([&]() {
+        data = in;
+        radix_sort(make_span(data));
+    }, 3);
+    bench::report(name.c_str(), opts.n, bytes, t);
+
+    std::vector<std::uint32_t> payload(opts.n);
+    name = std::string("radix_sort/radix_sort+payload/") + type_name;
+    t = bench::measure([&]() {
+        data = in;
+        radix_sort(make_span(data), make_span(payload));
+    }, 3);
+    bench::report(name.c_str(), opts.n, bytes + opts.n * sizeof(std::uint32_t), t);
+}
+
+static void bench_fill(const bench::options& opts)
+{
+    for (double fill : { 0.1, 0.5, 0.9 })
+    {
+        const auto in = make_input<double>(opts.n, fill);
+        std::vector<optional<double>> data;
+        const std::string fill_name = "/fill:" + std::to_string(static_cast<int>(fill * 100)) + "%";
+        const std::size_t bytes = opts.n * sizeof(optional<double>);
+
+        double t = bench::measure([&]() {
+            data = in;
+            optional<double> last;
+            for (auto& o : data)
+            {
+                if (o)
+                    last = o;
+                else
+                    o = last;
+            }
+        });
+        bench::report(("forward_fill/naive" + fill_name).c_str(), opts.n, bytes, t);
+
+        t = bench::measure([&]() {
+            data = in;
+            forward_fill(make_span(data));
+        });
+        bench::report(("forward_fill/optional" + fill_name).c_str(), opts.n, bytes, t);
+
+        std::vector<double> in_values(opts.n);
+        std::vector<std::uint64_t> in_validity((opts.n + 63) / 64);
+        for (std::size_t i = 0; i < opts.n; ++i)
+        {
+            if (in[i])
+            {
+                in_values[i] = *in[i];
+                in_validity[i / 64] |= std::uint64_t(1) << (i % 64);
+            }
+        }
+
+        std::vector<double> values;
+        std::vector<std::uint64_t> validity;
+        t = bench::measure([&]() {
+            values = in_values;
+            validity = in_validity;
+            forward_fill(make_span(values), validity.data());
+        });
+        bench::report(("forward_fill/bitmap" + fill_name).c_str(), opts.n, opts.n * sizeof(double), t);
+    }
+}
+
+static void bench_interpolate(const bench::options& opts)
+{
+    std::vector<double> times(opts.n);
+    for (std::size_t i = 0; i < opts.n; ++i)
+        times[i] = 0.5 * static_cast<double>(i);
+    span<const double> t(times);
+
+    for (double fill : { 0.1, 0.5, 0.9 })
+    {
+        const auto in = make_input<double>(opts.n, fill);
+        std::vector<optional<double>> data;
+        const std::string fill_name = "/fill:" + std::to_string(static_cast<int>(fill * 100)) + "%";
+        const std::size_t bytes = opts.n * (sizeof(optional<double>) + sizeof(double));
+
+        double elapsed = bench::measure([&]() {
+            data = in;
+            std::size_t last = static_cast<std::size_t>(-1);
+            for (std::size_t i = 0; i < data.size(); ++i)
+            {
+                if (!data[i])
+                    continue;
+                if (last != static_cast<std::size_t>(-1))
+                {
+                    const double slope = (*data[i] - *data[last]) / (times[i] - times[last]);
+                    for (std::size_t j = last + 1; j < i; ++j)
+                        data[j] = *data[last] + slope * (times[j] - times[last]);
+                }
+                last = i;
+            }
+        });
+        bench::report(("interpolate/naive" + fill_name).c_str(), opts.n, bytes, elapsed);
+
+        elapsed = bench::measure([&]() {
+            data = in;
+            interpolate(make_span(data), t, interpolation::linear);
+        });
+        bench::report(("interpolate/optional" + fill_name).c_str(), opts.n, bytes, elapsed);
+
+        std::vector<double> in_values(opts.n);
+        std::vector<std::uint64_t> in_validity((opts.n + 63) / 64);
+        for (std::size_t i = 0; i < opts.n; ++i)
+        {
+            if (in[i])
+            {
+                in_values[i] = *in[i];
+                in_validity[i / 64] |= std::uint64_t(1) << (i % 64);
+            }
+        }
+
+        std::vector<double> values;
+        std::vector<std::uint64_t> validity;
+        elapsed = bench::measure([&]() {
+            values = in_values;
+            validity = in_validity;
+            interpolate(make_span(values), validity.data(), t, interpolation::linear);
+        });
+        bench::report(("interpolate/bitmap" + fill_name).c_str(), opts.n, opts.n * 2 * sizeof(double), elapsed);
+
+        elapsed = bench::measure([&]() {
+            data.clear();
+            interpolator<double> stream(interpolation::linear);
+            const std::size_t chunk = 4096;
+            for (std::size_t i = 0; i < opts.n; i += chunk)
+            {
+                const std::size_t count = std::min(chunk, opts.n - i);
+                stream.push(span<const optional<double>>(in.data() + i, count), t.subspan(i, count), data);
+            }
+            stream.finish(data);
+        });
+        bench::report(("interpolate/streaming" + fill_name).c_str(), opts.n, bytes, elapsed);
+    }
+}
+
+static void bench_diff(const bench::options& opts)
+{
+    const auto old_values = make_input<std::int64_t>(opts.n, 0.9);
+    span<const optional<std::int64_t>> a(old_values);
+    const std::size_t bytes = opts.n * 2 * sizeof(optional<std::int64_t>);
+
+    for (double rate : { 0.001, 0.01, 0.1 })
+    {
+        // Changes of the value or the presence at random positions.
+        std::mt19937_64 rng(9);
+        std::bernoulli_distribution mutate(rate);
+        auto new_values = old_values;
+        for (auto& o : new_values)
+        {
+            if (!mutate(rng))
+                continue;
+            if (o && rng() % 4 != 0)
+                o = *o + 1;
+            else if (o)
+                o.reset();
+            else
+                o = static_cast<std::int64_t>(rng());
+        }
+        span<const optional<std::int64_t>> b(new_values);
+        char rate_name[32];
+        std::snprintf(rate_name, sizeof(rate_name), "/mutation:%g%%", rate * 100);
+
+        double t = bench::measure([&]() {
+            std::vector<std::size_t> positions;
+            for (std::size_t i = 0; i < opts.n; ++i)
+            {
+                if (old_values[i] != new_values[i])
+                    positions.push_back(i);
+            }
+            bench::do_not_optimize(positions.size());
+        });
+        bench::report((std::string("diff/naive") + rate_name).c_str(), opts.n, bytes, t);
+
+        optional_patch<std::int64_t> patch;
+        t = bench::measure([&]() {
+            patch = diff(a, b);
+        });
+        bench::report((std::string("diff/diff") + rate_name).c_str(), opts.n, bytes, t);
+
+        std::vector<optional<std::int64_t>> data;
+        t = bench::measure_with_setup([&]() { data = old_values; }, [&]() {
+            apply_patch(make_span(data), patch);
+        });
+        bench::report((std::string("diff/apply_patch") + rate_name).c_str(), patch.changes(), patch.bytes(), t);
+
+        std::printf("%-48s %10zu changes %10zu bytes (%.2f%% of the column)\n", (std::string("diff/delta") + rate_name).c_str(),
+            patch.changes(), patch.bytes(), 100.0 * static_cast<double>(patch.bytes()) / static_cast<double>(bytes / 2));
+    }
+}
+
+static void bench_rolling(const bench::options& opts)
+{
+    const auto in = make_input<double>(opts.n, 0.9);
+    std::vector<optional<double>> out(opts.n);
+    const std::size_t bytes = opts.n * 2 * sizeof(optional<double>);
+
+    for (std::size_t window : { 10, 1000 })
+    {
+        const std::string window_name = "/window:" + std::to_string(window);
+
+        double t = bench::measure([&]() {
+            rolling_sum<double> sum(window);
+            for (std::size_t i = 0; i < opts.n; ++i)
+                out[i] = sum.push(in[i]);
+        });
+        bench::report(("rolling/sum/streaming" + window_name).c_str(), opts.n, bytes, t);
+
+        t = bench::measure([&]() {
+            rolling_sum_batch(span<const optional<double>>(in), make_span(out), window);
+        });
+        bench::report(("rolling/sum/batch" + window_name).c_str(), opts.n, bytes, t);
+
+        t = bench::measure([&]() {
+            rolling_min<double> min(window);
+            for (std::size_t i = 0; i < opts.n; ++i)
+                out[i] = min.push(in[i]);
+        });
+        bench::report(("rolling/min/streaming" + window_name).c_str(), opts.n, bytes, t);
+
+        t = bench::measure([&]() {
+            rolling_min_batch(span<const optional<double>>(in), make_span(out), window);
+        });
+        bench::report(("rolling/min/batch" + window_name).c_str(), opts.n, bytes, t);
+    }
+}
+
+static void bench_join(const bench::options& opts)
+{
+    // Build on n / 10 rows with duplicate keys, probe with n rows.
+    const std::size_t build_n = opts.n / 10;
+    std::mt19937_64 rng(5);
+    std::bernoulli_distribution engaged(0.95);
+    std::uniform_int_distribution<std::int64_t> key(0, static_cast<std::int64_t>(build_n));
+
+    std::vector<optional<std::int64_t>> left(build_n), right(opts.n);
+    for (auto* side : { &left, &right })
+    {
+        for (auto& k : *side)
+        {
+            if (engaged(rng))
+                k = key(rng);
+        }
+    }
+    span<const optional<std::int64_t>> l(left);
+    span<const optional<std::int64_t>> r(right);
+    const std::size_t bytes = (build_n + opts.n) * sizeof(optional<std::int64_t>);
+
+    double t = bench::measure([&]() {
+        std::unordered_multimap<std::int64_t, std::size_t> table;
+        for (std::size_t i = 0; i < left.size(); ++i)
+        {
+            if (left[i])
+                table.emplace(*left[i], i);
+        }
+        join_result result;
+        for (std::size_t j = 0; j < right.size(); ++j)
+        {
+            if (!right[j])
+                continue;
+            const auto range = table.equal_range(*right[j]);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                result.left.push_back(it->second);
+                result.right.push_back(j);
+            }
+        }
+        bench::do_not_optimize(result.size());
+    }, 3);
+    bench::report("join/unordered_multimap", build_n + opts.n, bytes, t);
+
+    t = bench::measure([&]() {
+        const join_result result = hash_join(l, r);
+        bench::do_not_optimize(result.size());
+    }, 3);
+    bench::report("join/hash_join", build_n + opts.n, bytes, t);
+
+    t = bench::measure([&]() {
+        const join_result result = merge_join(l, r);
+        bench::do_not_optimize(result.size());
+    }, 3);
+    bench::report("join/merge_join", build_n + opts.n, bytes, t);
+}
+
+static void bench_scan(const bench::options& opts)
+{
+    for (double fill : { 0.5, 0.9 })
+    {
+        const std::string fill_name = "/fill:" + std::to_string(static_cast<int>(fill * 100)) + "%";
+        const auto in = make_input<double>(opts.n, fill);
+        span<const optional<double>> s(in);
+        std::vector<optional<double>> out(opts.n);
+        const std::size_t bytes = opts.n * 2 * sizeof(optional<double>);
+
+        // The obvious loop, which branches on every element.
+        double t = bench::measure([&]() {
+            double sum = 0.0;
+            bool any = false;
+            for (std::size_t i = 0; i < opts.n; ++i)
+            {
+                if (in[i])
+                {
+                    sum += *in[i];
+                    any = true;
+                }
+                out[i] = any ? optional<double>(sum) : optional<double>();
+            }
+        });
+        bench::report(("scan/sum/branching" + fill_name).c_str(), opts.n, bytes, t);
+
+        t = bench::measure([&]() {
+            inclusive_scan_skip_null(s, make_span(out), agg::sum());
+        });
+        bench::report(("scan/sum/running" + fill_name).c_str(), opts.n, bytes, t);
+
+        t = bench::measure([&]() {
+            inclusive_scan_skip_null(s, make_span(out), agg::sum(), null_output::null);
+        });
+        bench::report(("scan/sum/null" + fill_name).c_str(), opts.n, bytes, t);
+
+        t = bench::measure([&]() {
+            exclusive_scan_skip_null(s, make_span(out), agg::max());
+        });
+        bench::report(("scan/max/exclusive" + fill_name).c_str(), opts.n, bytes, t);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const bench::options opts = bench::parse_options(argc, argv, 10000000);
+
+    if (bench::enabled(opts, "hash"))
+    {
+        bench_hash<std::int32_t>(opts, "int32");
+        bench_hash<std::int64_t>(opts, "int64");
+        bench_hash<float>(opts, "float");
+        bench_hash<double>(opts, "double");
+    }
+
+    if (bench::enabled(opts, "radix_sort"))
+    {
+        bench_radix_sort<std::int32_t>(opts, "int32");
+        bench_radix_sort<std::int64_t>(opts, "int64");
+        bench_radix_sort<float>(opts, "float");
+    }
+
+    if (bench::enabled(opts, "fill"))
+        bench_fill(opts);
+
+    if (bench::enabled(opts, "interpolate"))
+        bench_interpolate(opts);
+
+    if (bench::enabled(opts, "diff"))
+        bench_diff(opts);
+
+    if (bench::enabled(opts, "rolling"))
+        bench_rolling(opts);
+
+    if (bench::enabled(opts, "join"))
+        bench_join(opts);
+
+    if (bench::enabled(opts, "scan"))
+        bench_scan(opts);
+
+    return 0;
+}
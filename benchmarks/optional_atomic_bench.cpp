@@ -0,0 +1,524 @@
+#include "benchmark.hpp"
+
+#include <optional_atomic.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace opt;
+
+// The baseline: an optional guarded by a mutex.
+template<typename T>
+class mutex_optional
+{
+public:
+    optional<T> load() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_value;
+    }
+
+    void store(optional<T> const& value)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_value = value;
+    }
+
+    optional<T> take()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        optional<T> value = m_value;
+        m_value.reset();
+        return value;
+    }
+
+    bool try_emplace_if_empty(T value)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_value)
+            return false;
+        m_value = value;
+        return true;
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    optional<T> m_value;
+};
+
+// Runs 'fn(thread, ops)' on 1, 2, 4, ... up to opts.threads threads, which share opts.n operations.
+template<typename Fn>
+static void contend(const bench::options& opts, const std::string& name, Fn fn)
+{
+    for (std::size_t threads = 1; ; threads = std::min(threads * 2, opts.threads))
+    {
+        const double t = bench::measure([&]() {
+            std::vector<std::thread> workers;
+            for (std::size_t i = 0; i < threads; ++i)
+                workers.emplace_back(fn, i, opts.n / threads);
+            for (auto& w : workers)
+                w.join();
+        }, 3);
+
+        const std::string label = name + "/threads:" + std::to_string(threads);
+        bench::report(label.c_str(), opts.n, 0, t);
+
+        if (threads == opts.threads)
+            break;
+    }
+}
+
+template<typename T, typename Cell>
+static void bench_cell(const bench::options& opts, const std::string& name)
+{
+    Cell cell;
+
+    // One store for every three loads.
+    contend(opts, name + "/read_mostly", [&](std::size_t thread, std::size_t ops) {
+        std::size_t engaged = 0;
+        for (std::size_t i = 0; i < ops; ++i)
+        {
+            if ((i & 3) == 0)
+                cell.store(optional<T>(static_cast<T>(i + thread)));
+            else
+                engaged += cell.load().has_value();
+        }
+        bench::do_not_optimize(engaged);
+    });
+
+    // Every thread fills the cell if it is empty and takes the value otherwise.
+    contend(opts, name + "/handoff", [&](std::size_t thread, std::size_t ops) {
+        std::size_t taken = 0;
+        for (std::size_t i = 0; i < ops; ++i)
+        {
+            if (!cell.try_emplace_if_empty(static_cast<T>(i + thread)))
+                taken += cell.take().has_value();
+        }
+        bench::do_not_optimize(taken);
+    });
+}
+
+// A read-mostly value that is too large for atomic_optional.
+struct config_block
+{
+    std::uint64_t fields[32];
+};
+
+// The baseline for rcu_optional: an immutable value behind a shared_ptr that is
+// loaded and replaced with std::atomic_load and std::atomic_store.
+template<typename T>
+class shared_ptr_optional
+{
+public:
+    std::shared_ptr<const T> read() const
+    {
+        return std::atomic_load(&m_value);
+    }
+
+    void store(T const& value)
+    {
+        std::atomic_store(&m_value, std::shared_ptr<const T>(std::make_shared<T>(value)));
+    }
+
+private:
+    std::shared_ptr<const T> m_value;
+};
+
+// Reads the first field of the value of a cell (without copying it if possible).
+template<typename Cell>
+static std::uint64_t first_field(const Cell& cell)
+{
+    return cell.load()->fields[0];
+}
+
+static std::uint64_t first_field(const rcu_optional<config_block>& cell)
+{
+    return cell.read()->fields[0];
+}
+
+static std::uint64_t first_field(const shared_ptr_optional<config_block>& cell)
+{
+    return cell.read()->fields[0];
+}
+
+// Readers load the value on 1, 2, 4, ... up to opts.threads threads (for example --threads=64)
+// while a writer replaces it every 100 microseconds.
+template<typename Cell>
+static void bench_read_scaling(const bench::options& opts, const std::string& name)
+{
+    Cell cell;
+    cell.store(config_block());
+
+    for (std::size_t threads = 1; ; threads = std::min(threads * 2, opts.threads))
+    {
+        std::atomic<bool> done(false);
+        std::thread writer([&]() {
+            config_block block = {};
+            while (!done.load(std::memory_order_relaxed))
+            {
+                ++block.fields[0];
+                cell.store(block);
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        });
+
+        const double t = bench::measure([&]() {
+            std::vector<std::thread> readers;
+            for (std::size_t i = 0; i < threads; ++i)
+            {
+                readers.emplace_back([&]() {
+                    std::uint64_t sum = 0;
+                    for (std::size_t k = opts.n / threads; k > 0; --k)
+                        sum += first_field(cell);
+                    bench::do_not_optimize(sum);
+                });
+            }
+            for (auto& r : readers)
+                r.join();
+        }, 3);
+
+        done = true;
+        writer.join();
+
+        const std::string label = name + "/readers:" + std::to_string(threads);
+        bench::report(label.c_str(), opts.n, opts.n * sizeof(config_block), t);
+
+        if (threads == opts.threads)
+            break;
+    }
+}
+
+// Every thread reads a lazily initialized value opts.n / threads times.
+static void bench_once(const bench::options& opts)
+{
+    const auto init = []() { return std::string("expensive singleton"); };
+
+    once_optional<std::string> once;
+    contend(opts, "once/once_optional", [&](std::size_t, std::size_t ops) {
+        std::size_t size = 0;
+        for (std::size_t i = 0; i < ops; ++i)
+            size += once.get_or_init(init).size();
+        bench::do_not_optimize(size);
+    });
+
+    std::once_flag flag;
+    std::string value;
+    contend(opts, "once/call_once", [&](std::size_t, std::size_t ops) {
+        std::size_t size = 0;
+        for (std::size_t i = 0; i < ops; ++i)
+        {
+            std::call_once(flag, [&]() { value = init(); });
+            size += value.size();
+        }
+        bench::do_not_optimize(size);
+    });
+
+    std::mutex mutex;
+    optional<std::string> guarded;
+    contend(opts, "once/mutex_optional", [&](std::size_t, std::size_t ops) {
+        std::size_t size = 0;
+        for (std::size_t i = 0; i < ops; ++i)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!guarded)
+                guarded = init();
+            size += guarded->size();
+        }
+        bench::do_not_optimize(size);
+    });
+}
+
+// The baseline for waitable_optional: an optional with a mutex and a condition variable.
+template<typename T>
+class cv_optional
+{
+public:
+    void emplace(T value)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_value = value;
+        }
+        m_ready.notify_all();
+    }
+
+    optional<T&> wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_ready.wait(lock, [this]() { return m_value.has_value(); });
+        return optional<T&>(*m_value);
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    optional<T> m_value;
+};
+
+// Bounces a value between two threads through two arrays of slots: the main thread
+// publishes ping[i] and waits for pong[i], which the other thread publishes.
+template<typename Slot>
+static void bench_wait(const bench::options& opts, const char* name)
+{
+    const std::size_t trips = opts.n / 1000;
+    const double t = bench::measure([&]() {
+        std::unique_ptr<Slot[]> ping(new Slot[trips]), pong(new Slot[trips]);
+        std::thread echo([&]() {
+            for (std::size_t i = 0; i < trips; ++i)
+                pong[i].emplace(*ping[i].wait() + 1);
+        });
+
+        int value = 0;
+        for (std::size_t i = 0; i < trips; ++i)
+        {
+            ping[i].emplace(value);
+            value = *pong[i].wait();
+        }
+        echo.join();
+        bench::do_not_optimize(value);
+    }, 3);
+
+    bench::report(name, trips, 0, t);
+    std::printf("%-48s %10.1f ns/round trip %5zu bytes/slot\n", "", t * 1e9 / static_cast<double>(trips), sizeof(Slot));
+}
+
+#if defined(__linux__)
+// Bounces a value between two processes opts.n / 1000 times. 'ping' runs in the parent
+// process and 'echo' in a child process; both get the trip count.
+template<typename Ping, typename Echo>
+static void bench_processes(const bench::options& opts, const char* name, Ping ping, Echo echo)
+{
+    const std::size_t trips = opts.n / 1000;
+    const double t = bench::measure([&]() {
+        const pid_t child = fork();
+        if (child == 0)
+        {
+            echo(trips);
+            _exit(0);
+        }
+        ping(trips);
+        waitpid(child, nullptr, 0);
+    }, 3);
+
+    bench::report(name, trips, 0, t);
+    std::printf("%-48s %10.1f ns/round trip\n", "", t * 1e9 / static_cast<double>(trips));
+}
+
+// Two processes pass a counter back and forth through two mailboxes in shared memory,
+// and through a pair of pipes for comparison.
+static void bench_ipc(const bench::options& opts)
+{
+    void* memory = mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return;
+    auto* cells = static_cast<shared_atomic_optional<std::int32_t>*>(memory);
+    shared_atomic_optional<std::int32_t>& request = cells[0];
+    shared_atomic_optional<std::int32_t>& reply = cells[1];
+
+    bench_processes(opts, "ipc/shared_atomic_optional",
+        [&](std::size_t trips) {
+            std::int32_t value = 0;
+            for (std::size_t i = 0; i < trips; ++i)
+            {
+                request.store(value);
+                value = *reply.wait_take();
+            }
+            bench::do_not_optimize(value);
+        },
+        [&](std::size_t trips) {
+            for (std::size_t i = 0; i < trips; ++i)
+                reply.store(*request.wait_take() + 1);
+        });
+    munmap(memory, 4096);
+
+    int to_child[2], to_parent[2];
+    if (pipe(to_child) != 0 || pipe(to_parent) != 0)
+        return;
+    bench_processes(opts, "ipc/pipe",
+        [&](std::size_t trips) {
+            std::int32_t value = 0;
+            for (std::size_t i = 0; i < trips; ++i)
+            {
+                if (write(to_child[1], &value, sizeof(value)) != sizeof(value) || read(to_parent[0], &value, sizeof(value)) != sizeof(value))
+                    break;
+            }
+            bench::do_not_optimize(value);
+        },
+        [&](std::size_t trips) {
+            std::int32_t value = 0;
+            for (std::size_t i = 0; i < trips; ++i)
+            {
+                if (read(to_child[0], &value, sizeof(value)) != sizeof(value))
+                    break;
+                ++value;
+                if (write(to_parent[1], &value, sizeof(value)) != sizeof(value))
+                    break;
+            }
+        });
+    for (int fd : { to_child[0], to_child[1], to_parent[0], to_parent[1] })
+        close(fd);
+}
+#endif
+
+// A row of an in-memory store.
+struct record
+{
+    std::uint64_t fields[8];
+};
+
+// The baseline for versioned_optional: the versions in a std::map guarded by a mutex.
+template<typename T>
+class mutex_versioned
+{
+public:
+    std::uint64_t latest_version() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_versions.empty() ? 0 : m_versions.rbegin()->first;
+    }
+
+    optional<T> read_at(std::uint64_t version) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_versions.upper_bound(version);
+        return it == m_versions.begin() ? optional<T>() : std::prev(it)->second;
+    }
+
+    bool store(std::uint64_t version, optional<T> const& value)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_versions.emplace(version, value);
+        return true;
+    }
+
+    void collect(std::uint64_t low_water)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_versions.upper_bound(low_water);
+        if (it != m_versions.begin())
+            m_versions.erase(m_versions.begin(), std::prev(it));
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::map<std::uint64_t, optional<T>> m_versions;
+};
+
+// Readers read the latest snapshot on 1, 2, 4, ... up to opts.threads threads while a
+// writer adds a version every 10 microseconds and collects all but the last two.
+template<typename Cell>
+static void bench_versioned(const bench::options& opts, const std::string& name)
+{
+    for (std::size_t threads = 1; ; threads = std::min(threads * 2, opts.threads))
+    {
+        Cell cell;
+        cell.store(1, record());
+        std::atomic<bool> done(false);
+        std::thread writer([&]() {
+            record r = {};
+            for (std::uint64_t version = 2; !done.load(std::memory_order_relaxed); ++version)
+            {
+                r.fields[0] = version;
+                cell.collect(version - 2);
+                cell.store(version, r);
+                std::this_thread::sleep_for(std::chrono::microseconds(10));
+            }
+        });
+
+        const double t = bench::measure([&]() {
+            std::vector<std::thread> readers;
+            for (std::size_t i = 0; i < threads; ++i)
+            {
+                readers.emplace_back([&]() {
+                    std::uint64_t sum = 0;
+                    for (std::size_t k = opts.n / threads; k > 0; --k)
+                    {
+                        const optional<record> r = cell.read_at(cell.latest_version());
+                        sum += r ? r->fields[0] : 0;
+                    }
+                    bench::do_not_optimize(sum);
+                });
+            }
+            for (auto& r : readers)
+                r.join();
+        }, 3);
+
+        done = true;
+        writer.join();
+
+        const std::string label = name + "/readers:" + std::to_string(threads);
+        bench::report(label.c_str(), opts.n, opts.n * sizeof(record), t);
+
+        if (threads == opts.threads)
+            break;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const bench::options opts = bench::parse_options(argc, argv, 10000000);
+
+    if (bench::enabled(opts, "atomic_optional"))
+    {
+        bench_cell<std::int32_t, atomic_optional<std::int32_t>>(opts, "atomic_optional/int32");
+        bench_cell<double, atomic_optional<double>>(opts, "atomic_optional/double");
+        bench_cell<std::int64_t, atomic_optional<std::int64_t, atomic_optional_niche_value<std::int64_t, INT64_MIN>>>(opts, "atomic_optional/int64_niche");
+#if OPT_HAS_DOUBLE_WIDTH_CAS
+        bench_cell<std::int64_t, atomic_optional<std::int64_t>>(opts, "atomic_optional/int64");
+#endif
+    }
+
+    if (bench::enabled(opts, "mutex_optional"))
+    {
+        bench_cell<std::int32_t, mutex_optional<std::int32_t>>(opts, "mutex_optional/int32");
+        bench_cell<double, mutex_optional<double>>(opts, "mutex_optional/double");
+        bench_cell<std::int64_t, mutex_optional<std::int64_t>>(opts, "mutex_optional/int64");
+    }
+
+    if (bench::enabled(opts, "read_scaling"))
+    {
+        bench_read_scaling<seqlock_optional<config_block>>(opts, "read_scaling/seqlock_optional");
+        bench_read_scaling<mutex_optional<config_block>>(opts, "read_scaling/mutex_optional");
+        bench_read_scaling<rcu_optional<config_block>>(opts, "read_scaling/rcu_optional");
+        bench_read_scaling<shared_ptr_optional<config_block>>(opts, "read_scaling/shared_ptr");
+    }
+
+    if (bench::enabled(opts, "once"))
+        bench_once(opts);
+
+    if (bench::enabled(opts, "waitable"))
+    {
+        bench_wait<waitable_optional<int>>(opts, "waitable/waitable_optional");
+        bench_wait<cv_optional<int>>(opts, "waitable/cv_optional");
+    }
+
+    if (bench::enabled(opts, "versioned"))
+    {
+        bench_versioned<versioned_optional<record>>(opts, "versioned/versioned_optional");
+        bench_versioned<mutex_versioned<record>>(opts, "versioned/mutex_map");
+    }
+
+#if defined(__linux__)
+    if (bench::enabled(opts, "ipc"))
+        bench_ipc(opts);
+#endif
+
+    return 0;
+}
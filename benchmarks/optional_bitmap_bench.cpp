@@ -0,0 +1,221 @@
+#include "benchmark.hpp"
+
+#include <optional_bitmap.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using namespace opt;
+
+template<typename T>
+static std::vector<optional<T>> make_input(std::size_t n, double fill, unsigned seed = 1)
+{
+    std::mt19937_64 rng(seed);
+    std::bernoulli_distribution engaged(fill);
+
+    std::vector<optional<T>> v(n);
+    for (auto& o : v)
+    {
+        if (engaged(rng))
+            o = static_cast<T>(rng() % 1000000);
+    }
+    return v;
+}
+
+template<typename T>
+static void bench_transcode(const bench::options& opts, const char* type_name)
+{
+    const auto aoo = make_input<T>(opts.n, 0.5);
+    const sentinel_encoding<T> encoding = default_sentinel<T>();
+
+    std::vector<T> sentinel(opts.n);
+    for (std::size_t i = 0; i < opts.n; ++i)
+        sentinel[i] = aoo[i] ? *aoo[i] : encoding.value;
+
+    std::vector<T> values(opts.n);
+    std::vector<std::uint64_t> validity((opts.n + 63) / 64);
+    std::vector<optional<T>> out(opts.n);
+    std::vector<T> encoded(opts.n);
+    const std::string suffix = std::string("/") + type_name;
+
+    // optional -> values + bitmap
+    double t = bench::measure([&]() {
+        std::fill(validity.begin(), validity.end(), 0);
+        for (std::size_t i = 0; i < opts.n; ++i)
+        {
+            if (aoo[i])
+            {
+                values[i] = *aoo[i];
+                validity[i / 64] |= std::uint64_t(1) << (i % 64);
+            }
+            else
+            {
+                values[i] = T();
+            }
+        }
+    });
+    bench::report(("transcode/optional->bitmap/naive" + suffix).c_str(), opts.n, opts.n * sizeof(optional<T>), t);
+
+    t = bench::measure([&]() {
+        transcode(span<const optional<T>>(aoo), make_span(values), validity.data());
+    });
+    bench::report(("transcode/optional->bitmap" + suffix).c_str(), opts.n, opts.n * sizeof(optional<T>), t);
+
+    // values + bitmap -> optional
+    t = bench::measure([&]() {
+        for (std::size_t i = 0; i < opts.n; ++i)
+        {
+            if ((validity[i / 64] >> (i % 64)) & 1)
+                out[i] = values[i];
+            else
+                out[i] = nullopt;
+        }
+    });
+    bench::report(("transcode/bitmap->optional/naive" + suffix).c_str(), opts.n, opts.n * sizeof(optional<T>), t);
+
+    t = bench::measure([&]() {
+        transcode(span<const T>(values), bitmap_view(validity.data(), opts.n), make_span(out));
+    });
+    bench::report(("transcode/bitmap->optional" + suffix).c_str(), opts.n, opts.n * sizeof(optional<T>), t);
+
+    // sentinel -> values + bitmap
+    t = bench::measure([&]() {
+        std::fill(validity.begin(), validity.end(), 0);
+        for (std::size_t i = 0; i < opts.n; ++i)
+        {
+            if (!encoding.is_missing(sentinel[i]))
+            {
+                values[i] = sentinel[i];
+                validity[i / 64] |= std::uint64_t(1) << (i % 64);
+            }
+            else
+            {
+                values[i] = T();
+            }
+        }
+    });
+    bench::report(("transcode/sentinel->bitmap/naive" + suffix).c_str(), opts.n, opts.n * sizeof(T), t);
+
+    t = bench::measure([&]() {
+        transcode(span<const T>(sentinel), encoding, make_span(values), validity.data());
+    });
+    bench::report(("transcode/sentinel->bitmap" + suffix).c_str(), opts.n, opts.n * sizeof(T), t);
+
+    // values + bitmap -> sentinel
+    t = bench::measure([&]() {
+        for (std::size_t i = 0; i < opts.n; ++i)
+            encoded[i] = ((validity[i / 64] >> (i % 64)) & 1) ? values[i] : encoding.value;
+    });
+    bench::report(("transcode/bitmap->sentinel/naive" + suffix).c_str(), opts.n, opts.n * sizeof(T), t);
+
+    t = bench::measure([&]() {
+        transcode(span<const T>(values), bitmap_view(validity.data(), opts.n), make_span(encoded), encoding);
+    });
+    bench::report(("transcode/bitmap->sentinel" + suffix).c_str(), opts.n, opts.n * sizeof(T), t);
+
+    // sentinel -> optional
+    t = bench::measure([&]() {
+        for (std::size_t i = 0; i < opts.n; ++i)
+        {
+            if (!encoding.is_missing(sentinel[i]))
+                out[i] = sentinel[i];
+            else
+                out[i] = nullopt;
+        }
+    });
+    bench::report(("transcode/sentinel->optional/naive" + suffix).c_str(), opts.n, opts.n * sizeof(optional<T>), t);
+
+    t = bench::measure([&]() {
+        transcode(span<const T>(sentinel), encoding, make_span(out));
+    });
+    bench::report(("transcode/sentinel->optional" + suffix).c_str(), opts.n, opts.n * sizeof(optional<T>), t);
+
+    // optional -> sentinel
+    t = bench::measure([&]() {
+        for (std::size_t i = 0; i < opts.n; ++i)
+            encoded[i] = aoo[i] ? *aoo[i] : encoding.value;
+    });
+    bench::report(("transcode/optional->sentinel/naive" + suffix).c_str(), opts.n, opts.n * sizeof(optional<T>), t);
+
+    t = bench::measure([&]() {
+        transcode(span<const optional<T>>(aoo), make_span(encoded), encoding);
+    });
+    bench::report(("transcode/optional->sentinel" + suffix).c_str(), opts.n, opts.n * sizeof(optional<T>), t);
+    bench::do_not_optimize(encoded.back());
+}
+
+static void bench_destroy(const bench::options& opts)
+{
+    using optional_type = optional<std::string>;
+    using storage_type = std::aligned_storage<sizeof(optional_type), alignof(optional_type)>::type;
+
+    // Short strings, so the cost of finding the engaged elements isn't hidden by deallocations.
+    const std::size_t n = opts.n / 4;
+    std::vector<storage_type> storage(n);
+    optional_type* data = reinterpret_cast<optional_type*>(storage.data());
+    const std::size_t bytes = n * sizeof(optional_type);
+
+    for (double fill : { 0.05, 0.5 })
+    {
+        const auto in = make_input<int>(n, fill);
+        const std::string fill_name = "/fill:" + std::to_string(static_cast<int>(fill * 100)) + "%";
+
+        validity_bitmap engaged(n);
+        auto construct = [&]() {
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                if (in[i])
+                    new (data + i) optional_type(in_place, "value");
+                else
+                    new (data + i) optional_type();
+                engaged.set(i, in[i].has_value());
+            }
+        };
+
+        double t = bench::measure_with_setup(construct, [&]() {
+            for (std::size_t i = 0; i < n; ++i)
+                data[i].~optional_type();
+        });
+        bench::report(("destroy/per-element" + fill_name).c_str(), n, bytes, t);
+
+        t = bench::measure_with_setup(construct, [&]() {
+            destroy_engaged(make_span(data, n), engaged);
+        });
+        bench::report(("destroy/destroy_engaged" + fill_name).c_str(), n, bytes, t);
+
+        // After a reset all elements are disengaged, so they can be constructed
+        // again without destroying them first.
+        t = bench::measure_with_setup(construct, [&]() {
+            for (std::size_t i = 0; i < n; ++i)
+                data[i].reset();
+        });
+        bench::report(("reset/per-element" + fill_name).c_str(), n, bytes, t);
+
+        t = bench::measure_with_setup(construct, [&]() {
+            reset_all(make_span(data, n), engaged);
+        });
+        bench::report(("reset/reset_all" + fill_name).c_str(), n, bytes, t);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const bench::options opts = bench::parse_options(argc, argv, 10000000);
+
+    if (bench::enabled(opts, "transcode"))
+    {
+        bench_transcode<std::int32_t>(opts, "int32");
+        bench_transcode<double>(opts, "double");
+    }
+
+    if (bench::enabled(opts, "destroy") || bench::enabled(opts, "reset"))
+        bench_destroy(opts);
+
+    return 0;
+}
@@ -0,0 +1,416 @@
+#include "benchmark.hpp"
+
+#include <optional_channel.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace opt;
+
+// Counts the allocations of the whole program. The replacements are not inlined: GCC
+// warns about free() on a pointer from operator new if it sees both in one function.
+static std::atomic<std::size_t> allocations(0);
+
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+BENCH_NOINLINE void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+BENCH_NOINLINE void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    ::operator delete(p);
+}
+
+// Reports the time and the number of allocations per operation of 'fn', which runs opts.n operations.
+template<typename Fn>
+static void run(const bench::options& opts, const char* name, Fn fn)
+{
+    const std::size_t before = allocations.load();
+    const double t = bench::measure(fn, 3);
+    const double allocs = static_cast<double>(allocations.load() - before) / (3.0 * static_cast<double>(opts.n));
+
+    bench::report(name, opts.n, 0, t);
+    std::printf("%-48s %10.1f ns/op %7.2f allocations/op\n", "", t * 1e9 / static_cast<double>(opts.n), allocs);
+}
+
+// A worker thread that runs the jobs handed to it through a single slot (and spins
+// while the slot is empty), so that a value is produced on another thread.
+class worker
+{
+public:
+    worker()
+        : m_job(nullptr)
+        , m_stop(false)
+        , m_thread(&worker::main, this)
+    {}
+
+    ~worker()
+    {
+        m_stop = true;
+        m_thread.join();
+    }
+
+    void post(void (*job)(void*), void* context)
+    {
+        m_context = context;
+        m_job.store(job, std::memory_order_release);
+    }
+
+private:
+    void main()
+    {
+        detail::backoff wait;
+        while (!m_stop.load(std::memory_order_relaxed))
+        {
+            if (void (*job)(void*) = m_job.load(std::memory_order_acquire))
+            {
+                m_job.store(nullptr, std::memory_order_relaxed);
+                job(m_context);
+                wait = detail::backoff();
+            }
+            else
+                wait();
+        }
+    }
+
+    std::atomic<void (*)(void*)> m_job;
+    void* m_context = nullptr;
+    std::atomic<bool> m_stop;
+    std::thread m_thread;
+};
+
+// Moves the sender to the worker (so that the receiver's thread doesn't touch it
+// concurrently) and sends a value.
+static void send_one(void* sender)
+{
+    oneshot_sender<int> tx(std::move(*static_cast<oneshot_sender<int>*>(sender)));
+    tx.send(1);
+}
+
+static void bench_oneshot(const bench::options& opts)
+{
+    // Create a channel, send and receive on one thread.
+    run(opts, "oneshot/local/make", [&]() {
+        for (std::size_t i = 0; i < opts.n; ++i)
+        {
+            auto channel = oneshot<int>::make();
+            channel.first.send(static_cast<int>(i));
+            bench::do_not_optimize(*channel.second.try_get());
+        }
+    });
+
+    run(opts, "oneshot/local/intrusive", [&]() {
+        oneshot<int> channel;
+        for (std::size_t i = 0; i < opts.n; ++i)
+        {
+            {
+                oneshot_receiver<int> rx = channel.receiver();
+                channel.sender().send(static_cast<int>(i));
+                bench::do_not_optimize(*rx.try_get());
+            }
+            channel.reset();
+        }
+    });
+
+    run(opts, "oneshot/local/std::promise", [&]() {
+        for (std::size_t i = 0; i < opts.n; ++i)
+        {
+            std::promise<int> promise;
+            std::future<int> future = promise.get_future();
+            promise.set_value(static_cast<int>(i));
+            bench::do_not_optimize(future.get());
+        }
+    });
+
+    // Round trip: the value is sent by another thread and the receiver waits for it.
+    worker w;
+    const std::size_t trips = opts.n / 100;
+    bench::options trip_opts = opts;
+    trip_opts.n = trips;
+
+    run(trip_opts, "oneshot/round_trip/make", [&]() {
+        for (std::size_t i = 0; i < trips; ++i)
+        {
+            auto channel = oneshot<int>::make();
+            w.post(send_one, &channel.first);
+            bench::do_not_optimize(*channel.second.wait());
+        }
+    });
+
+    run(trip_opts, "oneshot/round_trip/intrusive", [&]() {
+        oneshot<int> channel;
+        for (std::size_t i = 0; i < trips; ++i)
+        {
+            {
+                oneshot_sender<int> tx = channel.sender();
+                oneshot_receiver<int> rx = channel.receiver();
+                w.post(send_one, &tx);
+                bench::do_not_optimize(*rx.wait());
+            }
+            channel.reset();
+        }
+    });
+
+    run(trip_opts, "oneshot/round_trip/std::promise", [&]() {
+        for (std::size_t i = 0; i < trips; ++i)
+        {
+            std::promise<int> promise;
+            std::future<int> future = promise.get_future();
+            w.post([](void* p) {
+                std::promise<int> moved(std::move(*static_cast<std::promise<int>*>(p)));
+                moved.set_value(1);
+            }, &promise);
+            bench::do_not_optimize(future.get());
+        }
+    });
+}
+
+// The baseline: a deque guarded by a mutex.
+template<typename T>
+class mutex_queue
+{
+public:
+    explicit mutex_queue(std::size_t capacity)
+        : m_capacity(capacity)
+    {}
+
+    bool try_push(T value)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_values.size() == m_capacity)
+            return false;
+        m_values.push_back(std::move(value));
+        return true;
+    }
+
+    optional<T> try_pop()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_values.empty())
+            return nullopt;
+        optional<T> value(std::move(m_values.front()));
+        m_values.pop_front();
+        return value;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::deque<T> m_values;
+    std::size_t m_capacity;
+};
+
+// The out-parameter style: the same ring buffer as opt::spsc_queue, but the slots are
+// default constructed values that are assigned to and try_pop writes through a reference.
+template<typename T>
+class out_param_queue
+{
+public:
+    explicit out_param_queue(std::size_t capacity)
+        : m_values(capacity)
+        , m_head(0)
+        , m_tail(0)
+    {}
+
+    bool try_push(T value)
+    {
+        const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == m_values.size())
+            return false;
+        m_values[tail % m_values.size()] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& out)
+    {
+        const std::size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+        out = std::move(m_values[head % m_values.size()]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> m_values;
+    char m_padding0[64];
+    std::atomic<std::size_t> m_head;
+    char m_padding1[64];
+    std::atomic<std::size_t> m_tail;
+};
+
+template<typename Queue>
+static bool pop_value(Queue& q, std::uint64_t& out)
+{
+    if (optional<std::uint64_t> v = q.try_pop())
+    {
+        out = *v;
+        return true;
+    }
+    return false;
+}
+
+static bool pop_value(out_param_queue<std::uint64_t>& q, std::uint64_t& out)
+{
+    return q.try_pop(out);
+}
+
+// Passes opts.n values from a producer thread to a consumer thread.
+template<typename Queue>
+static void bench_throughput(const bench::options& opts, const char* name)
+{
+    const double t = bench::measure([&]() {
+        Queue q(1024);
+        std::thread producer([&]() {
+            detail::backoff wait;
+            for (std::uint64_t i = 0; i < opts.n; ++i)
+            {
+                while (!q.try_push(i))
+                    wait();
+            }
+        });
+
+        detail::backoff wait;
+        std::uint64_t sum = 0, value = 0;
+        for (std::size_t i = 0; i < opts.n; ++i)
+        {
+            while (!pop_value(q, value))
+                wait();
+            sum += value;
+        }
+        producer.join();
+        bench::do_not_optimize(sum);
+    }, 3);
+    bench::report(name, opts.n, opts.n * sizeof(std::uint64_t), t);
+}
+
+// Like bench_throughput, but with try_push_n and try_pop_n in batches of 64 values.
+template<typename Queue>
+static void bench_batch_throughput(const bench::options& opts, const char* name)
+{
+    const std::size_t batch = 64;
+    const double t = bench::measure([&]() {
+        Queue q(1024);
+        std::thread producer([&]() {
+            std::vector<std::uint64_t> values(batch);
+            for (std::uint64_t i = 0; i < opts.n;)
+            {
+                const std::size_t n = std::min<std::size_t>(batch, opts.n - i);
+                for (std::size_t k = 0; k < n; ++k)
+                    values[k] = i + k;
+                for (std::size_t pushed = 0; pushed < n;)
+                {
+                    const std::size_t p = q.try_push_n(values.begin() + pushed, n - pushed);
+                    if (p == 0)
+                        std::this_thread::yield();
+                    pushed += p;
+                }
+                i += n;
+            }
+        });
+
+        std::vector<std::uint64_t> values(batch);
+        std::uint64_t sum = 0;
+        for (std::size_t popped = 0; popped < opts.n;)
+        {
+            const std::size_t n = q.try_pop_n(values.begin(), batch);
+            if (n == 0)
+                std::this_thread::yield();
+            for (std::size_t k = 0; k < n; ++k)
+                sum += values[k];
+            popped += n;
+        }
+        producer.join();
+        bench::do_not_optimize(sum);
+    }, 3);
+    bench::report(name, opts.n, opts.n * sizeof(std::uint64_t), t);
+}
+
+// Bounces a value between two threads through two queues, opts.n / 100 times.
+template<typename Queue>
+static void bench_latency(const bench::options& opts, const char* name)
+{
+    const std::size_t trips = opts.n / 100;
+    const double t = bench::measure([&]() {
+        Queue ping(64), pong(64);
+        std::thread echo([&]() {
+            detail::backoff wait;
+            std::uint64_t value = 0;
+            for (std::size_t i = 0; i < trips; ++i)
+            {
+                while (!pop_value(ping, value))
+                    wait();
+                pong.try_push(value + 1);
+                wait = detail::backoff();
+            }
+        });
+
+        detail::backoff wait;
+        std::uint64_t value = 0;
+        for (std::size_t i = 0; i < trips; ++i)
+        {
+            ping.try_push(value);
+            while (!pop_value(pong, value))
+                wait();
+            wait = detail::backoff();
+        }
+        echo.join();
+        bench::do_not_optimize(value);
+    }, 3);
+
+    bench::report(name, trips, 0, t);
+    std::printf("%-48s %10.1f ns/round trip\n", "", t * 1e9 / static_cast<double>(trips));
+}
+
+static void bench_queue(const bench::options& opts)
+{
+    bench_throughput<spsc_queue<std::uint64_t>>(opts, "queue/throughput/spsc_queue");
+    bench_throughput<mpmc_queue<std::uint64_t>>(opts, "queue/throughput/mpmc_queue");
+    bench_throughput<out_param_queue<std::uint64_t>>(opts, "queue/throughput/out_param_queue");
+    bench_throughput<mutex_queue<std::uint64_t>>(opts, "queue/throughput/mutex_queue");
+    bench_batch_throughput<spsc_queue<std::uint64_t>>(opts, "queue/throughput/spsc_queue/batch:64");
+    bench_batch_throughput<mpmc_queue<std::uint64_t>>(opts, "queue/throughput/mpmc_queue/batch:64");
+
+    bench_latency<spsc_queue<std::uint64_t>>(opts, "queue/latency/spsc_queue");
+    bench_latency<mpmc_queue<std::uint64_t>>(opts, "queue/latency/mpmc_queue");
+    bench_latency<out_param_queue<std::uint64_t>>(opts, "queue/latency/out_param_queue");
+    bench_latency<mutex_queue<std::uint64_t>>(opts, "queue/latency/mutex_queue");
+}
+
+int main(int argc, char* argv[])
+{
+    const bench::options opts = bench::parse_options(argc, argv, 1000000);
+
+    if (bench::enabled(opts, "oneshot"))
+        bench_oneshot(opts);
+
+    if (bench::enabled(opts, "queue"))
+        bench_queue(opts);
+
+    return 0;
+}
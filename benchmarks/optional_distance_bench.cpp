@@ -0,0 +1,114 @@
+#include "benchmark.hpp"
+
+#include <optional_distance.hpp>
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace opt;
+
+static std::vector<optional<float>> make_input(std::size_t n, double fill, unsigned seed = 1)
+{
+    std::mt19937_64 rng(seed);
+    std::bernoulli_distribution engaged(fill);
+    std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+
+    std::vector<optional<float>> v(n);
+    for (auto& o : v)
+    {
+        if (engaged(rng))
+            o = value(rng);
+    }
+    return v;
+}
+
+// One query against a matrix of about opts.n elements with rows of 'dim' elements.
+static void bench_masked(const bench::options& opts, std::size_t dim)
+{
+    const std::size_t rows = opts.n / dim;
+    const std::size_t n = rows * dim;
+    const auto query = make_input(dim, 0.8, 1);
+    const auto matrix = make_input(n, 0.8, 2);
+    span<const optional<float>> q(query);
+    span<const optional<float>> m(matrix);
+    std::vector<optional<float>> out(rows);
+    const std::size_t bytes = n * sizeof(optional<float>);
+    const std::string dim_name = "/dim:" + std::to_string(dim);
+
+    double t = bench::measure([&]() {
+        for (std::size_t r = 0; r < rows; ++r)
+        {
+            const optional<float>* row = matrix.data() + r * dim;
+            float sum = 0.0f;
+            bool any = false;
+            for (std::size_t i = 0; i < dim; ++i)
+            {
+                if (query[i] && row[i])
+                {
+                    sum += *query[i] * *row[i];
+                    any = true;
+                }
+            }
+            out[r] = make_optional(any, sum);
+        }
+    });
+    bench::do_not_optimize(out.back());
+    bench::report(("masked/dot/naive" + dim_name).c_str(), n, bytes, t);
+
+    t = bench::measure([&]() {
+        for (std::size_t r = 0; r < rows; ++r)
+            out[r] = masked_dot(q, m.subspan(r * dim, dim));
+    });
+    bench::do_not_optimize(out.back());
+    bench::report(("masked/dot" + dim_name).c_str(), n, bytes, t);
+
+    t = bench::measure([&]() {
+        masked_dot_batch(q, m, make_span(out));
+    });
+    bench::do_not_optimize(out.back());
+    bench::report(("masked/dot_batch" + dim_name).c_str(), n, bytes, t);
+
+    t = bench::measure([&]() {
+        masked_l2_batch(q, m, make_span(out));
+    });
+    bench::do_not_optimize(out.back());
+    bench::report(("masked/l2_batch" + dim_name).c_str(), n, bytes, t);
+
+    t = bench::measure([&]() {
+        masked_cosine_batch(q, m, make_span(out));
+    });
+    bench::do_not_optimize(out.back());
+    bench::report(("masked/cosine_batch" + dim_name).c_str(), n, bytes, t);
+
+    // Values with validity bitmaps: a quarter of the bytes.
+    std::vector<float> query_values(dim), values(n);
+    std::vector<std::uint64_t> query_validity((dim + 63) / 64), validity((n + 63) / 64);
+    transcode(q, make_span(query_values), query_validity.data());
+    transcode(m, make_span(values), validity.data());
+    span<const float> qv(query_values);
+    span<const float> v(values);
+    const bitmap_view qb(query_validity.data(), dim);
+    const bitmap_view b(validity.data(), n);
+
+    t = bench::measure([&]() {
+        for (std::size_t r = 0; r < rows; ++r)
+            out[r] = masked_dot(qv, qb, v.subspan(r * dim, dim), b.subview(r * dim, dim));
+    });
+    bench::do_not_optimize(out.back());
+    bench::report(("masked/dot_bitmap" + dim_name).c_str(), n, n * sizeof(float) + n / 8, t);
+}
+
+int main(int argc, char* argv[])
+{
+    const bench::options opts = bench::parse_options(argc, argv, 10000000);
+
+    if (bench::enabled(opts, "masked"))
+    {
+        for (std::size_t dim : { 128, 512, 1024, 4096 })
+            bench_masked(opts, dim);
+    }
+
+    return 0;
+}
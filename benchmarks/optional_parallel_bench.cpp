@@ -0,0 +1,250 @@
+#include "benchmark.hpp"
+
+#include <optional_parallel.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace opt;
+
+template<typename T>
+static std::vector<optional<T>> make_input(std::size_t n, double fill, unsigned seed = 1)
+{
+    std::mt19937_64 rng(seed);
+    std::bernoulli_distribution engaged(fill);
+    std::uniform_real_distribution<double> value(-1.0, 1.0);
+
+    std::vector<optional<T>> v(n);
+    for (auto& o : v)
+    {
+        if (engaged(rng))
+            o = static_cast<T>(value(rng));
+    }
+    return v;
+}
+
+// Runs 'fn(pool)' for 1, 2, 4, ... up to opts.threads threads.
+template<typename Fn>
+static void scale(const bench::options& opts, const char* name, std::size_t bytes, Fn fn)
+{
+    for (std::size_t threads = 1; ; threads = std::min(threads * 2, opts.threads))
+    {
+        par::thread_pool pool(threads);
+        const double t = bench::measure([&]() { fn(pool); });
+
+        const std::string label = std::string(name) + "/threads:" + std::to_string(threads);
+        bench::report(label.c_str(), opts.n, bytes, t);
+
+        if (threads == opts.threads)
+            break;
+    }
+}
+
+static void bench_transform_reduce(const bench::options& opts)
+{
+    const auto v = make_input<float>(opts.n, 0.8);
+    span<const optional<float>> in(v);
+
+    double sequential = 0.0;
+    const double t = bench::measure([&]() {
+        double sum = 0.0;
+        for (auto& o : v)
+        {
+            if (o)
+                sum += static_cast<double>(*o) * *o;
+        }
+        sequential = sum;
+    });
+    bench::do_not_optimize(sequential);
+    bench::report("transform_reduce/sequential", opts.n, opts.n * sizeof(optional<float>), t);
+
+    scale(opts, "transform_reduce/par", opts.n * sizeof(optional<float>), [&](par::thread_pool& pool) {
+        double sum = par::transform_reduce(pool, in, 0.0, std::plus<double>(),
+            [](float f) { return static_cast<double>(f) * f; });
+        bench::do_not_optimize(sum);
+    });
+}
+
+static void bench_for_each_engaged(const bench::options& opts)
+{
+    auto v = make_input<float>(opts.n, 0.8);
+
+    scale(opts, "for_each_engaged/par", 2 * opts.n * sizeof(optional<float>), [&](par::thread_pool& pool) {
+        par::for_each_engaged(pool, make_span(v), [](float& f) { f = f * 0.5f + 1.0f; });
+    });
+}
+
+static void bench_compact(const bench::options& opts)
+{
+    for (double fill : { 0.1, 0.5, 0.9 })
+    {
+        const auto v = make_input<float>(opts.n, fill);
+        span<const optional<float>> in(v);
+        std::vector<float> out(opts.n);
+        const std::string fill_name = "/fill:" + std::to_string(static_cast<int>(fill * 100)) + "%";
+        const std::size_t bytes = opts.n * sizeof(optional<float>);
+
+        const double t = bench::measure([&]() {
+            std::size_t count = 0;
+            for (auto& o : v)
+            {
+                if (o)
+                    out[count++] = *o;
+            }
+            bench::do_not_optimize(count);
+        });
+        bench::report(("compact/naive" + fill_name).c_str(), opts.n, bytes, t);
+
+        const double ts = bench::measure([&]() {
+            bench::do_not_optimize(compact(in, out.data()));
+        });
+        bench::report(("compact/sequential" + fill_name).c_str(), opts.n, bytes, ts);
+
+        scale(opts, ("compact/par" + fill_name).c_str(), bytes, [&](par::thread_pool& pool) {
+            bench::do_not_optimize(par::compact(pool, in, out.data()));
+        });
+    }
+}
+
+static void bench_fill(const bench::options& opts)
+{
+    const auto in = make_input<double>(opts.n, 0.5);
+    std::vector<optional<double>> data;
+    const std::size_t bytes = opts.n * sizeof(optional<double>);
+
+    scale(opts, "forward_fill/par", bytes, [&](par::thread_pool& pool) {
+        data = in;
+        par::forward_fill(pool, make_span(data));
+    });
+}
+
+static void bench_group_aggregate(const bench::options& opts)
+{
+    // Hash aggregation is much slower per row than the other algorithms.
+    bench::options group_opts = opts;
+    group_opts.n = opts.n / 10;
+
+    for (std::int32_t groups : { 1000, 1000000 })
+    {
+        std::mt19937_64 rng(groups);
+        std::bernoulli_distribution engaged(0.95);
+        std::uniform_int_distribution<std::int32_t> key(0, groups - 1);
+
+        std::vector<optional<std::int32_t>> keys(group_opts.n);
+        for (auto& k : keys)
+        {
+            if (engaged(rng))
+                k = key(rng);
+        }
+        const auto values = make_input<double>(group_opts.n, 0.9);
+        span<const optional<std::int32_t>> k(keys);
+        span<const optional<double>> v(values);
+        const std::size_t bytes = group_opts.n * (sizeof(optional<std::int32_t>) + sizeof(optional<double>));
+        const std::string groups_name = "/groups:" + std::to_string(groups);
+
+        double t = bench::measure([&]() {
+            std::unordered_map<std::int32_t, std::pair<double, std::size_t>> map;
+            std::pair<double, std::size_t> null_group(0.0, 0);
+            for (std::size_t i = 0; i < keys.size(); ++i)
+            {
+                auto& g = keys[i] ? map[*keys[i]] : null_group;
+                if (values[i])
+                {
+                    g.first += *values[i];
+                    ++g.second;
+                }
+            }
+            bench::do_not_optimize(map.size());
+        }, 3);
+        bench::report(("group_aggregate/unordered_map" + groups_name).c_str(), group_opts.n, bytes, t);
+
+        scale(group_opts, ("group_aggregate/par" + groups_name).c_str(), bytes, [&](par::thread_pool& pool) {
+            const auto result = par::group_aggregate(pool, k, v, agg::sum(), agg::count());
+            bench::do_not_optimize(result.keys.size());
+        });
+    }
+}
+
+static void bench_hash_join(const bench::options& opts)
+{
+    // Build on n / 10 rows with distinct keys (10M x 100M by default), probe with n rows:
+    // about half of the probe rows match a single build row.
+    const std::size_t build_n = opts.n / 10;
+    std::mt19937_64 rng(3);
+    std::bernoulli_distribution engaged(0.95);
+
+    std::vector<optional<std::int32_t>> build(build_n);
+    for (std::size_t i = 0; i < build_n; ++i)
+    {
+        if (engaged(rng))
+            build[i] = static_cast<std::int32_t>(i);
+    }
+    std::shuffle(build.begin(), build.end(), rng);
+
+    std::uniform_int_distribution<std::int32_t> key(0, static_cast<std::int32_t>(2 * build_n));
+    std::vector<optional<std::int32_t>> probe(opts.n);
+    for (auto& k : probe)
+    {
+        if (engaged(rng))
+            k = key(rng);
+    }
+
+    span<const optional<std::int32_t>> left(build);
+    span<const optional<std::int32_t>> right(probe);
+    const std::size_t bytes = (build_n + opts.n) * sizeof(optional<std::int32_t>);
+
+    scale(opts, "hash_join/par", bytes, [&](par::thread_pool& pool) {
+        const join_result result = par::hash_join(pool, left, right);
+        bench::do_not_optimize(result.size());
+    });
+}
+
+static void bench_scan(const bench::options& opts)
+{
+    const auto v = make_input<double>(opts.n, 0.5);
+    span<const optional<double>> in(v);
+    std::vector<optional<double>> out(opts.n);
+    const std::size_t bytes = 2 * opts.n * sizeof(optional<double>);
+
+    const double t = bench::measure([&]() {
+        inclusive_scan_skip_null(in, make_span(out), agg::sum());
+    });
+    bench::report("scan/sequential", opts.n, bytes, t);
+
+    scale(opts, "scan/par", bytes, [&](par::thread_pool& pool) {
+        par::inclusive_scan_skip_null(pool, in, make_span(out), agg::sum());
+    });
+}
+
+int main(int argc, char* argv[])
+{
+    const bench::options opts = bench::parse_options(argc, argv, 100000000);
+
+    if (bench::enabled(opts, "transform_reduce"))
+        bench_transform_reduce(opts);
+
+    if (bench::enabled(opts, "for_each_engaged"))
+        bench_for_each_engaged(opts);
+
+    if (bench::enabled(opts, "compact"))
+        bench_compact(opts);
+
+    if (bench::enabled(opts, "fill"))
+        bench_fill(opts);
+
+    if (bench::enabled(opts, "group_aggregate"))
+        bench_group_aggregate(opts);
+
+    if (bench::enabled(opts, "hash_join"))
+        bench_hash_join(opts);
+
+    if (bench::enabled(opts, "scan"))
+        bench_scan(opts);
+
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include "benchmark.hpp"
+
+#include <optional_pool.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace opt;
+
+// A heavy object: a parser with a 16 KiB scratch buffer.
+struct parser
+{
+    parser()
+        : buffer(16384)
+    {}
+
+    std::vector<char> buffer;
+};
+
+// The baseline: a stack of objects guarded by a mutex.
+template<typename T>
+class mutex_pool
+{
+public:
+    class handle
+    {
+    public:
+        handle(mutex_pool* pool, std::unique_ptr<T> object)
+            : m_pool(pool)
+            , m_object(std::move(object))
+        {}
+
+        handle(handle&&) = default;
+
+        ~handle()
+        {
+            if (m_object)
+                m_pool->release(std::move(m_object));
+        }
+
+        T* operator->() const
+        {
+            return m_object.get();
+        }
+
+    private:
+        mutex_pool* m_pool;
+        std::unique_ptr<T> m_object;
+    };
+
+    explicit mutex_pool(std::size_t capacity)
+    {
+        for (std::size_t i = 0; i < capacity; ++i)
+            m_free.emplace_back(new T());
+    }
+
+    optional<handle> acquire()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_free.empty())
+            return optional<handle>();
+        handle h(this, std::move(m_free.back()));
+        m_free.pop_back();
+        return optional<handle>(std::move(h));
+    }
+
+private:
+    void release(std::unique_ptr<T> object)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free.push_back(std::move(object));
+    }
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<T>> m_free;
+};
+
+// Runs 'fn(ops)' on 1, 2, 4, ... up to opts.threads threads, which share opts.n operations.
+template<typename Fn>
+static void contend(const bench::options& opts, const std::string& name, Fn fn)
+{
+    for (std::size_t threads = 1; ; threads = std::min(threads * 2, opts.threads))
+    {
+        const double t = bench::measure([&]() {
+            std::vector<std::thread> workers;
+            for (std::size_t i = 0; i < threads; ++i)
+                workers.emplace_back(fn, opts.n / threads);
+            for (auto& w : workers)
+                w.join();
+        }, 3);
+
+        const std::string label = name + "/threads:" + std::to_string(threads);
+        bench::report(label.c_str(), opts.n, 0, t);
+
+        if (threads == opts.threads)
+            break;
+    }
+}
+
+// Every operation acquires a parser, writes to its buffer and returns it. Every
+// eighth operation holds four parsers at once, which spills and refills the caches.
+template<typename Acquire>
+static void use_parsers(std::size_t ops, Acquire acquire)
+{
+    std::size_t sum = 0;
+    for (std::size_t i = 0; i < ops; ++i)
+    {
+        if (i % 8 == 0)
+        {
+            auto a = acquire(), b = acquire(), c = acquire(), d = acquire();
+            a->buffer[0] = b->buffer[0] = c->buffer[0] = d->buffer[0] = static_cast<char>(i);
+            sum += static_cast<std::size_t>(a->buffer[0]);
+        }
+        else
+        {
+            auto p = acquire();
+            p->buffer[i % p->buffer.size()] = static_cast<char>(i);
+            sum += static_cast<std::size_t>(p->buffer[0]);
+        }
+    }
+    bench::do_not_optimize(sum);
+}
+
+static void bench_pool(const bench::options& opts)
+{
+    // Enough parsers for every thread to hold four.
+    const std::size_t capacity = 4 * opts.threads;
+
+    object_pool<parser> keep(capacity);
+    contend(opts, "pool/object_pool/keep", [&](std::size_t ops) {
+        use_parsers(ops, [&]() { return std::move(*keep.acquire()); });
+    });
+
+    object_pool<parser, pool_release::reset> reset(capacity);
+    contend(opts, "pool/object_pool/reset", [&](std::size_t ops) {
+        use_parsers(ops, [&]() { return std::move(*reset.acquire()); });
+    });
+
+    mutex_pool<parser> locked(capacity);
+    contend(opts, "pool/mutex_pool", [&](std::size_t ops) {
+        use_parsers(ops, [&]() { return std::move(*locked.acquire()); });
+    });
+
+    contend(opts, "pool/new_delete", [&](std::size_t ops) {
+        use_parsers(ops, []() { return std::unique_ptr<parser>(new parser()); });
+    });
+}
+
+int main(int argc, char* argv[])
+{
+    const bench::options opts = bench::parse_options(argc, argv, 1000000);
+
+    if (bench::enabled(opts, "pool"))
+        bench_pool(opts);
+
+    return 0;
+}
@@ -15,8 +15,10 @@
   */
 
 #include <cassert>          // for assert
+#include <cstdint>          // for std::uint64_t
+#include <cstring>          // for std::memcpy
 #include <stdexcept>        // for std::logic_error
-#include <functional>       // for std::reference_wrapper
+#include <functional>       // for std::reference_wrapper, std::hash
 #include <initializer_list> // for std::initializer_list
 #include <memory>           // for std::addressof
 #include <string>           // for arguments to opt::bad_optional_access
@@ -84,6 +86,7 @@ namespace opt
     {
         struct init_value_tag {};
         struct optional_tag {};
+        struct optional_access;
 
         namespace traits
         {
@@ -761,6 +764,8 @@ namespace opt
     private:
         using base = detail::optional_base_type<T>;
 
+        friend struct detail::optional_access;
+
     public:
         using this_type = optional<T>;
         using value_type = typename base::value_type;
@@ -1615,6 +1620,110 @@ namespace opt
     {
         return opt.get_ptr();
     }
+
+    namespace detail
+    {
+        // Gives the bulk algorithms access to the storage of an optional.
+        struct optional_access
+        {
+            // Returns the stored value without checking if the optional is engaged.
+            // Only valid for directly stored types. The storage of a disengaged optional
+            // holds an unspecified value: reset() and assigning a disengaged optional only
+            // clear the flag and keep the old value, and some constructors leave it
+            // uninitialized. Callers must mask the result with has_value() (or select
+            // by it) and must never let it reach the output for a disengaged element.
+            template<class T>
+            static typename optional<T>::reference_const_type raw_value(optional<T> const& opt) noexcept
+            {
+                static_assert(config::optional_uses_direct_storage_for<T>::value, "raw_value requires direct storage.");
+                return opt.get_impl();
+            }
+
+            template<class T>
+            static typename optional<T>::reference_type raw_value(optional<T>& opt) noexcept
+            {
+                static_assert(config::optional_uses_direct_storage_for<T>::value, "raw_value requires direct storage.");
+                return opt.get_impl();
+            }
+        };
+
+        // The hash of a disengaged optional.
+        OPT_INLINE_VAR std::uint64_t nullopt_hash = 0x5bd1e9955bd1e995ull;
+
+        // 64-bit finalizer from MurmurHash3 (seeded so that 0 does not hash to 0).
+        // @see https://github.com/aappleby/smhasher/blob/master/src/MurmurHash3.cpp
+        inline std::uint64_t hash_mix(std::uint64_t k) noexcept
+        {
+            k ^= 0x9e3779b97f4a7c15ull;
+            k ^= k >> 33;
+            k *= 0xff51afd7ed558ccdull;
+            k ^= k >> 33;
+            k *= 0xc4ceb9fe1a85ec53ull;
+            k ^= k >> 33;
+            return k;
+        }
+
+        // Reduces a value to the 64 bits that are fed to hash_mix.
+        // Types without a specialization fall back to std::hash.
+        template<typename T, typename = void>
+        struct hash_bits
+        {
+            static std::uint64_t get(T const& v)
+            {
+                return static_cast<std::uint64_t>(std::hash<T>()(v));
+            }
+        };
+
+        template<typename T>
+        struct hash_bits<T, traits::enable_if_t<std::is_integral<T>::value || std::is_enum<T>::value>>
+        {
+            static std::uint64_t get(T v) noexcept
+            {
+                return static_cast<std::uint64_t>(v);
+            }
+        };
+
+        template<typename T>
+        struct hash_bits<T*>
+        {
+            static std::uint64_t get(T* v) noexcept
+            {
+                return static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(v));
+            }
+        };
+
+        // +0.0 and -0.0 compare equal so they must also hash equal.
+        template<>
+        struct hash_bits<float>
+        {
+            static std::uint64_t get(float v) noexcept
+            {
+                std::uint32_t bits;
+                std::memcpy(&bits, &v, sizeof(bits));
+                return bits & (0 - static_cast<decltype(bits)>((bits << 1) != 0));
+            }
+        };
+
+        template<>
+        struct hash_bits<double>
+        {
+            static std::uint64_t get(double v) noexcept
+            {
+                std::uint64_t bits;
+                std::memcpy(&bits, &v, sizeof(bits));
+                return bits & (0 - static_cast<decltype(bits)>((bits << 1) != 0));
+            }
+        };
+    } // namespace detail
+
+    // Returns a 64-bit hash of the optional.
+    // All disengaged optionals hash to the same value.
+    template<class T>
+    std::uint64_t hash_value(optional<T> const& opt)
+    {
+        using value_type = detail::traits::decay_t<typename optional<T>::reference_const_type>;
+        return opt ? detail::hash_mix(detail::hash_bits<value_type>::get(*opt)) : detail::nullopt_hash;
+    }
 } // namespace opt
 
 namespace std
@@ -1625,4 +1734,16 @@ namespace std
     {
         x.swap(y);
     }
+
+    // Hash support for optional
+    // Since C++17
+    // @see https://en.cppreference.com/w/cpp/utility/optional/hash
+    template<class T>
+    struct hash<opt::optional<T>>
+    {
+        std::size_t operator()(opt::optional<T> const& o) const
+        {
+            return static_cast<std::size_t>(opt::hash_value(o));
+        }
+    };
 }
\ No newline at end of file
@@ -0,0 +1,2416 @@
+#pragma once
+
+//          Copyright Jeremiah van Oosten 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+ /**
+  *  @file optional_algorithm.hpp
+  *  @date October 16, 2026
+  *  @author Jeremiah van Oosten
+  *
+  *  @brief Bulk algorithms over contiguous ranges of opt::optional values.
+  */
+
+#include "optional.hpp"
+
+#include <algorithm>        // for std::copy
+#include <cassert>          // for assert
+#include <cstddef>          // for std::size_t
+#include <cstdint>          // for std::uint64_t
+#include <cstring>          // for std::memcpy, std::memcmp
+#include <functional>       // for std::less, std::greater
+#include <limits>           // for std::numeric_limits
+#include <tuple>
+#include <type_traits>
+#include <utility>          // for std::move, std::swap
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>         // for __popcnt64, _BitScanForward64
+#endif
+
+namespace opt
+{
+    // Since C++20
+    // @see https://en.cppreference.com/w/cpp/container/span
+    // Only spans with a dynamic extent are supported.
+    template<class T>
+    class span
+    {
+    public:
+        using element_type = T;
+        using value_type = typename std::remove_cv<T>::type;
+        using size_type = std::size_t;
+        using pointer = T*;
+        using reference = T&;
+        using iterator = T*;
+
+        constexpr span() noexcept
+            : m_data(nullptr)
+            , m_size(0)
+        {}
+
+        constexpr span(pointer first, size_type count) noexcept
+            : m_data(first)
+            , m_size(count)
+        {}
+
+        constexpr span(pointer first, pointer last) noexcept
+            : m_data(first)
+            , m_size(static_cast<size_type>(last - first))
+        {}
+
+        template<std::size_t N>
+        constexpr span(element_type(&arr)[N]) noexcept
+            : m_data(arr)
+            , m_size(N)
+        {}
+
+        // Construct from any contiguous container (std::vector, std::array, ...)
+        template<class Container, typename = detail::traits::enable_if_t<
+            !std::is_base_of<span, detail::traits::decay_t<Container>>::value &&
+            std::is_convertible<decltype(std::declval<Container&>().data()), pointer>::value>>
+        span(Container& c)
+            : m_data(c.data())
+            , m_size(c.size())
+        {}
+
+        // Allows span<T> to span<T const> conversion.
+        template<class U, typename = detail::traits::enable_if_t<std::is_convertible<U(*)[], T(*)[]>::value>>
+        constexpr span(span<U> const& s) noexcept
+            : m_data(s.data())
+            , m_size(s.size())
+        {}
+
+        constexpr pointer data() const noexcept
+        {
+            return m_data;
+        }
+
+        constexpr size_type size() const noexcept
+        {
+            return m_size;
+        }
+
+        constexpr bool empty() const noexcept
+        {
+            return m_size == 0;
+        }
+
+        constexpr iterator begin() const noexcept
+        {
+            return m_data;
+        }
+
+        constexpr iterator end() const noexcept
+        {
+            return m_data + m_size;
+        }
+
+        reference operator[](size_type idx) const
+        {
+            assert(idx < m_size);
+            return m_data[idx];
+        }
+
+        span first(size_type count) const
+        {
+            assert(count <= m_size);
+            return span(m_data, count);
+        }
+
+        span last(size_type count) const
+        {
+            assert(count <= m_size);
+            return span(m_data + (m_size - count), count);
+        }
+
+        span subspan(size_type offset, size_type count) const
+        {
+            assert(offset <= m_size && count <= m_size - offset);
+            return span(m_data + offset, count);
+        }
+
+        span subspan(size_type offset) const
+        {
+            assert(offset <= m_size);
+            return span(m_data + offset, m_size - offset);
+        }
+
+    private:
+        pointer m_data;
+        size_type m_size;
+    };
+
+    template<class T>
+    constexpr span<T> make_span(T* first, std::size_t count) noexcept
+    {
+        return span<T>(first, count);
+    }
+
+    template<class Container>
+    auto make_span(Container& c) -> span<typename std::remove_pointer<decltype(c.data())>::type>
+    {
+        return span<typename std::remove_pointer<decltype(c.data())>::type>(c);
+    }
+
+    // Computes opt::hash_value for each element of 'in' and writes the results to 'out'.
+    // 'out' must have room for in.size() hashes.
+    // The results are identical to calling opt::hash_value (and std::hash) on each element.
+    template<class T>
+    detail::traits::enable_if_t<std::is_arithmetic<T>::value>
+        hash_batch(span<const optional<T>> in, std::uint64_t* out)
+    {
+        using hash_bits = detail::hash_bits<T>;
+
+        const optional<T>* src = in.data();
+        const std::size_t n = in.size();
+
+        // Branch-free so that randomly disengaged elements don't cause branch
+        // mispredictions and so the loop can be vectorized on targets with 64-bit
+        // vector multiplies: the storage of disengaged elements is hashed as well
+        // and the result is replaced by the nullopt hash.
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const std::uint64_t h = detail::hash_mix(hash_bits::get(detail::optional_access::raw_value(src[i])));
+            const std::uint64_t mask = 0 - static_cast<std::uint64_t>(src[i].has_value());
+            out[i] = (h & mask) | (detail::nullopt_hash & ~mask);
+        }
+    }
+
+    // Where radix_sort places the disengaged elements.
+    enum class nulls_order
+    {
+        first,  // Disengaged elements are placed before all engaged elements (the order of operator<).
+        last,   // Disengaged elements are placed after all engaged elements.
+    };
+
+    namespace detail
+    {
+        // Maps an arithmetic value to an unsigned integer with the same ordering.
+        template<typename T, typename = void>
+        struct radix_key;
+
+        template<typename T>
+        struct radix_key<T, traits::enable_if_t<std::is_integral<T>::value && !std::is_same<T, bool>::value>>
+        {
+            using type = typename std::make_unsigned<T>::type;
+
+            static type get(T v) noexcept
+            {
+                // Flip the sign bit so negative values sort before positive values.
+                return std::is_signed<T>::value
+                    ? static_cast<type>(static_cast<type>(v) ^ (type(1) << (sizeof(type) * 8 - 1)))
+                    : static_cast<type>(v);
+            }
+        };
+
+        // Negative floats have all bits flipped (larger magnitude sorts first),
+        // positive floats only have the sign bit flipped.
+        // -0.0 is mapped to the key of +0.0 because they compare equal.
+        // NaNs are sorted after +infinity (or before -infinity if the sign bit is set).
+        template<typename T>
+        struct radix_key<T, traits::enable_if_t<std::is_floating_point<T>::value>>
+        {
+            using type = traits::conditional_t<sizeof(T) == 4, std::uint32_t, std::uint64_t>;
+
+            static_assert(sizeof(T) == sizeof(type), "radix_key only supports 32-bit and 64-bit floating point types.");
+
+            static type get(T v) noexcept
+            {
+                type bits;
+                std::memcpy(&bits, &v, sizeof(bits));
+
+                const type sign = type(1) << (sizeof(type) * 8 - 1);
+                bits = (bits << 1) == 0 ? 0 : bits;
+                return (bits & sign) ? ~bits : (bits | sign);
+            }
+        };
+
+        // Placeholder payload for radix sorts without a payload.
+        struct no_payload {};
+
+        template<typename P>
+        void radix_scatter(P* dst, std::size_t to, P* src, std::size_t from)
+        {
+            dst[to] = std::move(src[from]);
+        }
+
+        inline void radix_scatter(no_payload*, std::size_t, no_payload*, std::size_t) noexcept
+        {}
+
+        // Stable LSD radix sort (8 bits per pass) of 'values' and the parallel 'payload' array.
+        // 'counts' holds the per-pass digit histograms of the values.
+        // 'values_tmp' and 'payload_tmp' are scratch buffers of the same size.
+        // Passes in which all values share the same digit are skipped.
+        // Returns true if the sorted result is in the scratch buffers.
+        template<typename T, typename P>
+        bool radix_sort_passes(T* values, T* values_tmp, P* payload, P* payload_tmp, std::size_t n,
+            std::size_t(*counts)[256])
+        {
+            using key = radix_key<T>;
+
+            bool swapped = false;
+            for (std::size_t pass = 0; pass < sizeof(typename key::type); ++pass)
+            {
+                std::size_t* count = counts[pass];
+                const unsigned shift = static_cast<unsigned>(pass * 8);
+
+                if (count[(key::get(values[0]) >> shift) & 0xff] == n)
+                    continue;
+
+                std::size_t offset = 0;
+                for (std::size_t d = 0; d < 256; ++d)
+                {
+                    const std::size_t c = count[d];
+                    count[d] = offset;
+                    offset += c;
+                }
+
+                for (std::size_t i = 0; i < n; ++i)
+                {
+                    const std::size_t to = count[(key::get(values[i]) >> shift) & 0xff]++;
+                    values_tmp[to] = values[i];
+                    radix_scatter(payload_tmp, to, payload, i);
+                }
+
+                std::swap(values, values_tmp);
+                std::swap(payload, payload_tmp);
+                swapped = !swapped;
+            }
+
+            return swapped;
+        }
+
+        // Extracts the engaged values of 'data' into 'values' and builds the digit histograms
+        // in a single pass. If 'positions' is not null, the source position of each
+        // engaged value and of each disengaged element is stored (in order) in
+        // 'positions' and 'null_positions' respectively.
+        // Returns the number of engaged values.
+        template<typename T>
+        std::size_t radix_partition(span<const optional<T>> data, T* values, std::size_t* positions,
+            std::size_t* null_positions, std::size_t(*counts)[256])
+        {
+            using key = radix_key<T>;
+
+            std::size_t engaged = 0;
+            std::size_t disengaged = 0;
+            for (std::size_t i = 0; i < data.size(); ++i)
+            {
+                if (data[i])
+                {
+                    const T v = *data[i];
+                    const auto k = key::get(v);
+                    for (std::size_t pass = 0; pass < sizeof(k); ++pass)
+                        ++counts[pass][(k >> (pass * 8)) & 0xff];
+
+                    if (positions)
+                        positions[engaged] = i;
+                    values[engaged++] = v;
+                }
+                else if (null_positions)
+                {
+                    null_positions[disengaged++] = i;
+                }
+            }
+
+            return engaged;
+        }
+    } // namespace detail
+
+    // Sorts a range of optional integers or floating point values using a stable LSD radix sort.
+    // With nulls_order::first the result is identical to std::stable_sort using operator<.
+    // NaNs are sorted after +infinity.
+    template<class T>
+    detail::traits::enable_if_t<std::is_arithmetic<T>::value && !std::is_same<T, bool>::value>
+        radix_sort(span<optional<T>> data, nulls_order order = nulls_order::first)
+    {
+        const std::size_t n = data.size();
+        if (n < 2)
+            return;
+
+        std::size_t counts[sizeof(T)][256] = {};
+        std::vector<T> values(n);
+        const std::size_t engaged = detail::radix_partition<T>(data, values.data(), nullptr, nullptr, counts);
+
+        if (engaged > 1)
+        {
+            std::vector<T> values_tmp(engaged);
+            detail::no_payload* no_payload = nullptr;
+            if (detail::radix_sort_passes(values.data(), values_tmp.data(), no_payload, no_payload, engaged, counts))
+                values.swap(values_tmp);
+        }
+
+        const std::size_t disengaged = n - engaged;
+        const std::size_t first_value = (order == nulls_order::first) ? disengaged : 0;
+        const std::size_t first_null = (order == nulls_order::first) ? 0 : engaged;
+
+        for (std::size_t i = 0; i < disengaged; ++i)
+            data[first_null + i] = nullopt;
+
+        for (std::size_t i = 0; i < engaged; ++i)
+            data[first_value + i] = values[i];
+    }
+
+    // Sorts a range of optional integer or floating point keys together with a payload range
+    // of the same size. The payload elements are moved along with their keys.
+    // The sort is stable: elements with equal keys (including disengaged keys)
+    // keep their relative order.
+    template<class T, class V>
+    detail::traits::enable_if_t<std::is_arithmetic<T>::value && !std::is_same<T, bool>::value>
+        radix_sort(span<optional<T>> keys, span<V> payload, nulls_order order = nulls_order::first)
+    {
+        assert(keys.size() == payload.size());
+
+        const std::size_t n = keys.size();
+        if (n < 2)
+            return;
+
+        std::size_t counts[sizeof(T)][256] = {};
+        std::vector<T> values(n);
+        std::vector<std::size_t> positions(n);
+        std::vector<std::size_t> null_positions(n);
+        const std::size_t engaged = detail::radix_partition<T>(keys, values.data(), positions.data(), null_positions.data(), counts);
+
+        if (engaged > 1)
+        {
+            std::vector<T> values_tmp(engaged);
+            std::vector<std::size_t> positions_tmp(engaged);
+            if (detail::radix_sort_passes(values.data(), values_tmp.data(), positions.data(), positions_tmp.data(), engaged, counts))
+            {
+                values.swap(values_tmp);
+                positions.swap(positions_tmp);
+            }
+        }
+
+        const std::size_t disengaged = n - engaged;
+        const std::size_t first_value = (order == nulls_order::first) ? disengaged : 0;
+        const std::size_t first_null = (order == nulls_order::first) ? 0 : engaged;
+
+        std::vector<V> sorted_payload;
+        sorted_payload.reserve(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const bool is_null = (i >= first_null && i < first_null + disengaged);
+            sorted_payload.push_back(std::move(payload[is_null ? null_positions[i - first_null] : positions[i - first_value]]));
+        }
+
+        for (std::size_t i = 0; i < disengaged; ++i)
+            keys[first_null + i] = nullopt;
+
+        for (std::size_t i = 0; i < engaged; ++i)
+            keys[first_value + i] = values[i];
+
+        for (std::size_t i = 0; i < n; ++i)
+            payload[i] = std::move(sorted_payload[i]);
+    }
+
+    namespace detail
+    {
+        // Number of values gathered per block by the branch-free kernels.
+        OPT_INLINE_VAR std::size_t block_size = 256;
+
+        // Branch-free count of the engaged elements.
+        template<class T>
+        std::size_t count_engaged(span<const optional<T>> in) noexcept
+        {
+            std::size_t count = 0;
+            for (std::size_t i = 0; i < in.size(); ++i)
+                count += in[i].has_value() ? 1 : 0;
+            return count;
+        }
+
+        // Copies the engaged values of 'in' to 'out'.
+        // Directly stored values are gathered without branches into a small
+        // block buffer (which doesn't stall on randomly disengaged elements)
+        // and then copied to 'out', so no more than the engaged values are written.
+        template<class T>
+        traits::enable_if_t<config::optional_uses_direct_storage_for<T>::value, std::size_t>
+            compact_impl(span<const optional<T>> in, T* out)
+        {
+            T block[block_size];
+            std::size_t written = 0;
+
+            for (std::size_t first = 0; first < in.size(); first += block_size)
+            {
+                const std::size_t last = first + block_size < in.size() ? first + block_size : in.size();
+
+                std::size_t count = 0;
+                for (std::size_t i = first; i < last; ++i)
+                {
+                    block[count] = optional_access::raw_value(in[i]);
+                    count += in[i].has_value() ? 1 : 0;
+                }
+
+                std::copy(block, block + count, out + written);
+                written += count;
+            }
+
+            return written;
+        }
+
+        template<class T>
+        traits::enable_if_t<!config::optional_uses_direct_storage_for<T>::value, std::size_t>
+            compact_impl(span<const optional<T>> in, T* out)
+        {
+            std::size_t written = 0;
+            for (std::size_t i = 0; i < in.size(); ++i)
+            {
+                if (in[i])
+                    out[written++] = *in[i];
+            }
+            return written;
+        }
+    } // namespace detail
+
+    // Copies the engaged values of 'in' to 'out' (in order) and returns the number of values copied.
+    // 'out' must have room for all engaged values.
+    template<class T>
+    std::size_t compact(span<const optional<T>> in, T* out)
+    {
+        return detail::compact_impl(in, out);
+    }
+
+    // Returns the engaged values of 'in' (in order).
+    template<class T>
+    std::vector<T> compact(span<const optional<T>> in)
+    {
+        std::vector<T> out(detail::count_engaged(in));
+        detail::compact_impl(in, out.data());
+        return out;
+    }
+
+    // Use to disable the gap limit of the fill algorithms.
+    OPT_INLINE_VAR std::size_t no_limit = static_cast<std::size_t>(-1);
+
+    namespace detail
+    {
+        // Validity bitmaps store one bit per value in 64-bit words (least significant bit first).
+        // A set bit means the value is valid (engaged).
+        inline bool bit_test(const std::uint64_t* words, std::size_t i) noexcept
+        {
+            return ((words[i / 64] >> (i % 64)) & 1) != 0;
+        }
+
+        inline void bit_set(std::uint64_t* words, std::size_t i) noexcept
+        {
+            words[i / 64] |= std::uint64_t(1) << (i % 64);
+        }
+
+        inline unsigned popcount64(std::uint64_t x) noexcept
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return static_cast<unsigned>(__builtin_popcountll(x));
+#elif defined(_MSC_VER) && defined(_M_X64)
+            return static_cast<unsigned>(__popcnt64(x));
+#else
+            x = x - ((x >> 1) & 0x5555555555555555ull);
+            x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+            x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+            return static_cast<unsigned>((x * 0x0101010101010101ull) >> 56);
+#endif
+        }
+
+        // The index of the least significant set bit. 'x' must not be 0.
+        inline unsigned countr_zero64(std::uint64_t x) noexcept
+        {
+            assert(x != 0);
+#if defined(__GNUC__) || defined(__clang__)
+            return static_cast<unsigned>(__builtin_ctzll(x));
+#elif defined(_MSC_VER) && defined(_M_X64)
+            unsigned long idx;
+            _BitScanForward64(&idx, x);
+            return static_cast<unsigned>(idx);
+#else
+            unsigned n = 0;
+            while ((x & 1) == 0)
+            {
+                x >>= 1;
+                ++n;
+            }
+            return n;
+#endif
+        }
+
+        // The state that is carried from one element to the next by the fill algorithms.
+        template<class T>
+        struct fill_state
+        {
+            T value;            // The last observed value.
+            bool valid;         // Has a value been observed yet?
+            std::size_t gap;    // Number of elements since the last observation.
+        };
+
+        // Fills the disengaged elements of data[first, last) (in the direction of 'step')
+        // with the carried value and returns the state after the last element.
+        // Directly stored values are processed without branches: every element is
+        // rewritten (engaged elements with their own value).
+        template<class T>
+        traits::enable_if_t<config::optional_uses_direct_storage_for<T>::value, fill_state<T>>
+            fill_impl(optional<T>* data, std::ptrdiff_t first, std::ptrdiff_t last, std::ptrdiff_t step,
+                fill_state<T> state, std::size_t max_gap)
+        {
+            for (std::ptrdiff_t i = first; i != last; i += step)
+            {
+                const bool engaged = data[i].has_value();
+                // Indexed select (instead of ?:) so the compiler can't turn it into a branch.
+                const T candidates[2] = { state.value, optional_access::raw_value(data[i]) };
+                const T value = candidates[engaged];
+
+                state.gap = engaged ? 0 : state.gap + 1;
+                state.valid = state.valid || engaged;
+                state.value = value;
+
+                data[i] = optional<T>(engaged || (state.valid && state.gap <= max_gap), T(value));
+            }
+
+            return state;
+        }
+
+        template<class T>
+        traits::enable_if_t<!config::optional_uses_direct_storage_for<T>::value, fill_state<T>>
+            fill_impl(optional<T>* data, std::ptrdiff_t first, std::ptrdiff_t last, std::ptrdiff_t step,
+                fill_state<T> state, std::size_t max_gap)
+        {
+            for (std::ptrdiff_t i = first; i != last; i += step)
+            {
+                if (data[i])
+                {
+                    state.value = *data[i];
+                    state.valid = true;
+                    state.gap = 0;
+                }
+                else if (state.valid && ++state.gap <= max_gap)
+                {
+                    data[i] = state.value;
+                }
+            }
+
+            return state;
+        }
+
+        // Fills the 64 values that belong to one word of a validity bitmap without branches
+        // and returns the new validity word. If 'Forward' is false, the values are
+        // processed from the last to the first.
+        template<bool Forward, class T>
+        std::uint64_t fill_word(T* values, std::uint64_t word, fill_state<T>& state, std::size_t max_gap)
+        {
+            std::uint64_t result = word;
+            for (unsigned k = 0; k < 64; ++k)
+            {
+                const unsigned b = Forward ? k : 63 - k;
+                const bool valid = ((word >> b) & 1) != 0;
+
+                const T observed[2] = { state.value, values[b] };
+                state.value = observed[valid];
+                state.gap = valid ? 0 : state.gap + 1;
+                state.valid = state.valid || valid;
+
+                const bool fill = state.valid && state.gap <= max_gap;
+                const T filled[2] = { values[b], state.value };
+                values[b] = filled[fill];
+                result |= std::uint64_t(fill) << b;
+            }
+            return result;
+        }
+
+        // Forward fills values[first, last) and the matching bits of the validity bitmap.
+        // Whole words are handled at once if all their values are valid (the carried
+        // value is updated) or all are invalid (the carried value is broadcast).
+        // Other whole words are filled without branches.
+        template<class T>
+        fill_state<T> forward_fill_bitmap_impl(T* values, std::uint64_t* validity, std::size_t first, std::size_t last,
+            fill_state<T> state, std::size_t max_gap)
+        {
+            std::size_t i = first;
+            while (i < last)
+            {
+                if (i % 64 == 0 && i + 64 <= last)
+                {
+                    const std::uint64_t word = validity[i / 64];
+                    if (word == ~std::uint64_t(0))
+                    {
+                        state.value = values[i + 63];
+                        state.valid = true;
+                        state.gap = 0;
+                        i += 64;
+                        continue;
+                    }
+                    if (word == 0)
+                    {
+                        if (state.valid && state.gap < max_gap)
+                        {
+                            const std::size_t fill = (max_gap - state.gap < 64) ? max_gap - state.gap : 64;
+                            std::fill(values + i, values + i + fill, state.value);
+                            validity[i / 64] = (fill == 64) ? ~std::uint64_t(0) : ((std::uint64_t(1) << fill) - 1);
+                        }
+                        state.gap += 64;
+                        i += 64;
+                        continue;
+                    }
+
+                    validity[i / 64] = fill_word<true>(values + i, word, state, max_gap);
+                    i += 64;
+                    continue;
+                }
+
+                if (bit_test(validity, i))
+                {
+                    state.value = values[i];
+                    state.valid = true;
+                    state.gap = 0;
+                }
+                else if (state.valid && ++state.gap <= max_gap)
+                {
+                    values[i] = state.value;
+                    bit_set(validity, i);
+                }
+                ++i;
+            }
+
+            return state;
+        }
+
+        // Backward fills values[first, last) (starting at last - 1) and the matching bits of the validity bitmap.
+        template<class T>
+        fill_state<T> backward_fill_bitmap_impl(T* values, std::uint64_t* validity, std::size_t first, std::size_t last,
+            fill_state<T> state, std::size_t max_gap)
+        {
+            std::size_t i = last;
+            while (i > first)
+            {
+                if (i % 64 == 0 && i - 64 >= first)
+                {
+                    const std::size_t word_first = i - 64;
+                    const std::uint64_t word = validity[word_first / 64];
+                    if (word == ~std::uint64_t(0))
+                    {
+                        state.value = values[word_first];
+                        state.valid = true;
+                        state.gap = 0;
+                        i = word_first;
+                        continue;
+                    }
+                    if (word == 0)
+                    {
+                        if (state.valid && state.gap < max_gap)
+                        {
+                            const std::size_t fill = (max_gap - state.gap < 64) ? max_gap - state.gap : 64;
+                            std::fill(values + i - fill, values + i, state.value);
+                            validity[word_first / 64] = (fill == 64) ? ~std::uint64_t(0) : ~((std::uint64_t(1) << (64 - fill)) - 1);
+                        }
+                        state.gap += 64;
+                        i = word_first;
+                        continue;
+                    }
+
+                    validity[word_first / 64] = fill_word<false>(values + word_first, word, state, max_gap);
+                    i = word_first;
+                    continue;
+                }
+
+                --i;
+                if (bit_test(validity, i))
+                {
+                    state.value = values[i];
+                    state.valid = true;
+                    state.gap = 0;
+                }
+                else if (state.valid && ++state.gap <= max_gap)
+                {
+                    values[i] = state.value;
+                    bit_set(validity, i);
+                }
+            }
+
+            return state;
+        }
+    } // namespace detail
+
+    // Replaces every disengaged element with the last engaged value before it
+    // (last observation carried forward).
+    // At most 'max_gap' consecutive disengaged elements after an engaged element are filled.
+    // Disengaged elements before the first engaged element are left disengaged.
+    template<class T>
+    void forward_fill(span<optional<T>> data, std::size_t max_gap = no_limit)
+    {
+        detail::fill_impl(data.data(), 0, static_cast<std::ptrdiff_t>(data.size()), 1,
+            detail::fill_state<T>{ T(), false, 0 }, max_gap);
+    }
+
+    // Forward fill of values with a validity bitmap (one bit per value, least significant bit first,
+    // a set bit means the value is valid). Filled values also become valid.
+    template<class T>
+    void forward_fill(span<T> values, std::uint64_t* validity, std::size_t max_gap = no_limit)
+    {
+        detail::forward_fill_bitmap_impl(values.data(), validity, 0, values.size(),
+            detail::fill_state<T>{ T(), false, 0 }, max_gap);
+    }
+
+    // Replaces every disengaged element with the first engaged value after it
+    // (next observation carried backward).
+    // At most 'max_gap' consecutive disengaged elements before an engaged element are filled.
+    // Disengaged elements after the last engaged element are left disengaged.
+    template<class T>
+    void backward_fill(span<optional<T>> data, std::size_t max_gap = no_limit)
+    {
+        detail::fill_impl(data.data(), static_cast<std::ptrdiff_t>(data.size()) - 1, -1, -1,
+            detail::fill_state<T>{ T(), false, 0 }, max_gap);
+    }
+
+    // Backward fill of values with a validity bitmap (see forward_fill).
+    template<class T>
+    void backward_fill(span<T> values, std::uint64_t* validity, std::size_t max_gap = no_limit)
+    {
+        detail::backward_fill_bitmap_impl(values.data(), validity, 0, values.size(),
+            detail::fill_state<T>{ T(), false, 0 }, max_gap);
+    }
+
+    // The methods of interpolate.
+    enum class interpolation
+    {
+        linear,     // The straight line between the engaged values before and after the gap.
+        nearest,    // The engaged value (before or after the gap) that is nearest in time (ties go to the one before).
+        step        // The engaged value before the gap (sample and hold).
+    };
+
+    // The number of disengaged elements before the first engaged element and after the last
+    // engaged element that interpolate fills (with the first and last engaged value).
+    struct extrapolation_limits
+    {
+        constexpr extrapolation_limits(std::size_t max_before = 0, std::size_t max_after = 0) noexcept
+            : before(max_before)
+            , after(max_after)
+        {}
+
+        std::size_t before;
+        std::size_t after;
+    };
+
+    namespace detail
+    {
+        // The index of the first set (if Set is true) or clear bit in words[pos, n) or n if there is none.
+        // Whole words without such a bit are skipped.
+        template<bool Set>
+        std::size_t find_next_bit(const std::uint64_t* words, std::size_t pos, std::size_t n) noexcept
+        {
+            if (pos >= n)
+                return n;
+
+            std::size_t k = pos / 64;
+            const std::size_t last_word = (n - 1) / 64;
+            std::uint64_t w = (Set ? words[k] : ~words[k]) & (~std::uint64_t(0) << (pos % 64));
+            while (w == 0)
+            {
+                if (++k > last_word)
+                    return n;
+                w = Set ? words[k] : ~words[k];
+            }
+
+            const std::size_t i = k * 64 + countr_zero64(w);
+            return i < n ? i : n;
+        }
+
+        // Sets the bits [first, last).
+        inline void set_bits(std::uint64_t* words, std::size_t first, std::size_t last) noexcept
+        {
+            while (first < last && first % 64 != 0)
+                bit_set(words, first++);
+            for (; first + 64 <= last; first += 64)
+                words[first / 64] = ~std::uint64_t(0);
+            while (first < last)
+                bit_set(words, first++);
+        }
+
+        // Writes the interpolated values of the 'count' elements at 'times' between the engaged
+        // values (t0, v0) and (t1, v1) to 'out'. The method is selected once per gap and the
+        // loops are simple enough to be vectorized if 'out' is an array of values.
+        template<class Out, class T, class Time>
+        void interpolate_gap(Out* out, const Time* times, std::size_t count,
+            Time t0, T v0, Time t1, T v1, interpolation method)
+        {
+            switch (method)
+            {
+            case interpolation::linear:
+            {
+                const T slope = (v1 - v0) / static_cast<T>(t1 - t0);
+                for (std::size_t i = 0; i < count; ++i)
+                    out[i] = v0 + slope * static_cast<T>(times[i] - t0);
+                break;
+            }
+            case interpolation::nearest:
+                for (std::size_t i = 0; i < count; ++i)
+                    out[i] = (times[i] - t0) > (t1 - times[i]) ? v1 : v0;
+                break;
+            case interpolation::step:
+                for (std::size_t i = 0; i < count; ++i)
+                    out[i] = v0;
+                break;
+            }
+        }
+
+        // Calls fill(first, last, left, right) for every maximal run [first, last) of
+        // missing elements of a range of n elements. 'left' is first - 1 (or npos at the
+        // start of the range) and 'right' is 'last' (or npos at the end of the range).
+        // 'next_missing(pos)' and 'next_present(pos)' find the next missing or present
+        // element at or after 'pos' (or return n).
+        template<class NextMissing, class NextPresent, class Fill>
+        void for_each_gap(std::size_t n, NextMissing next_missing, NextPresent next_present, Fill fill)
+        {
+            const std::size_t npos = static_cast<std::size_t>(-1);
+            std::size_t pos = 0;
+            while (pos < n)
+            {
+                const std::size_t first = next_missing(pos);
+                if (first == n)
+                    break;
+                const std::size_t last = next_present(first);
+                fill(first, last, first == 0 ? npos : first - 1, last == n ? npos : last);
+                pos = last;
+            }
+        }
+
+        // Fills the gap [first, last) of a range of n elements (see for_each_gap).
+        // 'write(i, count, left, right)' interpolates the elements [i, i + count) between the
+        // engaged elements 'left' and 'right'; 'fill(i, count, source)' copies the engaged
+        // element 'source' to the elements [i, i + count).
+        template<class Write, class Fill>
+        void interpolate_gap_range(std::size_t first, std::size_t last, std::size_t left, std::size_t right,
+            std::size_t max_gap, extrapolation_limits limits, Write write, Fill fill)
+        {
+            const std::size_t npos = static_cast<std::size_t>(-1);
+            const std::size_t count = last - first;
+            if (left != npos && right != npos)
+            {
+                if (count <= max_gap)
+                    write(first, count, left, right);
+            }
+            else if (right != npos)
+            {
+                const std::size_t filled = std::min(count, limits.before);
+                fill(last - filled, filled, right);
+            }
+            else if (left != npos)
+            {
+                fill(first, std::min(count, limits.after), left);
+            }
+        }
+    } // namespace detail
+
+    // Replaces the disengaged elements of 'values' with values interpolated (see opt::interpolation)
+    // from the engaged elements before and after them. times[i] is the time of values[i]
+    // (the times must be strictly increasing).
+    // Gaps of more than 'max_gap' consecutive disengaged elements are left disengaged.
+    // At most limits.before disengaged elements before the first engaged element and at most
+    // limits.after disengaged elements after the last engaged element are filled (with the
+    // first and last engaged value, for every method).
+    template<class T, class Time>
+    void interpolate(span<optional<T>> values, span<const Time> times, interpolation method,
+        std::size_t max_gap = no_limit, extrapolation_limits limits = extrapolation_limits())
+    {
+        static_assert(std::is_floating_point<T>::value, "interpolate requires floating point values.");
+        static_assert(std::is_arithmetic<Time>::value, "interpolate requires arithmetic times.");
+        assert(values.size() == times.size());
+
+        optional<T>* data = values.data();
+        const std::size_t n = values.size();
+        detail::for_each_gap(n,
+            [&](std::size_t pos) { while (pos < n && data[pos]) ++pos; return pos; },
+            [&](std::size_t pos) { while (pos < n && !data[pos]) ++pos; return pos; },
+            [&](std::size_t first, std::size_t last, std::size_t left, std::size_t right) {
+                detail::interpolate_gap_range(first, last, left, right, max_gap, limits,
+                    [&](std::size_t i, std::size_t count, std::size_t l, std::size_t r) {
+                        detail::interpolate_gap(data + i, times.data() + i, count, times[l], *data[l], times[r], *data[r], method);
+                    },
+                    [&](std::size_t i, std::size_t count, std::size_t source) {
+                        const T value = *data[source];
+                        std::fill(data + i, data + i + count, optional<T>(value));
+                    });
+            });
+    }
+
+    // Interpolation of values with a validity bitmap (see forward_fill). Filled values also become valid.
+    // The gaps are found by scanning the words of the bitmap (skipping words that are all valid
+    // or all invalid) and the values of a gap are interpolated with a vectorizable loop.
+    template<class T, class Time>
+    void interpolate(span<T> values, std::uint64_t* validity, span<const Time> times, interpolation method,
+        std::size_t max_gap = no_limit, extrapolation_limits limits = extrapolation_limits())
+    {
+        static_assert(std::is_floating_point<T>::value, "interpolate requires floating point values.");
+        static_assert(std::is_arithmetic<Time>::value, "interpolate requires arithmetic times.");
+        assert(values.size() == times.size());
+
+        T* data = values.data();
+        const std::size_t n = values.size();
+        detail::for_each_gap(n,
+            [&](std::size_t pos) { return detail::find_next_bit<false>(validity, pos, n); },
+            [&](std::size_t pos) { return detail::find_next_bit<true>(validity, pos, n); },
+            [&](std::size_t first, std::size_t last, std::size_t left, std::size_t right) {
+                detail::interpolate_gap_range(first, last, left, right, max_gap, limits,
+                    [&](std::size_t i, std::size_t count, std::size_t l, std::size_t r) {
+                        detail::interpolate_gap(data + i, times.data() + i, count, times[l], data[l], times[r], data[r], method);
+                        detail::set_bits(validity, i, i + count);
+                    },
+                    [&](std::size_t i, std::size_t count, std::size_t source) {
+                        std::fill(data + i, data + i + count, data[source]);
+                        detail::set_bits(validity, i, i + count);
+                    });
+            });
+    }
+
+    // Streaming version of interpolate for unbounded input that arrives in chunks.
+    // The state (the last engaged value and the open gap) is carried from one chunk to the
+    // next, so the concatenated output is identical to interpolating the concatenated input.
+    // A disengaged element can only be output once the gap it belongs to is resolved, so the
+    // output lags the input by the open gap. Its times are buffered only while the gap can
+    // still be interpolated (at most 'max_gap' elements).
+    // If trailing extrapolation is enabled (limits.after > 0) a long gap is only output once it
+    // ends or finish is called.
+    template<class T, class Time = double>
+    class interpolator
+    {
+    public:
+        static_assert(std::is_floating_point<T>::value, "interpolator requires floating point values.");
+        static_assert(std::is_arithmetic<Time>::value, "interpolator requires arithmetic times.");
+
+        explicit interpolator(interpolation method, std::size_t max_gap = no_limit,
+            extrapolation_limits limits = extrapolation_limits())
+            : m_method(method)
+            , m_max_gap(max_gap)
+            , m_limits(limits)
+            , m_value()
+            , m_time()
+            , m_valid(false)
+            , m_gap(0)
+            , m_pending(0)
+        {}
+
+        // Processes the next chunk of the input and appends the elements whose output is final to 'out'.
+        void push(span<const optional<T>> values, span<const Time> times, std::vector<optional<T>>& out)
+        {
+            assert(values.size() == times.size());
+
+            for (std::size_t i = 0; i < values.size(); ++i)
+            {
+                if (values[i])
+                    close_gap(*values[i], times[i], out);
+                else
+                    extend_gap(times[i], out);
+            }
+        }
+
+        // Ends the input: appends the elements of the trailing gap to 'out' and resets the state.
+        void finish(std::vector<optional<T>>& out)
+        {
+            const std::size_t filled = m_valid ? std::min(m_pending, m_limits.after) : 0;
+            out.insert(out.end(), filled, optional<T>(m_value));
+            out.insert(out.end(), m_pending - filled, optional<T>());
+
+            m_valid = false;
+            m_gap = 0;
+            m_pending = 0;
+            m_times.clear();
+        }
+
+        // The number of input elements that have not been output yet.
+        std::size_t pending() const noexcept
+        {
+            return m_pending;
+        }
+
+    private:
+        void close_gap(T value, Time time, std::vector<optional<T>>& out)
+        {
+            if (m_gap == 0 && m_valid)
+            {
+                // Not the end of a gap.
+                out.push_back(value);
+                m_value = value;
+                m_time = time;
+                return;
+            }
+
+            if (!m_valid)
+            {
+                // Leading gap: only the last limits.before elements are still pending.
+                out.insert(out.end(), m_pending, optional<T>(value));
+            }
+            else if (m_gap <= m_max_gap)
+            {
+                const std::size_t first = out.size();
+                out.resize(first + m_pending);
+                detail::interpolate_gap(out.data() + first, m_times.data(), m_pending, m_time, m_value, time, value, m_method);
+            }
+            else
+            {
+                out.insert(out.end(), m_pending, optional<T>());
+            }
+            out.push_back(value);
+
+            m_value = value;
+            m_time = time;
+            m_valid = true;
+            m_gap = 0;
+            m_pending = 0;
+            m_times.clear();
+        }
+
+        void extend_gap(Time time, std::vector<optional<T>>& out)
+        {
+            ++m_gap;
+            ++m_pending;
+
+            if (!m_valid)
+            {
+                // Leading elements further than limits.before from the first engaged element stay disengaged.
+                if (m_pending > m_limits.before)
+                {
+                    out.push_back(nullopt);
+                    --m_pending;
+                }
+            }
+            else if (m_gap <= m_max_gap)
+            {
+                m_times.push_back(time);
+            }
+            else
+            {
+                // The gap is too long to be interpolated.
+                m_times.clear();
+                if (m_limits.after == 0)
+                {
+                    out.insert(out.end(), m_pending, optional<T>());
+                    m_pending = 0;
+                }
+            }
+        }
+
+        interpolation m_method;
+        std::size_t m_max_gap;
+        extrapolation_limits m_limits;
+
+        T m_value;                  // The last engaged value.
+        Time m_time;                // The time of the last engaged value.
+        bool m_valid;               // Has an engaged value been seen yet?
+        std::size_t m_gap;          // The length of the current gap.
+        std::size_t m_pending;      // The number of elements of the current gap that have not been output.
+        std::vector<Time> m_times;  // The times of the pending elements (while the gap can be interpolated).
+    };
+
+    namespace detail
+    {
+        // The last 'window' elements of a stream and the number of engaged elements among them.
+        template<class T>
+        class rolling_window
+        {
+        public:
+            explicit rolling_window(std::size_t window)
+                : m_values(window)
+                , m_next(0)
+                , m_count(0)
+                , m_position(0)
+            {
+                assert(window > 0);
+            }
+
+            // Adds 'value' to the window and returns the element that left the window
+            // (disengaged if the window wasn't full yet).
+            optional<T> push(optional<T> value)
+            {
+                optional<T> leaving = std::move(m_values[m_next]);
+                m_count += static_cast<std::size_t>(value.has_value()) - static_cast<std::size_t>(leaving.has_value());
+                m_values[m_next] = std::move(value);
+                m_next = (m_next + 1 == m_values.size()) ? 0 : m_next + 1;
+                ++m_position;
+                return leaving;
+            }
+
+            void reset()
+            {
+                std::fill(m_values.begin(), m_values.end(), nullopt);
+                m_next = 0;
+                m_count = 0;
+                m_position = 0;
+            }
+
+            std::size_t window() const noexcept
+            {
+                return m_values.size();
+            }
+
+            // The number of engaged elements in the window.
+            std::size_t count() const noexcept
+            {
+                return m_count;
+            }
+
+            // The number of elements that were pushed.
+            std::size_t position() const noexcept
+            {
+                return m_position;
+            }
+
+        private:
+            std::vector<optional<T>> m_values;
+            std::size_t m_next;
+            std::size_t m_count;
+            std::size_t m_position;
+        };
+
+        // Integers are summed in 64 bits, floating point values in their own type.
+        template<class T>
+        using rolling_sum_t = traits::conditional_t<std::is_floating_point<T>::value, T,
+            traits::conditional_t<std::is_signed<T>::value, std::int64_t, std::uint64_t>>;
+
+        // The mean of integers is a double.
+        template<class T>
+        using rolling_mean_t = traits::conditional_t<std::is_floating_point<T>::value, T, double>;
+
+        // A running sum that values are added to and subtracted from.
+        // Floating point sums are compensated (Kahan) so that they don't drift
+        // when values leave the window.
+        template<class T, bool = std::is_floating_point<T>::value>
+        struct running_sum
+        {
+            T sum = 0;
+
+            void add(T x) noexcept
+            {
+                sum += x;
+            }
+
+            void sub(T x) noexcept
+            {
+                sum -= x;
+            }
+        };
+
+        template<class T>
+        struct running_sum<T, true>
+        {
+            T sum = 0;
+            T compensation = 0;
+
+            void add(T x) noexcept
+            {
+                const T y = x - compensation;
+                const T t = sum + y;
+                compensation = (t - sum) - y;
+                sum = t;
+            }
+
+            void sub(T x) noexcept
+            {
+                add(-x);
+            }
+        };
+
+        // Updates 'sum' with an entering and a leaving element. Disengaged elements count as 0;
+        // the update is the same whether the elements are engaged or not, so that the batch
+        // version can run without branches and produce the same results as the streaming version.
+        template<class S>
+        void rolling_sum_update(running_sum<S>& sum, S entering, bool entering_engaged, S leaving, bool leaving_engaged) noexcept
+        {
+            const S in[2] = { S(0), entering };
+            const S out[2] = { S(0), leaving };
+            sum.add(in[entering_engaged]);
+            sum.sub(out[leaving_engaged]);
+        }
+
+        template<class T>
+        T optional_value_or_zero(optional<T> const& o)
+        {
+            return o.has_value() ? *o : T(0);
+        }
+    } // namespace detail
+
+    // The number of engaged elements in a sliding window over a stream of optionals.
+    template<class T>
+    class rolling_count
+    {
+    public:
+        explicit rolling_count(std::size_t window)
+            : m_window(window)
+        {}
+
+        // Adds the next element and returns the number of engaged elements among the last 'window' elements.
+        std::size_t push(optional<T> value)
+        {
+            m_window.push(std::move(value));
+            return m_window.count();
+        }
+
+        std::size_t value() const noexcept
+        {
+            return m_window.count();
+        }
+
+        void reset()
+        {
+            m_window.reset();
+        }
+
+    private:
+        detail::rolling_window<T> m_window;
+    };
+
+    // The sum of the engaged elements in a sliding window over a stream of optionals.
+    // Disengaged elements are skipped (not treated as zero). The result is disengaged if
+    // the window contains fewer than 'min_count' engaged elements.
+    // Each update is O(1).
+    template<class T>
+    class rolling_sum
+    {
+        static_assert(std::is_arithmetic<T>::value, "rolling_sum requires an arithmetic type.");
+
+    public:
+        using result_type = detail::rolling_sum_t<T>;
+
+        explicit rolling_sum(std::size_t window, std::size_t min_count = 1)
+            : m_window(window)
+            , m_min_count(min_count)
+        {}
+
+        // Adds the next element and returns the sum of the last 'window' elements.
+        optional<result_type> push(optional<T> value)
+        {
+            const bool engaged = value.has_value();
+            const result_type entering = static_cast<result_type>(detail::optional_value_or_zero(value));
+            const optional<T> leaving = m_window.push(std::move(value));
+            detail::rolling_sum_update(m_sum, entering, engaged,
+                static_cast<result_type>(detail::optional_value_or_zero(leaving)), leaving.has_value());
+            return this->value();
+        }
+
+        optional<result_type> value() const
+        {
+            return optional<result_type>(m_window.count() >= m_min_count && m_window.count() > 0, result_type(m_sum.sum));
+        }
+
+        std::size_t count() const noexcept
+        {
+            return m_window.count();
+        }
+
+        void reset()
+        {
+            m_window.reset();
+            m_sum = detail::running_sum<result_type>();
+        }
+
+    private:
+        detail::rolling_window<T> m_window;
+        detail::running_sum<result_type> m_sum;
+        std::size_t m_min_count;
+    };
+
+    // The mean of the engaged elements in a sliding window (see rolling_sum).
+    template<class T>
+    class rolling_mean
+    {
+    public:
+        using result_type = detail::rolling_mean_t<T>;
+
+        explicit rolling_mean(std::size_t window, std::size_t min_count = 1)
+            : m_sum(window, min_count)
+        {}
+
+        // Adds the next element and returns the mean of the last 'window' elements.
+        optional<result_type> push(optional<T> value)
+        {
+            m_sum.push(std::move(value));
+            return this->value();
+        }
+
+        optional<result_type> value() const
+        {
+            const optional<typename rolling_sum<T>::result_type> sum = m_sum.value();
+            return sum ? optional<result_type>(static_cast<result_type>(*sum) / static_cast<result_type>(m_sum.count()))
+                       : optional<result_type>();
+        }
+
+        std::size_t count() const noexcept
+        {
+            return m_sum.count();
+        }
+
+        void reset()
+        {
+            m_sum.reset();
+        }
+
+    private:
+        rolling_sum<T> m_sum;
+    };
+
+    // The extremum (according to 'Compare') of the engaged elements in a sliding window
+    // over a stream of optionals. Disengaged elements are skipped. The result is disengaged
+    // if the window contains fewer than 'min_count' engaged elements.
+    // A monotonic deque of the candidates is kept, so each update is O(1) amortized.
+    template<class T, class Compare>
+    class rolling_extremum
+    {
+    public:
+        using result_type = T;
+
+        explicit rolling_extremum(std::size_t window, std::size_t min_count = 1, Compare compare = Compare())
+            : m_window(window)
+            , m_deque(window)
+            , m_head(0)
+            , m_size(0)
+            , m_min_count(min_count)
+            , m_compare(compare)
+        {}
+
+        // Adds the next element and returns the extremum of the last 'window' elements.
+        optional<T> push(optional<T> value)
+        {
+            const std::size_t position = m_window.position();
+
+            // Remove the candidate that leaves the window.
+            if (m_size > 0 && m_deque[m_head].position + m_window.window() <= position)
+                pop_front();
+
+            if (value)
+            {
+                // Candidates that are not better than the new value can never be the result again.
+                while (m_size > 0 && !m_compare(back().value, *value))
+                    --m_size;
+                push_back(candidate{ position, *value });
+            }
+
+            m_window.push(optional<bool>(value.has_value(), true));
+            return this->value();
+        }
+
+        optional<T> value() const
+        {
+            if (m_window.count() < m_min_count || m_size == 0)
+                return nullopt;
+            return m_deque[m_head].value;
+        }
+
+        std::size_t count() const noexcept
+        {
+            return m_window.count();
+        }
+
+        void reset()
+        {
+            m_window.reset();
+            m_head = 0;
+            m_size = 0;
+        }
+
+    private:
+        struct candidate
+        {
+            std::size_t position;
+            T value;
+        };
+
+        // The index of the i-th candidate in the ring buffer.
+        std::size_t index(std::size_t i) const noexcept
+        {
+            const std::size_t idx = m_head + i;
+            return idx < m_deque.size() ? idx : idx - m_deque.size();
+        }
+
+        candidate& back()
+        {
+            return m_deque[index(m_size - 1)];
+        }
+
+        void push_back(candidate c)
+        {
+            assert(m_size < m_deque.size());
+            m_deque[index(m_size)] = std::move(c);
+            ++m_size;
+        }
+
+        void pop_front()
+        {
+            m_head = (m_head + 1 == m_deque.size()) ? 0 : m_head + 1;
+            --m_size;
+        }
+
+        detail::rolling_window<bool> m_window;
+        std::vector<candidate> m_deque;
+        std::size_t m_head;
+        std::size_t m_size;
+        std::size_t m_min_count;
+        Compare m_compare;
+    };
+
+    template<class T>
+    using rolling_min = rolling_extremum<T, std::less<T>>;
+
+    template<class T>
+    using rolling_max = rolling_extremum<T, std::greater<T>>;
+
+    // Batch versions of the rolling aggregates. out[i] is the aggregate of in[i - window + 1, i]
+    // (of in[0, i] for the first elements), which is the result of the i-th push of the
+    // streaming version. The loops have no data-dependent branches.
+
+    template<class T>
+    detail::traits::enable_if_t<std::is_arithmetic<T>::value>
+        rolling_count_batch(span<const optional<T>> in, span<std::size_t> out, std::size_t window)
+    {
+        assert(window > 0 && out.size() == in.size());
+
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < in.size(); ++i)
+        {
+            const bool leaving = i >= window && in[i - window].has_value();
+            count += static_cast<std::size_t>(in[i].has_value()) - static_cast<std::size_t>(leaving);
+            out[i] = count;
+        }
+    }
+
+    template<class T>
+    detail::traits::enable_if_t<std::is_arithmetic<T>::value>
+        rolling_sum_batch(span<const optional<T>> in, span<optional<detail::rolling_sum_t<T>>> out,
+                          std::size_t window, std::size_t min_count = 1)
+    {
+        using S = detail::rolling_sum_t<T>;
+        using detail::optional_access;
+        assert(window > 0 && out.size() == in.size());
+
+        detail::running_sum<S> sum;
+        std::size_t count = 0;
+        const optional<T> none;
+        for (std::size_t i = 0; i < in.size(); ++i)
+        {
+            const optional<T>* candidates[2] = { &none, &in[i - (i >= window ? window : 0)] };
+            const optional<T>& leaving = *candidates[i >= window];
+            detail::rolling_sum_update(sum,
+                static_cast<S>(optional_access::raw_value(in[i])), in[i].has_value(),
+                static_cast<S>(optional_access::raw_value(leaving)), leaving.has_value());
+            count += static_cast<std::size_t>(in[i].has_value()) - static_cast<std::size_t>(leaving.has_value());
+            out[i] = optional<S>(count >= min_count && count > 0, S(sum.sum));
+        }
+    }
+
+    template<class T>
+    detail::traits::enable_if_t<std::is_arithmetic<T>::value>
+        rolling_mean_batch(span<const optional<T>> in, span<optional<detail::rolling_mean_t<T>>> out,
+                           std::size_t window, std::size_t min_count = 1)
+    {
+        using S = detail::rolling_sum_t<T>;
+        using M = detail::rolling_mean_t<T>;
+        using detail::optional_access;
+        assert(window > 0 && out.size() == in.size());
+
+        detail::running_sum<S> sum;
+        std::size_t count = 0;
+        const optional<T> none;
+        for (std::size_t i = 0; i < in.size(); ++i)
+        {
+            const optional<T>* candidates[2] = { &none, &in[i - (i >= window ? window : 0)] };
+            const optional<T>& leaving = *candidates[i >= window];
+            detail::rolling_sum_update(sum,
+                static_cast<S>(optional_access::raw_value(in[i])), in[i].has_value(),
+                static_cast<S>(optional_access::raw_value(leaving)), leaving.has_value());
+            count += static_cast<std::size_t>(in[i].has_value()) - static_cast<std::size_t>(leaving.has_value());
+
+            // Dividing by 0 (if count is 0) yields a value that is discarded.
+            const M divisor[2] = { M(1), static_cast<M>(count) };
+            out[i] = optional<M>(count >= min_count && count > 0, static_cast<M>(sum.sum) / divisor[count > 0]);
+        }
+    }
+
+    namespace detail
+    {
+        // Sliding window extremum with the van Herk/Gil-Werman algorithm: the input is split
+        // into blocks of 'window' elements and the extremum of a window is the combination of
+        // a suffix extremum of the previous block and a prefix extremum of the current block.
+        // Three comparisons per element, independent of the window size and the data.
+        // Disengaged elements are replaced by 'identity' (a value that never wins).
+        template<class T, class Select>
+        void rolling_extremum_impl(span<const optional<T>> in, span<optional<T>> out,
+                                   std::size_t window, std::size_t min_count, T identity, Select select)
+        {
+            assert(window > 0 && out.size() == in.size());
+
+            // suffix[k] is the extremum of the previous block from element k onwards.
+            std::vector<T> suffix(window + 1, identity);
+            std::size_t count = 0;
+
+            for (std::size_t first = 0; first < in.size(); first += window)
+            {
+                const std::size_t last = std::min(first + window, in.size());
+
+                T prefix = identity;
+                for (std::size_t i = first; i < last; ++i)
+                {
+                    const T candidates[2] = { identity, optional_access::raw_value(in[i]) };
+                    prefix = select(prefix, candidates[in[i].has_value()]);
+
+                    const bool leaving = i >= window && in[i - window].has_value();
+                    count += static_cast<std::size_t>(in[i].has_value()) - static_cast<std::size_t>(leaving);
+
+                    out[i] = optional<T>(count >= min_count && count > 0, select(suffix[i - first + 1], prefix));
+                }
+
+                for (std::size_t i = last; i-- > first;)
+                {
+                    const T candidates[2] = { identity, optional_access::raw_value(in[i]) };
+                    suffix[i - first] = select(suffix[i - first + 1], candidates[in[i].has_value()]);
+                }
+            }
+        }
+
+        template<class T>
+        struct select_min
+        {
+            T operator()(T a, T b) const noexcept
+            {
+                const T candidates[2] = { a, b };
+                return candidates[b < a];
+            }
+        };
+
+        template<class T>
+        struct select_max
+        {
+            T operator()(T a, T b) const noexcept
+            {
+                const T candidates[2] = { a, b };
+                return candidates[a < b];
+            }
+        };
+    } // namespace detail
+
+    template<class T>
+    detail::traits::enable_if_t<std::is_arithmetic<T>::value>
+        rolling_min_batch(span<const optional<T>> in, span<optional<T>> out, std::size_t window, std::size_t min_count = 1)
+    {
+        const T identity = std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max();
+        detail::rolling_extremum_impl(in, out, window, min_count, identity, detail::select_min<T>());
+    }
+
+    template<class T>
+    detail::traits::enable_if_t<std::is_arithmetic<T>::value>
+        rolling_max_batch(span<const optional<T>> in, span<optional<T>> out, std::size_t window, std::size_t min_count = 1)
+    {
+        const T identity = std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::lowest();
+        detail::rolling_extremum_impl(in, out, window, min_count, identity, detail::select_max<T>());
+    }
+
+    // The aggregate operations of group_aggregate.
+    // Disengaged values are skipped by all operations (like SQL aggregate functions).
+    namespace agg
+    {
+        struct count {};    // The number of engaged values (std::size_t).
+        struct sum {};      // The sum of the engaged values (disengaged if there are none).
+        struct mean {};     // The mean of the engaged values (disengaged if there are none).
+        struct min {};      // The smallest engaged value (disengaged if there are none).
+        struct max {};      // The largest engaged value (disengaged if there are none).
+    } // namespace agg
+
+    namespace detail
+    {
+        template<class Op, class V>
+        struct aggregator;
+
+        template<class V>
+        struct aggregator<agg::count, V>
+        {
+            using result_type = std::size_t;
+
+            std::size_t count = 0;
+
+            void add(V const&) noexcept
+            {
+                ++count;
+            }
+
+            void merge(aggregator const& other) noexcept
+            {
+                count += other.count;
+            }
+
+            result_type result() const noexcept
+            {
+                return count;
+            }
+        };
+
+        template<class V>
+        struct aggregator<agg::sum, V>
+        {
+            using sum_type = rolling_sum_t<V>;
+            using result_type = optional<sum_type>;
+
+            sum_type sum = 0;
+            std::size_t count = 0;
+
+            void add(V const& v) noexcept
+            {
+                sum += static_cast<sum_type>(v);
+                ++count;
+            }
+
+            void merge(aggregator const& other) noexcept
+            {
+                sum += other.sum;
+                count += other.count;
+            }
+
+            result_type result() const
+            {
+                return result_type(count > 0, sum_type(sum));
+            }
+        };
+
+        template<class V>
+        struct aggregator<agg::mean, V>
+        {
+            using mean_type = rolling_mean_t<V>;
+            using result_type = optional<mean_type>;
+
+            aggregator<agg::sum, V> sum;
+
+            void add(V const& v) noexcept
+            {
+                sum.add(v);
+            }
+
+            void merge(aggregator const& other) noexcept
+            {
+                sum.merge(other.sum);
+            }
+
+            result_type result() const
+            {
+                return sum.count > 0 ? result_type(static_cast<mean_type>(sum.sum) / static_cast<mean_type>(sum.count))
+                                     : result_type();
+            }
+        };
+
+        template<class V, class Compare>
+        struct extremum_aggregator
+        {
+            using result_type = optional<V>;
+
+            optional<V> value;
+
+            void add(V const& v)
+            {
+                if (!value || Compare()(v, *value))
+                    value = v;
+            }
+
+            void merge(extremum_aggregator const& other)
+            {
+                if (other.value)
+                    add(*other.value);
+            }
+
+            result_type result() const
+            {
+                return value;
+            }
+        };
+
+        template<class V>
+        struct aggregator<agg::min, V> : extremum_aggregator<V, std::less<V>> {};
+
+        template<class V>
+        struct aggregator<agg::max, V> : extremum_aggregator<V, std::greater<V>> {};
+
+        // Applies an operation to every element of a tuple of aggregators.
+        template<std::size_t I, std::size_t N>
+        struct aggregators_apply
+        {
+            template<class States, class V>
+            static void add(States& states, V const& v)
+            {
+                std::get<I>(states).add(v);
+                aggregators_apply<I + 1, N>::add(states, v);
+            }
+
+            template<class Columns, class States>
+            static void emit(Columns& columns, States const& states)
+            {
+                std::get<I>(columns).push_back(std::get<I>(states).result());
+                aggregators_apply<I + 1, N>::emit(columns, states);
+            }
+        };
+
+        template<std::size_t N>
+        struct aggregators_apply<N, N>
+        {
+            template<class States, class V>
+            static void add(States&, V const&) {}
+
+            template<class Columns, class States>
+            static void emit(Columns&, States const&) {}
+        };
+
+        // An open addressing (linear probing) hash table that maps keys to dense indices
+        // (in the order the keys were inserted). The slots only contain the key and its index
+        // so probing touches as few cache lines as possible; whatever belongs to a key is
+        // stored by the user in a separate array at the key's index. The null key has a
+        // dedicated slot outside of the table.
+        template<class K>
+        class key_table
+        {
+        public:
+            static_assert(std::is_integral<K>::value || std::is_enum<K>::value, "key_table requires integral keys.");
+
+            // Returned by find if the key is not in the table.
+            static const std::uint32_t npos = 0xffffffffu;
+
+            explicit key_table(std::size_t expected_keys = 4)
+                : m_null_index(npos)
+            {
+                std::size_t capacity = 16;
+                while (capacity < expected_keys * 4)
+                    capacity *= 2;
+                set_capacity(capacity);
+            }
+
+            // Returns the index of 'key', inserting it if it isn't in the table yet
+            // (the index of a new key is size() - 1).
+            std::uint32_t insert(optional<K> const& key)
+            {
+                if (!key)
+                {
+                    if (m_null_index == npos)
+                        m_null_index = new_key(nullopt);
+                    return m_null_index;
+                }
+
+                const std::size_t mask = m_slots.size() - 1;
+                for (std::size_t i = slot_index(*key);; i = (i + 1) & mask)
+                {
+                    slot& s = m_slots[i];
+                    if (s.index == npos)
+                    {
+                        s.key = *key;
+                        s.index = new_key(key);
+                        if (m_keys.size() * 4 > m_slots.size())
+                            grow();
+                        return static_cast<std::uint32_t>(m_keys.size() - 1);
+                    }
+                    if (s.key == *key)
+                        return s.index;
+                }
+            }
+
+            // Returns the index of the (engaged) key or npos.
+            std::uint32_t find(K key) const noexcept
+            {
+                const std::size_t mask = m_slots.size() - 1;
+                for (std::size_t i = slot_index(key);; i = (i + 1) & mask)
+                {
+                    const slot& s = m_slots[i];
+                    if (s.index == npos || s.key == key)
+                        return s.index;
+                }
+            }
+
+            std::size_t size() const noexcept
+            {
+                return m_keys.size();
+            }
+
+            // The keys in the order they were inserted.
+            std::vector<optional<K>> const& keys() const noexcept
+            {
+                return m_keys;
+            }
+
+        private:
+            struct slot
+            {
+                K key;
+                std::uint32_t index;
+            };
+
+            // Fibonacci hashing: the top bits of the product are the slot index. This spreads
+            // runs of consecutive keys evenly over the table and is cheaper than hash_mix.
+            // (The parallel algorithms partition the keys with hash_mix, which is independent.)
+            std::size_t slot_index(K key) const noexcept
+            {
+                return static_cast<std::size_t>((hash_bits<K>::get(key) * 0x9e3779b97f4a7c15ull) >> m_shift);
+            }
+
+            void set_capacity(std::size_t capacity)
+            {
+                m_slots.assign(capacity, slot{ K(), npos });
+                m_shift = 64;
+                for (std::size_t c = capacity; c > 1; c /= 2)
+                    --m_shift;
+            }
+
+            std::uint32_t new_key(optional<K> const& key)
+            {
+                assert(m_keys.size() < npos);
+                m_keys.push_back(key);
+                return static_cast<std::uint32_t>(m_keys.size() - 1);
+            }
+
+            // Doubles the capacity to keep the load factor below 1/4
+            // (collisions cause branch mispredictions while probing).
+            void grow()
+            {
+                set_capacity(m_slots.size() * 2);
+                const std::size_t mask = m_slots.size() - 1;
+                for (std::size_t index = 0; index < m_keys.size(); ++index)
+                {
+                    if (!m_keys[index])
+                        continue;
+
+                    std::size_t i = slot_index(*m_keys[index]);
+                    while (m_slots[i].index != npos)
+                        i = (i + 1) & mask;
+                    m_slots[i] = slot{ *m_keys[index], static_cast<std::uint32_t>(index) };
+                }
+            }
+
+            std::vector<slot> m_slots;
+            unsigned m_shift;
+            std::uint32_t m_null_index;
+            std::vector<optional<K>> m_keys;
+        };
+
+        template<class K>
+        const std::uint32_t key_table<K>::npos;
+
+        // The groups of a group by: a key table and the aggregate states of each group
+        // (in the order the groups were found).
+        template<class K, class V, class... Ops>
+        class group_table
+        {
+        public:
+            using states_type = std::tuple<aggregator<Ops, V>...>;
+
+            // Adds the row with index 'row' to the group of 'key'.
+            void add(optional<K> const& key, optional<V> const& value, std::size_t row)
+            {
+                const std::uint32_t group = m_keys.insert(key);
+                if (group == m_states.size())
+                {
+                    m_states.push_back(states_type());
+                    m_first_rows.push_back(row);
+                }
+                if (value)
+                    aggregators_apply<0, sizeof...(Ops)>::add(m_states[group], *value);
+            }
+
+            std::size_t size() const noexcept
+            {
+                return m_keys.size();
+            }
+
+            std::vector<optional<K>> const& keys() const noexcept
+            {
+                return m_keys.keys();
+            }
+
+            std::vector<states_type> const& states() const noexcept
+            {
+                return m_states;
+            }
+
+            // The index of the first row of each group.
+            std::vector<std::size_t> const& first_rows() const noexcept
+            {
+                return m_first_rows;
+            }
+
+        private:
+            key_table<K> m_keys;
+            std::vector<states_type> m_states;
+            std::vector<std::size_t> m_first_rows;
+        };
+    } // namespace detail
+
+    // The result of group_aggregate: one row per group, stored column by column.
+    // keys[i] is the key of the i-th group (nullopt for the group of disengaged keys) and
+    // std::get<I>(aggregates)[i] is the result of the I-th operation for that group.
+    template<class K, class... Results>
+    struct group_result
+    {
+        std::vector<optional<K>> keys;
+        std::tuple<std::vector<Results>...> aggregates;
+
+        std::size_t size() const noexcept
+        {
+            return keys.size();
+        }
+    };
+
+    namespace detail
+    {
+        template<class K, class V, class... Ops>
+        using group_result_t = group_result<K, typename aggregator<Ops, V>::result_type...>;
+
+        // Appends group 'group' of 'table' to 'result'.
+        template<class K, class V, class... Ops>
+        void append_group(group_result_t<K, V, Ops...>& result, group_table<K, V, Ops...> const& table, std::size_t group)
+        {
+            result.keys.push_back(table.keys()[group]);
+            aggregators_apply<0, sizeof...(Ops)>::emit(result.aggregates, table.states()[group]);
+        }
+    } // namespace detail
+
+    // Groups the rows (keys[i], values[i]) by key and computes the aggregate operations
+    // ('ops', see opt::agg) over the values of each group.
+    // Disengaged keys form their own group. Disengaged values are skipped.
+    // The groups are returned in the order of their first row.
+    template<class K, class V, class... Ops>
+    detail::group_result_t<K, V, Ops...>
+        group_aggregate(span<const optional<K>> keys, span<const optional<V>> values, Ops...)
+    {
+        static_assert(std::is_integral<K>::value || std::is_enum<K>::value, "group_aggregate requires integral keys.");
+        static_assert(sizeof...(Ops) > 0, "group_aggregate requires at least one aggregate operation.");
+        assert(keys.size() == values.size());
+
+        detail::group_table<K, V, Ops...> table;
+        for (std::size_t i = 0; i < keys.size(); ++i)
+            table.add(keys[i], values[i], i);
+
+        detail::group_result_t<K, V, Ops...> result;
+        result.keys.reserve(table.size());
+        for (std::size_t group = 0; group < table.size(); ++group)
+            detail::append_group(result, table, group);
+        return result;
+    }
+
+    // What the scans output at the positions of disengaged elements.
+    enum class null_output
+    {
+        running,    // The running value (which is disengaged until the first engaged element, except for agg::count).
+        null        // A disengaged optional.
+    };
+
+    namespace detail
+    {
+        template<class R>
+        struct scan_output
+        {
+            using type = optional<R>;
+        };
+
+        template<class R>
+        struct scan_output<optional<R>>
+        {
+            using type = optional<R>;
+        };
+
+        // The element type of the output of a scan with the operation 'Op' (see opt::agg).
+        template<class Op, class T>
+        using scan_output_t = typename scan_output<typename aggregator<Op, T>::result_type>::type;
+
+        template<class R>
+        traits::enable_if_t<!config::optional_uses_direct_storage_for<R>::value, optional<R>>
+            scan_emit(optional<R> const& result, bool emit)
+        {
+            return emit ? result : optional<R>();
+        }
+
+        template<class R>
+        traits::enable_if_t<config::optional_uses_direct_storage_for<R>::value, optional<R>>
+            scan_emit(optional<R> const& result, bool emit) noexcept
+        {
+            return optional<R>(emit & result.has_value(), R(optional_access::raw_value(result)));
+        }
+
+        inline optional<std::size_t> scan_emit(std::size_t result, bool emit) noexcept
+        {
+            return optional<std::size_t>(emit, std::size_t(result));
+        }
+
+        // Adds an element to the state of a scan. The aggregators of directly stored values
+        // are updated without branches.
+        template<class Op, class T>
+        traits::enable_if_t<!config::optional_uses_direct_storage_for<T>::value>
+            scan_add(aggregator<Op, T>& state, optional<T> const& element)
+        {
+            if (element)
+                state.add(*element);
+        }
+
+        template<class T>
+        traits::enable_if_t<config::optional_uses_direct_storage_for<T>::value>
+            scan_add(aggregator<agg::count, T>& state, optional<T> const& element) noexcept
+        {
+            state.count += element.has_value();
+        }
+
+        template<class T>
+        traits::enable_if_t<config::optional_uses_direct_storage_for<T>::value>
+            scan_add(aggregator<agg::sum, T>& state, optional<T> const& element) noexcept
+        {
+            using sum_type = typename aggregator<agg::sum, T>::sum_type;
+            // The storage of a disengaged element may hold a stale value.
+            const sum_type values[2] = { sum_type(0), static_cast<sum_type>(optional_access::raw_value(element)) };
+            state.sum += values[element.has_value()];
+            state.count += element.has_value();
+        }
+
+        template<class T>
+        traits::enable_if_t<config::optional_uses_direct_storage_for<T>::value>
+            scan_add(aggregator<agg::mean, T>& state, optional<T> const& element) noexcept
+        {
+            scan_add(state.sum, element);
+        }
+
+        template<class T, class Compare>
+        traits::enable_if_t<config::optional_uses_direct_storage_for<T>::value>
+            scan_add(extremum_aggregator<T, Compare>& state, optional<T> const& element) noexcept
+        {
+            const T value = optional_access::raw_value(element);
+            const bool better = element.has_value() & (!state.value.has_value() | Compare()(value, optional_access::raw_value(state.value)));
+            const T candidates[2] = { optional_access::raw_value(state.value), value };
+            state.value = optional<T>(state.value.has_value() | element.has_value(), T(candidates[better]));
+        }
+
+        // Scans in[first, last) starting with 'state' (which is updated).
+        template<bool Inclusive, class Op, class T>
+        void scan_impl(const optional<T>* in, scan_output_t<Op, T>* out, std::size_t first, std::size_t last,
+            aggregator<Op, T>& state, null_output nulls)
+        {
+            const bool running = nulls == null_output::running;
+            for (std::size_t i = first; i < last; ++i)
+            {
+                const bool emit = running || in[i].has_value();
+                if (!Inclusive)
+                    out[i] = scan_emit(state.result(), emit);
+                scan_add(state, in[i]);
+                if (Inclusive)
+                    out[i] = scan_emit(state.result(), emit);
+            }
+        }
+    } // namespace detail
+
+    // Cumulative aggregates that skip disengaged elements: out[i] is the aggregate ('op', see
+    // opt::agg) of the engaged elements of in[0, i]. Disengaged elements contribute nothing
+    // but still have an output, which is set by 'nulls'.
+    // For example the inclusive sum scan of { 1, nullopt, 2 } is { 1, 1, 3 } with
+    // null_output::running and { 1, nullopt, 3 } with null_output::null.
+    template<class T, class Op>
+    void inclusive_scan_skip_null(span<const optional<T>> in, span<detail::scan_output_t<Op, T>> out, Op,
+        null_output nulls = null_output::running)
+    {
+        assert(in.size() == out.size());
+        detail::aggregator<Op, T> state;
+        detail::scan_impl<true>(in.data(), out.data(), 0, in.size(), state, nulls);
+    }
+
+    // Like inclusive_scan_skip_null, but out[i] is the aggregate of the engaged elements of in[0, i),
+    // so out[0] is the aggregate of no elements (disengaged, or 0 for agg::count).
+    template<class T, class Op>
+    void exclusive_scan_skip_null(span<const optional<T>> in, span<detail::scan_output_t<Op, T>> out, Op,
+        null_output nulls = null_output::running)
+    {
+        assert(in.size() == out.size());
+        detail::aggregator<Op, T> state;
+        detail::scan_impl<false>(in.data(), out.data(), 0, in.size(), state, nulls);
+    }
+
+    // The result of a join: the i-th match is the pair of row indices (left[i], right[i]).
+    struct join_result
+    {
+        std::vector<std::size_t> left;
+        std::vector<std::size_t> right;
+
+        std::size_t size() const noexcept
+        {
+            return left.size();
+        }
+    };
+
+    namespace detail
+    {
+        template<class K>
+        struct join_row
+        {
+            K key;
+            std::size_t index;
+        };
+
+        // The build side of a hash join: a key table and, for each key, the indices of
+        // the rows with that key (stored contiguously, in the order they were added).
+        template<class K>
+        class join_table
+        {
+        public:
+            // Adds the rows row_at(0) ... row_at(count - 1) (join_row<K>) to the table.
+            template<class RowAt>
+            void build(std::size_t count, RowAt row_at)
+            {
+                std::vector<std::uint32_t> key_index(count);
+                for (std::size_t i = 0; i < count; ++i)
+                    key_index[i] = m_keys.insert(row_at(i).key);
+
+                m_begin.assign(m_keys.size() + 1, 0);
+                for (std::size_t i = 0; i < count; ++i)
+                    ++m_begin[key_index[i] + 1];
+                for (std::size_t k = 0; k < m_keys.size(); ++k)
+                    m_begin[k + 1] += m_begin[k];
+
+                std::vector<std::size_t> next(m_begin.begin(), m_begin.end() - 1);
+                m_rows.resize(count);
+                for (std::size_t i = 0; i < count; ++i)
+                    m_rows[next[key_index[i]]++] = row_at(i).index;
+            }
+
+            // Appends a match (row, 'right') for every row with 'key' to 'result'.
+            void probe(K key, std::size_t right, join_result& result) const
+            {
+                const std::uint32_t k = m_keys.find(key);
+                if (k == key_table<K>::npos)
+                    return;
+
+                for (std::size_t i = m_begin[k]; i < m_begin[k + 1]; ++i)
+                {
+                    result.left.push_back(m_rows[i]);
+                    result.right.push_back(right);
+                }
+            }
+
+        private:
+            key_table<K> m_keys;
+            std::vector<std::size_t> m_begin;
+            std::vector<std::size_t> m_rows;
+        };
+
+        // The engaged keys of 'in' sorted (stably) with their row indices.
+        template<class K>
+        std::size_t sort_keys(span<const optional<K>> in, std::vector<optional<K>>& keys, std::vector<std::size_t>& rows)
+        {
+            keys.assign(in.begin(), in.end());
+            rows.resize(in.size());
+            for (std::size_t i = 0; i < rows.size(); ++i)
+                rows[i] = i;
+
+            radix_sort(make_span(keys), make_span(rows), nulls_order::last);
+            return count_engaged(span<const optional<K>>(keys));
+        }
+    } // namespace detail
+
+    // Joins the rows of 'left' and 'right' with equal keys with a hash join: a hash table
+    // is built from 'left' (which should be the smaller side) and probed with 'right'.
+    // Disengaged keys never match (not even each other), like NULL in SQL.
+    // The matches are ordered by the right row index and then by the left row index.
+    template<class K>
+    join_result hash_join(span<const optional<K>> left, span<const optional<K>> right)
+    {
+        static_assert(std::is_integral<K>::value, "hash_join requires integral keys.");
+
+        std::vector<detail::join_row<K>> rows;
+        for (std::size_t i = 0; i < left.size(); ++i)
+        {
+            if (left[i])
+                rows.push_back(detail::join_row<K>{ *left[i], i });
+        }
+
+        detail::join_table<K> table;
+        table.build(rows.size(), [&](std::size_t i) { return rows[i]; });
+
+        join_result result;
+        for (std::size_t i = 0; i < right.size(); ++i)
+        {
+            if (right[i])
+                table.probe(*right[i], i, result);
+        }
+        return result;
+    }
+
+    // Joins the rows of 'left' and 'right' with equal keys with a sort-merge join: both
+    // sides are sorted with radix_sort and then merged.
+    // Disengaged keys never match (not even each other), like NULL in SQL.
+    // The matches are ordered by key, then by the left row index and then by the right row index.
+    template<class K>
+    join_result merge_join(span<const optional<K>> left, span<const optional<K>> right)
+    {
+        static_assert(std::is_integral<K>::value, "merge_join requires integral keys.");
+
+        std::vector<optional<K>> left_keys, right_keys;
+        std::vector<std::size_t> left_rows, right_rows;
+        const std::size_t left_count = detail::sort_keys(left, left_keys, left_rows);
+        const std::size_t right_count = detail::sort_keys(right, right_keys, right_rows);
+
+        join_result result;
+        std::size_t i = 0;
+        std::size_t j = 0;
+        while (i < left_count && j < right_count)
+        {
+            const K key = *left_keys[i];
+            if (key < *right_keys[j])
+            {
+                ++i;
+            }
+            else if (*right_keys[j] < key)
+            {
+                ++j;
+            }
+            else
+            {
+                std::size_t left_end = i + 1;
+                while (left_end < left_count && *left_keys[left_end] == key)
+                    ++left_end;
+                std::size_t right_end = j + 1;
+                while (right_end < right_count && *right_keys[right_end] == key)
+                    ++right_end;
+
+                for (std::size_t l = i; l < left_end; ++l)
+                {
+                    for (std::size_t r = j; r < right_end; ++r)
+                    {
+                        result.left.push_back(left_rows[l]);
+                        result.right.push_back(right_rows[r]);
+                    }
+                }
+                i = left_end;
+                j = right_end;
+            }
+        }
+        return result;
+    }
+
+    // The changes from one range of optionals to another (see diff and apply_patch).
+    // Only the changed positions are stored: their indices, whether they are engaged in the
+    // new range and the new values of the engaged ones.
+    template<class T>
+    struct optional_patch
+    {
+        std::size_t size = 0;                   // The size of the new range.
+        std::vector<std::size_t> positions;     // The changed positions, in ascending order.
+        std::vector<std::uint64_t> engaged;     // Bit k is set if positions[k] is engaged in the new range.
+        std::vector<T> values;                  // The new values of the engaged changed positions, in order.
+
+        std::size_t changes() const noexcept
+        {
+            return positions.size();
+        }
+
+        // The size of the changes in bytes (if they are shipped as is).
+        std::size_t bytes() const noexcept
+        {
+            return sizeof(size) + positions.size() * sizeof(std::size_t) +
+                engaged.size() * sizeof(std::uint64_t) + values.size() * sizeof(T);
+        }
+    };
+
+    namespace detail
+    {
+        // Directly stored values are compared bit by bit, so NaNs and signed zeros are
+        // replicated exactly. Other values are compared with operator==.
+        template<class T>
+        traits::enable_if_t<config::optional_uses_direct_storage_for<T>::value, bool>
+            same_value(const T& a, const T& b) noexcept
+        {
+            return std::memcmp(&a, &b, sizeof(T)) == 0;
+        }
+
+        template<class T>
+        traits::enable_if_t<!config::optional_uses_direct_storage_for<T>::value, bool>
+            same_value(const T& a, const T& b)
+        {
+            return a == b;
+        }
+
+        template<class T>
+        void add_change(optional_patch<T>& patch, std::size_t position, const optional<T>& value)
+        {
+            const std::size_t k = patch.positions.size();
+            patch.positions.push_back(position);
+            if (k % 64 == 0)
+                patch.engaged.push_back(0);
+            if (value)
+            {
+                patch.engaged.back() |= std::uint64_t(1) << (k % 64);
+                patch.values.push_back(*value);
+            }
+        }
+
+        template<class T>
+        void diff_range(const optional<T>* a, const optional<T>* b, std::size_t first, std::size_t last, optional_patch<T>& patch)
+        {
+            for (std::size_t i = first; i < last; ++i)
+            {
+                if (a[i].has_value() != b[i].has_value() || (a[i] && !same_value(*a[i], *b[i])))
+                    add_change(patch, i, b[i]);
+            }
+        }
+
+        // The number of elements that diff compares as raw bytes at once.
+        OPT_INLINE_VAR std::size_t diff_block = 64;
+
+        // Blocks of directly stored optionals with identical bytes are equal, so they are
+        // skipped with a (vectorized) memcmp. Blocks that differ, possibly only in the
+        // padding or in the storage of disengaged elements, are compared element by element.
+        template<class T>
+        traits::enable_if_t<config::optional_uses_direct_storage_for<T>::value>
+            diff_impl(const optional<T>* a, const optional<T>* b, std::size_t n, optional_patch<T>& patch)
+        {
+            std::size_t i = 0;
+            for (; i + diff_block <= n; i += diff_block)
+            {
+                if (std::memcmp(a + i, b + i, diff_block * sizeof(optional<T>)) != 0)
+                    diff_range(a, b, i, i + diff_block, patch);
+            }
+            diff_range(a, b, i, n, patch);
+        }
+
+        template<class T>
+        traits::enable_if_t<!config::optional_uses_direct_storage_for<T>::value>
+            diff_impl(const optional<T>* a, const optional<T>* b, std::size_t n, optional_patch<T>& patch)
+        {
+            diff_range(a, b, 0, n, patch);
+        }
+    } // namespace detail
+
+    // Returns the changes from 'old_values' to 'new_values': the positions where the
+    // presence or the value differ. If 'new_values' is longer, its extra engaged elements
+    // are changes; if it is shorter, the patch shrinks the range.
+    template<class T>
+    optional_patch<T> diff(span<const optional<T>> old_values, span<const optional<T>> new_values)
+    {
+        optional_patch<T> patch;
+        patch.size = new_values.size();
+
+        const std::size_t common = std::min(old_values.size(), new_values.size());
+        detail::diff_impl(old_values.data(), new_values.data(), common, patch);
+        for (std::size_t i = common; i < new_values.size(); ++i)
+        {
+            if (new_values[i])
+                detail::add_change(patch, i, new_values[i]);
+        }
+        return patch;
+    }
+
+    // Applies the changes of 'patch' to 'data' (the old range of diff), which must have
+    // the size of the new range.
+    template<class T>
+    void apply_patch(span<optional<T>> data, const optional_patch<T>& patch)
+    {
+        assert(data.size() == patch.size);
+
+        std::size_t v = 0;
+        for (std::size_t k = 0; k < patch.positions.size(); ++k)
+        {
+            optional<T>& element = data[patch.positions[k]];
+            if (((patch.engaged[k / 64] >> (k % 64)) & 1) != 0)
+                element = patch.values[v++];
+            else
+                element.reset();
+        }
+    }
+
+    // Resizes 'data' to the size of the new range (appending disengaged elements)
+    // and applies the changes of 'patch'.
+    template<class T>
+    void apply_patch(std::vector<optional<T>>& data, const optional_patch<T>& patch)
+    {
+        data.resize(patch.size);
+        apply_patch(make_span(data), patch);
+    }
+} // namespace opt
@@ -0,0 +1,1777 @@
+#pragma once
+
+//          Copyright Jeremiah van Oosten 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+ /**
+  *  @file optional_atomic.hpp
+  *  @date October 16, 2026
+  *  @author Jeremiah van Oosten
+  *
+  *  @brief Thread-safe cells that hold an optional value.
+  *
+  *  opt::atomic_optional stores the engaged flag and the value of a small
+  *  trivially copyable type in a single lock-free word. The flag is packed into
+  *  a spare byte of the word, or an empty cell is marked by a reserved value of T
+  *  (a niche, see opt::atomic_optional_niche) if T fills the word exactly.
+  *  Doubles and pointers have a niche. Other 8 byte values use cells of 16
+  *  bytes, which require a double-width compare-and-swap (cmpxchg16b, enabled
+  *  with -mcx16 on GCC and Clang) for writes; their loads are plain loads.
+  *
+  *  opt::seqlock_optional holds values of any trivially copyable type. Readers
+  *  copy the value and retry if a write overlapped the copy, so they never
+  *  write to shared memory.
+  *
+  *  opt::versioned_optional keeps the last few versions of a trivially copyable
+  *  value (multi-version concurrency control). Every version is a small seqlock,
+  *  so readers of a snapshot version never block and never write to shared memory.
+  *
+  *  opt::once_optional is initialized exactly once by the first caller of
+  *  get_or_init. Threads that wait for an initialization in progress sleep on
+  *  a futex (on Linux; elsewhere they yield until it completes).
+  *
+  *  opt::waitable_optional is published once by emplace and lets threads wait
+  *  (with an optional timeout) until it is engaged, sleeping on the same kind of
+  *  32 bit futex word instead of a mutex and a condition variable.
+  *
+  *  opt::shared_atomic_optional is a cell for values of up to 4 bytes that can
+  *  be placed in memory shared between processes (a mapped file or a shm_open
+  *  region). Its layout is a single 64 bit word, and processes wait for a value
+  *  on a (process-shared) futex in the word.
+  *
+  *  opt::rcu_optional holds values of any type behind a pointer that writers
+  *  replace (read-copy-update). Readers pin the current value by announcing an
+  *  epoch in a per-thread record, with plain stores and no read-modify-write;
+  *  writers free a replaced value once no reader announced an epoch that could
+  *  still see it. On Linux the store-load fence of the readers is moved to the
+  *  writers with membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED), so that a reader
+  *  only needs a compiler barrier.
+  */
+
+#include "optional.hpp"
+
+#include <atomic>
+#include <cassert>          // for assert
+#include <chrono>
+#include <cstddef>          // for std::size_t
+#include <cstdint>          // for std::uint32_t, std::uint64_t
+#include <cstring>          // for std::memcpy, std::memcmp
+#include <exception>        // for std::terminate
+#include <limits>           // for std::numeric_limits
+#include <mutex>            // for std::mutex, std::lock_guard
+#include <thread>           // for std::this_thread::yield
+#include <type_traits>
+#include <utility>          // for std::forward, std::pair
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>         // for _InterlockedCompareExchange128, _mm_pause
+#endif
+
+#if defined(__linux__)
+#include <linux/futex.h>    // for FUTEX_WAIT, FUTEX_WAKE, FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE
+#include <sys/syscall.h>    // for SYS_futex, SYS_membarrier
+#include <time.h>           // for timespec
+#include <unistd.h>         // for syscall
+#endif
+
+// Whether a 16 byte compare-and-swap is available (1) or not (0).
+#if !defined(OPT_HAS_DOUBLE_WIDTH_CAS)
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16) || (defined(_MSC_VER) && defined(_M_X64))
+#define OPT_HAS_DOUBLE_WIDTH_CAS 1
+#else
+#define OPT_HAS_DOUBLE_WIDTH_CAS 0
+#endif
+#endif
+
+namespace opt
+{
+    // A value of T that is never stored in an opt::atomic_optional<T> and marks
+    // an empty cell instead. Specializations derive from std::true_type and define
+    // 'static T get() noexcept'. A niche is only used if T has a size of 4, 8 or
+    // 16 bytes (otherwise the engaged flag is packed into a spare byte).
+    template<class T>
+    struct atomic_optional_niche : std::false_type {};
+
+    // A niche that is a constant of an integral or enumeration type. Cells that never hold
+    // the constant can opt in to it, for example
+    // opt::atomic_optional<std::int64_t, opt::atomic_optional_niche_value<std::int64_t, INT64_MIN>>
+    // is a single 8 byte word. Storing the niche in such a cell is a precondition violation.
+    template<class T, T Value>
+    struct atomic_optional_niche_value : std::true_type
+    {
+        static T get() noexcept
+        {
+            return Value;
+        }
+    };
+
+    // A signaling NaN with a payload that arithmetic never produces. A double with
+    // exactly these bits (which may still be read from a file or the network) is
+    // stored as the default quiet NaN.
+    template<>
+    struct atomic_optional_niche<double> : std::true_type
+    {
+        static double get() noexcept
+        {
+            const std::uint64_t bits = 0x7ff0dead0b5e0001ull;
+            double d;
+            std::memcpy(&d, &bits, sizeof(d));
+            return d;
+        }
+    };
+
+    // The address with all bits set. No object starts there (its one-past-the-end
+    // pointer could not be represented), and it is misaligned for any T with an
+    // alignment above 1. Null pointers are values.
+    template<class T>
+    struct atomic_optional_niche<T*> : std::true_type
+    {
+        static T* get() noexcept
+        {
+            return reinterpret_cast<T*>(~std::uintptr_t(0));
+        }
+    };
+
+    namespace detail
+    {
+        OPT_INLINE_VAR std::size_t atomic_cell_max_size = OPT_HAS_DOUBLE_WIDTH_CAS ? 16 : 8;
+
+        // The failure order of a compare-and-swap with the order 'order'.
+        constexpr std::memory_order cas_failure_order(std::memory_order order) noexcept
+        {
+            return order == std::memory_order_acq_rel ? std::memory_order_acquire
+                : order == std::memory_order_release ? std::memory_order_relaxed
+                : order;
+        }
+
+        // Spins with a pause instruction for a while and then yields the thread
+        // (the thread it waits for may run on the same core).
+        class backoff
+        {
+        public:
+            void operator()() noexcept
+            {
+                if (m_spins < 64)
+                {
+                    ++m_spins;
+#if defined(__x86_64__) || defined(__i386__)
+                    __builtin_ia32_pause();
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+                    _mm_pause();
+#elif defined(__aarch64__)
+                    __asm__ __volatile__("yield");
+#endif
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+
+        private:
+            unsigned m_spins = 0;
+        };
+
+        static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t), "A futex is a plain 32 bit word.");
+
+        // Blocks while 'word' holds 'expected'. May return spuriously, so callers wait in a loop.
+        inline void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected) noexcept
+        {
+#if defined(__linux__)
+            syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+            if (word.load(std::memory_order_relaxed) == expected)
+                std::this_thread::yield();
+#endif
+        }
+
+        // Like futex_wait, but returns after 'timeout' at the latest.
+        inline void futex_wait_for(std::atomic<std::uint32_t>& word, std::uint32_t expected, std::chrono::nanoseconds timeout) noexcept
+        {
+#if defined(__linux__)
+            timespec relative;
+            relative.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+            relative.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+            syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, &relative, nullptr, 0);
+#else
+            (void)timeout;
+            futex_wait(word, expected);
+#endif
+        }
+
+        // Wakes all threads that wait on 'word'.
+        inline void futex_wake_all(std::atomic<std::uint32_t>& word) noexcept
+        {
+#if defined(__linux__)
+            syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE_PRIVATE, 0x7fffffff, nullptr, nullptr, 0);
+#else
+            (void)word;
+#endif
+        }
+
+        // Like futex_wait, but for a word in memory that is shared between processes (which
+        // may map it at different addresses). Returns after '*timeout' if it isn't null.
+        inline void futex_wait_shared(const volatile void* word, std::uint32_t expected, const std::chrono::nanoseconds* timeout) noexcept
+        {
+#if defined(__linux__)
+            timespec relative;
+            if (timeout)
+            {
+                relative.tv_sec = static_cast<time_t>(timeout->count() / 1000000000);
+                relative.tv_nsec = static_cast<long>(timeout->count() % 1000000000);
+            }
+            syscall(SYS_futex, word, FUTEX_WAIT, expected, timeout ? &relative : nullptr, nullptr, 0);
+#else
+            (void)word;
+            (void)expected;
+            (void)timeout;
+            std::this_thread::yield();
+#endif
+        }
+
+        // Wakes all threads (of any process) that wait on 'word' with futex_wait_shared.
+        inline void futex_wake_all_shared(const volatile void* word) noexcept
+        {
+#if defined(__linux__)
+            syscall(SYS_futex, word, FUTEX_WAKE, 0x7fffffff, nullptr, nullptr, 0);
+#else
+            (void)word;
+#endif
+        }
+
+        // A lock-free word of 'Size' bytes.
+        template<std::size_t Size>
+        class atomic_cell;
+
+        template<class Word>
+        class atomic_integer_cell
+        {
+        public:
+            using word = Word;
+
+            explicit atomic_integer_cell(word w) noexcept
+                : m_word(w)
+            {}
+
+            word load(std::memory_order order) const noexcept
+            {
+                return m_word.load(order);
+            }
+
+            void store(word w, std::memory_order order) noexcept
+            {
+                m_word.store(w, order);
+            }
+
+            word exchange(word w, std::memory_order order) noexcept
+            {
+                return m_word.exchange(w, order);
+            }
+
+            bool compare_exchange_weak(word& expected, word desired, std::memory_order order) noexcept
+            {
+                return m_word.compare_exchange_weak(expected, desired, order, cas_failure_order(order));
+            }
+
+            bool compare_exchange_strong(word& expected, word desired, std::memory_order order) noexcept
+            {
+                return m_word.compare_exchange_strong(expected, desired, order, cas_failure_order(order));
+            }
+
+            bool is_lock_free() const noexcept
+            {
+                return m_word.is_lock_free();
+            }
+
+        private:
+            std::atomic<word> m_word;
+        };
+
+        template<>
+        class atomic_cell<4> : public atomic_integer_cell<std::uint32_t>
+        {
+        public:
+            using atomic_integer_cell<std::uint32_t>::atomic_integer_cell;
+        };
+
+        template<>
+        class atomic_cell<8> : public atomic_integer_cell<std::uint64_t>
+        {
+        public:
+            using atomic_integer_cell<std::uint64_t>::atomic_integer_cell;
+        };
+
+        // A 16 byte cell for an 8 byte value and its engaged flag (see below).
+        class atomic_versioned_cell;
+
+#if OPT_HAS_DOUBLE_WIDTH_CAS
+        struct alignas(16) double_word
+        {
+            std::uint64_t lo;
+            std::uint64_t hi;
+        };
+
+        // Replaces '*target' with 'desired' if it equals 'expected' (a cmpxchg16b, which is a
+        // full barrier). Otherwise 'expected' is set to the current word.
+        inline bool double_word_cas(double_word* target, double_word& expected, double_word desired) noexcept
+        {
+#if defined(_MSC_VER)
+            return _InterlockedCompareExchange128(reinterpret_cast<volatile long long*>(target),
+                static_cast<long long>(desired.hi), static_cast<long long>(desired.lo),
+                reinterpret_cast<long long*>(&expected)) != 0;
+#else
+            __extension__ typedef unsigned __int128 uint128;
+            uint128 e, d;
+            std::memcpy(&e, &expected, sizeof(e));
+            std::memcpy(&d, &desired, sizeof(d));
+            const uint128 old = __sync_val_compare_and_swap(reinterpret_cast<uint128*>(target), e, d);
+            std::memcpy(&expected, &old, sizeof(old));
+            return old == e;
+#endif
+        }
+
+        // An acquire load of one half of a double_word (that is written with double_word_cas).
+        inline std::uint64_t load_half(const std::uint64_t& half) noexcept
+        {
+#if defined(_MSC_VER)
+            const std::uint64_t value = *static_cast<const volatile std::uint64_t*>(&half);
+            _ReadWriteBarrier();
+            return value;
+#else
+            return __atomic_load_n(&half, __ATOMIC_ACQUIRE);
+#endif
+        }
+
+        // A cell for values that fill 16 bytes (a niche) or leave less than 8 bytes for the
+        // flag. Writes are cmpxchg16b loops. A load is a single aligned vector load if AVX is
+        // enabled (Intel and AMD guarantee that those are atomic on processors with AVX);
+        // otherwise it is a cmpxchg16b as well, which writes to the cell.
+        template<>
+        class atomic_cell<16>
+        {
+        public:
+            using word = double_word;
+
+            explicit atomic_cell(word w) noexcept
+                : m_word(w)
+            {}
+
+            word load(std::memory_order) const noexcept
+            {
+#if defined(__AVX__) && defined(__x86_64__) && !defined(_MSC_VER)
+                typedef long long vector __attribute__((vector_size(16)));
+                vector v;
+                __asm__ __volatile__("vmovdqa %1, %0" : "=x"(v) : "m"(m_word) : "memory");
+                word w;
+                std::memcpy(&w, &v, sizeof(w));
+                return w;
+#else
+                word expected = { 0, 0 };
+                double_word_cas(&m_word, expected, expected);
+                return expected;
+#endif
+            }
+
+            void store(word w, std::memory_order order) noexcept
+            {
+                exchange(w, order);
+            }
+
+            word exchange(word w, std::memory_order) noexcept
+            {
+                word expected = { 0, 0 };
+                while (!double_word_cas(&m_word, expected, w))
+                {}
+                return expected;
+            }
+
+            bool compare_exchange_weak(word& expected, word desired, std::memory_order) noexcept
+            {
+                return double_word_cas(&m_word, expected, desired);
+            }
+
+            bool compare_exchange_strong(word& expected, word desired, std::memory_order) noexcept
+            {
+                return double_word_cas(&m_word, expected, desired);
+            }
+
+            bool is_lock_free() const noexcept
+            {
+                return true;
+            }
+
+        private:
+            mutable word m_word;
+        };
+
+        // The words passed in and out of this cell hold an 8 byte value in 'lo' and the engaged
+        // flag in the first byte of 'hi' (like every packed layout). In the cell, 'hi' holds the
+        // flag in bit 0 and counts the writes in the other bits, so that every write changes it.
+        // A load reads the halves with plain acquire loads (hi, lo, hi) and retries if 'hi'
+        // changed in between, like a seqlock, so readers never write to the cell. Writes are
+        // cmpxchg16b loops that replace both halves at once.
+        class atomic_versioned_cell
+        {
+        public:
+            using word = double_word;
+
+            explicit atomic_versioned_cell(word w) noexcept
+                : m_word{ w.lo, w.hi != 0 ? 1u : 0u }
+            {}
+
+            word load(std::memory_order) const noexcept
+            {
+                return untag(load_tagged());
+            }
+
+            void store(word w, std::memory_order order) noexcept
+            {
+                exchange(w, order);
+            }
+
+            word exchange(word w, std::memory_order) noexcept
+            {
+                word current = load_tagged();
+                while (!double_word_cas(&m_word, current, tag(w, current)))
+                {}
+                return untag(current);
+            }
+
+            bool compare_exchange_weak(word& expected, word desired, std::memory_order order) noexcept
+            {
+                return compare_exchange_strong(expected, desired, order);
+            }
+
+            bool compare_exchange_strong(word& expected, word desired, std::memory_order) noexcept
+            {
+                word current = load_tagged();
+                for (;;)
+                {
+                    const word value = untag(current);
+                    if (value.lo != expected.lo || value.hi != expected.hi)
+                    {
+                        expected = value;
+                        return false;
+                    }
+                    // Only fails if another write came in between.
+                    if (double_word_cas(&m_word, current, tag(desired, current)))
+                        return true;
+                }
+            }
+
+            bool is_lock_free() const noexcept
+            {
+                return true;
+            }
+
+        private:
+            word load_tagged() const noexcept
+            {
+                for (;;)
+                {
+                    const std::uint64_t hi = load_half(m_word.hi);
+                    const std::uint64_t lo = load_half(m_word.lo);
+                    if (load_half(m_word.hi) == hi)
+                        return word{ lo, hi };
+                }
+            }
+
+            // 'w' as it is stored after the (tagged) word 'previous'.
+            static word tag(word w, word previous) noexcept
+            {
+                return word{ w.lo, ((previous.hi | 1) + 1) | (w.hi != 0 ? 1u : 0u) };
+            }
+
+            static word untag(word tagged) noexcept
+            {
+                unsigned char flag[sizeof(std::uint64_t)] = { static_cast<unsigned char>(tagged.hi & 1) };
+                word w = { tagged.lo, 0 };
+                std::memcpy(&w.hi, flag, sizeof(flag));
+                return w;
+            }
+
+            word m_word;
+        };
+#endif
+
+        template<class T, class Niche = atomic_optional_niche<T>>
+        struct atomic_optional_layout
+        {
+            static constexpr bool uses_niche = Niche::value
+                && (sizeof(T) == 4 || sizeof(T) == 8 || sizeof(T) == 16);
+
+            // The size of the cell (a niche or the value followed by the engaged flag). A value
+            // of 16 bytes without a niche leaves no room for the flag and gets a size of 32,
+            // which no cell supports.
+            static constexpr std::size_t size = uses_niche ? sizeof(T)
+                : sizeof(T) < 4 ? 4 : sizeof(T) < 8 ? 8 : sizeof(T) < 16 ? 16 : 32;
+
+            // An 8 byte value without a niche leaves 8 bytes of its 16 byte cell for the flag,
+            // which also count the writes (see atomic_versioned_cell).
+            static constexpr bool versioned = !uses_niche && sizeof(T) == 8;
+
+            static_assert(uses_niche || sizeof(T) < size, "The engaged flag must fit in the cell after the value.");
+        };
+
+        template<class T, class Niche>
+        constexpr bool atomic_optional_layout<T, Niche>::uses_niche;
+
+        template<class T, class Niche>
+        constexpr std::size_t atomic_optional_layout<T, Niche>::size;
+
+        template<class T, class Niche>
+        constexpr bool atomic_optional_layout<T, Niche>::versioned;
+    } // namespace detail
+
+    // A lock-free cell that holds an optional value of a small trivially copyable type.
+    // The engaged flag and the value are stored in a single word (see optional_atomic.hpp),
+    // so that they are always read and written together. 'Niche' is the value that marks
+    // an empty cell (see opt::atomic_optional_niche and opt::atomic_optional_niche_value).
+    // Values are compared by their object representation (like std::atomic), so T
+    // should not have padding bits and compare_exchange distinguishes 0.0 from -0.0.
+    template<class T, class Niche = atomic_optional_niche<T>>
+    class atomic_optional
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "opt::atomic_optional requires a trivially copyable type.");
+        static_assert(detail::atomic_optional_layout<T, Niche>::size <= detail::atomic_cell_max_size,
+            "T is too large for opt::atomic_optional (values of 8 bytes need a niche or a 16 byte compare-and-swap, values of 16 bytes need a niche).");
+
+        using layout = detail::atomic_optional_layout<T, Niche>;
+        using cell = typename std::conditional<layout::versioned,
+            detail::atomic_versioned_cell, detail::atomic_cell<layout::size>>::type;
+        using word = typename cell::word;
+
+    public:
+        using value_type = T;
+
+        // Creates an empty cell.
+        atomic_optional() noexcept
+            : m_cell(encode(optional<T>()))
+        {}
+
+        atomic_optional(optional<T> const& value) noexcept
+            : m_cell(encode(value))
+        {}
+
+        atomic_optional(const atomic_optional&) = delete;
+        atomic_optional& operator=(const atomic_optional&) = delete;
+
+        optional<T> load(std::memory_order order = std::memory_order_seq_cst) const noexcept
+        {
+            return decode(m_cell.load(order));
+        }
+
+        bool has_value(std::memory_order order = std::memory_order_seq_cst) const noexcept
+        {
+            return engaged(m_cell.load(order));
+        }
+
+        void store(optional<T> const& value, std::memory_order order = std::memory_order_seq_cst) noexcept
+        {
+            m_cell.store(encode(value), order);
+        }
+
+        void reset(std::memory_order order = std::memory_order_seq_cst) noexcept
+        {
+            m_cell.store(encode(optional<T>()), order);
+        }
+
+        // Stores 'value' and returns the previous value.
+        optional<T> exchange(optional<T> const& value, std::memory_order order = std::memory_order_seq_cst) noexcept
+        {
+            return decode(m_cell.exchange(encode(value), order));
+        }
+
+        // Empties the cell and returns its previous value.
+        optional<T> take(std::memory_order order = std::memory_order_seq_cst) noexcept
+        {
+            return exchange(optional<T>(), order);
+        }
+
+        // Stores 'desired' if the cell holds 'expected' (an empty cell only equals a
+        // disengaged 'expected'). Otherwise 'expected' is set to the current value.
+        bool compare_exchange_weak(optional<T>& expected, optional<T> const& desired,
+            std::memory_order order = std::memory_order_seq_cst) noexcept
+        {
+            word w = encode(expected);
+            if (m_cell.compare_exchange_weak(w, encode(desired), order))
+                return true;
+            expected = decode(w);
+            return false;
+        }
+
+        bool compare_exchange_strong(optional<T>& expected, optional<T> const& desired,
+            std::memory_order order = std::memory_order_seq_cst) noexcept
+        {
+            word w = encode(expected);
+            if (m_cell.compare_exchange_strong(w, encode(desired), order))
+                return true;
+            expected = decode(w);
+            return false;
+        }
+
+        // Stores T(args...) if the cell is empty. Returns false (and leaves the cell
+        // unchanged) if the cell already holds a value.
+        template<class... Args>
+        bool try_emplace_if_empty(Args&&... args) noexcept(std::is_nothrow_constructible<T, Args&&...>::value)
+        {
+            word w = encode(optional<T>());
+            return m_cell.compare_exchange_strong(w, encode(optional<T>(T(std::forward<Args>(args)...))),
+                std::memory_order_acq_rel);
+        }
+
+        bool is_lock_free() const noexcept
+        {
+            return m_cell.is_lock_free();
+        }
+
+    private:
+        static word encode(optional<T> const& value) noexcept
+        {
+            // Unused bytes are zero, so that equal values have equal words.
+            unsigned char bytes[sizeof(word)] = {};
+            if (value)
+            {
+                std::memcpy(bytes, std::addressof(*value), sizeof(T));
+                if (!layout::uses_niche)
+                    bytes[sizeof(T)] = 1;
+                else if (std::memcmp(bytes, niche_bytes().data, sizeof(T)) == 0)
+                    replace_niche(bytes, std::is_floating_point<T>());
+            }
+            else if (layout::uses_niche)
+            {
+                std::memcpy(bytes, niche_bytes().data, sizeof(T));
+            }
+
+            word w;
+            std::memcpy(&w, bytes, sizeof(w));
+            return w;
+        }
+
+        static bool engaged(word const& w) noexcept
+        {
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&w);
+            return layout::uses_niche ? std::memcmp(bytes, niche_bytes().data, sizeof(T)) != 0 : bytes[sizeof(T)] != 0;
+        }
+
+        static optional<T> decode(word const& w) noexcept
+        {
+            if (!engaged(w))
+                return optional<T>();
+
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type value;
+            std::memcpy(&value, &w, sizeof(T));
+            return optional<T>(*reinterpret_cast<const T*>(&value));
+        }
+
+        struct niche_representation
+        {
+            unsigned char data[sizeof(T)];
+        };
+
+        static niche_representation niche_bytes() noexcept
+        {
+            niche_representation bytes = {};
+            niche_copy(bytes, std::integral_constant<bool, layout::uses_niche>());
+            return bytes;
+        }
+
+        static void niche_copy(niche_representation& bytes, std::true_type) noexcept
+        {
+            const T niche = Niche::get();
+            std::memcpy(bytes.data, std::addressof(niche), sizeof(T));
+        }
+
+        static void niche_copy(niche_representation&, std::false_type) noexcept
+        {}
+
+        // A NaN with the bits of the niche is stored as the default quiet NaN.
+        static void replace_niche(unsigned char* bytes, std::true_type) noexcept
+        {
+            const T nan = std::numeric_limits<T>::quiet_NaN();
+            std::memcpy(bytes, &nan, sizeof(T));
+            assert(std::memcmp(bytes, niche_bytes().data, sizeof(T)) != 0 && "The niche of T must not be the default quiet NaN.");
+        }
+
+        static void replace_niche(unsigned char*, std::false_type) noexcept
+        {
+            assert(!"The niche of T can't be stored in an opt::atomic_optional.");
+        }
+
+        cell m_cell;
+    };
+
+    // An optional value of a trivially copyable type of any size, for values that are
+    // read often and written rarely. A sequence number is marked at the start of every
+    // write and incremented at its end; a reader copies the value between two reads of
+    // the sequence number and retries if they differ (or a write was in progress). Readers never write to
+    // shared memory, so they don't contend with each other.
+    // There must be a single writer at a time (concurrent writers need external
+    // synchronization). A reader that keeps overlapping with writes spins until it
+    // gets a consistent copy.
+    template<class T>
+    class seqlock_optional
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "opt::seqlock_optional requires a trivially copyable type.");
+
+        // The value is copied through relaxed atomic words so that overlapping reads and
+        // writes are not data races.
+        static constexpr std::size_t words = (sizeof(T) + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+
+        // Bit 0 of the sequence number is set during a write, bit 1 is the engaged flag.
+        static constexpr std::uint64_t writing = 1;
+        static constexpr std::uint64_t engaged = 2;
+        static constexpr std::uint64_t increment = 4;
+
+    public:
+        using value_type = T;
+
+        // Creates an empty cell.
+        seqlock_optional() noexcept
+            : m_sequence(0)
+        {
+            for (auto& w : m_words)
+                w.store(0, std::memory_order_relaxed);
+        }
+
+        seqlock_optional(optional<T> const& value) noexcept
+            : seqlock_optional()
+        {
+            store(value);
+        }
+
+        seqlock_optional(const seqlock_optional&) = delete;
+        seqlock_optional& operator=(const seqlock_optional&) = delete;
+
+        // Returns a copy of the value.
+        optional<T> load() const noexcept
+        {
+            std::uint64_t buffer[words];
+            detail::backoff wait;
+            for (;;)
+            {
+                const std::uint64_t before = m_sequence.load(std::memory_order_acquire);
+                if (!(before & writing))
+                {
+                    // An empty cell has no value to copy.
+                    if (!(before & engaged))
+                        return optional<T>();
+
+                    for (std::size_t i = 0; i < words; ++i)
+                        buffer[i] = m_words[i].load(std::memory_order_relaxed);
+
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (m_sequence.load(std::memory_order_relaxed) == before)
+                        break;
+                }
+                wait();
+            }
+
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type value;
+            std::memcpy(&value, buffer, sizeof(T));
+            return optional<T>(*reinterpret_cast<const T*>(&value));
+        }
+
+        bool has_value() const noexcept
+        {
+            detail::backoff wait;
+            std::uint64_t sequence;
+            while ((sequence = m_sequence.load(std::memory_order_acquire)) & writing)
+                wait();
+            return (sequence & engaged) != 0;
+        }
+
+        // Writer: replaces the value.
+        void store(optional<T> const& value) noexcept
+        {
+            if (!value)
+            {
+                reset();
+                return;
+            }
+
+            std::uint64_t buffer[words] = {};
+            std::memcpy(buffer, std::addressof(*value), sizeof(T));
+
+            const std::uint64_t sequence = begin_write();
+            for (std::size_t i = 0; i < words; ++i)
+                m_words[i].store(buffer[i], std::memory_order_relaxed);
+            end_write(sequence, true);
+        }
+
+        // Writer: empties the cell.
+        void reset() noexcept
+        {
+            // The flag is part of the sequence number, so the words are left as they are.
+            end_write(begin_write(), false);
+        }
+
+    private:
+        std::uint64_t begin_write() noexcept
+        {
+            const std::uint64_t sequence = m_sequence.load(std::memory_order_relaxed);
+            assert(!(sequence & writing) && "Concurrent writes to an opt::seqlock_optional.");
+            m_sequence.store(sequence | writing, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            return sequence;
+        }
+
+        void end_write(std::uint64_t sequence, bool is_engaged) noexcept
+        {
+            m_sequence.store(((sequence & ~(increment - 1)) + increment) | (is_engaged ? engaged : 0), std::memory_order_release);
+        }
+
+        std::atomic<std::uint64_t> m_sequence;
+        std::atomic<std::uint64_t> m_words[words];
+    };
+
+    template<class T>
+    constexpr std::size_t seqlock_optional<T>::words;
+
+    template<class T>
+    constexpr std::uint64_t seqlock_optional<T>::writing;
+
+    template<class T>
+    constexpr std::uint64_t seqlock_optional<T>::engaged;
+
+    template<class T>
+    constexpr std::uint64_t seqlock_optional<T>::increment;
+
+    // A bounded chain of (version, optional value) entries of a trivially copyable type for
+    // snapshot reads: read_at(v) returns the value of the newest entry with a version <= v
+    // (nullopt if that entry is a reset, or if there is none), so a reader sees the same
+    // value for the same snapshot while a writer adds newer versions. Each entry is a
+    // seqlock (like opt::seqlock_optional): readers never block and never write to shared
+    // memory, and only retry if the entry they copy is overwritten during the copy.
+    //
+    // There must be a single writer at a time, and versions must be stored in increasing
+    // order. store fails if all 'Capacity' entries are in use; collect(low_water) frees the
+    // entries that are no longer visible to a reader of a version >= low_water (all but the
+    // newest entry at or below it). The low-water mark must not exceed the version of any
+    // reader in progress: a read below it returns an unspecified value of the chain (or nullopt),
+    // but never a torn one.
+    template<class T, std::size_t Capacity = 4>
+    class versioned_optional
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "opt::versioned_optional requires a trivially copyable type.");
+        static_assert(Capacity >= 2, "opt::versioned_optional needs room for a new version next to the current one.");
+
+        static constexpr std::size_t words = (sizeof(T) + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+
+        // Bit 0 of the sequence number is set during a write, bit 1 is the engaged flag.
+        static constexpr std::uint64_t writing = 1;
+        static constexpr std::uint64_t engaged = 2;
+        static constexpr std::uint64_t increment = 4;
+
+        // Versions are > 0: an entry with version 0 is free.
+        struct entry
+        {
+            std::atomic<std::uint64_t> sequence{ 0 };
+            std::atomic<std::uint64_t> version{ 0 };
+            std::atomic<std::uint64_t> words[versioned_optional::words];
+        };
+
+    public:
+        using value_type = T;
+
+        // Creates an empty chain: every version reads as nullopt.
+        versioned_optional() noexcept
+            : m_latest(0)
+            , m_low_water(0)
+        {
+            for (auto& e : m_entries)
+            {
+                for (auto& w : e.words)
+                    w.store(0, std::memory_order_relaxed);
+            }
+            for (auto& v : m_versions)
+                v = 0;
+        }
+
+        versioned_optional(const versioned_optional&) = delete;
+        versioned_optional& operator=(const versioned_optional&) = delete;
+
+        static constexpr std::size_t capacity() noexcept
+        {
+            return Capacity;
+        }
+
+        // The newest version that was stored (0 if none).
+        std::uint64_t latest_version() const noexcept
+        {
+            return m_latest.load(std::memory_order_acquire);
+        }
+
+        // Reader: returns the value as of 'version'.
+        optional<T> read_at(std::uint64_t version) const noexcept
+        {
+            std::uint64_t buffer[words];
+            detail::backoff wait;
+            for (;;)
+            {
+                // Find the newest entry at or below 'version' (entries that are being written are newer).
+                const entry* best = nullptr;
+                std::uint64_t best_version = 0;
+                std::uint64_t best_sequence = 0;
+                for (const entry& e : m_entries)
+                {
+                    const std::uint64_t sequence = e.sequence.load(std::memory_order_acquire);
+                    const std::uint64_t v = e.version.load(std::memory_order_relaxed);
+                    if (!(sequence & writing) && v != 0 && v <= version && v > best_version)
+                    {
+                        best = &e;
+                        best_version = v;
+                        best_sequence = sequence;
+                    }
+                }
+                if (!best)
+                    return optional<T>();
+
+                // Copy it, and start over if it was overwritten in the meantime.
+                if (best_sequence & engaged)
+                {
+                    for (std::size_t i = 0; i < words; ++i)
+                        buffer[i] = best->words[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (best->sequence.load(std::memory_order_relaxed) == best_sequence)
+                {
+                    if (!(best_sequence & engaged))
+                        return optional<T>();
+                    break;
+                }
+                wait();
+            }
+
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type value;
+            std::memcpy(&value, buffer, sizeof(T));
+            return optional<T>(*reinterpret_cast<const T*>(&value));
+        }
+
+        // Reader: returns the newest value.
+        optional<T> load() const noexcept
+        {
+            return read_at(latest_version());
+        }
+
+        // Writer: adds 'value' (or a reset, if it is nullopt) as 'version', which must be
+        // newer than the versions stored before. Returns false if the chain is full.
+        bool store(std::uint64_t version, optional<T> const& value) noexcept
+        {
+            assert(version > m_latest.load(std::memory_order_relaxed) && "opt::versioned_optional versions must increase.");
+
+            std::size_t index = 0;
+            while (index < Capacity && m_versions[index] != 0)
+                ++index;
+            if (index == Capacity)
+                return false;
+
+            std::uint64_t buffer[words] = {};
+            if (value)
+                std::memcpy(buffer, std::addressof(*value), sizeof(T));
+
+            entry& e = m_entries[index];
+            const std::uint64_t sequence = begin_write(e);
+            e.version.store(version, std::memory_order_relaxed);
+            for (std::size_t i = 0; i < words; ++i)
+                e.words[i].store(buffer[i], std::memory_order_relaxed);
+            end_write(e, sequence, value.has_value());
+
+            m_versions[index] = version;
+            m_latest.store(version, std::memory_order_release);
+            return true;
+        }
+
+        // Writer: adds an empty value as 'version'.
+        bool reset(std::uint64_t version) noexcept
+        {
+            return store(version, nullopt);
+        }
+
+        // Writer: frees the entries that no reader of a version >= 'low_water' can see,
+        // and returns the number of entries that were freed.
+        std::size_t collect(std::uint64_t low_water) noexcept
+        {
+            assert(low_water >= m_low_water && "The low-water mark of an opt::versioned_optional must not go back.");
+            m_low_water = low_water;
+
+            // The newest entry at or below the mark stays visible.
+            std::uint64_t visible = 0;
+            for (std::uint64_t v : m_versions)
+            {
+                if (v <= low_water && v > visible)
+                    visible = v;
+            }
+
+            std::size_t freed = 0;
+            for (std::size_t i = 0; i < Capacity; ++i)
+            {
+                if (m_versions[i] != 0 && m_versions[i] < visible)
+                {
+                    entry& e = m_entries[i];
+                    const std::uint64_t sequence = begin_write(e);
+                    e.version.store(0, std::memory_order_relaxed);
+                    end_write(e, sequence, false);
+                    m_versions[i] = 0;
+                    ++freed;
+                }
+            }
+            return freed;
+        }
+
+    private:
+        static std::uint64_t begin_write(entry& e) noexcept
+        {
+            const std::uint64_t sequence = e.sequence.load(std::memory_order_relaxed);
+            e.sequence.store(sequence | writing, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            return sequence;
+        }
+
+        static void end_write(entry& e, std::uint64_t sequence, bool is_engaged) noexcept
+        {
+            e.sequence.store(((sequence & ~(increment - 1)) + increment) | (is_engaged ? engaged : 0), std::memory_order_release);
+        }
+
+        entry m_entries[Capacity];
+        std::atomic<std::uint64_t> m_latest;
+
+        // Only used by the writer: the versions of the entries (0 for a free entry) and the low-water mark.
+        std::uint64_t m_versions[Capacity];
+        std::uint64_t m_low_water;
+    };
+
+    template<class T, std::size_t Capacity>
+    constexpr std::size_t versioned_optional<T, Capacity>::words;
+
+    template<class T, std::size_t Capacity>
+    constexpr std::uint64_t versioned_optional<T, Capacity>::writing;
+
+    template<class T, std::size_t Capacity>
+    constexpr std::uint64_t versioned_optional<T, Capacity>::engaged;
+
+    template<class T, std::size_t Capacity>
+    constexpr std::uint64_t versioned_optional<T, Capacity>::increment;
+
+    // A lock-free cell for a trivially copyable value of up to 4 bytes (such as a status code)
+    // that can be shared between processes: placed in a mapped file or a shm_open region,
+    // possibly at different addresses in each process. The layout is a single 64 bit
+    // integer that doesn't depend on the compiler: the value in the high 32 bits and the
+    // state in the low 32 bits (bit 0: engaged, bit 1: a process waits for a value).
+    // Memory that is filled with zeros is an empty cell. Processes that wait for a value
+    // sleep on a process-shared futex on the state half of the word (on Linux).
+    template<class T>
+    class shared_atomic_optional
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "opt::shared_atomic_optional requires a trivially copyable type.");
+        static_assert(sizeof(T) <= sizeof(std::uint32_t), "opt::shared_atomic_optional holds values of up to 4 bytes.");
+        static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "opt::shared_atomic_optional requires a lock-free (address-free) 64 bit atomic.");
+        static_assert(sizeof(std::atomic<std::uint64_t>) == sizeof(std::uint64_t) && alignof(std::atomic<std::uint64_t>) == alignof(std::uint64_t),
+            "The word of opt::shared_atomic_optional must have the layout of a std::uint64_t.");
+
+        static constexpr std::uint64_t engaged = 1;
+        static constexpr std::uint64_t waiters = 2;
+
+    public:
+        using value_type = T;
+
+        // Creates an empty cell (the same as zero-filled memory).
+        shared_atomic_optional() noexcept
+            : m_word(0)
+        {}
+
+        shared_atomic_optional(const shared_atomic_optional&) = delete;
+        shared_atomic_optional& operator=(const shared_atomic_optional&) = delete;
+
+        optional<T> load(std::memory_order order = std::memory_order_seq_cst) const noexcept
+        {
+            return decode(m_word.load(order));
+        }
+
+        bool has_value(std::memory_order order = std::memory_order_seq_cst) const noexcept
+        {
+            return (m_word.load(order) & engaged) != 0;
+        }
+
+        // Replaces the value and wakes the processes that wait for one.
+        void store(optional<T> const& value) noexcept
+        {
+            const std::uint64_t desired = encode(value);
+            std::uint64_t word = m_word.load(std::memory_order_relaxed);
+            // Storing nullopt keeps the waiters, who still wait for a value.
+            while (!m_word.compare_exchange_weak(word, desired | (desired ? 0 : word & waiters), std::memory_order_seq_cst))
+                ;
+            if (desired && (word & waiters))
+                detail::futex_wake_all_shared(state());
+        }
+
+        void reset() noexcept
+        {
+            store(nullopt);
+        }
+
+        // Empties the cell and returns its value (nullopt if it was empty).
+        optional<T> take() noexcept
+        {
+            std::uint64_t word = m_word.load(std::memory_order_relaxed);
+            while (word & engaged)
+            {
+                if (m_word.compare_exchange_weak(word, 0, std::memory_order_seq_cst))
+                    return decode(word);
+            }
+            return optional<T>();
+        }
+
+        // Blocks until the cell holds a value and takes it.
+        optional<T> wait_take() noexcept
+        {
+            for (;;)
+            {
+                std::uint64_t word;
+                if (take_or_announce(word))
+                    return decode(word);
+                detail::futex_wait_shared(state(), static_cast<std::uint32_t>(word), nullptr);
+            }
+        }
+
+        // Like wait_take, but returns nullopt if no value arrives within 'timeout'.
+        template<class Rep, class Period>
+        optional<T> wait_take_for(const std::chrono::duration<Rep, Period>& timeout) noexcept
+        {
+            using clock = std::chrono::steady_clock;
+            const clock::time_point deadline = clock::now() + std::chrono::duration_cast<clock::duration>(timeout);
+            for (;;)
+            {
+                std::uint64_t word;
+                if (take_or_announce(word))
+                    return decode(word);
+
+                const clock::time_point now = clock::now();
+                if (now >= deadline)
+                    return take();
+                const std::chrono::nanoseconds remaining = deadline - now;
+                detail::futex_wait_shared(state(), static_cast<std::uint32_t>(word), &remaining);
+            }
+        }
+
+    private:
+        // Takes the value if there is one (and returns true), or sets the waiters bit and
+        // stores the word to wait on in 'word'.
+        bool take_or_announce(std::uint64_t& word) noexcept
+        {
+            word = m_word.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                if (word & engaged)
+                {
+                    if (m_word.compare_exchange_weak(word, 0, std::memory_order_seq_cst))
+                        return true;
+                }
+                else if (word & waiters)
+                {
+                    return false;
+                }
+                else if (m_word.compare_exchange_weak(word, word | waiters, std::memory_order_seq_cst))
+                {
+                    word |= waiters;
+                    return false;
+                }
+            }
+        }
+
+        // The address of the low (state) half of the word.
+        const volatile void* state() const noexcept
+        {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            return reinterpret_cast<const volatile std::uint32_t*>(&m_word) + 1;
+#else
+            return reinterpret_cast<const volatile std::uint32_t*>(&m_word);
+#endif
+        }
+
+        // Checks the layout that is shared with other processes (here, where the class is
+        // complete; every operation encodes or decodes a word).
+        static void check_layout() noexcept
+        {
+            static_assert(sizeof(shared_atomic_optional) == sizeof(std::uint64_t), "opt::shared_atomic_optional must be a single 64 bit word.");
+            static_assert(alignof(shared_atomic_optional) == alignof(std::uint64_t), "opt::shared_atomic_optional must be aligned like a 64 bit word.");
+            static_assert(std::is_standard_layout<shared_atomic_optional>::value, "opt::shared_atomic_optional must have standard layout.");
+        }
+
+        static std::uint64_t encode(optional<T> const& value) noexcept
+        {
+            check_layout();
+            if (!value)
+                return 0;
+            std::uint32_t bits = 0;
+            std::memcpy(&bits, std::addressof(*value), sizeof(T));
+            return static_cast<std::uint64_t>(bits) << 32 | engaged;
+        }
+
+        static optional<T> decode(std::uint64_t word) noexcept
+        {
+            check_layout();
+            if (!(word & engaged))
+                return optional<T>();
+            const std::uint32_t bits = static_cast<std::uint32_t>(word >> 32);
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type value;
+            std::memcpy(&value, &bits, sizeof(T));
+            return optional<T>(*reinterpret_cast<const T*>(&value));
+        }
+
+        std::atomic<std::uint64_t> m_word;
+    };
+
+    template<class T>
+    constexpr std::uint64_t shared_atomic_optional<T>::engaged;
+
+    template<class T>
+    constexpr std::uint64_t shared_atomic_optional<T>::waiters;
+
+    // A value that is initialized at most once, by the first call of get_or_init.
+    // After the initialization get_or_init is a single acquire load. Threads that call
+    // get_or_init while another thread initializes the value sleep until it is done.
+    // If the initialization throws, the exception is propagated to its caller and the
+    // next caller (possibly a waiting thread) tries again.
+    template<class T>
+    class once_optional
+    {
+        // The states of m_state.
+        static constexpr std::uint32_t empty = 0;
+        static constexpr std::uint32_t initializing = 1;
+        static constexpr std::uint32_t initializing_with_waiters = 2;
+        static constexpr std::uint32_t ready = 3;
+
+    public:
+        using value_type = T;
+
+        once_optional() noexcept
+            : m_state(empty)
+        {}
+
+        once_optional(const once_optional&) = delete;
+        once_optional& operator=(const once_optional&) = delete;
+
+        // Returns the value, initializing it with the result of 'init()' if this is the first call.
+        // 'init' must not call get_or_init on the same object.
+        template<class F>
+        T& get_or_init(F&& init)
+        {
+            if (m_state.load(std::memory_order_acquire) != ready)
+                initialize(std::forward<F>(init));
+            return *m_value;
+        }
+
+        // Returns the value if it has been initialized.
+        optional<T&> get() noexcept
+        {
+            return has_value() ? optional<T&>(*m_value) : optional<T&>();
+        }
+
+        optional<const T&> get() const noexcept
+        {
+            return has_value() ? optional<const T&>(*m_value) : optional<const T&>();
+        }
+
+        bool has_value() const noexcept
+        {
+            return m_state.load(std::memory_order_acquire) == ready;
+        }
+
+    private:
+        template<class F>
+        void initialize(F&& init)
+        {
+            for (;;)
+            {
+                std::uint32_t state = m_state.load(std::memory_order_acquire);
+                if (state == ready)
+                    return;
+
+                if (state == empty)
+                {
+                    if (!m_state.compare_exchange_strong(state, initializing, std::memory_order_acquire))
+                        continue;
+
+                    try
+                    {
+                        m_value.emplace(std::forward<F>(init)());
+                    }
+                    catch (...)
+                    {
+                        finish(empty);
+                        throw;
+                    }
+                    finish(ready);
+                    return;
+                }
+
+                // Announce the waiter, so that the initializing thread wakes it.
+                if (state == initializing && !m_state.compare_exchange_strong(state, initializing_with_waiters, std::memory_order_relaxed))
+                    continue;
+                detail::futex_wait(m_state, initializing_with_waiters);
+            }
+        }
+
+        void finish(std::uint32_t state) noexcept
+        {
+            if (m_state.exchange(state, std::memory_order_release) == initializing_with_waiters)
+                detail::futex_wake_all(m_state);
+        }
+
+        std::atomic<std::uint32_t> m_state;
+        optional<T> m_value;
+    };
+
+    template<class T>
+    constexpr std::uint32_t once_optional<T>::empty;
+
+    template<class T>
+    constexpr std::uint32_t once_optional<T>::initializing;
+
+    template<class T>
+    constexpr std::uint32_t once_optional<T>::initializing_with_waiters;
+
+    template<class T>
+    constexpr std::uint32_t once_optional<T>::ready;
+
+    // A value that is published once by emplace and that other threads can wait for.
+    // The state is a single 32 bit word next to the opt::optional<T>, and waiting threads
+    // sleep on it (a futex on Linux), so a slot costs one word more than an opt::optional.
+    // emplace must not be called concurrently with another emplace or with reset.
+    template<class T>
+    class waitable_optional
+    {
+        // The states of m_state.
+        static constexpr std::uint32_t empty = 0;
+        static constexpr std::uint32_t empty_with_waiters = 1;
+        static constexpr std::uint32_t ready = 2;
+
+    public:
+        using value_type = T;
+
+        waitable_optional() noexcept
+            : m_state(empty)
+        {}
+
+        waitable_optional(const waitable_optional&) = delete;
+        waitable_optional& operator=(const waitable_optional&) = delete;
+
+        // Publishes T(args...) and wakes the waiting threads.
+        template<class... Args>
+        T& emplace(Args&&... args)
+        {
+            assert(m_state.load(std::memory_order_relaxed) != ready && "opt::waitable_optional is already engaged.");
+            m_value.emplace(std::forward<Args>(args)...);
+            if (m_state.exchange(ready, std::memory_order_release) == empty_with_waiters)
+                detail::futex_wake_all(m_state);
+            return *m_value;
+        }
+
+        // Returns the value if it has been published.
+        optional<T&> try_get() noexcept
+        {
+            return has_value() ? optional<T&>(*m_value) : optional<T&>();
+        }
+
+        // Blocks until the value is published.
+        optional<T&> wait() noexcept
+        {
+            while (!ready_or_announce())
+                detail::futex_wait(m_state, empty_with_waiters);
+            return optional<T&>(*m_value);
+        }
+
+        // Blocks until the value is published or 'timeout' expires (then returns nullopt).
+        template<class Rep, class Period>
+        optional<T&> wait_for(const std::chrono::duration<Rep, Period>& timeout) noexcept
+        {
+            using clock = std::chrono::steady_clock;
+            const clock::time_point deadline = clock::now() + std::chrono::duration_cast<clock::duration>(timeout);
+            while (!ready_or_announce())
+            {
+                const clock::time_point now = clock::now();
+                if (now >= deadline)
+                    return try_get();
+                detail::futex_wait_for(m_state, empty_with_waiters, deadline - now);
+            }
+            return optional<T&>(*m_value);
+        }
+
+        bool has_value() const noexcept
+        {
+            return m_state.load(std::memory_order_acquire) == ready;
+        }
+
+        // Empties the slot for the next value. No other thread may use the slot (or its value) concurrently.
+        void reset() noexcept
+        {
+            m_value.reset();
+            m_state.store(empty, std::memory_order_relaxed);
+        }
+
+    private:
+        // Returns true if the value is ready, or marks the state so that emplace wakes this thread.
+        bool ready_or_announce() noexcept
+        {
+            std::uint32_t state = m_state.load(std::memory_order_acquire);
+            while (state == empty)
+            {
+                if (m_state.compare_exchange_weak(state, empty_with_waiters, std::memory_order_acquire))
+                    return false;
+            }
+            return state == ready;
+        }
+
+        std::atomic<std::uint32_t> m_state;
+        optional<T> m_value;
+    };
+
+    template<class T>
+    constexpr std::uint32_t waitable_optional<T>::empty;
+
+    template<class T>
+    constexpr std::uint32_t waitable_optional<T>::empty_with_waiters;
+
+    template<class T>
+    constexpr std::uint32_t waitable_optional<T>::ready;
+
+    namespace detail
+    {
+        // A reader of opt::rcu_optional: one record per thread, which is reused by a later
+        // thread when its thread exits. 'epoch' is the epoch of the domain at the time the
+        // thread started reading, or 0 if it isn't reading.
+        struct rcu_record
+        {
+            std::atomic<std::uint64_t> epoch{ 0 };
+            std::atomic<bool> in_use{ true };
+            rcu_record* next = nullptr;
+            unsigned nesting = 0;   // Only used by the owning thread.
+            char padding[64];
+        };
+
+        // The readers of all opt::rcu_optional cells, and the epoch that writers advance
+        // every time they replace a value.
+        class rcu_domain
+        {
+        public:
+            static rcu_domain& instance() noexcept
+            {
+                // Never destroyed: threads may still use their records during static destruction.
+                static rcu_domain* domain = new rcu_domain();
+                return *domain;
+            }
+
+            // The record of the current thread.
+            static rcu_record& current_record()
+            {
+                static thread_local thread_record thread;
+                if (!thread.record)
+                    thread.record = instance().acquire_record();
+                return *thread.record;
+            }
+
+            void lock(rcu_record& record) noexcept
+            {
+                if (record.nesting++ == 0)
+                {
+                    record.epoch.store(m_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+                    // Orders the store above before the reader's load of the pointer (see synchronize).
+                    if (m_expedited)
+                        std::atomic_signal_fence(std::memory_order_seq_cst);
+                    else
+                        std::atomic_thread_fence(std::memory_order_seq_cst);
+                }
+            }
+
+            void unlock(rcu_record& record) noexcept
+            {
+                if (--record.nesting == 0)
+                    record.epoch.store(0, std::memory_order_release);
+            }
+
+            // Advances the epoch after a writer replaced a pointer and returns the previous epoch.
+            // Readers that announce a later epoch see the new pointer.
+            std::uint64_t advance() noexcept
+            {
+                return m_epoch.fetch_add(1, std::memory_order_seq_cst);
+            }
+
+            // The oldest epoch announced by a reader (~0 if no thread is reading). A value that was
+            // replaced in an epoch before it is no longer pinned.
+            std::uint64_t synchronize() noexcept
+            {
+                // Either a reader's announcement is visible below, or the reader sees the new pointer.
+                // With membarrier the readers only issue a compiler barrier, so a writer can't make
+                // up for a failed membarrier with a fence of its own. The command can't fail once the
+                // process is registered, and a failure would break the readers, so it is fatal.
+                if (!m_expedited)
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                else if (membarrier(membarrier_private_expedited) != 0)
+                    std::terminate();
+
+                std::uint64_t oldest = ~std::uint64_t(0);
+                for (rcu_record* r = m_records.load(std::memory_order_acquire); r; r = r->next)
+                {
+                    const std::uint64_t epoch = r->epoch.load(std::memory_order_acquire);
+                    if (epoch != 0 && epoch < oldest)
+                        oldest = epoch;
+                }
+                return oldest;
+            }
+
+        private:
+            // Returns the record to the domain when the thread exits.
+            struct thread_record
+            {
+                rcu_record* record = nullptr;
+
+                ~thread_record()
+                {
+                    if (record)
+                        record->in_use.store(false, std::memory_order_release);
+                }
+            };
+
+            // The commands of membarrier (see linux/membarrier.h).
+            static constexpr int membarrier_query = 0;
+            static constexpr int membarrier_private_expedited = 1 << 3;
+            static constexpr int membarrier_register_private_expedited = 1 << 4;
+
+            rcu_domain() noexcept
+                : m_epoch(1)
+                , m_records(nullptr)
+                , m_expedited(false)
+            {
+                const long commands = membarrier(membarrier_query);
+                m_expedited = commands > 0 && (commands & membarrier_private_expedited)
+                    && membarrier(membarrier_register_private_expedited) == 0;
+            }
+
+            // Runs a membarrier command. Returns -1 if membarrier is not available.
+            static long membarrier(int command) noexcept
+            {
+#if defined(__linux__) && defined(SYS_membarrier)
+                return syscall(SYS_membarrier, command, 0);
+#else
+                (void)command;
+                return -1;
+#endif
+            }
+
+            rcu_record* acquire_record()
+            {
+                for (rcu_record* r = m_records.load(std::memory_order_acquire); r; r = r->next)
+                {
+                    bool in_use = false;
+                    if (!r->in_use.load(std::memory_order_relaxed) && r->in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire))
+                        return r;
+                }
+
+                rcu_record* r = new rcu_record();
+                r->next = m_records.load(std::memory_order_relaxed);
+                while (!m_records.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed))
+                    ;
+                return r;
+            }
+
+            std::atomic<std::uint64_t> m_epoch;
+            std::atomic<rcu_record*> m_records;
+            bool m_expedited;
+        };
+    } // namespace detail
+
+    // A value that is read far more often than it is replaced (such as a configuration).
+    // read() returns a guard that pins the current value (or nullopt) until it is destroyed,
+    // without locks and without atomic read-modify-write instructions, so readers on
+    // different cores don't contend. Writers allocate the new value, swap the pointer and
+    // free the values they replaced once no reader can still see them (see rcu_domain);
+    // values that are still pinned are freed by a later write or by reclaim().
+    // A guard must be destroyed by the thread that created it.
+    template<class T>
+    class rcu_optional
+    {
+        struct node
+        {
+            template<class... Args>
+            explicit node(Args&&... args)
+                : value(std::forward<Args>(args)...)
+            {}
+
+            T value;
+        };
+
+    public:
+        using value_type = T;
+
+        // Pins the value of an opt::rcu_optional (like an opt::optional<const T&>).
+        class guard
+        {
+        public:
+            guard(guard&& other) noexcept
+                : m_record(other.m_record)
+                , m_node(other.m_node)
+            {
+                other.m_record = nullptr;
+            }
+
+            guard(const guard&) = delete;
+            guard& operator=(const guard&) = delete;
+
+            ~guard()
+            {
+                if (m_record)
+                    detail::rcu_domain::instance().unlock(*m_record);
+            }
+
+            bool has_value() const noexcept
+            {
+                return m_node != nullptr;
+            }
+
+            explicit operator bool() const noexcept
+            {
+                return has_value();
+            }
+
+            const T& operator*() const noexcept
+            {
+                assert(m_node);
+                return m_node->value;
+            }
+
+            const T* operator->() const noexcept
+            {
+                assert(m_node);
+                return &m_node->value;
+            }
+
+            optional<const T&> get() const noexcept
+            {
+                return m_node ? optional<const T&>(m_node->value) : optional<const T&>();
+            }
+
+        private:
+            friend class rcu_optional;
+
+            guard(detail::rcu_record* record, const node* n) noexcept
+                : m_record(record)
+                , m_node(n)
+            {}
+
+            detail::rcu_record* m_record;
+            const node* m_node;
+        };
+
+        // Creates an empty cell.
+        rcu_optional() noexcept
+            : m_current(nullptr)
+        {}
+
+        explicit rcu_optional(optional<T> const& value)
+            : m_current(value ? new node(*value) : nullptr)
+        {}
+
+        rcu_optional(const rcu_optional&) = delete;
+        rcu_optional& operator=(const rcu_optional&) = delete;
+
+        // No thread may read the cell while it is destroyed.
+        ~rcu_optional()
+        {
+            delete m_current.load(std::memory_order_relaxed);
+            for (auto& retired : m_retired)
+                delete retired.second;
+        }
+
+        // Reader: pins the current value.
+        guard read() const
+        {
+            detail::rcu_domain& domain = detail::rcu_domain::instance();
+            detail::rcu_record& record = detail::rcu_domain::current_record();
+            domain.lock(record);
+            return guard(&record, m_current.load(std::memory_order_acquire));
+        }
+
+        // Reader: copies the current value.
+        optional<T> load() const
+        {
+            const guard g = read();
+            return g ? optional<T>(*g) : optional<T>();
+        }
+
+        bool has_value() const noexcept
+        {
+            return m_current.load(std::memory_order_acquire) != nullptr;
+        }
+
+        // Writer: replaces the value.
+        void store(optional<T> const& value)
+        {
+            if (value)
+                emplace(*value);
+            else
+                reset();
+        }
+
+        // Writer: replaces the value with T(args...).
+        template<class... Args>
+        void emplace(Args&&... args)
+        {
+            publish(new node(std::forward<Args>(args)...));
+        }
+
+        // Writer: empties the cell.
+        void reset()
+        {
+            publish(nullptr);
+        }
+
+        // Frees the replaced values that are no longer pinned by a reader and returns
+        // the number of replaced values that are still pinned.
+        std::size_t reclaim()
+        {
+            std::lock_guard<std::mutex> lock(m_writer);
+            return reclaim_locked();
+        }
+
+    private:
+        void publish(node* n)
+        {
+            std::lock_guard<std::mutex> lock(m_writer);
+            try
+            {
+                m_retired.reserve(m_retired.size() + 1);
+            }
+            catch (...)
+            {
+                delete n;
+                throw;
+            }
+
+            if (const node* old = m_current.exchange(n, std::memory_order_seq_cst))
+                m_retired.emplace_back(detail::rcu_domain::instance().advance(), old);
+            reclaim_locked();
+        }
+
+        std::size_t reclaim_locked() noexcept
+        {
+            if (m_retired.empty())
+                return 0;
+
+            // Values are retired in increasing epochs.
+            const std::uint64_t oldest = detail::rcu_domain::instance().synchronize();
+            std::size_t freed = 0;
+            while (freed < m_retired.size() && m_retired[freed].first < oldest)
+                delete m_retired[freed++].second;
+            m_retired.erase(m_retired.begin(), m_retired.begin() + static_cast<std::ptrdiff_t>(freed));
+            return m_retired.size();
+        }
+
+        std::atomic<const node*> m_current;
+        std::mutex m_writer;
+        std::vector<std::pair<std::uint64_t, const node*>> m_retired;  // The epoch in which a value was replaced.
+    };
+} // namespace opt
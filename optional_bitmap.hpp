@@ -0,0 +1,1041 @@
+#pragma once
+
+//          Copyright Jeremiah van Oosten 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+ /**
+  *  @file optional_bitmap.hpp
+  *  @date October 16, 2026
+  *  @author Jeremiah van Oosten
+  *
+  *  @brief Validity (presence) bitmaps for columns of opt::optional values.
+  *
+  *  A validity bitmap stores one bit per value in 64-bit words (least significant
+  *  bit first). A set bit means the value is valid (engaged). This is the same
+  *  layout that is used by the values + bitmap overloads in optional_algorithm.hpp.
+  *
+  *  The transcode functions convert between the three layouts of a nullable column:
+  *  an array of optionals, values + a validity bitmap, and sentinel encoded values.
+  *  Columns of 4 or 8 byte integers, float and double are converted in all six
+  *  directions with AVX2 if it is enabled (for example with -mavx2 or
+  *  -march=native, see OPTIONAL_NATIVE_ARCH); other types use scalar loops.
+  */
+
+#include "optional_algorithm.hpp"
+
+#include <cassert>          // for assert
+#include <cstddef>          // for std::size_t
+#include <cstdint>          // for std::uint64_t
+#include <cstring>          // for std::memcpy
+#include <limits>           // for std::numeric_limits
+#include <type_traits>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace opt
+{
+    // Returned by find_next if there is no set bit.
+    OPT_INLINE_VAR std::size_t bitmap_npos = static_cast<std::size_t>(-1);
+
+    namespace detail
+    {
+        // The number of set bits in words[0, count).
+        inline std::size_t popcount_words(const std::uint64_t* words, std::size_t count) noexcept
+        {
+            std::size_t total = 0;
+            std::size_t i = 0;
+#if defined(__AVX2__)
+            // Nibble lookup table popcount (Mula et al.), 4 words per iteration.
+            const __m256i lookup = _mm256_setr_epi8(
+                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+            const __m256i low_mask = _mm256_set1_epi8(0x0f);
+            __m256i acc = _mm256_setzero_si256();
+            for (; i + 4 <= count; i += 4)
+            {
+                const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+                const __m256i lo = _mm256_and_si256(v, low_mask);
+                const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+                const __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+                acc = _mm256_add_epi64(acc, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+            }
+            total += static_cast<std::size_t>(_mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+                                              _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3));
+#endif
+            for (; i < count; ++i)
+                total += popcount64(words[i]);
+            return total;
+        }
+
+        // A mask with the lowest 'n' bits set (0 < n <= 64).
+        inline std::uint64_t low_bits(std::size_t n) noexcept
+        {
+            return ~std::uint64_t(0) >> (64 - n);
+        }
+    } // namespace detail
+
+    // A non-owning view of 'size' bits of a validity bitmap that start at bit 'offset'.
+    // The offset does not need to be a multiple of 64.
+    class bitmap_view
+    {
+    public:
+        using size_type = std::size_t;
+
+        constexpr bitmap_view() noexcept
+            : m_words(nullptr)
+            , m_size(0)
+            , m_offset(0)
+        {}
+
+        constexpr bitmap_view(const std::uint64_t* words, size_type size, size_type offset = 0) noexcept
+            : m_words(words)
+            , m_size(size)
+            , m_offset(offset)
+        {}
+
+        constexpr const std::uint64_t* words() const noexcept
+        {
+            return m_words;
+        }
+
+        constexpr size_type size() const noexcept
+        {
+            return m_size;
+        }
+
+        constexpr size_type offset() const noexcept
+        {
+            return m_offset;
+        }
+
+        constexpr bool empty() const noexcept
+        {
+            return m_size == 0;
+        }
+
+        bool test(size_type i) const
+        {
+            assert(i < m_size);
+            return detail::bit_test(m_words, m_offset + i);
+        }
+
+        bool operator[](size_type i) const
+        {
+            return test(i);
+        }
+
+        // The number of 64-bit words that are needed to store the bits of the view.
+        constexpr size_type word_count() const noexcept
+        {
+            return (m_size + 63) / 64;
+        }
+
+        // Bits [64 * k, 64 * k + 64) of the view. Bits past the end of the view are 0.
+        std::uint64_t word(size_type k) const
+        {
+            assert(k < word_count());
+
+            const size_type first = m_offset + k * 64;
+            const size_type remaining = m_size - k * 64;
+            const unsigned shift = first % 64;
+
+            std::uint64_t w = m_words[first / 64] >> shift;
+            if (shift != 0 && shift + remaining > 64)
+                w |= m_words[first / 64 + 1] << (64 - shift);
+            if (remaining < 64)
+                w &= detail::low_bits(remaining);
+            return w;
+        }
+
+        bitmap_view subview(size_type offset, size_type count) const
+        {
+            assert(offset <= m_size && count <= m_size - offset);
+            return bitmap_view(m_words, count, m_offset + offset);
+        }
+
+        // The number of set bits.
+        size_type count() const
+        {
+            if (m_size == 0)
+                return 0;
+
+            const size_type full = m_size / 64;
+            size_type total = 0;
+            if (m_offset % 64 == 0)
+            {
+                total = detail::popcount_words(m_words + m_offset / 64, full);
+            }
+            else
+            {
+                for (size_type k = 0; k < full; ++k)
+                    total += detail::popcount64(word(k));
+            }
+            if (m_size % 64 != 0)
+                total += detail::popcount64(word(full));
+            return total;
+        }
+
+        // The index of the first set bit at or after 'i', or bitmap_npos if there is none.
+        size_type find_next(size_type i) const
+        {
+            if (i >= m_size)
+                return bitmap_npos;
+
+            size_type k = i / 64;
+            std::uint64_t w = word(k) & (~std::uint64_t(0) << (i % 64));
+            while (w == 0)
+            {
+                if (++k == word_count())
+                    return bitmap_npos;
+                w = word(k);
+            }
+            return k * 64 + detail::countr_zero64(w);
+        }
+
+        size_type find_first() const
+        {
+            return find_next(0);
+        }
+
+    private:
+        const std::uint64_t* m_words;
+        size_type m_size;
+        size_type m_offset;
+    };
+
+    namespace detail
+    {
+        struct bitmap_copy_op
+        {
+            std::uint64_t operator()(std::uint64_t, std::uint64_t b) const noexcept { return b; }
+        };
+
+        struct bitmap_and_op
+        {
+            std::uint64_t operator()(std::uint64_t a, std::uint64_t b) const noexcept { return a & b; }
+        };
+
+        struct bitmap_or_op
+        {
+            std::uint64_t operator()(std::uint64_t a, std::uint64_t b) const noexcept { return a | b; }
+        };
+
+        struct bitmap_xor_op
+        {
+            std::uint64_t operator()(std::uint64_t a, std::uint64_t b) const noexcept { return a ^ b; }
+        };
+
+        struct bitmap_and_not_op
+        {
+            std::uint64_t operator()(std::uint64_t a, std::uint64_t b) const noexcept { return a & ~b; }
+        };
+
+        // dst[k] = op(dst[k], src.word(k)) for all words of 'src'. 'dst' starts at bit 0.
+        // The loops over whole words have no branches so they are vectorized
+        // by the compiler; unaligned sources are shifted into place two words at a time.
+        template<class Op>
+        void bitmap_apply(std::uint64_t* dst, bitmap_view src, Op op)
+        {
+            const std::size_t full = src.size() / 64;
+            const std::uint64_t* words = src.words() + src.offset() / 64;
+            const unsigned shift = src.offset() % 64;
+
+            if (shift == 0)
+            {
+                for (std::size_t k = 0; k < full; ++k)
+                    dst[k] = op(dst[k], words[k]);
+            }
+            else
+            {
+                for (std::size_t k = 0; k < full; ++k)
+                    dst[k] = op(dst[k], (words[k] >> shift) | (words[k + 1] << (64 - shift)));
+            }
+
+            if (src.size() % 64 != 0)
+                dst[full] = op(dst[full], src.word(full));
+        }
+    } // namespace detail
+
+    // An owning validity bitmap. The first bit is always aligned to the start of a word
+    // and the unused bits of the last word are always 0.
+    class validity_bitmap
+    {
+    public:
+        using size_type = std::size_t;
+
+        validity_bitmap() noexcept
+            : m_size(0)
+        {}
+
+        explicit validity_bitmap(size_type size, bool valid = false)
+            : m_words((size + 63) / 64, valid ? ~std::uint64_t(0) : 0)
+            , m_size(size)
+        {
+            clear_unused_bits();
+        }
+
+        // Copies (and aligns) the bits of a view.
+        explicit validity_bitmap(bitmap_view bits)
+            : m_words(bits.word_count())
+            , m_size(bits.size())
+        {
+            detail::bitmap_apply(m_words.data(), bits, detail::bitmap_copy_op());
+        }
+
+        operator bitmap_view() const noexcept
+        {
+            return view();
+        }
+
+        bitmap_view view() const noexcept
+        {
+            return bitmap_view(m_words.data(), m_size);
+        }
+
+        size_type size() const noexcept
+        {
+            return m_size;
+        }
+
+        bool empty() const noexcept
+        {
+            return m_size == 0;
+        }
+
+        size_type word_count() const noexcept
+        {
+            return m_words.size();
+        }
+
+        std::uint64_t* data() noexcept
+        {
+            return m_words.data();
+        }
+
+        const std::uint64_t* data() const noexcept
+        {
+            return m_words.data();
+        }
+
+        bool test(size_type i) const
+        {
+            assert(i < m_size);
+            return detail::bit_test(m_words.data(), i);
+        }
+
+        bool operator[](size_type i) const
+        {
+            return test(i);
+        }
+
+        void set(size_type i, bool valid = true)
+        {
+            assert(i < m_size);
+            const std::uint64_t bit = std::uint64_t(1) << (i % 64);
+            m_words[i / 64] = (m_words[i / 64] & ~bit) | (bit & (0 - std::uint64_t(valid)));
+        }
+
+        void reset(size_type i)
+        {
+            set(i, false);
+        }
+
+        size_type count() const
+        {
+            return detail::popcount_words(m_words.data(), m_words.size());
+        }
+
+        size_type find_next(size_type i) const
+        {
+            return view().find_next(i);
+        }
+
+        size_type find_first() const
+        {
+            return find_next(0);
+        }
+
+        validity_bitmap& operator&=(bitmap_view other)
+        {
+            assert(other.size() == m_size);
+            detail::bitmap_apply(m_words.data(), other, detail::bitmap_and_op());
+            return *this;
+        }
+
+        validity_bitmap& operator|=(bitmap_view other)
+        {
+            assert(other.size() == m_size);
+            detail::bitmap_apply(m_words.data(), other, detail::bitmap_or_op());
+            return *this;
+        }
+
+        validity_bitmap& operator^=(bitmap_view other)
+        {
+            assert(other.size() == m_size);
+            detail::bitmap_apply(m_words.data(), other, detail::bitmap_xor_op());
+            return *this;
+        }
+
+        // Clears the bits that are set in 'other' (*this & ~other).
+        validity_bitmap& and_not(bitmap_view other)
+        {
+            assert(other.size() == m_size);
+            detail::bitmap_apply(m_words.data(), other, detail::bitmap_and_not_op());
+            return *this;
+        }
+
+        friend bool operator==(validity_bitmap const& lhs, validity_bitmap const& rhs)
+        {
+            return lhs.m_size == rhs.m_size && lhs.m_words == rhs.m_words;
+        }
+
+        friend bool operator!=(validity_bitmap const& lhs, validity_bitmap const& rhs)
+        {
+            return !(lhs == rhs);
+        }
+
+    private:
+        void clear_unused_bits()
+        {
+            if (m_size % 64 != 0)
+                m_words.back() &= detail::low_bits(m_size % 64);
+        }
+
+        std::vector<std::uint64_t> m_words;
+        size_type m_size;
+    };
+
+    inline validity_bitmap operator&(bitmap_view lhs, bitmap_view rhs)
+    {
+        validity_bitmap result(lhs);
+        result &= rhs;
+        return result;
+    }
+
+    inline validity_bitmap operator|(bitmap_view lhs, bitmap_view rhs)
+    {
+        validity_bitmap result(lhs);
+        result |= rhs;
+        return result;
+    }
+
+    inline validity_bitmap operator^(bitmap_view lhs, bitmap_view rhs)
+    {
+        validity_bitmap result(lhs);
+        result ^= rhs;
+        return result;
+    }
+
+    // lhs & ~rhs
+    inline validity_bitmap and_not(bitmap_view lhs, bitmap_view rhs)
+    {
+        validity_bitmap result(lhs);
+        result.and_not(rhs);
+        return result;
+    }
+
+    // Returns a bitmap with the bits set for the engaged elements of 'in'.
+    template<class T>
+    validity_bitmap to_validity_bitmap(span<const optional<T>> in)
+    {
+        validity_bitmap result(in.size());
+        std::uint64_t* words = result.data();
+
+        const optional<T>* src = in.data();
+        const std::size_t full = in.size() / 64;
+        for (std::size_t k = 0; k < full; ++k, src += 64)
+        {
+            std::uint64_t w = 0;
+            for (unsigned b = 0; b < 64; ++b)
+                w |= std::uint64_t(src[b].has_value()) << b;
+            words[k] = w;
+        }
+        for (std::size_t i = full * 64; i < in.size(); ++i)
+        {
+            if (in[i].has_value())
+                detail::bit_set(words, i);
+        }
+        return result;
+    }
+
+    namespace detail
+    {
+        // Invokes fn(i) for the index of every set bit of 'bits' (every clear bit if 'Invert'
+        // is true). The bits are found with a count trailing zeros loop, so the cost only
+        // depends on the number of bits that are visited.
+        template<bool Invert, class Fn>
+        void for_each_bit(bitmap_view bits, Fn fn)
+        {
+            for (std::size_t k = 0; k < bits.word_count(); ++k)
+            {
+                std::uint64_t w = Invert ? ~bits.word(k) : bits.word(k);
+                if (Invert && bits.size() - k * 64 < 64)
+                    w &= low_bits(bits.size() - k * 64);
+
+                while (w != 0)
+                {
+                    fn(k * 64 + countr_zero64(w));
+                    w &= w - 1;
+                }
+            }
+        }
+
+        template<class T>
+        struct reset_at
+        {
+            optional<T>* data;
+
+            void operator()(std::size_t i) const noexcept
+            {
+                data[i].reset();
+            }
+        };
+
+        template<class T>
+        struct destroy_at
+        {
+            optional<T>* data;
+
+            void operator()(std::size_t i) const noexcept
+            {
+                using optional_type = optional<T>;
+                assert(data[i].has_value());
+                data[i].~optional_type();
+            }
+        };
+
+        // Whether destroy_engaged has to visit the engaged elements. optional<T> always has a
+        // user-provided destructor, so this depends on T alone.
+        template<class T>
+        struct destroy_engaged_visits : std::integral_constant<bool, !std::is_trivially_destructible<T>::value> {};
+    } // namespace detail
+
+    // Resets the elements of 'data' whose bit in 'validity' is not set.
+    // Only the elements that have to be reset are visited.
+    template<class T>
+    void apply_validity(bitmap_view validity, span<optional<T>> data)
+    {
+        assert(validity.size() == data.size());
+        detail::for_each_bit<true>(validity, detail::reset_at<T>{ data.data() });
+    }
+
+    // Resets all elements of 'data', given a bitmap of the engaged elements.
+    // Only the engaged elements are visited, so the cache lines of disengaged
+    // elements are never touched.
+    template<class T>
+    void reset_all(span<optional<T>> data, bitmap_view engaged)
+    {
+        assert(engaged.size() == data.size());
+        detail::for_each_bit<false>(engaged, detail::reset_at<T>{ data.data() });
+    }
+
+    // Ends the lifetime of the elements of 'data', given a bitmap of the engaged elements.
+    // Only the engaged elements are destroyed because destroying a disengaged optional
+    // does nothing. Nothing is visited at all if T is trivially destructible.
+    // Only for optionals that were constructed in raw storage (such as the columns of a
+    // structure of arrays) and are not destroyed by anything else: the elements must not
+    // be used or destroyed again afterwards. Never use it on the elements of a container
+    // such as std::vector, which destroys them again; use reset_all for those.
+    template<class T>
+    void destroy_engaged(span<optional<T>> data, bitmap_view engaged)
+    {
+        assert(engaged.size() == data.size());
+        if (!detail::destroy_engaged_visits<T>::value)
+            return;
+
+        detail::for_each_bit<false>(engaged, detail::destroy_at<T>{ data.data() });
+    }
+
+    // Describes a sentinel encoded array: missing values are stored as 'value'.
+    // If 'value' is a NaN, every NaN is treated as missing.
+    template<class T>
+    struct sentinel_encoding
+    {
+        static_assert(std::is_arithmetic<T>::value, "Sentinel encoding requires an arithmetic type.");
+
+        T value;
+
+        bool is_missing(T x) const noexcept
+        {
+            // Written with non-short-circuit operators so it stays branch-free.
+            return (x == value) | ((x != x) & (value != value));
+        }
+    };
+
+    template<class T>
+    constexpr sentinel_encoding<T> make_sentinel(T value) noexcept
+    {
+        return sentinel_encoding<T>{ value };
+    }
+
+    // The usual sentinel: the lowest value for integers, NaN for floating point types.
+    template<class T>
+    constexpr sentinel_encoding<T> default_sentinel() noexcept
+    {
+        return sentinel_encoding<T>{ std::numeric_limits<T>::has_quiet_NaN
+            ? std::numeric_limits<T>::quiet_NaN()
+            : std::numeric_limits<T>::lowest() };
+    }
+
+    namespace detail
+    {
+        template<class T>
+        using enable_if_transcodable_t = traits::enable_if_t<std::is_arithmetic<T>::value>;
+
+        // Reads one validity bit for each of the first 'count' elements of 'get'.
+        // Writes the bits of full words at once so the loops have no branches.
+        template<class IsValid>
+        void pack_bits(std::size_t count, std::uint64_t* validity, IsValid is_valid)
+        {
+            const std::size_t full = count / 64;
+            for (std::size_t k = 0; k < full; ++k)
+            {
+                std::uint64_t w = 0;
+                for (unsigned b = 0; b < 64; ++b)
+                    w |= std::uint64_t(is_valid(k * 64 + b)) << b;
+                validity[k] = w;
+            }
+            if (count % 64 != 0)
+            {
+                std::uint64_t w = 0;
+                for (std::size_t i = full * 64; i < count; ++i)
+                    w |= std::uint64_t(is_valid(i)) << (i % 64);
+                validity[full] = w;
+            }
+        }
+
+        // optional -> value + bit. Missing values are written as T().
+        template<class T>
+        struct from_optional
+        {
+            const optional<T>* in;
+            T* values;
+
+            bool operator()(std::size_t i) const noexcept
+            {
+                const bool valid = in[i].has_value();
+                const T candidates[2] = { T(), optional_access::raw_value(in[i]) };
+                values[i] = candidates[valid];
+                return valid;
+            }
+        };
+
+        // sentinel -> value + bit. Missing values are written as T().
+        // 'values' may be the same array as 'in'.
+        template<class T>
+        struct from_sentinel
+        {
+            const T* in;
+            T* values;
+            sentinel_encoding<T> encoding;
+
+            bool operator()(std::size_t i) const noexcept
+            {
+                const T x = in[i];
+                const bool valid = !encoding.is_missing(x);
+                const T candidates[2] = { T(), x };
+                values[i] = candidates[valid];
+                return valid;
+            }
+        };
+
+        // Vectorized kernels for the transcode functions. Each one converts the leading part
+        // of the input (whole 64-bit words of the bitmap, or whole vectors if there is no
+        // bitmap), returns the number of values that were converted, and the caller converts
+        // the rest. With AVX2 there are kernels for integers of 4 or 8 bytes, float and double
+        // in all six directions; without AVX2, or for other types, nothing is converted here.
+        template<class T>
+        struct simd_transcodable : std::integral_constant<bool,
+            (std::is_integral<T>::value && !std::is_same<T, bool>::value && (sizeof(T) == 4 || sizeof(T) == 8)) ||
+            std::is_same<T, float>::value || std::is_same<T, double>::value>
+        {
+        };
+
+        template<class T, bool Vectorized = simd_transcodable<T>::value>
+        struct transcode_simd
+        {
+            static std::size_t optional_to_bitmap(const optional<T>*, T*, std::uint64_t*, std::size_t) noexcept { return 0; }
+            static std::size_t bitmap_to_optional(const T*, bitmap_view, optional<T>*) noexcept { return 0; }
+            static std::size_t optional_to_sentinel(const optional<T>*, T*, std::size_t, sentinel_encoding<T>) noexcept { return 0; }
+            static std::size_t sentinel_to_optional(const T*, optional<T>*, std::size_t, sentinel_encoding<T>) noexcept { return 0; }
+            static std::size_t sentinel_to_bitmap(const T*, T*, std::uint64_t*, std::size_t, sentinel_encoding<T>) noexcept { return 0; }
+            static std::size_t bitmap_to_sentinel(const T*, bitmap_view, T*, sentinel_encoding<T>) noexcept { return 0; }
+        };
+
+#if defined(__AVX2__)
+        // The lanes of T in a __m256i. Masks have all bits of a lane set for valid values.
+        //
+        // An optional<T> of these types is { bool, padding, T } with the value at offset
+        // sizeof(T), so 8 (or 4) optionals are two vectors of alternating flag and value
+        // lanes (see also optional_distance.hpp). The padding bytes are not initialized;
+        // only the low byte of a flag lane is read and whole flag lanes are written.
+        template<class T, std::size_t Size = sizeof(T)>
+        struct avx2_lanes;
+
+        template<class T>
+        struct avx2_lanes<T, 4>
+        {
+            static constexpr unsigned count = 8;
+
+            static __m256i set1(T x) noexcept
+            {
+                std::int32_t bits;
+                std::memcpy(&bits, &x, sizeof(T));
+                return _mm256_set1_epi32(bits);
+            }
+
+            static __m256i equal(__m256i a, __m256i b) noexcept { return _mm256_cmpeq_epi32(a, b); }
+
+            static unsigned bits(__m256i mask) noexcept { return static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(mask))); }
+
+            // Expands the low 8 validity bits to a mask.
+            static __m256i from_bits(std::uint64_t bits) noexcept
+            {
+                const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+                return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(static_cast<int>(bits & 0xff)), lane_bits), lane_bits);
+            }
+
+            static __m256i load_optionals(const optional<T>* p, __m256i& valid) noexcept
+            {
+                static_assert(sizeof(optional<T>) == 2 * sizeof(T), "The kernels assume optional<T> is { bool, padding, T }.");
+                const __m256 lo = _mm256_loadu_ps(reinterpret_cast<const float*>(p));
+                const __m256 hi = _mm256_loadu_ps(reinterpret_cast<const float*>(p) + 8);
+                // The shuffles work within 128-bit lanes; permute4x64 restores the order.
+                const __m256d values = _mm256_castps_pd(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+                const __m256d flags = _mm256_castps_pd(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+                const __m256i flag_bytes = _mm256_and_si256(_mm256_castpd_si256(_mm256_permute4x64_pd(flags, _MM_SHUFFLE(3, 1, 2, 0))), _mm256_set1_epi32(0xff));
+                valid = _mm256_cmpgt_epi32(flag_bytes, _mm256_setzero_si256());
+                return _mm256_castpd_si256(_mm256_permute4x64_pd(values, _MM_SHUFFLE(3, 1, 2, 0)));
+            }
+
+            static void store_optionals(optional<T>* p, __m256i values, __m256i valid) noexcept
+            {
+                static_assert(sizeof(optional<T>) == 2 * sizeof(T), "The kernels assume optional<T> is { bool, padding, T }.");
+                const __m256i flags = _mm256_and_si256(valid, _mm256_set1_epi32(1));
+                const __m256i a = _mm256_unpacklo_epi32(flags, values);   // f0 v0 f1 v1 | f4 v4 f5 v5
+                const __m256i b = _mm256_unpackhi_epi32(flags, values);   // f2 v2 f3 v3 | f6 v6 f7 v7
+                __m256i* out = reinterpret_cast<__m256i*>(p);
+                _mm256_storeu_si256(out, _mm256_permute2x128_si256(a, b, 0x20));
+                _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(a, b, 0x31));
+            }
+        };
+
+        template<class T>
+        struct avx2_lanes<T, 8>
+        {
+            static constexpr unsigned count = 4;
+
+            static __m256i set1(T x) noexcept
+            {
+                std::int64_t bits;
+                std::memcpy(&bits, &x, sizeof(T));
+                return _mm256_set1_epi64x(bits);
+            }
+
+            static __m256i equal(__m256i a, __m256i b) noexcept { return _mm256_cmpeq_epi64(a, b); }
+
+            static unsigned bits(__m256i mask) noexcept { return static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(mask))); }
+
+            // Expands the low 4 validity bits to a mask.
+            static __m256i from_bits(std::uint64_t bits) noexcept
+            {
+                const __m256i lane_bits = _mm256_setr_epi64x(1, 2, 4, 8);
+                return _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_set1_epi64x(static_cast<long long>(bits & 0xf)), lane_bits), lane_bits);
+            }
+
+            static __m256i load_optionals(const optional<T>* p, __m256i& valid) noexcept
+            {
+                static_assert(sizeof(optional<T>) == 2 * sizeof(T), "The kernels assume optional<T> is { bool, padding, T }.");
+                const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));       // f0 v0 | f1 v1
+                const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 2));   // f2 v2 | f3 v3
+                const __m256i values = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+                const __m256i flags = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+                valid = _mm256_cmpgt_epi64(_mm256_and_si256(flags, _mm256_set1_epi64x(0xff)), _mm256_setzero_si256());
+                return values;
+            }
+
+            static void store_optionals(optional<T>* p, __m256i values, __m256i valid) noexcept
+            {
+                static_assert(sizeof(optional<T>) == 2 * sizeof(T), "The kernels assume optional<T> is { bool, padding, T }.");
+                const __m256i flags = _mm256_and_si256(valid, _mm256_set1_epi64x(1));
+                const __m256i a = _mm256_unpacklo_epi64(flags, values);   // f0 v0 | f2 v2
+                const __m256i b = _mm256_unpackhi_epi64(flags, values);   // f1 v1 | f3 v3
+                __m256i* out = reinterpret_cast<__m256i*>(p);
+                _mm256_storeu_si256(out, _mm256_permute2x128_si256(a, b, 0x20));
+                _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(a, b, 0x31));
+            }
+        };
+
+        // The missing lanes of 'x'. Any NaN is missing if the sentinel is NaN.
+        template<class T>
+        __m256i missing_lanes(__m256i x, __m256i sentinel, sentinel_encoding<T>) noexcept
+        {
+            return avx2_lanes<T>::equal(x, sentinel);
+        }
+
+        inline __m256i missing_lanes(__m256i x, __m256i sentinel, sentinel_encoding<float> encoding) noexcept
+        {
+            const __m256 v = _mm256_castsi256_ps(x);
+            return _mm256_castps_si256(encoding.value != encoding.value
+                ? _mm256_cmp_ps(v, v, _CMP_UNORD_Q)
+                : _mm256_cmp_ps(v, _mm256_castsi256_ps(sentinel), _CMP_EQ_OQ));
+        }
+
+        inline __m256i missing_lanes(__m256i x, __m256i sentinel, sentinel_encoding<double> encoding) noexcept
+        {
+            const __m256d v = _mm256_castsi256_pd(x);
+            return _mm256_castpd_si256(encoding.value != encoding.value
+                ? _mm256_cmp_pd(v, v, _CMP_UNORD_Q)
+                : _mm256_cmp_pd(v, _mm256_castsi256_pd(sentinel), _CMP_EQ_OQ));
+        }
+
+        template<class T>
+        struct transcode_simd<T, true>
+        {
+            using lanes = avx2_lanes<T>;
+
+            static __m256i load(const T* p) noexcept { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+            static void store(T* p, __m256i x) noexcept { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), x); }
+
+            static std::size_t optional_to_bitmap(const optional<T>* in, T* values, std::uint64_t* validity, std::size_t count) noexcept
+            {
+                for (std::size_t k = 0; k < count / 64; ++k)
+                {
+                    std::uint64_t w = 0;
+                    for (unsigned b = 0; b < 64; b += lanes::count)
+                    {
+                        __m256i valid;
+                        const __m256i x = lanes::load_optionals(in + k * 64 + b, valid);
+                        store(values + k * 64 + b, _mm256_and_si256(x, valid));
+                        w |= std::uint64_t(lanes::bits(valid)) << b;
+                    }
+                    validity[k] = w;
+                }
+                return count / 64 * 64;
+            }
+
+            static std::size_t bitmap_to_optional(const T* values, bitmap_view validity, optional<T>* out) noexcept
+            {
+                const std::size_t full = validity.size() / 64;
+                for (std::size_t k = 0; k < full; ++k)
+                {
+                    const std::uint64_t w = validity.word(k);
+                    for (unsigned b = 0; b < 64; b += lanes::count)
+                        lanes::store_optionals(out + k * 64 + b, load(values + k * 64 + b), lanes::from_bits(w >> b));
+                }
+                return full * 64;
+            }
+
+            static std::size_t optional_to_sentinel(const optional<T>* in, T* out, std::size_t count, sentinel_encoding<T> encoding) noexcept
+            {
+                const __m256i sentinel = lanes::set1(encoding.value);
+                const std::size_t full = count / lanes::count * lanes::count;
+                for (std::size_t i = 0; i < full; i += lanes::count)
+                {
+                    __m256i valid;
+                    const __m256i x = lanes::load_optionals(in + i, valid);
+                    store(out + i, _mm256_blendv_epi8(sentinel, x, valid));
+                }
+                return full;
+            }
+
+            static std::size_t sentinel_to_optional(const T* in, optional<T>* out, std::size_t count, sentinel_encoding<T> encoding) noexcept
+            {
+                const __m256i sentinel = lanes::set1(encoding.value);
+                const __m256i ones = _mm256_set1_epi32(-1);
+                const std::size_t full = count / lanes::count * lanes::count;
+                for (std::size_t i = 0; i < full; i += lanes::count)
+                {
+                    const __m256i x = load(in + i);
+                    lanes::store_optionals(out + i, x, _mm256_xor_si256(missing_lanes(x, sentinel, encoding), ones));
+                }
+                return full;
+            }
+
+            static std::size_t sentinel_to_bitmap(const T* in, T* values, std::uint64_t* validity, std::size_t count, sentinel_encoding<T> encoding) noexcept
+            {
+                const __m256i sentinel = lanes::set1(encoding.value);
+                const unsigned all = (1u << lanes::count) - 1;
+                for (std::size_t k = 0; k < count / 64; ++k)
+                {
+                    std::uint64_t w = 0;
+                    for (unsigned b = 0; b < 64; b += lanes::count)
+                    {
+                        const __m256i x = load(in + k * 64 + b);
+                        const __m256i missing = missing_lanes(x, sentinel, encoding);
+                        store(values + k * 64 + b, _mm256_andnot_si256(missing, x));
+                        w |= std::uint64_t(~lanes::bits(missing) & all) << b;
+                    }
+                    validity[k] = w;
+                }
+                return count / 64 * 64;
+            }
+
+            static std::size_t bitmap_to_sentinel(const T* values, bitmap_view validity, T* out, sentinel_encoding<T> encoding) noexcept
+            {
+                const __m256i sentinel = lanes::set1(encoding.value);
+                const std::size_t full = validity.size() / 64;
+                for (std::size_t k = 0; k < full; ++k)
+                {
+                    const std::uint64_t w = validity.word(k);
+                    for (unsigned b = 0; b < 64; b += lanes::count)
+                        store(out + k * 64 + b, _mm256_blendv_epi8(sentinel, load(values + k * 64 + b), lanes::from_bits(w >> b)));
+                }
+                return full * 64;
+            }
+        };
+
+        template<class T>
+        constexpr unsigned avx2_lanes<T, 4>::count;
+
+        template<class T>
+        constexpr unsigned avx2_lanes<T, 8>::count;
+#endif
+
+        // values + bitmap -> sentinel. 'out' may be the same array as 'values'.
+        template<class T>
+        void to_sentinel_impl(const T* values, bitmap_view validity, T* out, sentinel_encoding<T> encoding)
+        {
+            for (std::size_t k = transcode_simd<T>::bitmap_to_sentinel(values, validity, out, encoding) / 64; k < validity.word_count(); ++k)
+            {
+                const std::uint64_t w = validity.word(k);
+                const std::size_t count = std::min<std::size_t>(64, validity.size() - k * 64);
+                for (std::size_t b = 0; b < count; ++b)
+                {
+                    const T candidates[2] = { encoding.value, values[k * 64 + b] };
+                    out[k * 64 + b] = candidates[(w >> b) & 1];
+                }
+            }
+        }
+    } // namespace detail
+
+    // Array of optionals -> values + validity bitmap.
+    // 'validity' must have room for (in.size() + 63) / 64 words.
+    // The values of disengaged elements are written as T().
+    template<class T>
+    detail::enable_if_transcodable_t<T> transcode(span<const optional<T>> in, span<T> values, std::uint64_t* validity)
+    {
+        assert(values.size() == in.size());
+        const std::size_t done = detail::transcode_simd<T>::optional_to_bitmap(in.data(), values.data(), validity, in.size());
+        detail::pack_bits(in.size() - done, validity + done / 64, detail::from_optional<T>{ in.data() + done, values.data() + done });
+    }
+
+    // Values + validity bitmap -> array of optionals.
+    template<class T>
+    detail::enable_if_transcodable_t<T> transcode(span<const T> values, bitmap_view validity, span<optional<T>> out)
+    {
+        assert(validity.size() == values.size() && out.size() == values.size());
+        for (std::size_t k = detail::transcode_simd<T>::bitmap_to_optional(values.data(), validity, out.data()) / 64; k < validity.word_count(); ++k)
+        {
+            const std::uint64_t w = validity.word(k);
+            const std::size_t count = std::min<std::size_t>(64, values.size() - k * 64);
+            for (std::size_t b = 0; b < count; ++b)
+                out[k * 64 + b] = optional<T>(((w >> b) & 1) != 0, T(values[k * 64 + b]));
+        }
+    }
+
+    // Array of optionals -> sentinel encoded values.
+    template<class T>
+    detail::enable_if_transcodable_t<T> transcode(span<const optional<T>> in, span<T> out, sentinel_encoding<T> encoding)
+    {
+        assert(out.size() == in.size());
+        for (std::size_t i = detail::transcode_simd<T>::optional_to_sentinel(in.data(), out.data(), in.size(), encoding); i < in.size(); ++i)
+        {
+            const T candidates[2] = { encoding.value, detail::optional_access::raw_value(in[i]) };
+            out[i] = candidates[in[i].has_value()];
+        }
+    }
+
+    // Sentinel encoded values -> array of optionals.
+    template<class T>
+    detail::enable_if_transcodable_t<T> transcode(span<const T> in, sentinel_encoding<T> encoding, span<optional<T>> out)
+    {
+        assert(out.size() == in.size());
+        for (std::size_t i = detail::transcode_simd<T>::sentinel_to_optional(in.data(), out.data(), in.size(), encoding); i < in.size(); ++i)
+            out[i] = optional<T>(!encoding.is_missing(in[i]), T(in[i]));
+    }
+
+    // Sentinel encoded values -> values + validity bitmap.
+    // 'validity' must have room for (in.size() + 63) / 64 words.
+    // The values of missing elements are written as T(). 'values' may be the same array as 'in'.
+    template<class T>
+    detail::enable_if_transcodable_t<T> transcode(span<const T> in, sentinel_encoding<T> encoding, span<T> values, std::uint64_t* validity)
+    {
+        assert(values.size() == in.size());
+        const std::size_t done = detail::transcode_simd<T>::sentinel_to_bitmap(in.data(), values.data(), validity, in.size(), encoding);
+        detail::pack_bits(in.size() - done, validity + done / 64, detail::from_sentinel<T>{ in.data() + done, values.data() + done, encoding });
+    }
+
+    // Values + validity bitmap -> sentinel encoded values. 'out' may be the same array as 'values'.
+    template<class T>
+    detail::enable_if_transcodable_t<T> transcode(span<const T> values, bitmap_view validity, span<T> out, sentinel_encoding<T> encoding)
+    {
+        assert(validity.size() == values.size() && out.size() == values.size());
+        detail::to_sentinel_impl(values.data(), validity, out.data(), encoding);
+    }
+
+    // Converts streams that don't fit in memory block by block, using only the
+    // buffers that are passed to the constructor (no memory is allocated).
+    //
+    // decode: sentinel encoded blocks -> values + validity bitmap blocks.
+    //   read(span<T> block) fills (part of) the block and returns the number of values read (0 at the end).
+    //   write(span<const T> values, bitmap_view validity) consumes a converted block.
+    // encode: values + validity bitmap blocks -> sentinel encoded blocks.
+    //   read(span<T> values, std::uint64_t* validity) fills (part of) the blocks and returns the number of values read (0 at the end).
+    //   write(span<const T> values) consumes a converted block.
+    //
+    // Both return the total number of values that were converted.
+    template<class T>
+    class block_transcoder
+    {
+    public:
+        // 'validity' must have room for (buffer.size() + 63) / 64 words.
+        block_transcoder(span<T> buffer, std::uint64_t* validity, sentinel_encoding<T> encoding = default_sentinel<T>()) noexcept
+            : m_buffer(buffer)
+            , m_validity(validity)
+            , m_encoding(encoding)
+        {
+            assert(!buffer.empty());
+        }
+
+        template<class Read, class Write>
+        std::size_t decode(Read read, Write write)
+        {
+            std::size_t total = 0;
+            while (std::size_t count = read(m_buffer))
+            {
+                assert(count <= m_buffer.size());
+                const span<T> block = m_buffer.first(count);
+                transcode(span<const T>(block), m_encoding, block, m_validity);
+                write(span<const T>(block), bitmap_view(m_validity, count));
+                total += count;
+            }
+            return total;
+        }
+
+        template<class Read, class Write>
+        std::size_t encode(Read read, Write write)
+        {
+            std::size_t total = 0;
+            while (std::size_t count = read(m_buffer, m_validity))
+            {
+                assert(count <= m_buffer.size());
+                const span<T> block = m_buffer.first(count);
+                transcode(span<const T>(block), bitmap_view(m_validity, count), block, m_encoding);
+                write(span<const T>(block));
+                total += count;
+            }
+            return total;
+        }
+
+    private:
+        span<T> m_buffer;
+        std::uint64_t* m_validity;
+        sentinel_encoding<T> m_encoding;
+    };
+} // namespace opt
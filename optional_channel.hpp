@@ -0,0 +1,749 @@
+#pragma once
+
+//          Copyright Jeremiah van Oosten 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+ /**
+  *  @file optional_channel.hpp
+  *  @date October 16, 2026
+  *  @author Jeremiah van Oosten
+  *
+  *  @brief Channels that pass values between threads and return opt::optional.
+  *
+  *  opt::oneshot passes a single value (or no value) from a sender to a receiver.
+  *  The value is stored in an opt::optional inside the channel, next to a 32 bit
+  *  state word that the receiver waits on (see opt::detail::futex_wait).
+  *
+  *  opt::spsc_queue and opt::mpmc_queue are bounded lock-free ring buffers. Their
+  *  cells are uninitialized storage (like the storage of an opt::optional), so T
+  *  doesn't need a default constructor, and try_pop returns an opt::optional<T>.
+  */
+
+#include "optional_atomic.hpp"
+
+#include <algorithm>        // for std::min
+#include <atomic>
+#include <cassert>          // for assert
+#include <cstddef>          // for std::size_t
+#include <cstdint>          // for std::uint32_t
+#include <memory>           // for std::unique_ptr
+#include <new>              // for placement new
+#include <type_traits>
+#include <utility>          // for std::move, std::forward, std::pair
+
+namespace opt
+{
+    template<class T> class oneshot_sender;
+    template<class T> class oneshot_receiver;
+
+    // The shared state of a channel that passes a single value from a sender to a receiver.
+    // make() allocates a channel that is destroyed with its last endpoint. A oneshot can
+    // also be embedded in another object (intrusive mode): sender() and receiver() return
+    // endpoints that don't own it, so it must outlive them. reset() prepares it for reuse.
+    template<class T>
+    class oneshot
+    {
+        // The states of m_state.
+        static constexpr std::uint32_t empty = 0;
+        static constexpr std::uint32_t waiting = 1;     // The receiver sleeps on m_state.
+        static constexpr std::uint32_t ready = 2;
+        static constexpr std::uint32_t closed = 3;      // The sender was destroyed without sending.
+        static constexpr std::uint32_t received = 4;
+
+    public:
+        using value_type = T;
+
+        oneshot() noexcept
+            : m_state(empty)
+            , m_references(0)
+            , m_destroy(nullptr)
+        {}
+
+        oneshot(const oneshot&) = delete;
+        oneshot& operator=(const oneshot&) = delete;
+
+        // Allocates a channel and returns its endpoints.
+        static std::pair<oneshot_sender<T>, oneshot_receiver<T>> make()
+        {
+            oneshot* channel = new oneshot();
+            channel->m_references.store(2, std::memory_order_relaxed);
+            channel->m_destroy = &destroy;
+            return std::pair<oneshot_sender<T>, oneshot_receiver<T>>(oneshot_sender<T>(channel), oneshot_receiver<T>(channel));
+        }
+
+        // Intrusive mode: endpoints that don't own the channel.
+        // Each channel has a single sender and a single receiver.
+        oneshot_sender<T> sender() noexcept
+        {
+            return oneshot_sender<T>(this);
+        }
+
+        oneshot_receiver<T> receiver() noexcept
+        {
+            return oneshot_receiver<T>(this);
+        }
+
+        // Intrusive mode: empties the channel so that it can be used again. Must not be
+        // called while a sender or receiver of the channel exists.
+        void reset() noexcept
+        {
+            m_value.reset();
+            m_state.store(empty, std::memory_order_relaxed);
+        }
+
+    private:
+        friend class oneshot_sender<T>;
+        friend class oneshot_receiver<T>;
+
+        // Sends T(args...) and releases the sender's reference.
+        template<class... Args>
+        void send(Args&&... args)
+        {
+            assert(m_state.load(std::memory_order_relaxed) <= waiting && "A oneshot can only send one value.");
+            m_value.emplace(std::forward<Args>(args)...);
+            publish(ready);
+        }
+
+        // Closes the channel and releases the sender's reference.
+        void close() noexcept
+        {
+            publish(closed);
+        }
+
+        // Once the state is published, the receiver may destroy an intrusive channel,
+        // so the channel is not touched afterwards (except by the futex wake up, which
+        // tolerates a stale address, and the release of an allocated channel).
+        void publish(std::uint32_t state) noexcept
+        {
+            void (*destroy)(oneshot*) = m_destroy;
+            if (m_state.exchange(state, std::memory_order_release) == waiting)
+                detail::futex_wake_all(m_state);
+            if (destroy)
+                release(destroy);
+        }
+
+        // Takes the value if it has been sent. 'state' is the current state.
+        optional<T> receive(std::uint32_t state)
+        {
+            if (state != ready)
+                return optional<T>();
+
+            optional<T> value(std::move(m_value));
+            m_value.reset();
+            m_state.store(received, std::memory_order_relaxed);
+            return value;
+        }
+
+        optional<T> try_receive()
+        {
+            return receive(m_state.load(std::memory_order_acquire));
+        }
+
+        optional<T> wait()
+        {
+            for (;;)
+            {
+                std::uint32_t state = m_state.load(std::memory_order_acquire);
+                if (state >= ready)
+                    return receive(state);
+
+                if (state == empty && !m_state.compare_exchange_strong(state, waiting, std::memory_order_acquire))
+                    continue;
+                detail::futex_wait(m_state, waiting);
+            }
+        }
+
+        bool is_ready() const noexcept
+        {
+            return m_state.load(std::memory_order_acquire) == ready;
+        }
+
+        bool is_closed() const noexcept
+        {
+            return m_state.load(std::memory_order_acquire) >= closed;
+        }
+
+        // Releases a reference to an allocated channel.
+        void release(void (*destroy)(oneshot*)) noexcept
+        {
+            if (m_references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                destroy(this);
+        }
+
+        // Releases the receiver's reference.
+        void detach_receiver() noexcept
+        {
+            if (m_destroy)
+                release(m_destroy);
+        }
+
+        static void destroy(oneshot* channel) noexcept
+        {
+            delete channel;
+        }
+
+        std::atomic<std::uint32_t> m_state;
+        std::atomic<std::uint32_t> m_references;
+        void (*m_destroy)(oneshot*);     // Deletes an allocated channel (null in intrusive mode).
+        optional<T> m_value;
+    };
+
+    template<class T>
+    constexpr std::uint32_t oneshot<T>::empty;
+
+    template<class T>
+    constexpr std::uint32_t oneshot<T>::waiting;
+
+    template<class T>
+    constexpr std::uint32_t oneshot<T>::ready;
+
+    template<class T>
+    constexpr std::uint32_t oneshot<T>::closed;
+
+    template<class T>
+    constexpr std::uint32_t oneshot<T>::received;
+
+    // The sending end of a oneshot. Destroying it without sending closes the channel
+    // (the receiver gets nullopt).
+    template<class T>
+    class oneshot_sender
+    {
+    public:
+        oneshot_sender() noexcept
+            : m_channel(nullptr)
+        {}
+
+        oneshot_sender(oneshot_sender&& other) noexcept
+            : m_channel(other.m_channel)
+        {
+            other.m_channel = nullptr;
+        }
+
+        oneshot_sender& operator=(oneshot_sender&& other) noexcept
+        {
+            if (this != &other)
+            {
+                detach();
+                m_channel = other.m_channel;
+                other.m_channel = nullptr;
+            }
+            return *this;
+        }
+
+        ~oneshot_sender()
+        {
+            detach();
+        }
+
+        // Sends T(args...) and detaches the sender from the channel. If T's constructor
+        // throws, nothing is sent and the sender stays attached.
+        template<class... Args>
+        void send(Args&&... args)
+        {
+            assert(m_channel && "The sender has no channel.");
+            m_channel->send(std::forward<Args>(args)...);
+            m_channel = nullptr;
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return m_channel != nullptr;
+        }
+
+    private:
+        friend class oneshot<T>;
+
+        explicit oneshot_sender(oneshot<T>* channel) noexcept
+            : m_channel(channel)
+        {}
+
+        void detach() noexcept
+        {
+            if (m_channel)
+            {
+                m_channel->close();
+                m_channel = nullptr;
+            }
+        }
+
+        oneshot<T>* m_channel;
+    };
+
+    // The receiving end of a oneshot.
+    template<class T>
+    class oneshot_receiver
+    {
+    public:
+        oneshot_receiver() noexcept
+            : m_channel(nullptr)
+        {}
+
+        oneshot_receiver(oneshot_receiver&& other) noexcept
+            : m_channel(other.m_channel)
+        {
+            other.m_channel = nullptr;
+        }
+
+        oneshot_receiver& operator=(oneshot_receiver&& other) noexcept
+        {
+            if (this != &other)
+            {
+                detach();
+                m_channel = other.m_channel;
+                other.m_channel = nullptr;
+            }
+            return *this;
+        }
+
+        ~oneshot_receiver()
+        {
+            detach();
+        }
+
+        // Returns the value if it has been sent (and not received before) without blocking.
+        optional<T> try_get()
+        {
+            assert(m_channel && "The receiver has no channel.");
+            return m_channel->try_receive();
+        }
+
+        // Blocks until the value is sent or the sender is destroyed and returns the value
+        // (or nullopt if the channel was closed without a value or the value was received before).
+        optional<T> wait()
+        {
+            assert(m_channel && "The receiver has no channel.");
+            return m_channel->wait();
+        }
+
+        // Whether the value has been sent and can be received.
+        bool ready() const noexcept
+        {
+            return m_channel && m_channel->is_ready();
+        }
+
+        // Whether no value will arrive anymore (it has been received or the sender is gone).
+        bool closed() const noexcept
+        {
+            return !m_channel || m_channel->is_closed();
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return m_channel != nullptr;
+        }
+
+    private:
+        friend class oneshot<T>;
+
+        explicit oneshot_receiver(oneshot<T>* channel) noexcept
+            : m_channel(channel)
+        {}
+
+        void detach() noexcept
+        {
+            if (m_channel)
+            {
+                m_channel->detach_receiver();
+                m_channel = nullptr;
+            }
+        }
+
+        oneshot<T>* m_channel;
+    };
+
+    namespace detail
+    {
+        // Assumed size of a cache line (like opt::par::cache_line_size). The indices of the
+        // queues are separated by padding of this size so that the producers and consumers
+        // don't invalidate each other's cache lines.
+        OPT_INLINE_VAR std::size_t queue_padding = 64;
+
+        inline std::size_t queue_capacity(std::size_t capacity) noexcept
+        {
+            std::size_t c = 2;
+            while (c < capacity)
+                c *= 2;
+            return c;
+        }
+
+        // Uninitialized storage for a T (the storage of an opt::optional without the flag).
+        template<class T>
+        struct queue_slot
+        {
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+            T* get() noexcept
+            {
+                return reinterpret_cast<T*>(&storage);
+            }
+
+            // Moves the value out of the slot and destroys it.
+            optional<T> take() noexcept(std::is_nothrow_move_constructible<T>::value)
+            {
+                optional<T> value(std::move(*get()));
+                get()->~T();
+                return value;
+            }
+        };
+    } // namespace detail
+
+    // A bounded lock-free queue for a single producer thread and a single consumer thread.
+    // The capacity is rounded up to a power of two. Each side keeps a cached copy of the
+    // other side's index and only reads the shared index when the cached one says the
+    // queue is full (or empty). The batch operations publish their index once per batch.
+    template<class T>
+    class spsc_queue
+    {
+    public:
+        using value_type = T;
+
+        explicit spsc_queue(std::size_t capacity)
+            : m_mask(detail::queue_capacity(capacity) - 1)
+            , m_slots(new detail::queue_slot<T>[m_mask + 1])
+            , m_head(0)
+            , m_tail_cache(0)
+            , m_tail(0)
+            , m_head_cache(0)
+        {}
+
+        spsc_queue(const spsc_queue&) = delete;
+        spsc_queue& operator=(const spsc_queue&) = delete;
+
+        ~spsc_queue()
+        {
+            const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+            for (std::size_t i = m_head.load(std::memory_order_relaxed); i != tail; ++i)
+                m_slots[i & m_mask].get()->~T();
+        }
+
+        std::size_t capacity() const noexcept
+        {
+            return m_mask + 1;
+        }
+
+        // The number of values in the queue (only exact if neither side is active).
+        std::size_t size_approx() const noexcept
+        {
+            const std::size_t head = m_head.load(std::memory_order_acquire);
+            return m_tail.load(std::memory_order_acquire) - head;
+        }
+
+        // Producer: appends T(args...) unless the queue is full.
+        template<class... Args>
+        bool try_emplace(Args&&... args)
+        {
+            const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+            if (free_slots(tail, 1) == 0)
+                return false;
+
+            ::new (m_slots[tail & m_mask].get()) T(std::forward<Args>(args)...);
+            m_tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool try_push(T const& value)
+        {
+            return try_emplace(value);
+        }
+
+        bool try_push(T&& value)
+        {
+            return try_emplace(std::move(value));
+        }
+
+        // Producer: appends values from 'first' (up to 'count') and returns the number appended.
+        template<class InputIt>
+        std::size_t try_push_n(InputIt first, std::size_t count)
+        {
+            const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+            const std::size_t n = free_slots(tail, count);
+
+            std::size_t i = 0;
+            try
+            {
+                for (; i < n; ++i, ++first)
+                    ::new (m_slots[(tail + i) & m_mask].get()) T(*first);
+            }
+            catch (...)
+            {
+                // Publish the values that were constructed.
+                m_tail.store(tail + i, std::memory_order_release);
+                throw;
+            }
+            m_tail.store(tail + n, std::memory_order_release);
+            return n;
+        }
+
+        // Consumer: removes the value at the front of the queue (nullopt if the queue is empty).
+        optional<T> try_pop() noexcept(std::is_nothrow_move_constructible<T>::value)
+        {
+            const std::size_t head = m_head.load(std::memory_order_relaxed);
+            if (available(head, 1) == 0)
+                return optional<T>();
+
+            optional<T> value = m_slots[head & m_mask].take();
+            m_head.store(head + 1, std::memory_order_release);
+            return value;
+        }
+
+        // Consumer: moves up to 'count' values to 'out' and returns the number moved.
+        template<class OutputIt>
+        std::size_t try_pop_n(OutputIt out, std::size_t count)
+        {
+            const std::size_t head = m_head.load(std::memory_order_relaxed);
+            const std::size_t n = available(head, count);
+            std::size_t i = 0;
+            try
+            {
+                for (; i < n; ++i, ++out)
+                {
+                    T* value = m_slots[(head + i) & m_mask].get();
+                    *out = std::move(*value);
+                    value->~T();
+                }
+            }
+            catch (...)
+            {
+                // Remove the values that were moved out (and destroyed). The value whose
+                // assignment threw stays at the front of the queue.
+                m_head.store(head + i, std::memory_order_release);
+                throw;
+            }
+            m_head.store(head + n, std::memory_order_release);
+            return n;
+        }
+
+    private:
+        // The number of slots (up to 'count') that the producer can fill.
+        std::size_t free_slots(std::size_t tail, std::size_t count) noexcept
+        {
+            if (capacity() - (tail - m_head_cache) < count)
+                m_head_cache = m_head.load(std::memory_order_acquire);
+            return std::min(count, capacity() - (tail - m_head_cache));
+        }
+
+        // The number of values (up to 'count') that the consumer can take.
+        std::size_t available(std::size_t head, std::size_t count) noexcept
+        {
+            if (m_tail_cache - head < count)
+                m_tail_cache = m_tail.load(std::memory_order_acquire);
+            return std::min(count, m_tail_cache - head);
+        }
+
+        const std::size_t m_mask;
+        const std::unique_ptr<detail::queue_slot<T>[]> m_slots;
+        char m_padding0[detail::queue_padding];
+
+        // Written by the consumer.
+        std::atomic<std::size_t> m_head;
+        std::size_t m_tail_cache;
+        char m_padding1[detail::queue_padding];
+
+        // Written by the producer.
+        std::atomic<std::size_t> m_tail;
+        std::size_t m_head_cache;
+        char m_padding2[detail::queue_padding];
+    };
+
+    // A bounded lock-free queue for any number of producers and consumers (Vyukov's
+    // bounded MPMC queue). Each cell has a sequence number that says whether it is
+    // ready to be filled or emptied in the current lap of the ring; producers and
+    // consumers claim cells by advancing their index with a compare-and-swap. The
+    // batch operations claim a run of consecutive cells with a single compare-and-swap.
+    // T must be nothrow move constructible: values are constructed before a cell is
+    // claimed and moved into it, so that a claimed cell is always filled.
+    template<class T>
+    class mpmc_queue
+    {
+        static_assert(std::is_nothrow_move_constructible<T>::value, "opt::mpmc_queue requires a nothrow move constructible type.");
+
+        struct cell
+        {
+            std::atomic<std::size_t> sequence;
+            detail::queue_slot<T> slot;
+        };
+
+    public:
+        using value_type = T;
+
+        explicit mpmc_queue(std::size_t capacity)
+            : m_mask(detail::queue_capacity(capacity) - 1)
+            , m_cells(new cell[m_mask + 1])
+            , m_tail(0)
+            , m_head(0)
+        {
+            for (std::size_t i = 0; i <= m_mask; ++i)
+                m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        mpmc_queue(const mpmc_queue&) = delete;
+        mpmc_queue& operator=(const mpmc_queue&) = delete;
+
+        ~mpmc_queue()
+        {
+            while (try_pop())
+            {}
+        }
+
+        std::size_t capacity() const noexcept
+        {
+            return m_mask + 1;
+        }
+
+        // Appends T(args...) unless the queue is full. The value is constructed before the
+        // queue is checked, so rvalue arguments may be moved from even if it is full.
+        template<class... Args>
+        bool try_emplace(Args&&... args)
+        {
+            return try_push(T(std::forward<Args>(args)...));
+        }
+
+        bool try_push(T const& value)
+        {
+            return try_push(T(value));
+        }
+
+        bool try_push(T&& value) noexcept
+        {
+            std::size_t tail;
+            if (claim<0>(m_tail, 1, tail) == 0)
+                return false;
+            cell& c = m_cells[tail & m_mask];
+            ::new (c.slot.get()) T(std::move(value));
+            c.sequence.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Appends values from 'first' (up to 'count') and returns the number appended.
+        // If T can be constructed from *first without throwing, runs of cells are claimed
+        // with a single compare-and-swap and the values are constructed in place.
+        // Otherwise each value is constructed before its cell is claimed.
+        template<class InputIt>
+        std::size_t try_push_n(InputIt first, std::size_t count)
+        {
+            return push_n(first, count, std::is_nothrow_constructible<T, decltype(*first)>());
+        }
+
+        // Removes the value at the front of the queue (nullopt if the queue is empty).
+        optional<T> try_pop() noexcept
+        {
+            std::size_t head;
+            if (claim<1>(m_head, 1, head) == 0)
+                return optional<T>();
+            return take(head);
+        }
+
+        // Moves up to 'count' values to 'out' and returns the number moved. If an assignment
+        // to 'out' throws, the value being assigned and the rest of its batch are lost.
+        template<class OutputIt>
+        std::size_t try_pop_n(OutputIt out, std::size_t count)
+        {
+            std::size_t popped = 0;
+            while (popped < count)
+            {
+                std::size_t head;
+                const std::size_t n = claim<1>(m_head, count - popped, head);
+                if (n == 0)
+                    break;
+
+                std::size_t i = 0;
+                try
+                {
+                    for (; i < n; ++i, ++out)
+                        *out = std::move(*take(head + i));
+                }
+                catch (...)
+                {
+                    // The claimed cells can't be given back (other consumers may have claimed
+                    // later ones), so the rest of the run is dropped to free the cells.
+                    while (++i < n)
+                        take(head + i);
+                    throw;
+                }
+                popped += n;
+            }
+            return popped;
+        }
+
+    private:
+        template<class InputIt>
+        std::size_t push_n(InputIt first, std::size_t count, std::true_type) noexcept
+        {
+            std::size_t pushed = 0;
+            while (pushed < count)
+            {
+                std::size_t tail;
+                const std::size_t n = claim<0>(m_tail, count - pushed, tail);
+                if (n == 0)
+                    break;
+                for (std::size_t i = 0; i < n; ++i, ++first)
+                {
+                    cell& c = m_cells[(tail + i) & m_mask];
+                    ::new (c.slot.get()) T(*first);
+                    c.sequence.store(tail + i + 1, std::memory_order_release);
+                }
+                pushed += n;
+            }
+            return pushed;
+        }
+
+        template<class InputIt>
+        std::size_t push_n(InputIt first, std::size_t count, std::false_type)
+        {
+            std::size_t pushed = 0;
+            for (; pushed < count && try_push(T(*first)); ++pushed)
+                ++first;
+            return pushed;
+        }
+
+        // Claims up to 'count' consecutive cells at 'index' that are ready for producers
+        // (Lap = 0) or consumers (Lap = 1) and returns the number claimed (and in 'first'
+        // the index of the first one).
+        template<std::size_t Lap>
+        std::size_t claim(std::atomic<std::size_t>& index, std::size_t count, std::size_t& first) noexcept
+        {
+            first = index.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                std::size_t n = 0;
+                while (n < count && n <= m_mask
+                    && m_cells[(first + n) & m_mask].sequence.load(std::memory_order_acquire) == first + n + Lap)
+                    ++n;
+
+                if (n == 0)
+                {
+                    // The cell is not ready: the queue is full (empty), or 'first' is stale.
+                    const std::size_t current = index.load(std::memory_order_relaxed);
+                    if (current == first)
+                        return 0;
+                    first = current;
+                }
+                else if (index.compare_exchange_weak(first, first + n, std::memory_order_relaxed))
+                {
+                    return n;
+                }
+            }
+        }
+
+        // Takes the value of the claimed cell 'head' and frees the cell for the next lap.
+        optional<T> take(std::size_t head) noexcept
+        {
+            cell& c = m_cells[head & m_mask];
+            optional<T> value = c.slot.take();
+            c.sequence.store(head + m_mask + 1, std::memory_order_release);
+            return value;
+        }
+
+        const std::size_t m_mask;
+        const std::unique_ptr<cell[]> m_cells;
+        char m_padding0[detail::queue_padding];
+
+        std::atomic<std::size_t> m_tail;
+        char m_padding1[detail::queue_padding];
+
+        std::atomic<std::size_t> m_head;
+        char m_padding2[detail::queue_padding];
+    };
+} // namespace opt
@@ -0,0 +1,429 @@
+#pragma once
+
+//          Copyright Jeremiah van Oosten 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+ /**
+  *  @file optional_distance.hpp
+  *  @date October 16, 2026
+  *  @author Jeremiah van Oosten
+  *
+  *  @brief Masked similarity and distance kernels over vectors of opt::optional values.
+  *
+  *  Only the positions that are engaged in both vectors contribute to the result.
+  *  The result is disengaged if the vectors have no engaged position in common.
+  *
+  *  The kernels for float vectors use AVX-512 (if __AVX512F__ is defined) or
+  *  AVX2 and FMA (if __AVX2__ and __FMA__ are defined). The combined validity
+  *  mask of each block of values selects the lanes that are accumulated.
+  *  Otherwise a portable loop without data-dependent branches is used.
+  */
+
+#include "optional_bitmap.hpp"
+
+#include <cassert>          // for assert
+#include <cmath>            // for std::sqrt
+#include <cstddef>          // for std::size_t
+#include <cstdint>          // for std::uint64_t
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace opt
+{
+    namespace detail
+    {
+        enum class masked_op
+        {
+            dot,
+            l2,
+            cosine
+        };
+
+        // The sums that are accumulated by the masked kernels (only the ones that 'Op' needs).
+        template<class T>
+        struct masked_sums
+        {
+            T ab;       // Sum of a * b.
+            T aa;       // Sum of a * a.
+            T bb;       // Sum of b * b.
+            T dd;       // Sum of (a - b)^2.
+            bool any;   // Is any position engaged in both vectors?
+        };
+
+        template<masked_op Op, class T>
+        void masked_add(masked_sums<T>& sums, bool engaged, T a, T b) noexcept
+        {
+            // Disengaged positions may hold any value (even NaN), so they are replaced, not multiplied by 0.
+            a = engaged ? a : T(0);
+            b = engaged ? b : T(0);
+            if (Op == masked_op::dot || Op == masked_op::cosine)
+                sums.ab += a * b;
+            if (Op == masked_op::cosine)
+            {
+                sums.aa += a * a;
+                sums.bb += b * b;
+            }
+            if (Op == masked_op::l2)
+                sums.dd += (a - b) * (a - b);
+            sums.any |= engaged;
+        }
+
+        // Reads the lanes (engaged flag and value) of an array of optionals.
+        template<class T>
+        struct optional_lanes
+        {
+            const optional<T>* data;
+
+            bool get(std::size_t i, T& value) const noexcept
+            {
+                value = optional_access::raw_value(data[i]);
+                return data[i].has_value();
+            }
+
+            // An optional<float> is stored as { bool, padding, float }: 8 bytes, the flag
+            // in the low byte of the first 32-bit word and the value in the second.
+#if defined(__AVX512F__)
+            __mmask16 load16(std::size_t i, __m512& values) const noexcept
+            {
+                static_assert(sizeof(optional<float>) == 2 * sizeof(float), "Unexpected layout of optional<float>.");
+                const float* p = reinterpret_cast<const float*>(data + i);
+                const __m512 lo = _mm512_loadu_ps(p);
+                const __m512 hi = _mm512_loadu_ps(p + 16);
+                const __m512i odd = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+                const __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+                values = _mm512_permutex2var_ps(lo, odd, hi);
+                const __m512i flags = _mm512_permutex2var_epi32(_mm512_castps_si512(lo), even, _mm512_castps_si512(hi));
+                // The padding bytes are not initialized.
+                return _mm512_test_epi32_mask(flags, _mm512_set1_epi32(0xff));
+            }
+#elif defined(__AVX2__) && defined(__FMA__)
+            __m256 load8(std::size_t i, __m256& values) const noexcept
+            {
+                static_assert(sizeof(optional<float>) == 2 * sizeof(float), "Unexpected layout of optional<float>.");
+                const float* p = reinterpret_cast<const float*>(data + i);
+                const __m256 lo = _mm256_loadu_ps(p);
+                const __m256 hi = _mm256_loadu_ps(p + 8);
+                // Deinterleave (the 128-bit lanes are mixed up: 0 1 4 5 | 2 3 6 7) and restore the order.
+                const __m256d v = _mm256_castps_pd(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+                const __m256d f = _mm256_castps_pd(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+                values = _mm256_castpd_ps(_mm256_permute4x64_pd(v, _MM_SHUFFLE(3, 1, 2, 0)));
+                const __m256i flags = _mm256_and_si256(_mm256_castpd_si256(_mm256_permute4x64_pd(f, _MM_SHUFFLE(3, 1, 2, 0))),
+                                                       _mm256_set1_epi32(0xff));
+                return _mm256_castsi256_ps(_mm256_cmpgt_epi32(flags, _mm256_setzero_si256()));
+            }
+#endif
+        };
+
+        // Reads the lanes of an array of values with a validity bitmap.
+        template<class T>
+        struct bitmap_lanes
+        {
+            const T* data;
+            bitmap_view validity;
+
+            bool get(std::size_t i, T& value) const noexcept
+            {
+                value = data[i];
+                return validity.test(i);
+            }
+
+            // The validity bits of the block [i, i + Width), which must be inside the bitmap.
+            template<unsigned Width>
+            std::uint64_t block_bits(std::size_t i) const noexcept
+            {
+                const std::size_t bit = validity.offset() + i;
+                const unsigned shift = bit % 64;
+                std::uint64_t w = validity.words()[bit / 64] >> shift;
+                if (shift + Width > 64)
+                    w |= validity.words()[bit / 64 + 1] << (64 - shift);
+                return w;
+            }
+
+#if defined(__AVX512F__)
+            __mmask16 load16(std::size_t i, __m512& values) const noexcept
+            {
+                values = _mm512_loadu_ps(data + i);
+                return static_cast<__mmask16>(block_bits<16>(i));
+            }
+#elif defined(__AVX2__) && defined(__FMA__)
+            __m256 load8(std::size_t i, __m256& values) const noexcept
+            {
+                values = _mm256_loadu_ps(data + i);
+                const int bits = static_cast<int>(block_bits<8>(i) & 0xff);
+                const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+                return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), bit), bit));
+            }
+#endif
+        };
+
+        // Accumulates the leading blocks of the vectors with SIMD and returns the number of
+        // positions that were processed. Only float vectors have SIMD kernels.
+        template<masked_op Op, class T, class A, class B>
+        std::size_t masked_simd(masked_sums<T>&, const A&, const B&, std::size_t) noexcept
+        {
+            return 0;
+        }
+
+#if defined(__AVX512F__)
+        inline float reduce_add512(__m512 v) noexcept
+        {
+            alignas(64) float lanes[16];
+            _mm512_store_ps(lanes, v);
+            float sum = 0.0f;
+            for (float lane : lanes)
+                sum += lane;
+            return sum;
+        }
+
+        template<masked_op Op, class A, class B>
+        std::size_t masked_simd(masked_sums<float>& sums, const A& a, const B& b, std::size_t n) noexcept
+        {
+            __m512 ab = _mm512_setzero_ps();
+            __m512 aa = _mm512_setzero_ps();
+            __m512 bb = _mm512_setzero_ps();
+            __m512 dd = _mm512_setzero_ps();
+            unsigned any = 0;
+
+            std::size_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                __m512 x, y;
+                const __mmask16 ka = a.load16(i, x);
+                const __mmask16 kb = b.load16(i, y);
+                const __mmask16 k = static_cast<__mmask16>(ka & kb);
+                any |= k;
+
+                // Lanes that are not in the mask keep the accumulated sum.
+                if (Op == masked_op::dot || Op == masked_op::cosine)
+                    ab = _mm512_mask3_fmadd_ps(x, y, ab, k);
+                if (Op == masked_op::cosine)
+                {
+                    aa = _mm512_mask3_fmadd_ps(x, x, aa, k);
+                    bb = _mm512_mask3_fmadd_ps(y, y, bb, k);
+                }
+                if (Op == masked_op::l2)
+                {
+                    const __m512 d = _mm512_maskz_sub_ps(k, x, y);
+                    dd = _mm512_fmadd_ps(d, d, dd);
+                }
+            }
+
+            sums.ab += reduce_add512(ab);
+            sums.aa += reduce_add512(aa);
+            sums.bb += reduce_add512(bb);
+            sums.dd += reduce_add512(dd);
+            sums.any = sums.any || any != 0;
+            return i;
+        }
+#elif defined(__AVX2__) && defined(__FMA__)
+        inline float reduce_add256(__m256 v) noexcept
+        {
+            __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            s = _mm_add_ss(s, _mm_movehdup_ps(s));
+            return _mm_cvtss_f32(s);
+        }
+
+        template<masked_op Op, class A, class B>
+        std::size_t masked_simd(masked_sums<float>& sums, const A& a, const B& b, std::size_t n) noexcept
+        {
+            __m256 ab = _mm256_setzero_ps();
+            __m256 aa = _mm256_setzero_ps();
+            __m256 bb = _mm256_setzero_ps();
+            __m256 dd = _mm256_setzero_ps();
+            __m256 any = _mm256_setzero_ps();
+
+            std::size_t i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                __m256 x, y;
+                const __m256 ma = a.load8(i, x);
+                const __m256 mb = b.load8(i, y);
+                const __m256 m = _mm256_and_ps(ma, mb);
+                any = _mm256_or_ps(any, m);
+
+                // Lanes that are not in the mask are zeroed (they may hold NaN).
+                x = _mm256_and_ps(m, x);
+                y = _mm256_and_ps(m, y);
+                if (Op == masked_op::dot || Op == masked_op::cosine)
+                    ab = _mm256_fmadd_ps(x, y, ab);
+                if (Op == masked_op::cosine)
+                {
+                    aa = _mm256_fmadd_ps(x, x, aa);
+                    bb = _mm256_fmadd_ps(y, y, bb);
+                }
+                if (Op == masked_op::l2)
+                {
+                    const __m256 d = _mm256_sub_ps(x, y);
+                    dd = _mm256_fmadd_ps(d, d, dd);
+                }
+            }
+
+            sums.ab += reduce_add256(ab);
+            sums.aa += reduce_add256(aa);
+            sums.bb += reduce_add256(bb);
+            sums.dd += reduce_add256(dd);
+            sums.any = sums.any || _mm256_movemask_ps(any) != 0;
+            return i;
+        }
+#endif
+
+        template<masked_op Op, class T, class A, class B>
+        masked_sums<T> masked_reduce(const A& a, const B& b, std::size_t n) noexcept
+        {
+            masked_sums<T> sums = { T(0), T(0), T(0), T(0), false };
+            std::size_t i = masked_simd<Op>(sums, a, b, n);
+
+            // Independent partial sums, so the additions don't wait for each other.
+            const std::size_t lanes = 8;
+            masked_sums<T> partial[lanes];
+            partial[0] = sums;
+            for (std::size_t k = 1; k < lanes; ++k)
+                partial[k] = masked_sums<T>{ T(0), T(0), T(0), T(0), false };
+            for (; i + lanes <= n; i += lanes)
+            {
+                for (std::size_t k = 0; k < lanes; ++k)
+                {
+                    T x, y;
+                    const bool ea = a.get(i + k, x);
+                    const bool eb = b.get(i + k, y);
+                    masked_add<Op>(partial[k], ea & eb, x, y);
+                }
+            }
+            for (std::size_t k = 0; i < n; ++i, ++k)
+            {
+                T x, y;
+                const bool ea = a.get(i, x);
+                const bool eb = b.get(i, y);
+                masked_add<Op>(partial[k], ea & eb, x, y);
+            }
+
+            sums = partial[0];
+            for (std::size_t k = 1; k < lanes; ++k)
+            {
+                sums.ab += partial[k].ab;
+                sums.aa += partial[k].aa;
+                sums.bb += partial[k].bb;
+                sums.dd += partial[k].dd;
+                sums.any = sums.any || partial[k].any;
+            }
+            return sums;
+        }
+
+        template<class T>
+        optional<T> masked_result(masked_op op, const masked_sums<T>& sums)
+        {
+            switch (op)
+            {
+            case masked_op::dot:
+                return optional<T>(sums.any, T(sums.ab));
+            case masked_op::l2:
+                return optional<T>(sums.any, std::sqrt(sums.dd));
+            case masked_op::cosine:
+                // Undefined if either vector is zero at the common positions.
+                if (sums.aa > T(0) && sums.bb > T(0))
+                    return sums.ab / (std::sqrt(sums.aa) * std::sqrt(sums.bb));
+                return nullopt;
+            }
+            return nullopt;
+        }
+
+        template<masked_op Op, class T>
+        optional<T> masked(span<const optional<T>> a, span<const optional<T>> b)
+        {
+            static_assert(std::is_floating_point<T>::value, "The masked kernels require floating point values.");
+            assert(a.size() == b.size());
+            return masked_result(Op, masked_reduce<Op, T>(optional_lanes<T>{ a.data() }, optional_lanes<T>{ b.data() }, a.size()));
+        }
+
+        template<masked_op Op, class T>
+        optional<T> masked(span<const T> a, bitmap_view a_validity, span<const T> b, bitmap_view b_validity)
+        {
+            static_assert(std::is_floating_point<T>::value, "The masked kernels require floating point values.");
+            assert(a.size() == b.size() && a_validity.size() == a.size() && b_validity.size() == b.size());
+            return masked_result(Op, masked_reduce<Op, T>(bitmap_lanes<T>{ a.data(), a_validity }, bitmap_lanes<T>{ b.data(), b_validity }, a.size()));
+        }
+
+        // One query against every row of a row-major matrix.
+        template<masked_op Op, class T>
+        void masked_batch(span<const optional<T>> query, span<const optional<T>> rows, span<optional<T>> out)
+        {
+            static_assert(std::is_floating_point<T>::value, "The masked kernels require floating point values.");
+            const std::size_t dim = query.size();
+            assert(rows.size() == out.size() * dim);
+
+            const optional_lanes<T> q = { query.data() };
+            for (std::size_t r = 0; r < out.size(); ++r)
+                out[r] = masked_result(Op, masked_reduce<Op, T>(q, optional_lanes<T>{ rows.data() + r * dim }, dim));
+        }
+    } // namespace detail
+
+    // The dot product of the positions that are engaged in both vectors.
+    // Disengaged if the vectors have no engaged position in common.
+    template<class T>
+    optional<T> masked_dot(span<const optional<T>> a, span<const optional<T>> b)
+    {
+        return detail::masked<detail::masked_op::dot>(a, b);
+    }
+
+    // The Euclidean distance between the positions that are engaged in both vectors.
+    // Disengaged if the vectors have no engaged position in common.
+    template<class T>
+    optional<T> masked_l2(span<const optional<T>> a, span<const optional<T>> b)
+    {
+        return detail::masked<detail::masked_op::l2>(a, b);
+    }
+
+    // The cosine similarity of the positions that are engaged in both vectors.
+    // Disengaged if the vectors have no engaged position in common or if either vector
+    // is zero at those positions.
+    template<class T>
+    optional<T> masked_cosine(span<const optional<T>> a, span<const optional<T>> b)
+    {
+        return detail::masked<detail::masked_op::cosine>(a, b);
+    }
+
+    // Overloads for vectors of values with a validity bitmap.
+    template<class T>
+    optional<T> masked_dot(span<const T> a, bitmap_view a_validity, span<const T> b, bitmap_view b_validity)
+    {
+        return detail::masked<detail::masked_op::dot>(a, a_validity, b, b_validity);
+    }
+
+    template<class T>
+    optional<T> masked_l2(span<const T> a, bitmap_view a_validity, span<const T> b, bitmap_view b_validity)
+    {
+        return detail::masked<detail::masked_op::l2>(a, a_validity, b, b_validity);
+    }
+
+    template<class T>
+    optional<T> masked_cosine(span<const T> a, bitmap_view a_validity, span<const T> b, bitmap_view b_validity)
+    {
+        return detail::masked<detail::masked_op::cosine>(a, a_validity, b, b_validity);
+    }
+
+    // One-vs-many versions: out[r] is the result for 'query' and the r-th row of 'rows',
+    // a row-major matrix with out.size() rows of query.size() elements.
+    template<class T>
+    void masked_dot_batch(span<const optional<T>> query, span<const optional<T>> rows, span<optional<T>> out)
+    {
+        detail::masked_batch<detail::masked_op::dot>(query, rows, out);
+    }
+
+    template<class T>
+    void masked_l2_batch(span<const optional<T>> query, span<const optional<T>> rows, span<optional<T>> out)
+    {
+        detail::masked_batch<detail::masked_op::l2>(query, rows, out);
+    }
+
+    template<class T>
+    void masked_cosine_batch(span<const optional<T>> query, span<const optional<T>> rows, span<optional<T>> out)
+    {
+        detail::masked_batch<detail::masked_op::cosine>(query, rows, out);
+    }
+} // namespace opt
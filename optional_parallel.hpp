@@ -0,0 +1,874 @@
+#pragma once
+
+//          Copyright Jeremiah van Oosten 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+ /**
+  *  @file optional_parallel.hpp
+  *  @date October 16, 2026
+  *  @author Jeremiah van Oosten
+  *
+  *  @brief Parallel algorithms over contiguous ranges of opt::optional values.
+  *
+  *  The algorithms run on a small work-stealing thread pool (opt::par::thread_pool).
+  *  Ranges are split into chunks whose size only depends on the element size
+  *  (never on the number of threads) and the per-chunk results are always
+  *  combined in chunk order, so the results are deterministic and identical
+  *  for any number of threads.
+  */
+
+#include "optional_algorithm.hpp"
+
+#include <algorithm>            // for std::min, std::sort
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>              // for std::size_t
+#include <exception>            // for std::exception_ptr
+#include <functional>           // for std::plus
+#include <memory>               // for std::unique_ptr
+#include <mutex>
+#include <new>                  // for placement new
+#include <thread>
+#include <type_traits>
+#include <utility>              // for std::move, std::pair
+#include <vector>
+
+namespace opt
+{
+namespace par
+{
+    // Assumed size of a cache line.
+    OPT_INLINE_VAR std::size_t cache_line_size = 64;
+
+    // Target size (in bytes) of the chunks that are processed by a single task.
+    OPT_INLINE_VAR std::size_t chunk_bytes = 64 * 1024;
+
+    namespace detail
+    {
+        constexpr std::size_t gcd(std::size_t a, std::size_t b)
+        {
+            return b == 0 ? a : gcd(b, a % b);
+        }
+
+        // The number of elements of type T per chunk.
+        // This is always a multiple of the number of elements that fill a whole
+        // number of cache lines so that (for cache line aligned ranges) two chunks
+        // never write to the same cache line.
+        template<class T>
+        constexpr std::size_t chunk_size()
+        {
+            return ((chunk_bytes / sizeof(T) + cache_line_size / gcd(cache_line_size, sizeof(T)) - 1)
+                / (cache_line_size / gcd(cache_line_size, sizeof(T))))
+                * (cache_line_size / gcd(cache_line_size, sizeof(T)));
+        }
+
+        inline std::size_t chunk_count(std::size_t n, std::size_t chunk)
+        {
+            return (n + chunk - 1) / chunk;
+        }
+
+        class thread_pool_base
+        {
+        protected:
+            // The pool that the current thread is executing a task for (if any).
+            static thread_pool_base*& current() noexcept
+            {
+                static thread_local thread_pool_base* pool = nullptr;
+                return pool;
+            }
+        };
+    } // namespace detail
+
+    // A fixed size pool of worker threads.
+    // Each worker owns a queue of chunk indices. A worker processes the chunks
+    // in its own queue from the front and steals half of the remaining chunks
+    // from the back of another worker's queue when its own queue runs dry.
+    class thread_pool : private detail::thread_pool_base
+    {
+    public:
+        // Creates a pool with 'threads' threads (including the thread that calls parallel_for).
+        explicit thread_pool(std::size_t threads = std::thread::hardware_concurrency())
+            : m_size(threads > 0 ? threads : 1)
+            , m_queues(new worker_queue[m_size])
+            , m_generation(0)
+            , m_active(0)
+            , m_stop(false)
+            , m_invoke(nullptr)
+            , m_context(nullptr)
+            , m_cancelled(false)
+        {
+            m_threads.reserve(m_size - 1);
+            for (std::size_t i = 1; i < m_size; ++i)
+                m_threads.emplace_back(&thread_pool::worker_main, this, i);
+        }
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        ~thread_pool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_wake.notify_all();
+
+            for (auto& t : m_threads)
+                t.join();
+        }
+
+        // The number of threads that execute tasks (including the calling thread).
+        std::size_t size() const noexcept
+        {
+            return m_size;
+        }
+
+        // Invokes fn(chunk) for every chunk in [0, chunks) and blocks until all
+        // invocations have completed. The calling thread participates.
+        // If an invocation throws, the remaining chunks are skipped and the
+        // first exception is rethrown.
+        // Nested calls (from within a task) run sequentially on the calling thread.
+        template<class Fn>
+        void parallel_for(std::size_t chunks, Fn&& fn)
+        {
+            if (chunks == 0)
+                return;
+
+            if (chunks == 1 || m_size == 1 || current() != nullptr)
+            {
+                for (std::size_t i = 0; i < chunks; ++i)
+                    fn(i);
+                return;
+            }
+
+            using fn_type = typename std::remove_reference<Fn>::type;
+
+            std::lock_guard<std::mutex> submit_lock(m_submit);
+
+            for (std::size_t w = 0; w < m_size; ++w)
+            {
+                std::lock_guard<std::mutex> lock(m_queues[w].mutex);
+                m_queues[w].begin = chunks * w / m_size;
+                m_queues[w].end = chunks * (w + 1) / m_size;
+            }
+
+            m_invoke = [](void* context, std::size_t chunk) { (*static_cast<fn_type*>(context))(chunk); };
+            m_context = const_cast<void*>(static_cast<const void*>(std::addressof(fn)));
+            m_cancelled.store(false, std::memory_order_relaxed);
+            m_exception = nullptr;
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ++m_generation;
+                m_active = m_size - 1;
+            }
+            m_wake.notify_all();
+
+            run(0);
+
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_done.wait(lock, [this]() { return m_active == 0; });
+            }
+
+            if (m_exception)
+                std::rethrow_exception(m_exception);
+        }
+
+    private:
+        struct worker_queue
+        {
+            std::mutex mutex;
+            std::size_t begin = 0;
+            std::size_t end = 0;
+            // Keep the queues of different workers on different cache lines.
+            char padding[cache_line_size];
+        };
+
+        void worker_main(std::size_t index)
+        {
+            std::size_t generation = 0;
+            for (;;)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_wake.wait(lock, [&]() { return m_stop || m_generation != generation; });
+                    if (m_stop)
+                        return;
+                    generation = m_generation;
+                }
+
+                run(index);
+
+                bool last;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    last = (--m_active == 0);
+                }
+                if (last)
+                    m_done.notify_one();
+            }
+        }
+
+        // Processes chunks until there is no more work in any queue.
+        void run(std::size_t index)
+        {
+            current() = this;
+
+            std::size_t chunk;
+            while (pop(index, chunk) || steal(index, chunk))
+            {
+                if (m_cancelled.load(std::memory_order_relaxed))
+                    continue;
+
+                try
+                {
+                    m_invoke(m_context, chunk);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (!m_exception)
+                        m_exception = std::current_exception();
+                    m_cancelled.store(true, std::memory_order_relaxed);
+                }
+            }
+
+            current() = nullptr;
+        }
+
+        bool pop(std::size_t index, std::size_t& chunk)
+        {
+            worker_queue& q = m_queues[index];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.begin == q.end)
+                return false;
+
+            chunk = q.begin++;
+            return true;
+        }
+
+        bool steal(std::size_t thief, std::size_t& chunk)
+        {
+            for (std::size_t i = 1; i < m_size; ++i)
+            {
+                worker_queue& victim = m_queues[(thief + i) % m_size];
+
+                std::size_t begin, end;
+                {
+                    std::lock_guard<std::mutex> lock(victim.mutex);
+                    if (victim.begin == victim.end)
+                        continue;
+
+                    // Take the back half (rounded up) of the victim's chunks.
+                    end = victim.end;
+                    begin = victim.end - (victim.end - victim.begin + 1) / 2;
+                    victim.end = begin;
+                }
+
+                chunk = begin;
+                if (begin + 1 < end)
+                {
+                    worker_queue& own = m_queues[thief];
+                    std::lock_guard<std::mutex> lock(own.mutex);
+                    own.begin = begin + 1;
+                    own.end = end;
+                }
+                return true;
+            }
+
+            return false;
+        }
+
+        const std::size_t m_size;
+        std::unique_ptr<worker_queue[]> m_queues;
+        std::vector<std::thread> m_threads;
+
+        // Serializes calls to parallel_for from different threads.
+        std::mutex m_submit;
+
+        // Protects the generation, active worker count, stop flag and exception.
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_done;
+        std::size_t m_generation;
+        std::size_t m_active;
+        bool m_stop;
+
+        // The current job.
+        void (*m_invoke)(void*, std::size_t);
+        void* m_context;
+        std::atomic<bool> m_cancelled;
+        std::exception_ptr m_exception;
+    };
+
+    // The pool that is used by the overloads that don't take a pool.
+    // Uses one thread per hardware thread.
+    inline thread_pool& default_pool()
+    {
+        static thread_pool pool;
+        return pool;
+    }
+
+    // Applies 'transform' to every engaged element of 'in' and reduces the results
+    // (and 'init') with 'reduce'. Disengaged elements are skipped.
+    // The results of the chunks are reduced in order, so 'reduce' only needs to be
+    // associative (not commutative) for the result to equal the sequential one.
+    template<class T, class R, class Reduce, class Transform>
+    R transform_reduce(thread_pool& pool, span<const optional<T>> in, R init, Reduce reduce, Transform transform)
+    {
+        const std::size_t chunk = detail::chunk_size<optional<T>>();
+        const std::size_t chunks = detail::chunk_count(in.size(), chunk);
+
+        std::vector<optional<R>> partials(chunks);
+        pool.parallel_for(chunks, [&](std::size_t c) {
+            const std::size_t begin = c * chunk;
+            const std::size_t end = std::min(begin + chunk, in.size());
+
+            std::size_t i = begin;
+            while (i < end && !in[i])
+                ++i;
+            if (i == end)
+                return;
+
+            R acc = transform(*in[i]);
+            for (++i; i < end; ++i)
+            {
+                if (in[i])
+                    acc = reduce(std::move(acc), transform(*in[i]));
+            }
+            partials[c] = std::move(acc);
+        });
+
+        for (auto& p : partials)
+        {
+            if (p)
+                init = reduce(std::move(init), std::move(*p));
+        }
+
+        return init;
+    }
+
+    template<class T, class R, class Reduce, class Transform>
+    R transform_reduce(span<const optional<T>> in, R init, Reduce reduce, Transform transform)
+    {
+        return par::transform_reduce(default_pool(), in, std::move(init), reduce, transform);
+    }
+
+    // Invokes fn(value) for every engaged element of 'data'.
+    // 'data' may be a span of (const) optionals.
+    template<class Opt, class Fn>
+    void for_each_engaged(thread_pool& pool, span<Opt> data, Fn fn)
+    {
+        static_assert(std::is_base_of<opt::detail::optional_tag, typename std::remove_cv<Opt>::type>::value,
+            "for_each_engaged requires a span of optionals.");
+
+        const std::size_t chunk = detail::chunk_size<Opt>();
+        const std::size_t chunks = detail::chunk_count(data.size(), chunk);
+
+        pool.parallel_for(chunks, [&](std::size_t c) {
+            const std::size_t begin = c * chunk;
+            const std::size_t end = std::min(begin + chunk, data.size());
+
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                if (data[i])
+                    fn(*data[i]);
+            }
+        });
+    }
+
+    template<class Opt, class Fn>
+    void for_each_engaged(span<Opt> data, Fn fn)
+    {
+        par::for_each_engaged(default_pool(), data, fn);
+    }
+
+    // Copies the engaged values of 'in' to 'out' and returns the number of values copied.
+    // The engaged elements of each chunk are counted in parallel, the offsets of
+    // the chunks in 'out' are computed with a prefix sum and then the values of
+    // each chunk are copied in parallel. The result is identical to opt::compact.
+    // 'out' must have room for all engaged values.
+    template<class T>
+    std::size_t compact(thread_pool& pool, span<const optional<T>> in, T* out)
+    {
+        const std::size_t chunk = detail::chunk_size<optional<T>>();
+        const std::size_t chunks = detail::chunk_count(in.size(), chunk);
+
+        // The counting pass only pays off if the chunks are copied concurrently.
+        if (pool.size() == 1 || chunks < 2)
+            return opt::compact(in, out);
+
+        std::vector<std::size_t> offsets(chunks + 1);
+        pool.parallel_for(chunks, [&](std::size_t c) {
+            const std::size_t begin = c * chunk;
+            offsets[c + 1] = opt::detail::count_engaged(in.subspan(begin, std::min(chunk, in.size() - begin)));
+        });
+
+        for (std::size_t c = 0; c < chunks; ++c)
+            offsets[c + 1] += offsets[c];
+
+        pool.parallel_for(chunks, [&](std::size_t c) {
+            const std::size_t begin = c * chunk;
+            opt::detail::compact_impl(in.subspan(begin, std::min(chunk, in.size() - begin)), out + offsets[c]);
+        });
+
+        return offsets[chunks];
+    }
+
+    template<class T>
+    std::size_t compact(span<const optional<T>> in, T* out)
+    {
+        return par::compact(default_pool(), in, out);
+    }
+
+    // Returns the engaged values of 'in' (in order).
+    template<class T>
+    std::vector<T> compact(thread_pool& pool, span<const optional<T>> in)
+    {
+        std::vector<T> out(par::transform_reduce(pool, in, std::size_t(0), std::plus<std::size_t>(),
+            [](const T&) { return std::size_t(1); }));
+        par::compact(pool, in, out.data());
+        return out;
+    }
+
+    template<class T>
+    std::vector<T> compact(span<const optional<T>> in)
+    {
+        return par::compact(default_pool(), in);
+    }
+
+    namespace detail
+    {
+        OPT_INLINE_VAR std::size_t npos = static_cast<std::size_t>(-1);
+
+        // The chunk size of the bitmap algorithms is also a multiple of 64
+        // so that two chunks never share a word of the bitmap.
+        template<class T>
+        constexpr std::size_t bitmap_chunk_size()
+        {
+            return (chunk_size<T>() + 63) / 64 * 64;
+        }
+
+        // Computes the state that is carried into each chunk by the fill algorithms.
+        // 'observed[c]' is the index of the observation in chunk c that is carried
+        // into the next chunk (npos if chunk c has no observations) and 'value_at'
+        // returns the value at an index. If 'forward' is false, the state is carried
+        // from the last chunk to the first.
+        template<class T, class ValueAt>
+        std::vector<opt::detail::fill_state<T>> fill_states(const std::vector<std::size_t>& observed, std::size_t chunk,
+            std::size_t n, bool forward, ValueAt value_at)
+        {
+            const std::size_t chunks = observed.size();
+            std::vector<opt::detail::fill_state<T>> states(chunks, opt::detail::fill_state<T>{ T(), false, 0 });
+
+            for (std::size_t k = 1; k < chunks; ++k)
+            {
+                // Carry from chunk 'prev' into chunk 'c'.
+                const std::size_t c = forward ? k : chunks - 1 - k;
+                const std::size_t prev = forward ? c - 1 : c + 1;
+                const std::size_t begin = c * chunk;
+                const std::size_t end = std::min(begin + chunk, n);
+
+                if (observed[prev] != npos)
+                {
+                    states[c].value = value_at(observed[prev]);
+                    states[c].valid = true;
+                    states[c].gap = forward ? begin - observed[prev] - 1 : observed[prev] - end;
+                }
+                else
+                {
+                    states[c] = states[prev];
+                    states[c].gap += std::min(chunk, n - prev * chunk);
+                }
+            }
+
+            return states;
+        }
+
+        template<class T>
+        void fill(thread_pool& pool, span<optional<T>> data, std::size_t max_gap, bool forward)
+        {
+            const std::size_t n = data.size();
+            const std::size_t chunk = chunk_size<optional<T>>();
+            const std::size_t chunks = chunk_count(n, chunk);
+
+            // Find the observation that each chunk carries into the next one.
+            std::vector<std::size_t> observed(chunks, npos);
+            pool.parallel_for(chunks, [&](std::size_t c) {
+                const std::size_t begin = c * chunk;
+                const std::size_t end = std::min(begin + chunk, n);
+                for (std::size_t k = 0; k < end - begin; ++k)
+                {
+                    const std::size_t i = forward ? end - 1 - k : begin + k;
+                    if (data[i])
+                    {
+                        observed[c] = i;
+                        break;
+                    }
+                }
+            });
+
+            const auto states = fill_states<T>(observed, chunk, n, forward, [&](std::size_t i) { return *data[i]; });
+
+            pool.parallel_for(chunks, [&](std::size_t c) {
+                const std::ptrdiff_t begin = static_cast<std::ptrdiff_t>(c * chunk);
+                const std::ptrdiff_t end = static_cast<std::ptrdiff_t>(std::min(c * chunk + chunk, n));
+                if (forward)
+                    opt::detail::fill_impl(data.data(), begin, end, 1, states[c], max_gap);
+                else
+                    opt::detail::fill_impl(data.data(), end - 1, begin - 1, -1, states[c], max_gap);
+            });
+        }
+
+        template<class T>
+        void fill(thread_pool& pool, span<T> values, std::uint64_t* validity, std::size_t max_gap, bool forward)
+        {
+            const std::size_t n = values.size();
+            const std::size_t chunk = bitmap_chunk_size<T>();
+            const std::size_t chunks = chunk_count(n, chunk);
+
+            std::vector<std::size_t> observed(chunks, npos);
+            pool.parallel_for(chunks, [&](std::size_t c) {
+                const std::size_t begin = c * chunk;
+                const std::size_t end = std::min(begin + chunk, n);
+                for (std::size_t k = 0; k < end - begin; ++k)
+                {
+                    const std::size_t i = forward ? end - 1 - k : begin + k;
+                    if (opt::detail::bit_test(validity, i))
+                    {
+                        observed[c] = i;
+                        break;
+                    }
+                }
+            });
+
+            const auto states = fill_states<T>(observed, chunk, n, forward, [&](std::size_t i) { return values[i]; });
+
+            pool.parallel_for(chunks, [&](std::size_t c) {
+                const std::size_t begin = c * chunk;
+                const std::size_t end = std::min(begin + chunk, n);
+                if (forward)
+                    opt::detail::forward_fill_bitmap_impl(values.data(), validity, begin, end, states[c], max_gap);
+                else
+                    opt::detail::backward_fill_bitmap_impl(values.data(), validity, begin, end, states[c], max_gap);
+            });
+        }
+    } // namespace detail
+
+    // Parallel version of opt::forward_fill.
+    // Each chunk is filled in parallel, starting with the value carried over
+    // from the last observation in the preceding chunks.
+    template<class T>
+    void forward_fill(thread_pool& pool, span<optional<T>> data, std::size_t max_gap = no_limit)
+    {
+        detail::fill(pool, data, max_gap, true);
+    }
+
+    template<class T>
+    void forward_fill(thread_pool& pool, span<T> values, std::uint64_t* validity, std::size_t max_gap = no_limit)
+    {
+        detail::fill(pool, values, validity, max_gap, true);
+    }
+
+    // Parallel version of opt::backward_fill.
+    template<class T>
+    void backward_fill(thread_pool& pool, span<optional<T>> data, std::size_t max_gap = no_limit)
+    {
+        detail::fill(pool, data, max_gap, false);
+    }
+
+    template<class T>
+    void backward_fill(thread_pool& pool, span<T> values, std::uint64_t* validity, std::size_t max_gap = no_limit)
+    {
+        detail::fill(pool, values, validity, max_gap, false);
+    }
+
+    namespace detail
+    {
+        // Two pass scan: the aggregate of each chunk is computed in parallel, the aggregates
+        // are combined into the state that is carried into each chunk and then each chunk is
+        // scanned in parallel, starting with its carried state.
+        template<bool Inclusive, class T, class Op>
+        void scan(thread_pool& pool, span<const optional<T>> in, span<opt::detail::scan_output_t<Op, T>> out,
+            null_output nulls)
+        {
+            assert(in.size() == out.size());
+            const std::size_t n = in.size();
+            const std::size_t chunk = chunk_size<optional<T>>();
+            const std::size_t chunks = chunk_count(n, chunk);
+
+            // A single thread also scans chunk by chunk, so that the rounding of
+            // floating-point sums doesn't depend on the number of threads.
+            std::vector<opt::detail::aggregator<Op, T>> states(std::max<std::size_t>(chunks, 1));
+            if (chunks < 2)
+            {
+                opt::detail::scan_impl<Inclusive>(in.data(), out.data(), 0, n, states[0], nulls);
+                return;
+            }
+
+            pool.parallel_for(chunks - 1, [&](std::size_t c) {
+                const std::size_t end = (c + 1) * chunk;
+                for (std::size_t i = c * chunk; i < end; ++i)
+                    opt::detail::scan_add(states[c + 1], in[i]);
+            });
+
+            for (std::size_t c = 2; c < chunks; ++c)
+                states[c].merge(states[c - 1]);
+
+            pool.parallel_for(chunks, [&](std::size_t c) {
+                opt::detail::scan_impl<Inclusive>(in.data(), out.data(), c * chunk, std::min(n, (c + 1) * chunk), states[c], nulls);
+            });
+        }
+    } // namespace detail
+
+    // Parallel versions of opt::inclusive_scan_skip_null and opt::exclusive_scan_skip_null.
+    // The chunk aggregates are combined in a different order than the sequential scan
+    // adds the elements, so floating-point sums and means may differ from the sequential
+    // result by rounding (but they do not depend on the number of threads).
+    template<class T, class Op>
+    void inclusive_scan_skip_null(thread_pool& pool, span<const optional<T>> in,
+        span<opt::detail::scan_output_t<Op, T>> out, Op, null_output nulls = null_output::running)
+    {
+        detail::scan<true, T, Op>(pool, in, out, nulls);
+    }
+
+    template<class T, class Op>
+    void inclusive_scan_skip_null(span<const optional<T>> in, span<opt::detail::scan_output_t<Op, T>> out, Op op,
+        null_output nulls = null_output::running)
+    {
+        par::inclusive_scan_skip_null(default_pool(), in, out, op, nulls);
+    }
+
+    template<class T, class Op>
+    void exclusive_scan_skip_null(thread_pool& pool, span<const optional<T>> in,
+        span<opt::detail::scan_output_t<Op, T>> out, Op, null_output nulls = null_output::running)
+    {
+        detail::scan<false, T, Op>(pool, in, out, nulls);
+    }
+
+    template<class T, class Op>
+    void exclusive_scan_skip_null(span<const optional<T>> in, span<opt::detail::scan_output_t<Op, T>> out, Op op,
+        null_output nulls = null_output::running)
+    {
+        par::exclusive_scan_skip_null(default_pool(), in, out, op, nulls);
+    }
+
+    namespace detail
+    {
+        // The rows of par::group_aggregate and par::hash_join are partitioned
+        // by the top bits of the hash of their key.
+        OPT_INLINE_VAR unsigned key_partition_bits = 6;
+        OPT_INLINE_VAR std::size_t key_partitions = std::size_t(1) << key_partition_bits;
+
+        template<class K>
+        std::size_t key_partition(K key) noexcept
+        {
+            return static_cast<std::size_t>(opt::detail::hash_mix(opt::detail::hash_bits<K>::get(key)) >> (64 - key_partition_bits));
+        }
+
+        // Radix partitioning: the rows make_row(i) of an input with n rows, stored grouped by
+        // partition_of(i). The rows of each partition are counted per chunk in parallel, the
+        // offsets of each (partition, chunk) pair are computed with a prefix sum and then the
+        // rows are scattered in parallel. The rows of a partition stay in input order.
+        template<class Row>
+        class partitioned_rows
+        {
+        public:
+            template<class PartitionOf, class MakeRow>
+            partitioned_rows(thread_pool& pool, std::size_t n, std::size_t chunk, std::size_t partitions,
+                             PartitionOf partition_of, MakeRow make_row)
+                : m_size(n)
+                , m_begin(partitions + 1)
+            {
+                const std::size_t chunks = chunk_count(n, chunk);
+
+                std::vector<std::size_t> offsets(chunks * partitions);
+                pool.parallel_for(chunks, [&](std::size_t c) {
+                    std::size_t* counts = offsets.data() + c * partitions;
+                    const std::size_t end = std::min(n, (c + 1) * chunk);
+                    for (std::size_t i = c * chunk; i < end; ++i)
+                        ++counts[partition_of(i)];
+                });
+
+                // Partition major, chunk minor, so the rows of each partition stay in order.
+                std::size_t total = 0;
+                for (std::size_t p = 0; p < partitions; ++p)
+                {
+                    m_begin[p] = total;
+                    for (std::size_t c = 0; c < chunks; ++c)
+                    {
+                        const std::size_t count = offsets[c * partitions + p];
+                        offsets[c * partitions + p] = total;
+                        total += count;
+                    }
+                }
+                m_begin[partitions] = total;
+
+                // Not initialized, so the pages are first touched by the (parallel) scatter.
+                m_storage.reset(new storage_type[n]);
+                Row* rows = data();
+                pool.parallel_for(chunks, [&](std::size_t c) {
+                    std::size_t* next = offsets.data() + c * partitions;
+                    const std::size_t end = std::min(n, (c + 1) * chunk);
+                    for (std::size_t i = c * chunk; i < end; ++i)
+                        new (rows + next[partition_of(i)]++) Row(make_row(i));
+                });
+            }
+
+            partitioned_rows(const partitioned_rows&) = delete;
+            partitioned_rows& operator=(const partitioned_rows&) = delete;
+
+            ~partitioned_rows()
+            {
+                Row* rows = data();
+                for (std::size_t i = 0; i < m_size; ++i)
+                    rows[i].~Row();
+            }
+
+            Row* data() noexcept
+            {
+                return reinterpret_cast<Row*>(m_storage.get());
+            }
+
+            // The rows of partition p are data()[begin(p), begin(p + 1)).
+            std::size_t begin(std::size_t p) const noexcept
+            {
+                return m_begin[p];
+            }
+
+        private:
+            using storage_type = typename std::aligned_storage<sizeof(Row), alignof(Row)>::type;
+
+            std::unique_ptr<storage_type[]> m_storage;
+            std::size_t m_size;
+            std::vector<std::size_t> m_begin;
+        };
+
+        template<class K, class V>
+        struct group_row
+        {
+            optional<K> key;
+            optional<V> value;
+            std::size_t index;
+        };
+    } // namespace detail
+
+    // Parallel version of opt::group_aggregate.
+    // The rows are radix partitioned by the hash of their key (into a fixed number of
+    // partitions, independent of the number of threads) and then each partition is
+    // aggregated in its own hash table in parallel. Every group belongs to exactly one
+    // partition and its rows are aggregated in order, so the result is identical to
+    // opt::group_aggregate. Rows with the same key are aggregated by a single thread,
+    // so a few very large groups limit the parallelism.
+    template<class K, class V, class... Ops>
+    opt::detail::group_result_t<K, V, Ops...>
+        group_aggregate(thread_pool& pool, span<const optional<K>> keys, span<const optional<V>> values, Ops... ops)
+    {
+        assert(keys.size() == values.size());
+
+        const std::size_t chunk = detail::chunk_size<optional<K>>();
+        const std::size_t partitions = detail::key_partitions;
+
+        if (pool.size() == 1 || detail::chunk_count(keys.size(), chunk) < 2)
+            return opt::group_aggregate(keys, values, ops...);
+
+        // The rows are copied (not only their indices) so that each partition is read sequentially.
+        using row = detail::group_row<K, V>;
+        detail::partitioned_rows<row> rows(pool, keys.size(), chunk, partitions,
+            [&](std::size_t i) { return keys[i] ? detail::key_partition(*keys[i]) : 0; },
+            [&](std::size_t i) { return row{ keys[i], values[i], i }; });
+
+        std::vector<opt::detail::group_table<K, V, Ops...>> tables(partitions);
+        pool.parallel_for(partitions, [&](std::size_t p) {
+            const row* data = rows.data();
+            for (std::size_t r = rows.begin(p); r < rows.begin(p + 1); ++r)
+                tables[p].add(data[r].key, data[r].value, data[r].index);
+        });
+
+        // Merge the groups of all partitions in the order of their first row.
+        std::vector<std::pair<std::size_t, std::size_t>> order;
+        for (std::size_t p = 0; p < partitions; ++p)
+        {
+            for (std::size_t g = 0; g < tables[p].size(); ++g)
+                order.emplace_back(tables[p].first_rows()[g], g * partitions + p);
+        }
+        std::sort(order.begin(), order.end());
+
+        opt::detail::group_result_t<K, V, Ops...> result;
+        result.keys.reserve(order.size());
+        for (const auto& o : order)
+            opt::detail::append_group(result, tables[o.second % partitions], o.second / partitions);
+        return result;
+    }
+
+    template<class K, class V, class... Ops>
+    opt::detail::group_result_t<K, V, Ops...>
+        group_aggregate(span<const optional<K>> keys, span<const optional<V>> values, Ops... ops)
+    {
+        return par::group_aggregate(default_pool(), keys, values, ops...);
+    }
+
+    // Parallel version of opt::hash_join.
+    // Build: the engaged rows of 'left' are radix partitioned by the hash of their key and
+    // a hash table is built for each partition in parallel.
+    // Probe: the chunks of 'right' are probed in parallel (each key in the table of its
+    // partition) and the matches of the chunks are concatenated in order.
+    // The result is identical to opt::hash_join.
+    template<class K>
+    join_result hash_join(thread_pool& pool, span<const optional<K>> left, span<const optional<K>> right)
+    {
+        const std::size_t chunk = detail::chunk_size<optional<K>>();
+        const std::size_t partitions = detail::key_partitions;
+
+        if (pool.size() == 1 || detail::chunk_count(left.size(), chunk) + detail::chunk_count(right.size(), chunk) < 3)
+            return opt::hash_join(left, right);
+
+        // Rows with disengaged keys are put in an extra partition that is ignored.
+        using row = opt::detail::join_row<K>;
+        detail::partitioned_rows<row> rows(pool, left.size(), chunk, partitions + 1,
+            [&](std::size_t i) { return left[i] ? detail::key_partition(*left[i]) : partitions; },
+            [&](std::size_t i) { return row{ left[i] ? *left[i] : K(), i }; });
+
+        std::vector<opt::detail::join_table<K>> tables(partitions);
+        pool.parallel_for(partitions, [&](std::size_t p) {
+            const row* data = rows.data() + rows.begin(p);
+            tables[p].build(rows.begin(p + 1) - rows.begin(p), [&](std::size_t i) { return data[i]; });
+        });
+
+        const std::size_t chunks = detail::chunk_count(right.size(), chunk);
+        std::vector<join_result> matches(chunks);
+        pool.parallel_for(chunks, [&](std::size_t c) {
+            const std::size_t end = std::min(right.size(), (c + 1) * chunk);
+            for (std::size_t i = c * chunk; i < end; ++i)
+            {
+                if (right[i])
+                    tables[detail::key_partition(*right[i])].probe(*right[i], i, matches[c]);
+            }
+        });
+
+        std::vector<std::size_t> offsets(chunks + 1);
+        for (std::size_t c = 0; c < chunks; ++c)
+            offsets[c + 1] = offsets[c] + matches[c].size();
+
+        join_result result;
+        result.left.resize(offsets[chunks]);
+        result.right.resize(offsets[chunks]);
+        pool.parallel_for(chunks, [&](std::size_t c) {
+            std::copy(matches[c].left.begin(), matches[c].left.end(), result.left.begin() + offsets[c]);
+            std::copy(matches[c].right.begin(), matches[c].right.end(), result.right.begin() + offsets[c]);
+            join_result().left.swap(matches[c].left);
+            join_result().right.swap(matches[c].right);
+        });
+        return result;
+    }
+
+    template<class K>
+    join_result hash_join(span<const optional<K>> left, span<const optional<K>> right)
+    {
+        return par::hash_join(default_pool(), left, right);
+    }
+} // namespace par
+} // namespace opt
@@ -0,0 +1,367 @@
+#pragma once
+
+//          Copyright Jeremiah van Oosten 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+ /**
+  *  @file optional_pool.hpp
+  *  @date October 16, 2026
+  *  @author Jeremiah van Oosten
+  *
+  *  @brief A lock-free pool of objects that are stored in opt::optional slots.
+  *
+  *  opt::object_pool owns a fixed array of opt::optional<T> slots. An empty slot
+  *  has no T yet (or its T was destroyed on release), so objects are only
+  *  constructed when they are first needed. Free slots are kept in lock-free
+  *  stacks of slot indices: a small cache for every group of threads and a free
+  *  list that full caches spill into.
+  */
+
+#include "optional.hpp"
+
+#include <atomic>
+#include <cassert>          // for assert
+#include <cstddef>          // for std::size_t
+#include <cstdint>          // for std::uint32_t, std::uint64_t
+#include <memory>           // for std::unique_ptr
+#include <thread>           // for std::thread::hardware_concurrency
+#include <type_traits>
+#include <utility>          // for std::forward
+
+namespace opt
+{
+    // What an opt::object_pool does with an object when its handle is destroyed.
+    enum class pool_release
+    {
+        keep,   // The object stays constructed and is handed out again as it is.
+        reset   // The object is destroyed (the slot is reset to nullopt).
+    };
+
+    namespace detail
+    {
+        // Assumed size of a cache line. The caches of a pool are separated by padding of this size.
+        OPT_INLINE_VAR std::size_t pool_padding = 64;
+
+        // A small number that identifies the current thread (assigned in the order that threads ask for it).
+        inline std::size_t pool_thread_index() noexcept
+        {
+            static std::atomic<std::size_t> next(0);
+            static thread_local std::size_t index = next.fetch_add(1, std::memory_order_relaxed);
+            return index;
+        }
+
+        // The number of caches of a pool: a power of two close to the number of hardware threads.
+        inline std::size_t pool_cache_count() noexcept
+        {
+            const std::size_t threads = std::thread::hardware_concurrency();
+            std::size_t count = 1;
+            while (count < threads && count < 64)
+                count *= 2;
+            return count;
+        }
+    } // namespace detail
+
+    template<class T, pool_release Release> class object_pool;
+
+    // Gives access to an object of an opt::object_pool and returns it to the pool when destroyed.
+    template<class T, pool_release Release = pool_release::keep>
+    class pool_handle
+    {
+    public:
+        using value_type = T;
+
+        pool_handle() noexcept
+            : m_pool(nullptr)
+            , m_index(0)
+        {}
+
+        pool_handle(pool_handle&& other) noexcept
+            : m_pool(other.m_pool)
+            , m_index(other.m_index)
+        {
+            other.m_pool = nullptr;
+        }
+
+        pool_handle& operator=(pool_handle&& other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                m_pool = other.m_pool;
+                m_index = other.m_index;
+                other.m_pool = nullptr;
+            }
+            return *this;
+        }
+
+        ~pool_handle()
+        {
+            reset();
+        }
+
+        // Returns the object to the pool.
+        void reset() noexcept
+        {
+            if (m_pool)
+            {
+                m_pool->release(m_index);
+                m_pool = nullptr;
+            }
+        }
+
+        T* get() const noexcept
+        {
+            return m_pool ? &*m_pool->m_slots[m_index].value : nullptr;
+        }
+
+        T& operator*() const noexcept
+        {
+            assert(m_pool);
+            return *m_pool->m_slots[m_index].value;
+        }
+
+        T* operator->() const noexcept
+        {
+            return get();
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return m_pool != nullptr;
+        }
+
+    private:
+        friend class object_pool<T, Release>;
+
+        pool_handle(object_pool<T, Release>* pool, std::uint32_t index) noexcept
+            : m_pool(pool)
+            , m_index(index)
+        {}
+
+        object_pool<T, Release>* m_pool;
+        std::uint32_t m_index;
+    };
+
+    // A fixed number of objects that are handed out by acquire() and returned by the
+    // destructor of their pool_handle. Objects are constructed the first time their slot
+    // is acquired. With pool_release::keep a returned object is handed out again without
+    // being reconstructed (the arguments of acquire are only used for empty slots); with
+    // pool_release::reset it is destroyed when it is returned.
+    //
+    // A thread releases objects to the cache that belongs to it (there is one cache for
+    // every group of threads) and acquires from that cache first, so that most calls only
+    // touch a cache line that isn't shared with the other threads. The caches and the free
+    // list are lock-free stacks: every operation is a single compare-and-swap of the head
+    // of a stack, so a thread that is preempted never blocks the others. A full cache is
+    // detached as a whole and pushed to the free list in one compare-and-swap. The pool
+    // must outlive its handles.
+    template<class T, pool_release Release = pool_release::keep>
+    class object_pool
+    {
+    public:
+        using value_type = T;
+        using handle = pool_handle<T, Release>;
+
+        explicit object_pool(std::size_t capacity)
+            : m_capacity(static_cast<std::uint32_t>(capacity))
+            , m_slots(new slot[capacity])
+            , m_cache_mask(detail::pool_cache_count() - 1)
+            , m_caches(new cache[m_cache_mask + 1])
+            , m_free(0)
+        {
+            assert(capacity < 0xffffffffu);
+
+            // All slots start on the free list.
+            for (std::uint32_t i = 0; i < m_capacity; ++i)
+                m_slots[i].next.store(i + 1 < m_capacity ? i + 2 : 0, std::memory_order_relaxed);
+            m_free.store(m_capacity > 0 ? 1 : 0, std::memory_order_relaxed);
+        }
+
+        object_pool(const object_pool&) = delete;
+        object_pool& operator=(const object_pool&) = delete;
+
+        std::size_t capacity() const noexcept
+        {
+            return m_capacity;
+        }
+
+        // Hands out a free object, or nullopt if all objects are in use. An empty slot
+        // is filled with T(args...) first; if that throws, the slot stays free.
+        template<class... Args>
+        optional<handle> acquire(Args&&... args)
+        {
+            std::uint32_t index;
+            if (!pop(index))
+                return optional<handle>();
+
+            handle h(this, index);
+            optional<T>& value = m_slots[index].value;
+            if (!value)
+            {
+                try
+                {
+                    value.emplace(std::forward<Args>(args)...);
+                }
+                catch (...)
+                {
+                    h.m_pool = nullptr;
+                    push(index);
+                    throw;
+                }
+            }
+            return optional<handle>(std::move(h));
+        }
+
+    private:
+        friend class pool_handle<T, Release>;
+
+        static constexpr std::uint32_t cache_size = 14;
+
+        // The stacks of slot indices (the caches and the free list) have a head that holds
+        // the top index + 1 in the low 32 bits and a counter in the high 32 bits that is
+        // incremented by every change, so that a compare-and-swap fails if the stack was
+        // popped and pushed in between. The counter of a cache is shifted by 'cache_tag'
+        // bits, and the bits below it hold the number of slots in the cache.
+        static constexpr std::uint32_t cache_tag = 6;
+        static constexpr std::uint32_t free_step = 1;
+        static constexpr std::uint32_t cache_push_step = (1u << cache_tag) + 1;
+        static constexpr std::uint32_t cache_pop_step = (1u << cache_tag) - 1;
+
+        struct slot
+        {
+            optional<T> value;
+            std::atomic<std::uint32_t> next{ 0 };    // The next free slot + 1 (0 ends the stack).
+        };
+
+        // The free slots of a group of threads.
+        struct cache
+        {
+            std::atomic<std::uint64_t> head{ 0 };
+            char padding[detail::pool_padding];
+        };
+
+        void release(std::uint32_t index) noexcept
+        {
+            if (Release == pool_release::reset)
+                m_slots[index].value.reset();
+            push(index);
+        }
+
+        void push(std::uint32_t index) noexcept
+        {
+            std::atomic<std::uint64_t>& cache_head = local_cache().head;
+            std::uint64_t head = cache_head.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                if (cache_length(head) == cache_size)
+                {
+                    // Detach the full cache (the slots are then owned by this thread) and push it to the free list.
+                    if (cache_head.compare_exchange_weak(head, next_head(head, 0, (1u << cache_tag) - cache_size),
+                        std::memory_order_acquire, std::memory_order_relaxed))
+                    {
+                        const std::uint32_t first = static_cast<std::uint32_t>(head) - 1;
+                        std::uint32_t last = first;
+                        for (std::uint32_t i = 1; i < cache_size; ++i)
+                            last = m_slots[last].next.load(std::memory_order_relaxed) - 1;
+                        push_stack(m_free, first, last, free_step);
+                        head = cache_head.load(std::memory_order_relaxed);
+                    }
+                    continue;
+                }
+
+                m_slots[index].next.store(static_cast<std::uint32_t>(head), std::memory_order_relaxed);
+                if (cache_head.compare_exchange_weak(head, next_head(head, index + 1, cache_push_step),
+                    std::memory_order_release, std::memory_order_relaxed))
+                    return;
+            }
+        }
+
+        bool pop(std::uint32_t& index) noexcept
+        {
+            cache& local = local_cache();
+            if (pop_stack(local.head, cache_pop_step, index) || pop_stack(m_free, free_step, index))
+                return true;
+
+            // The pool looks exhausted: take a slot from the caches of the other threads.
+            for (std::size_t i = 0; i <= m_cache_mask; ++i)
+            {
+                if (&m_caches[i] != &local && pop_stack(m_caches[i].head, cache_pop_step, index))
+                    return true;
+            }
+            return false;
+        }
+
+        // Pushes the slots first ... last, which are linked by their 'next' indices.
+        void push_stack(std::atomic<std::uint64_t>& stack, std::uint32_t first, std::uint32_t last, std::uint32_t step) noexcept
+        {
+            std::uint64_t head = stack.load(std::memory_order_relaxed);
+            do
+            {
+                m_slots[last].next.store(static_cast<std::uint32_t>(head), std::memory_order_relaxed);
+            } while (!stack.compare_exchange_weak(head, next_head(head, first + 1, step),
+                std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        bool pop_stack(std::atomic<std::uint64_t>& stack, std::uint32_t step, std::uint32_t& index) noexcept
+        {
+            std::uint64_t head = stack.load(std::memory_order_acquire);
+            for (;;)
+            {
+                const std::uint32_t top = static_cast<std::uint32_t>(head);
+                if (top == 0)
+                    return false;
+
+                // 'next' may be stale if the slot was popped in the meantime; the counter makes the CAS fail then.
+                const std::uint32_t next = m_slots[top - 1].next.load(std::memory_order_relaxed);
+                if (stack.compare_exchange_weak(head, next_head(head, next, step),
+                    std::memory_order_acquire, std::memory_order_acquire))
+                {
+                    index = top - 1;
+                    return true;
+                }
+            }
+        }
+
+        // The head after a change that adds 'step' to the high 32 bits (the bits that overflow are dropped).
+        static std::uint64_t next_head(std::uint64_t head, std::uint32_t top, std::uint32_t step) noexcept
+        {
+            return ((head >> 32) + step) << 32 | top;
+        }
+
+        static std::uint32_t cache_length(std::uint64_t head) noexcept
+        {
+            return static_cast<std::uint32_t>(head >> 32) & ((1u << cache_tag) - 1);
+        }
+
+        cache& local_cache() noexcept
+        {
+            return m_caches[detail::pool_thread_index() & m_cache_mask];
+        }
+
+        const std::uint32_t m_capacity;
+        const std::unique_ptr<slot[]> m_slots;
+        const std::size_t m_cache_mask;
+        const std::unique_ptr<cache[]> m_caches;
+        char m_padding0[detail::pool_padding];
+
+        std::atomic<std::uint64_t> m_free;
+        char m_padding1[detail::pool_padding];
+    };
+
+    template<class T, pool_release Release>
+    constexpr std::uint32_t object_pool<T, Release>::cache_size;
+
+    template<class T, pool_release Release>
+    constexpr std::uint32_t object_pool<T, Release>::cache_tag;
+
+    template<class T, pool_release Release>
+    constexpr std::uint32_t object_pool<T, Release>::free_step;
+
+    template<class T, pool_release Release>
+    constexpr std::uint32_t object_pool<T, Release>::cache_push_step;
+
+    template<class T, pool_release Release>
+    constexpr std::uint32_t object_pool<T, Release>::cache_pop_step;
+} // namespace opt
@@ -0,0 +1,855 @@
+#include <gtest/gtest.h>
+
+#include <optional_algorithm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace opt;
+
+template<typename T>
+static std::vector<optional<T>> make_random_optionals(std::size_t n, double fill, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::bernoulli_distribution engaged(fill);
+    std::uniform_int_distribution<int> value(-1000, 1000);
+
+    std::vector<optional<T>> v(n);
+    for (auto& o : v)
+    {
+        if (engaged(rng))
+            o = static_cast<T>(value(rng));
+    }
+    return v;
+}
+
+TEST(optional_algorithm, Span)
+{
+    std::vector<int> v = { 1, 2, 3, 4, 5 };
+    span<int> s = make_span(v);
+    EXPECT_EQ(s.size(), 5u);
+    EXPECT_EQ(s.data(), v.data());
+    EXPECT_EQ(s[2], 3);
+
+    span<const int> cs = s;
+    EXPECT_EQ(cs.subspan(1, 3).size(), 3u);
+    EXPECT_EQ(cs.subspan(1, 3)[0], 2);
+    EXPECT_EQ(cs.first(2).size(), 2u);
+    EXPECT_EQ(cs.last(2)[0], 4);
+
+    int sum = 0;
+    for (int i : cs)
+        sum += i;
+    EXPECT_EQ(sum, 15);
+}
+
+TEST(optional_algorithm, Hash)
+{
+    std::hash<optional<int>> h;
+    optional<int> o1;
+    optional<int> o2 = nullopt;
+    optional<int> o3 = 0;
+    optional<int> o4 = 0;
+    optional<int> o5 = 1;
+
+    EXPECT_EQ(h(o1), h(o2));
+    EXPECT_EQ(h(o3), h(o4));
+    EXPECT_NE(h(o1), h(o3));
+    EXPECT_NE(h(o3), h(o5));
+
+    // +0.0 == -0.0 so they must hash the same.
+    EXPECT_EQ(hash_value(optional<double>(0.0)), hash_value(optional<double>(-0.0)));
+    EXPECT_EQ(hash_value(optional<float>(0.0f)), hash_value(optional<float>(-0.0f)));
+
+    // Non-arithmetic types go through std::hash.
+    std::hash<optional<std::string>> hs;
+    EXPECT_EQ(hs(optional<std::string>("abc")), hs(optional<std::string>("abc")));
+    EXPECT_EQ(hs(optional<std::string>()), h(o1));
+
+    std::unordered_map<optional<int>, int> m;
+    m[nullopt] = 1;
+    m[1] = 2;
+    m[2] = 3;
+    EXPECT_EQ(m.size(), 3u);
+    EXPECT_EQ(m[optional<int>()], 1);
+    EXPECT_EQ(m[optional<int>(2)], 3);
+}
+
+TEST(optional_algorithm, HashQuality)
+{
+    // Sequential keys must not collide (the mixer is a bijection on 64 bits)
+    // and the low bits (used for bucket selection) must be evenly distributed.
+    const std::size_t n = 1 << 20;
+    const std::size_t buckets = 1 << 10;
+
+    std::unordered_set<std::uint64_t> seen;
+    std::vector<std::size_t> counts(buckets);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        std::uint64_t h = hash_value(optional<std::uint32_t>(static_cast<std::uint32_t>(i)));
+        EXPECT_TRUE(seen.insert(h).second);
+        ++counts[h & (buckets - 1)];
+    }
+    EXPECT_EQ(seen.count(hash_value(optional<std::uint32_t>())), 0u);
+
+    // Chi-squared test with 1023 degrees of freedom (p ~ 0.0001 at 1200).
+    const double expected = static_cast<double>(n) / buckets;
+    double chi2 = 0.0;
+    for (std::size_t c : counts)
+        chi2 += (c - expected) * (c - expected) / expected;
+    EXPECT_LT(chi2, 1200.0);
+}
+
+template<typename T>
+static void check_hash_batch(std::size_t n)
+{
+    auto v = make_random_optionals<T>(n, 0.7, 42);
+    std::vector<std::uint64_t> out(n);
+    hash_batch(span<const optional<T>>(v), out.data());
+
+    for (std::size_t i = 0; i < n; ++i)
+        EXPECT_EQ(out[i], hash_value(v[i]));
+}
+
+TEST(optional_algorithm, HashBatch)
+{
+    check_hash_batch<int>(1000);
+    check_hash_batch<std::int8_t>(1000);
+    check_hash_batch<std::uint64_t>(1000);
+    check_hash_batch<float>(1000);
+    check_hash_batch<double>(1000);
+    check_hash_batch<int>(0);
+    check_hash_batch<int>(1);
+
+    std::vector<optional<double>> v = { -0.0, 0.0, std::numeric_limits<double>::infinity(), nullopt };
+    std::uint64_t out[4];
+    hash_batch(span<const optional<double>>(v), out);
+    EXPECT_EQ(out[0], out[1]);
+    EXPECT_EQ(out[2], hash_value(v[2]));
+    EXPECT_EQ(out[3], hash_value(optional<double>()));
+}
+
+template<typename T>
+static bool nulls_last_less(const optional<T>& a, const optional<T>& b)
+{
+    return (!a) ? false : (!b) ? true : *a < *b;
+}
+
+template<typename T>
+static void check_radix_sort(std::size_t n, double fill)
+{
+    auto v = make_random_optionals<T>(n, fill, 7);
+
+    auto expected = v;
+    std::stable_sort(expected.begin(), expected.end());
+    auto actual = v;
+    radix_sort(make_span(actual));
+    EXPECT_EQ(actual, expected);
+
+    expected = v;
+    std::stable_sort(expected.begin(), expected.end(), nulls_last_less<T>);
+    actual = v;
+    radix_sort(make_span(actual), nulls_order::last);
+    EXPECT_EQ(actual, expected);
+}
+
+TEST(optional_algorithm, RadixSort)
+{
+    check_radix_sort<int>(10000, 0.8);
+    check_radix_sort<std::int8_t>(1000, 0.5);
+    check_radix_sort<std::uint16_t>(1000, 0.5);
+    check_radix_sort<std::int64_t>(10000, 0.9);
+    check_radix_sort<std::uint64_t>(1000, 0.9);
+    check_radix_sort<float>(10000, 0.8);
+    check_radix_sort<double>(10000, 0.8);
+    check_radix_sort<int>(1000, 0.0);
+    check_radix_sort<int>(1000, 1.0);
+    check_radix_sort<int>(1, 1.0);
+    check_radix_sort<int>(0, 1.0);
+
+    const double inf = std::numeric_limits<double>::infinity();
+    std::vector<optional<double>> v = { 1.0, -0.0, nullopt, -inf, 0.0, inf, -1.5, nullopt, -0.0 };
+    auto expected = v;
+    std::stable_sort(expected.begin(), expected.end());
+    radix_sort(make_span(v));
+    ASSERT_EQ(v, expected);
+    // -0.0 and 0.0 compare equal so they must keep their relative order.
+    EXPECT_TRUE(std::signbit(*v[4]));
+    EXPECT_FALSE(std::signbit(*v[5]));
+    EXPECT_TRUE(std::signbit(*v[6]));
+}
+
+TEST(optional_algorithm, RadixSortPayload)
+{
+    const std::size_t n = 10000;
+    auto keys = make_random_optionals<int>(n, 0.7, 3);
+    std::vector<std::size_t> payload(n);
+    for (std::size_t i = 0; i < n; ++i)
+        payload[i] = i;
+
+    std::vector<std::pair<optional<int>, std::size_t>> expected(n);
+    for (std::size_t i = 0; i < n; ++i)
+        expected[i] = std::make_pair(keys[i], i);
+    std::stable_sort(expected.begin(), expected.end(),
+        [](const std::pair<optional<int>, std::size_t>& a, const std::pair<optional<int>, std::size_t>& b) {
+            return a.first < b.first;
+        });
+
+    radix_sort(make_span(keys), make_span(payload));
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        EXPECT_EQ(keys[i], expected[i].first);
+        EXPECT_EQ(payload[i], expected[i].second);
+    }
+
+    std::vector<optional<int>> k = { 3, nullopt, 1, nullopt, 3 };
+    std::vector<std::string> p = { "a", "b", "c", "d", "e" };
+    radix_sort(make_span(k), make_span(p), nulls_order::last);
+    EXPECT_EQ(k, (std::vector<optional<int>>{ 1, 3, 3, nullopt, nullopt }));
+    EXPECT_EQ(p, (std::vector<std::string>{ "c", "a", "e", "b", "d" }));
+}
+
+TEST(optional_algorithm, Compact)
+{
+    auto v = make_random_optionals<int>(10000, 0.5, 11);
+    std::vector<int> expected;
+    for (auto& o : v)
+    {
+        if (o)
+            expected.push_back(*o);
+    }
+
+    EXPECT_EQ(compact(span<const optional<int>>(v)), expected);
+
+    std::vector<int> out(expected.size());
+    EXPECT_EQ(compact(span<const optional<int>>(v), out.data()), expected.size());
+    EXPECT_EQ(out, expected);
+
+    std::vector<optional<std::string>> s = { std::string("a"), nullopt, std::string("b"), nullopt };
+    EXPECT_EQ(compact(span<const optional<std::string>>(s)), (std::vector<std::string>{ "a", "b" }));
+    EXPECT_TRUE(compact(span<const optional<int>>()).empty());
+}
+
+template<typename T>
+static std::vector<optional<T>> reference_forward_fill(std::vector<optional<T>> v, std::size_t max_gap)
+{
+    optional<T> last;
+    std::size_t gap = 0;
+    for (auto& o : v)
+    {
+        if (o)
+        {
+            last = o;
+            gap = 0;
+        }
+        else if (last && ++gap <= max_gap)
+        {
+            o = last;
+        }
+    }
+    return v;
+}
+
+template<typename T>
+static std::vector<optional<T>> reference_backward_fill(std::vector<optional<T>> v, std::size_t max_gap)
+{
+    std::reverse(v.begin(), v.end());
+    v = reference_forward_fill(v, max_gap);
+    std::reverse(v.begin(), v.end());
+    return v;
+}
+
+// Splits optionals into values and a validity bitmap.
+template<typename T>
+static void to_bitmap(const std::vector<optional<T>>& v, std::vector<T>& values, std::vector<std::uint64_t>& validity)
+{
+    values.assign(v.size(), T());
+    validity.assign((v.size() + 63) / 64, 0);
+    for (std::size_t i = 0; i < v.size(); ++i)
+    {
+        if (v[i])
+        {
+            values[i] = *v[i];
+            validity[i / 64] |= std::uint64_t(1) << (i % 64);
+        }
+    }
+}
+
+template<typename T>
+static std::vector<optional<T>> from_bitmap(const std::vector<T>& values, const std::vector<std::uint64_t>& validity)
+{
+    std::vector<optional<T>> v(values.size());
+    for (std::size_t i = 0; i < values.size(); ++i)
+    {
+        if ((validity[i / 64] >> (i % 64)) & 1)
+            v[i] = values[i];
+    }
+    return v;
+}
+
+TEST(optional_algorithm, ForwardFill)
+{
+    std::vector<optional<double>> v = { nullopt, 1.0, nullopt, nullopt, nullopt, 2.0, nullopt };
+    auto f = v;
+    forward_fill(make_span(f));
+    EXPECT_EQ(f, (std::vector<optional<double>>{ nullopt, 1.0, 1.0, 1.0, 1.0, 2.0, 2.0 }));
+
+    f = v;
+    forward_fill(make_span(f), 2);
+    EXPECT_EQ(f, (std::vector<optional<double>>{ nullopt, 1.0, 1.0, 1.0, nullopt, 2.0, 2.0 }));
+
+    f = v;
+    backward_fill(make_span(f));
+    EXPECT_EQ(f, (std::vector<optional<double>>{ 1.0, 1.0, 2.0, 2.0, 2.0, 2.0, nullopt }));
+
+    f = v;
+    backward_fill(make_span(f), 1);
+    EXPECT_EQ(f, (std::vector<optional<double>>{ 1.0, 1.0, nullopt, nullopt, 2.0, 2.0, nullopt }));
+
+    for (double fill : { 0.0, 0.01, 0.3, 0.9, 1.0 })
+    {
+        for (std::size_t max_gap : { std::size_t(0), std::size_t(1), std::size_t(5), std::size_t(100), no_limit })
+        {
+            const auto in = make_random_optionals<int>(2000, fill, 5);
+
+            auto out = in;
+            forward_fill(make_span(out), max_gap);
+            EXPECT_EQ(out, reference_forward_fill(in, max_gap));
+
+            out = in;
+            backward_fill(make_span(out), max_gap);
+            EXPECT_EQ(out, reference_backward_fill(in, max_gap));
+
+            std::vector<int> values;
+            std::vector<std::uint64_t> validity;
+            to_bitmap(in, values, validity);
+            forward_fill(make_span(values), validity.data(), max_gap);
+            EXPECT_EQ(from_bitmap(values, validity), reference_forward_fill(in, max_gap));
+
+            to_bitmap(in, values, validity);
+            backward_fill(make_span(values), validity.data(), max_gap);
+            EXPECT_EQ(from_bitmap(values, validity), reference_backward_fill(in, max_gap));
+        }
+    }
+
+    std::vector<optional<std::string>> s = { nullopt, std::string("a"), nullopt, std::string("b"), nullopt };
+    forward_fill(make_span(s));
+    EXPECT_EQ(s, (std::vector<optional<std::string>>{ nullopt, std::string("a"), std::string("a"), std::string("b"), std::string("b") }));
+}
+
+// Aggregates in[first, last) the slow way.
+template<typename T>
+static std::vector<T> window_values(const std::vector<optional<T>>& in, std::size_t i, std::size_t window)
+{
+    std::vector<T> values;
+    for (std::size_t j = (i + 1 >= window ? i + 1 - window : 0); j <= i; ++j)
+    {
+        if (in[j])
+            values.push_back(*in[j]);
+    }
+    return values;
+}
+
+TEST(optional_algorithm, Rolling)
+{
+    const std::vector<optional<int>> in = { 1, nullopt, 3, 2, nullopt, nullopt, nullopt, 5, 4, 4, nullopt, 1 };
+
+    rolling_sum<int> sum(3);
+    rolling_mean<int> mean(3, 2);
+    rolling_min<int> min(3);
+    rolling_max<int> max(3);
+    rolling_count<int> count(3);
+
+    for (std::size_t i = 0; i < in.size(); ++i)
+    {
+        const auto values = window_values(in, i, 3);
+        const auto s = sum.push(in[i]);
+        const auto m = mean.push(in[i]);
+        const auto lo = min.push(in[i]);
+        const auto hi = max.push(in[i]);
+        EXPECT_EQ(count.push(in[i]), values.size());
+
+        if (values.empty())
+        {
+            EXPECT_FALSE(s);
+            EXPECT_FALSE(lo);
+            EXPECT_FALSE(hi);
+        }
+        else
+        {
+            std::int64_t total = 0;
+            for (int v : values)
+                total += v;
+            EXPECT_EQ(s, total);
+            EXPECT_EQ(lo, *std::min_element(values.begin(), values.end()));
+            EXPECT_EQ(hi, *std::max_element(values.begin(), values.end()));
+        }
+
+        // The mean needs at least 2 observations.
+        if (values.size() < 2)
+        {
+            EXPECT_FALSE(m);
+        }
+        else
+        {
+            double total = 0;
+            for (int v : values)
+                total += v;
+            EXPECT_EQ(m, total / values.size());
+        }
+    }
+
+    sum.reset();
+    EXPECT_FALSE(sum.value());
+    EXPECT_EQ(sum.push(7), std::int64_t(7));
+}
+
+TEST(optional_algorithm, RollingBatch)
+{
+    for (std::size_t window : { 1, 2, 5, 64, 1000 })
+    {
+        for (std::size_t min_count : { 1, 3 })
+        {
+            const auto in = make_random_optionals<double>(500, 0.6, static_cast<unsigned>(window));
+            const auto ints = make_random_optionals<std::int32_t>(500, 0.3, static_cast<unsigned>(window));
+            const std::size_t n = in.size();
+
+            std::vector<optional<double>> sums(n), means(n), mins(n), maxs(n);
+            std::vector<optional<std::int32_t>> int_mins(n);
+            std::vector<std::size_t> counts(n);
+            rolling_sum_batch(span<const optional<double>>(in), make_span(sums), window, min_count);
+            rolling_mean_batch(span<const optional<double>>(in), make_span(means), window, min_count);
+            rolling_min_batch(span<const optional<double>>(in), make_span(mins), window, min_count);
+            rolling_max_batch(span<const optional<double>>(in), make_span(maxs), window, min_count);
+            rolling_min_batch(span<const optional<std::int32_t>>(ints), make_span(int_mins), window, min_count);
+            rolling_count_batch(span<const optional<double>>(in), make_span(counts), window);
+
+            // The batch versions produce exactly the results of the streaming versions.
+            rolling_sum<double> sum(window, min_count);
+            rolling_mean<double> mean(window, min_count);
+            rolling_min<double> min(window, min_count);
+            rolling_max<double> max(window, min_count);
+            rolling_min<std::int32_t> int_min(window, min_count);
+            rolling_count<double> count(window);
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                ASSERT_EQ(sums[i], sum.push(in[i]));
+                ASSERT_EQ(means[i], mean.push(in[i]));
+                ASSERT_EQ(mins[i], min.push(in[i]));
+                ASSERT_EQ(maxs[i], max.push(in[i]));
+                ASSERT_EQ(int_mins[i], int_min.push(ints[i]));
+                ASSERT_EQ(counts[i], count.push(in[i]));
+                ASSERT_EQ(mins[i].has_value(), window_values(in, i, window).size() >= min_count);
+            }
+        }
+    }
+
+    // Compensated sums don't drift when large values leave the window.
+    std::vector<optional<double>> in(1000, 0.1);
+    in[10] = 1e15;
+    std::vector<optional<double>> sums(in.size());
+    rolling_sum_batch(span<const optional<double>>(in), make_span(sums), 10);
+    EXPECT_NEAR(*sums.back(), 1.0, 1e-12);
+}
+
+TEST(optional_algorithm, GroupAggregate)
+{
+    const std::vector<optional<int>> keys = { 2, nullopt, 2, 7, nullopt, 7, 2, 9 };
+    const std::vector<optional<double>> values = { 1.0, 5.0, 3.0, nullopt, nullopt, nullopt, nullopt, -1.0 };
+
+    const auto result = group_aggregate(span<const optional<int>>(keys), span<const optional<double>>(values),
+        agg::count(), agg::sum(), agg::mean(), agg::min(), agg::max());
+
+    // The groups are in the order of their first row.
+    ASSERT_EQ(result.size(), 4u);
+    EXPECT_EQ(result.keys, (std::vector<optional<int>>{ 2, nullopt, 7, 9 }));
+    EXPECT_EQ(std::get<0>(result.aggregates), (std::vector<std::size_t>{ 2, 1, 0, 1 }));
+    EXPECT_EQ(std::get<1>(result.aggregates), (std::vector<optional<double>>{ 4.0, 5.0, nullopt, -1.0 }));
+    EXPECT_EQ(std::get<2>(result.aggregates), (std::vector<optional<double>>{ 2.0, 5.0, nullopt, -1.0 }));
+    EXPECT_EQ(std::get<3>(result.aggregates), (std::vector<optional<double>>{ 1.0, 5.0, nullopt, -1.0 }));
+    EXPECT_EQ(std::get<4>(result.aggregates), (std::vector<optional<double>>{ 3.0, 5.0, nullopt, -1.0 }));
+
+    // Many groups (the table grows) compared to std::unordered_map.
+    const auto many_keys = make_random_optionals<std::int32_t>(20000, 0.95, 1);
+    const auto many_values = make_random_optionals<std::int32_t>(20000, 0.7, 2);
+    const auto many = group_aggregate(span<const optional<std::int32_t>>(many_keys),
+        span<const optional<std::int32_t>>(many_values), agg::sum(), agg::count());
+
+    std::unordered_map<std::int64_t, std::pair<std::int64_t, std::size_t>> expected;
+    for (std::size_t i = 0; i < many_keys.size(); ++i)
+    {
+        auto& e = expected[many_keys[i] ? *many_keys[i] : std::numeric_limits<std::int64_t>::min()];
+        e.first += many_values[i] ? *many_values[i] : 0;
+        e.second += many_values[i].has_value();
+    }
+
+    ASSERT_EQ(many.size(), expected.size());
+    for (std::size_t g = 0; g < many.size(); ++g)
+    {
+        const auto& e = expected[many.keys[g] ? *many.keys[g] : std::numeric_limits<std::int64_t>::min()];
+        ASSERT_EQ(std::get<0>(many.aggregates)[g], e.second > 0 ? optional<std::int64_t>(e.first) : nullopt);
+        ASSERT_EQ(std::get<1>(many.aggregates)[g], e.second);
+    }
+}
+
+// The scans by definition: the aggregate of the engaged elements of in[0, i].
+template<typename T, typename Op>
+static std::vector<detail::scan_output_t<Op, T>> reference_scan(const std::vector<optional<T>>& in, Op, bool inclusive,
+    null_output nulls)
+{
+    std::vector<detail::scan_output_t<Op, T>> out(in.size());
+    for (std::size_t i = 0; i < in.size(); ++i)
+    {
+        detail::aggregator<Op, T> state;
+        for (std::size_t j = 0; j < i + inclusive; ++j)
+        {
+            if (in[j])
+                state.add(*in[j]);
+        }
+        if (nulls == null_output::running || in[i])
+            out[i] = state.result();
+    }
+    return out;
+}
+
+template<typename T, typename Op>
+static void check_scans(const std::vector<optional<T>>& in, Op op)
+{
+    for (null_output nulls : { null_output::running, null_output::null })
+    {
+        std::vector<detail::scan_output_t<Op, T>> out(in.size());
+        inclusive_scan_skip_null(span<const optional<T>>(in), make_span(out), op, nulls);
+        EXPECT_EQ(out, reference_scan(in, op, true, nulls));
+        exclusive_scan_skip_null(span<const optional<T>>(in), make_span(out), op, nulls);
+        EXPECT_EQ(out, reference_scan(in, op, false, nulls));
+    }
+}
+
+TEST(optional_algorithm, ScanSkipNull)
+{
+    const std::vector<optional<int>> in = { nullopt, 3, nullopt, 1, 5, nullopt };
+    span<const optional<int>> s(in);
+
+    std::vector<optional<std::int64_t>> sums(in.size());
+    inclusive_scan_skip_null(s, make_span(sums), agg::sum());
+    EXPECT_EQ(sums, (std::vector<optional<std::int64_t>>{ nullopt, 3, 3, 4, 9, 9 }));
+    inclusive_scan_skip_null(s, make_span(sums), agg::sum(), null_output::null);
+    EXPECT_EQ(sums, (std::vector<optional<std::int64_t>>{ nullopt, 3, nullopt, 4, 9, nullopt }));
+    exclusive_scan_skip_null(s, make_span(sums), agg::sum());
+    EXPECT_EQ(sums, (std::vector<optional<std::int64_t>>{ nullopt, nullopt, 3, 3, 4, 9 }));
+    exclusive_scan_skip_null(s, make_span(sums), agg::sum(), null_output::null);
+    EXPECT_EQ(sums, (std::vector<optional<std::int64_t>>{ nullopt, nullopt, nullopt, 3, 4, nullopt }));
+
+    std::vector<optional<std::size_t>> counts(in.size());
+    inclusive_scan_skip_null(s, make_span(counts), agg::count());
+    EXPECT_EQ(counts, (std::vector<optional<std::size_t>>{ 0, 1, 1, 2, 3, 3 }));
+
+    std::vector<optional<int>> mins(in.size());
+    inclusive_scan_skip_null(s, make_span(mins), agg::min());
+    EXPECT_EQ(mins, (std::vector<optional<int>>{ nullopt, 3, 3, 1, 1, 1 }));
+
+    // Stale values in the storage of disengaged elements are ignored.
+    std::vector<optional<double>> stale = { 1.0, 100.0, -100.0, 2.0 };
+    stale[1].reset();
+    stale[2].reset();
+    check_scans(stale, agg::sum());
+    check_scans(stale, agg::min());
+    check_scans(stale, agg::max());
+
+    for (double fill : { 0.0, 0.3, 1.0 })
+    {
+        const auto doubles = make_random_optionals<double>(300, fill, 3);
+        check_scans(doubles, agg::count());
+        check_scans(doubles, agg::sum());
+        check_scans(doubles, agg::mean());
+        check_scans(doubles, agg::min());
+        check_scans(doubles, agg::max());
+
+        const auto ints = make_random_optionals<std::int16_t>(300, fill, 4);
+        check_scans(ints, agg::sum());
+        check_scans(ints, agg::min());
+        check_scans(ints, agg::max());
+
+        std::vector<optional<std::string>> strings(ints.size());
+        for (std::size_t i = 0; i < ints.size(); ++i)
+        {
+            if (ints[i])
+                strings[i] = std::to_string(*ints[i]);
+        }
+        check_scans(strings, agg::min());
+        check_scans(strings, agg::count());
+    }
+}
+
+TEST(optional_algorithm, Join)
+{
+    const std::vector<optional<int>> left = { 3, nullopt, 1, 3, 5 };
+    const std::vector<optional<int>> right = { nullopt, 3, 4, 1, 3 };
+    span<const optional<int>> l(left);
+    span<const optional<int>> r(right);
+
+    // Disengaged keys never match, not even each other.
+    const join_result hashed = hash_join(l, r);
+    EXPECT_EQ(hashed.left, (std::vector<std::size_t>{ 0, 3, 2, 0, 3 }));
+    EXPECT_EQ(hashed.right, (std::vector<std::size_t>{ 1, 1, 3, 4, 4 }));
+
+    const join_result merged = merge_join(l, r);
+    EXPECT_EQ(merged.left, (std::vector<std::size_t>{ 2, 0, 0, 3, 3 }));
+    EXPECT_EQ(merged.right, (std::vector<std::size_t>{ 3, 1, 4, 1, 4 }));
+
+    EXPECT_EQ(hash_join(r, span<const optional<int>>()).size(), 0u);
+    EXPECT_EQ(merge_join(span<const optional<int>>(), l).size(), 0u);
+
+    // Many duplicate keys compared to a nested loop join.
+    const auto many_left = make_random_optionals<std::int64_t>(3000, 0.8, 3);
+    const auto many_right = make_random_optionals<std::int64_t>(2000, 0.8, 4);
+    std::vector<std::pair<std::size_t, std::size_t>> expected;
+    for (std::size_t j = 0; j < many_right.size(); ++j)
+    {
+        for (std::size_t i = 0; i < many_left.size(); ++i)
+        {
+            if (many_left[i] && many_left[i] == many_right[j])
+                expected.emplace_back(i, j);
+        }
+    }
+
+    for (const join_result& result : { hash_join(span<const optional<std::int64_t>>(many_left), span<const optional<std::int64_t>>(many_right)),
+                                       merge_join(span<const optional<std::int64_t>>(many_left), span<const optional<std::int64_t>>(many_right)) })
+    {
+        ASSERT_EQ(result.left.size(), result.right.size());
+        std::vector<std::pair<std::size_t, std::size_t>> actual;
+        for (std::size_t m = 0; m < result.size(); ++m)
+            actual.emplace_back(result.left[m], result.right[m]);
+        std::sort(actual.begin(), actual.end(), [](const std::pair<std::size_t, std::size_t>& a, const std::pair<std::size_t, std::size_t>& b) {
+            return a.second != b.second ? a.second < b.second : a.first < b.first;
+        });
+        EXPECT_EQ(actual, expected);
+    }
+}
+
+// Interpolates every disengaged element on its own (see opt::interpolate).
+static std::vector<optional<double>> naive_interpolate(const std::vector<optional<double>>& in, const std::vector<double>& times,
+    interpolation method, std::size_t max_gap, extrapolation_limits limits)
+{
+    std::vector<optional<double>> out = in;
+    const std::ptrdiff_t n = static_cast<std::ptrdiff_t>(in.size());
+    for (std::ptrdiff_t i = 0; i < n; ++i)
+    {
+        if (in[i])
+            continue;
+        std::ptrdiff_t l = i, r = i;
+        while (l >= 0 && !in[l])
+            --l;
+        while (r < n && !in[r])
+            ++r;
+
+        if (l >= 0 && r < n)
+        {
+            if (static_cast<std::size_t>(r - l - 1) > max_gap)
+                continue;
+            if (method == interpolation::linear)
+                out[i] = *in[l] + (*in[r] - *in[l]) / (times[r] - times[l]) * (times[i] - times[l]);
+            else if (method == interpolation::nearest)
+                out[i] = (times[i] - times[l] > times[r] - times[i]) ? *in[r] : *in[l];
+            else
+                out[i] = *in[l];
+        }
+        else if (r < n && static_cast<std::size_t>(r - i) <= limits.before)
+        {
+            out[i] = *in[r];
+        }
+        else if (l >= 0 && static_cast<std::size_t>(i - l) <= limits.after)
+        {
+            out[i] = *in[l];
+        }
+    }
+    return out;
+}
+
+TEST(optional_algorithm, Interpolate)
+{
+    {
+        std::vector<optional<double>> v = { nullopt, 1.0, nullopt, nullopt, 4.0, nullopt, nullopt };
+        const std::vector<double> t = { 0.0, 1.0, 2.0, 2.5, 4.0, 5.0, 6.0 };
+        interpolate(make_span(v), span<const double>(t), interpolation::linear);
+        EXPECT_EQ(v, (std::vector<optional<double>>{ nullopt, 1.0, 2.0, 2.5, 4.0, nullopt, nullopt }));
+    }
+    {
+        std::vector<optional<double>> v = { nullopt, 1.0, nullopt, nullopt, 4.0, nullopt, nullopt };
+        const std::vector<double> t = { 0.0, 1.0, 2.0, 2.5, 4.0, 5.0, 6.0 };
+        interpolate(make_span(v), span<const double>(t), interpolation::nearest, no_limit, extrapolation_limits(1, 1));
+        EXPECT_EQ(v, (std::vector<optional<double>>{ 1.0, 1.0, 1.0, 1.0, 4.0, 4.0, nullopt }));
+    }
+    {
+        std::vector<optional<double>> v = { 1.0, nullopt, nullopt, 4.0, nullopt, 6.0 };
+        const std::vector<std::int64_t> t = { 0, 1, 2, 3, 4, 5 };
+        interpolate(make_span(v), span<const std::int64_t>(t), interpolation::step, 1);
+        EXPECT_EQ(v, (std::vector<optional<double>>{ 1.0, nullopt, nullopt, 4.0, 4.0, 6.0 }));
+    }
+
+    // Both layouts and the streaming version (in chunks of random sizes) compared to the naive version.
+    std::mt19937 rng(37);
+    const std::size_t n = 3000;
+    std::vector<double> times(n);
+    std::uniform_real_distribution<double> step(0.1, 2.0);
+    for (std::size_t i = 1; i < n; ++i)
+        times[i] = times[i - 1] + step(rng);
+
+    for (double fill : { 0.02, 0.5, 0.97 })
+    {
+        const auto in = make_random_optionals<double>(n, fill, 3);
+        for (interpolation method : { interpolation::linear, interpolation::nearest, interpolation::step })
+        {
+            for (std::size_t max_gap : { std::size_t(0), std::size_t(3), std::size_t(100), no_limit })
+            {
+                for (extrapolation_limits limits : { extrapolation_limits(), extrapolation_limits(2, 70), extrapolation_limits(no_limit, no_limit) })
+                {
+                    const auto expected = naive_interpolate(in, times, method, max_gap, limits);
+
+                    auto actual = in;
+                    interpolate(make_span(actual), span<const double>(times), method, max_gap, limits);
+                    ASSERT_EQ(actual.size(), expected.size());
+                    for (std::size_t i = 0; i < n; ++i)
+                    {
+                        ASSERT_EQ(actual[i].has_value(), expected[i].has_value());
+                        if (actual[i])
+                        {
+                            ASSERT_NEAR(*actual[i], *expected[i], 1e-9);
+                        }
+                    }
+
+                    std::vector<double> values(n);
+                    std::vector<std::uint64_t> validity((n + 63) / 64);
+                    for (std::size_t i = 0; i < n; ++i)
+                    {
+                        if (in[i])
+                        {
+                            values[i] = *in[i];
+                            validity[i / 64] |= std::uint64_t(1) << (i % 64);
+                        }
+                    }
+                    interpolate(make_span(values), validity.data(), span<const double>(times), method, max_gap, limits);
+                    for (std::size_t i = 0; i < n; ++i)
+                    {
+                        ASSERT_EQ(((validity[i / 64] >> (i % 64)) & 1) != 0, actual[i].has_value());
+                        if (actual[i])
+                        {
+                            ASSERT_EQ(values[i], *actual[i]);
+                        }
+                    }
+
+                    interpolator<double> stream(method, max_gap, limits);
+                    std::vector<optional<double>> streamed;
+                    std::uniform_int_distribution<std::size_t> chunk(0, 200);
+                    for (std::size_t i = 0; i < n; )
+                    {
+                        const std::size_t count = std::min(n - i, chunk(rng));
+                        stream.push(span<const optional<double>>(in.data() + i, count), span<const double>(times.data() + i, count), streamed);
+                        i += count;
+                        ASSERT_EQ(streamed.size() + stream.pending(), i);
+                    }
+                    stream.finish(streamed);
+                    EXPECT_EQ(streamed, actual);
+                }
+            }
+        }
+    }
+}
+
+TEST(optional_algorithm, DiffPatch)
+{
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const std::vector<optional<double>> old_values = { 1.0, nullopt, 3.0, nan, 0.0, nullopt };
+    const std::vector<optional<double>> new_values = { 1.0, 2.0, nullopt, nan, -0.0, nullopt, nullopt, 8.0 };
+
+    // NaN is unchanged (same bits), -0.0 is a change.
+    const auto patch = diff(span<const optional<double>>(old_values), span<const optional<double>>(new_values));
+    EXPECT_EQ(patch.size, new_values.size());
+    EXPECT_EQ(patch.positions, (std::vector<std::size_t>{ 1, 2, 4, 7 }));
+    EXPECT_EQ(patch.engaged, (std::vector<std::uint64_t>{ 0xd }));
+    ASSERT_EQ(patch.values.size(), 3u);
+    EXPECT_EQ(patch.values[0], 2.0);
+    EXPECT_TRUE(std::signbit(patch.values[1]));
+    EXPECT_EQ(patch.values[2], 8.0);
+
+    std::vector<optional<double>> data = old_values;
+    apply_patch(data, patch);
+    ASSERT_EQ(data.size(), new_values.size());
+    for (std::size_t i = 0; i < data.size(); ++i)
+    {
+        ASSERT_EQ(data[i].has_value(), new_values[i].has_value());
+        if (data[i])
+        {
+            EXPECT_EQ(std::memcmp(&*data[i], &*new_values[i], sizeof(double)), 0);
+        }
+    }
+
+    // Shrinking.
+    std::vector<optional<double>> shrunk = new_values;
+    apply_patch(shrunk, diff(span<const optional<double>>(new_values), span<const optional<double>>(old_values)));
+    EXPECT_EQ(shrunk.size(), old_values.size());
+    EXPECT_EQ(shrunk[4], 0.0);
+
+    // Random mutations of long ranges, with directly stored values (the disengaged elements
+    // keep stale values, so blocks can differ in their bytes only) and with strings.
+    std::mt19937 rng(39);
+    for (double rate : { 0.0, 0.001, 0.05, 1.0 })
+    {
+        std::bernoulli_distribution mutate(rate);
+        const auto a = make_random_optionals<std::int64_t>(10000, 0.7, 5);
+        auto b = a;
+        for (std::size_t i = 0; i < b.size(); ++i)
+        {
+            if (!mutate(rng))
+            {
+                if (!b[i] && rng() % 50 == 0)
+                {
+                    // A stale value in the storage of a disengaged element is not a change.
+                    b[i] = 42;
+                    b[i].reset();
+                }
+                continue;
+            }
+            if (b[i] && rng() % 2 == 0)
+                b[i] = *b[i] + 1;
+            else if (b[i])
+                b[i].reset();
+            else
+                b[i] = 1;
+        }
+
+        const auto p = diff(span<const optional<std::int64_t>>(a), span<const optional<std::int64_t>>(b));
+        std::vector<std::size_t> actual_positions;
+        for (std::size_t i = 0; i < a.size(); ++i)
+        {
+            if (a[i] != b[i])
+                actual_positions.push_back(i);
+        }
+        EXPECT_EQ(p.positions, actual_positions);
+
+        std::vector<optional<std::int64_t>> patched = a;
+        apply_patch(make_span(patched), p);
+        EXPECT_EQ(patched, b);
+
+        std::vector<optional<std::string>> sa(a.size()), sb(b.size());
+        for (std::size_t i = 0; i < a.size(); ++i)
+        {
+            if (a[i])
+                sa[i] = std::to_string(*a[i]);
+            if (b[i])
+                sb[i] = std::to_string(*b[i]);
+        }
+        const auto sp = diff(span<const optional<std::string>>(sa), span<const optional<std::string>>(sb));
+        EXPECT_EQ(sp.positions, actual_positions);
+        apply_patch(make_span(sa), sp);
+        EXPECT_EQ(sa, sb);
+    }
+}
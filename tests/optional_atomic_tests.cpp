@@ -0,0 +1,810 @@
+#include <gtest/gtest.h>
+
+#include <optional_atomic.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <typeinfo>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace opt;
+
+namespace
+{
+    struct rgb
+    {
+        std::uint8_t r, g, b;
+
+        bool operator==(const rgb& other) const
+        {
+            return r == other.r && g == other.g && b == other.b;
+        }
+    };
+
+    struct triple
+    {
+        std::int32_t a, b, c;
+
+        bool operator==(const triple& other) const
+        {
+            return a == other.a && b == other.b && c == other.c;
+        }
+    };
+
+    // 16 bytes without a spare byte for the engaged flag.
+    struct pair64
+    {
+        std::uint64_t first, second;
+
+        bool operator==(const pair64& other) const
+        {
+            return first == other.first && second == other.second;
+        }
+    };
+
+    // 16 bytes with a niche (a size that no range has).
+    struct range
+    {
+        std::uint64_t offset, size;
+
+        bool operator==(const range& other) const
+        {
+            return offset == other.offset && size == other.size;
+        }
+    };
+}
+
+namespace opt
+{
+    template<>
+    struct atomic_optional_niche<range> : std::true_type
+    {
+        static range get() noexcept
+        {
+            return range{ 0, ~std::uint64_t(0) };
+        }
+    };
+}
+
+// An int64 cell that never holds INT64_MIN.
+using int64_niche = atomic_optional_niche_value<std::int64_t, std::numeric_limits<std::int64_t>::min()>;
+
+template<typename T, typename Niche = atomic_optional_niche<T>>
+static void check_atomic_optional(T a, T b)
+{
+    atomic_optional<T, Niche> cell;
+    EXPECT_TRUE(cell.is_lock_free());
+    EXPECT_FALSE(cell.has_value());
+    EXPECT_EQ(cell.load(), nullopt);
+
+    cell.store(a);
+    EXPECT_TRUE(cell.has_value());
+    EXPECT_EQ(cell.load(), a);
+
+    EXPECT_EQ(cell.exchange(b), a);
+    EXPECT_EQ(cell.load(), b);
+
+    // compare_exchange fails with the wrong expected value (engaged or not) and returns the current one.
+    optional<T> expected = a;
+    EXPECT_FALSE(cell.compare_exchange_strong(expected, a));
+    EXPECT_EQ(expected, b);
+    expected = nullopt;
+    EXPECT_FALSE(cell.compare_exchange_strong(expected, a));
+    EXPECT_EQ(expected, b);
+    EXPECT_TRUE(cell.compare_exchange_strong(expected, nullopt));
+    EXPECT_EQ(cell.load(), nullopt);
+    expected = nullopt;
+    while (!cell.compare_exchange_weak(expected, a))
+        ASSERT_EQ(expected, nullopt);
+    EXPECT_EQ(cell.load(), a);
+
+    // Only an empty cell is filled by try_emplace_if_empty.
+    EXPECT_FALSE(cell.try_emplace_if_empty(b));
+    EXPECT_EQ(cell.take(), a);
+    EXPECT_EQ(cell.take(), nullopt);
+    EXPECT_TRUE(cell.try_emplace_if_empty(b));
+    EXPECT_EQ(cell.load(), b);
+
+    cell.reset();
+    EXPECT_FALSE(cell.has_value());
+
+    atomic_optional<T, Niche> engaged(a);
+    EXPECT_EQ(engaged.load(std::memory_order_acquire), a);
+}
+
+TEST(optional_atomic, Basic)
+{
+    check_atomic_optional<std::uint8_t>(0, 255);
+    check_atomic_optional<std::int16_t>(-1, 7);
+    check_atomic_optional<rgb>(rgb{ 1, 2, 3 }, rgb{ 0, 0, 0 });
+    check_atomic_optional<std::int32_t>(0, -1);
+    check_atomic_optional<float>(0.0f, 1.5f);
+    check_atomic_optional<double>(0.0, -2.5);
+    check_atomic_optional<const void*>(nullptr, &typeid(int));
+    check_atomic_optional<std::int64_t, int64_niche>(0, -1);
+#if OPT_HAS_DOUBLE_WIDTH_CAS
+    check_atomic_optional<std::int64_t>(0, -1);
+    check_atomic_optional<std::uint64_t>(~std::uint64_t(0), 1);
+    check_atomic_optional<triple>(triple{ 1, 2, 3 }, triple{ 0, 0, 0 });
+    check_atomic_optional<range>(range{ 0, 0 }, range{ 16, 4096 });
+#endif
+}
+
+TEST(optional_atomic, Layout)
+{
+    // The flag is packed into a spare byte, doubles and pointers use a niche.
+    EXPECT_EQ(sizeof(atomic_optional<std::uint8_t>), 4u);
+    EXPECT_EQ(sizeof(atomic_optional<rgb>), 4u);
+    EXPECT_EQ(sizeof(atomic_optional<float>), 8u);
+    EXPECT_EQ(sizeof(atomic_optional<double>), 8u);
+    EXPECT_EQ(sizeof(atomic_optional<const void*>), sizeof(void*));
+    EXPECT_EQ(sizeof(atomic_optional<std::int64_t, int64_niche>), 8u);
+#if OPT_HAS_DOUBLE_WIDTH_CAS
+    EXPECT_EQ(sizeof(atomic_optional<std::int64_t>), 16u);
+    EXPECT_EQ(sizeof(atomic_optional<range>), 16u);
+#endif
+
+    // A value of 16 bytes without a niche has no room for the flag, so it is rejected.
+    EXPECT_GT(detail::atomic_optional_layout<pair64>::size, detail::atomic_cell_max_size);
+
+    // Other NaNs are values.
+    atomic_optional<double> cell(std::numeric_limits<double>::quiet_NaN());
+    EXPECT_TRUE(cell.has_value());
+
+    // A double with the bits of the niche is stored as the default quiet NaN.
+    const double niche = atomic_optional_niche<double>::get();
+    cell.store(niche);
+    ASSERT_TRUE(cell.has_value());
+    const double stored = *cell.load();
+    EXPECT_TRUE(std::isnan(stored));
+    EXPECT_NE(std::memcmp(&stored, &niche, sizeof(niche)), 0);
+    EXPECT_TRUE(cell.exchange(niche).has_value());
+}
+
+#if OPT_HAS_DOUBLE_WIDTH_CAS
+TEST(optional_atomic, VersionedCell)
+{
+    // Writers alternate between values and resets; a load that combined the value of
+    // one write with the flag of another would return an engaged 0, which is never stored.
+    atomic_optional<std::int64_t> cell;
+    std::atomic<bool> done(false);
+    std::atomic<int> torn(0);
+
+    std::vector<std::thread> threads;
+    for (int w = 0; w < 2; ++w)
+    {
+        threads.emplace_back([&, w]() {
+            for (std::int64_t i = 1; i <= 50000; ++i)
+            {
+                cell.store(i * 2 + w);
+                cell.reset();
+                std::int64_t expected_value = i * 2 + w;
+                optional<std::int64_t> expected = expected_value;
+                cell.compare_exchange_strong(expected, -expected_value);
+            }
+        });
+    }
+    for (int r = 0; r < 2; ++r)
+    {
+        threads.emplace_back([&]() {
+            while (!done.load())
+            {
+                if (cell.load() == std::int64_t(0))
+                    ++torn;
+            }
+        });
+    }
+    threads[0].join();
+    threads[1].join();
+    done = true;
+    threads[2].join();
+    threads[3].join();
+    EXPECT_EQ(torn.load(), 0);
+
+#if defined(__linux__)
+    // Loads don't write to the cell, so it can be read from read-only memory.
+    const long page = sysconf(_SC_PAGESIZE);
+    void* memory = mmap(nullptr, static_cast<std::size_t>(page), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(memory, MAP_FAILED);
+    const auto* read_only = new (memory) atomic_optional<std::int64_t>(42);
+    ASSERT_EQ(mprotect(memory, static_cast<std::size_t>(page), PROT_READ), 0);
+    EXPECT_EQ(read_only->load(), std::int64_t(42));
+    EXPECT_TRUE(read_only->has_value());
+    munmap(memory, static_cast<std::size_t>(page));
+#endif
+}
+#endif
+
+template<typename T>
+static void check_handoff()
+{
+    // Producers hand values to consumers through a single cell: every value is taken exactly once.
+    const std::int32_t per_producer = 20000;
+    const int producers = 2;
+    const int consumers = 2;
+
+    atomic_optional<T> cell;
+    std::atomic<std::int64_t> taken_sum(0);
+    std::atomic<std::int32_t> taken_count(0);
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&, p]() {
+            for (std::int32_t i = 1; i <= per_producer; ++i)
+            {
+                while (!cell.try_emplace_if_empty(static_cast<T>(i + p * per_producer)))
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for (int c = 0; c < consumers; ++c)
+    {
+        threads.emplace_back([&]() {
+            while (taken_count.load() < producers * per_producer)
+            {
+                const optional<T> v = cell.take();
+                if (v)
+                {
+                    taken_sum += static_cast<std::int64_t>(*v);
+                    ++taken_count;
+                }
+                else
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    const std::int64_t n = producers * per_producer;
+    EXPECT_EQ(taken_count.load(), n);
+    EXPECT_EQ(taken_sum.load(), n * (n + 1) / 2);
+    EXPECT_FALSE(cell.has_value());
+}
+
+TEST(optional_atomic, Concurrent)
+{
+    check_handoff<std::int32_t>();
+    check_handoff<double>();
+#if OPT_HAS_DOUBLE_WIDTH_CAS
+    check_handoff<std::int64_t>();
+#endif
+}
+
+TEST(optional_atomic, Seqlock)
+{
+    seqlock_optional<triple> cell;
+    EXPECT_FALSE(cell.has_value());
+    EXPECT_EQ(cell.load(), nullopt);
+
+    cell.store(triple{ 1, 2, 3 });
+    EXPECT_TRUE(cell.has_value());
+    EXPECT_EQ(cell.load(), (triple{ 1, 2, 3 }));
+    cell.reset();
+    EXPECT_EQ(cell.load(), nullopt);
+    cell.store(nullopt);
+    EXPECT_FALSE(cell.has_value());
+
+    seqlock_optional<rgb> small(rgb{ 4, 5, 6 });
+    EXPECT_EQ(small.load(), (rgb{ 4, 5, 6 }));
+}
+
+TEST(optional_atomic, SeqlockConcurrent)
+{
+    // A large value whose words are all equal: readers must never see a torn copy.
+    struct block
+    {
+        std::uint64_t words[37];
+    };
+
+    seqlock_optional<block> cell;
+    std::atomic<bool> done(false);
+
+    std::thread writer([&]() {
+        block b;
+        for (std::uint64_t i = 1; i <= 20000; ++i)
+        {
+            if (i % 3 == 0)
+            {
+                cell.reset();
+                continue;
+            }
+            for (auto& w : b.words)
+                w = i;
+            cell.store(b);
+            if (i % 64 == 0)
+                std::this_thread::yield();
+        }
+        done = true;
+    });
+
+    std::vector<std::thread> readers;
+    std::atomic<std::size_t> torn(0);
+    for (int r = 0; r < 3; ++r)
+    {
+        readers.emplace_back([&]() {
+            std::uint64_t last = 0;
+            while (!done)
+            {
+                const optional<block> b = cell.load();
+                if (!b)
+                    continue;
+                for (auto w : b->words)
+                    torn += w != b->words[0];
+                // Values never go back in time.
+                torn += b->words[0] < last;
+                last = b->words[0];
+            }
+        });
+    }
+
+    writer.join();
+    for (auto& r : readers)
+        r.join();
+    EXPECT_EQ(torn.load(), 0u);
+}
+
+TEST(optional_atomic, Once)
+{
+    once_optional<std::string> once;
+    EXPECT_FALSE(once.has_value());
+    EXPECT_EQ(once.get(), nullopt);
+
+    // A failed initialization is retried by the next call.
+    EXPECT_THROW(once.get_or_init([]() -> std::string { throw std::runtime_error("failed"); }), std::runtime_error);
+    EXPECT_FALSE(once.has_value());
+
+    EXPECT_EQ(once.get_or_init([]() { return std::string("first"); }), "first");
+    EXPECT_EQ(once.get_or_init([]() { return std::string("second"); }), "first");
+    EXPECT_TRUE(once.has_value());
+    EXPECT_EQ(*once.get(), "first");
+
+    const once_optional<std::string>& c = once;
+    EXPECT_EQ(&*c.get(), &*once.get());
+}
+
+TEST(optional_atomic, OnceConcurrent)
+{
+    // The first initialization throws (after the other threads started waiting) and is
+    // retried by one of the waiting threads. All threads see the same value.
+    once_optional<int> once;
+    std::atomic<int> calls(0);
+    std::atomic<int> failures(0);
+    std::vector<const int*> seen(8, nullptr);
+
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < seen.size(); ++t)
+    {
+        threads.emplace_back([&, t]() {
+            try
+            {
+                seen[t] = &once.get_or_init([&]() {
+                    const int call = ++calls;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                    if (call == 1)
+                        throw std::runtime_error("failed");
+                    return 42;
+                });
+            }
+            catch (const std::runtime_error&)
+            {
+                ++failures;
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    EXPECT_EQ(calls.load(), 2);
+    EXPECT_EQ(failures.load(), 1);
+    for (const int* p : seen)
+    {
+        if (p)
+        {
+            EXPECT_EQ(p, &*once.get());
+        }
+    }
+    EXPECT_EQ(*once.get(), 42);
+}
+
+TEST(optional_atomic, Waitable)
+{
+    waitable_optional<std::string> slot;
+    EXPECT_FALSE(slot.has_value());
+    EXPECT_EQ(slot.try_get(), nullopt);
+    EXPECT_EQ(slot.wait_for(std::chrono::milliseconds(5)), nullopt);
+
+    EXPECT_EQ(slot.emplace(3, 'x'), "xxx");
+    EXPECT_TRUE(slot.has_value());
+    EXPECT_EQ(slot.wait(), std::string("xxx"));
+    EXPECT_EQ(&*slot.wait_for(std::chrono::seconds(0)), &*slot.try_get());
+
+    slot.reset();
+    EXPECT_FALSE(slot.has_value());
+
+    // The state is a single word next to the optional.
+    EXPECT_EQ(sizeof(waitable_optional<std::int32_t>), sizeof(optional<std::int32_t>) + sizeof(std::uint32_t));
+}
+
+TEST(optional_atomic, WaitableConcurrent)
+{
+    // Every worker waits on its own slot; the slots are published in reverse order.
+    std::vector<waitable_optional<int>> slots(8);
+    std::vector<int> seen(slots.size(), -1);
+    std::atomic<int> timeouts(0);
+
+    std::vector<std::thread> workers;
+    for (std::size_t i = 0; i < slots.size(); ++i)
+    {
+        workers.emplace_back([&, i]() {
+            // Some workers poll with a timeout until the value arrives.
+            optional<int&> value = i % 2 ? slots[i].wait() : slots[i].wait_for(std::chrono::milliseconds(1));
+            while (!value)
+            {
+                ++timeouts;
+                value = slots[i].wait_for(std::chrono::milliseconds(1));
+            }
+            seen[i] = *value;
+        });
+    }
+
+    // Nothing is published before a worker has timed out, so the timeout path always runs.
+    while (timeouts.load() == 0)
+        std::this_thread::yield();
+    for (std::size_t i = slots.size(); i-- > 0;)
+        slots[i].emplace(static_cast<int>(i) * 10);
+    for (auto& w : workers)
+        w.join();
+
+    for (std::size_t i = 0; i < slots.size(); ++i)
+        EXPECT_EQ(seen[i], static_cast<int>(i) * 10);
+    EXPECT_GT(timeouts.load(), 0);
+}
+
+TEST(optional_atomic, Shared)
+{
+    EXPECT_EQ(sizeof(shared_atomic_optional<std::int32_t>), 8u);
+    EXPECT_TRUE(std::is_standard_layout<shared_atomic_optional<rgb>>::value);
+
+    // Zero-filled memory is an empty cell.
+    alignas(8) unsigned char memory[8];
+    std::memset(memory, 0, sizeof(memory));
+    auto& cell = *reinterpret_cast<shared_atomic_optional<std::int32_t>*>(memory);
+    EXPECT_FALSE(cell.has_value());
+    EXPECT_EQ(cell.take(), nullopt);
+    EXPECT_EQ(cell.wait_take_for(std::chrono::milliseconds(5)), nullopt);
+
+    cell.store(-7);
+    EXPECT_EQ(cell.load(), -7);
+    cell.store(0);
+    EXPECT_TRUE(cell.has_value());
+    EXPECT_EQ(cell.wait_take(), 0);
+    EXPECT_EQ(cell.take(), nullopt);
+    cell.store(3);
+    cell.reset();
+    EXPECT_EQ(cell.load(), nullopt);
+
+    shared_atomic_optional<rgb> color;
+    color.store(rgb{ 1, 2, 3 });
+    EXPECT_EQ(color.take(), (rgb{ 1, 2, 3 }));
+}
+
+#if defined(__linux__)
+TEST(optional_atomic, SharedProcesses)
+{
+    // Two cells in a mapped file: a request and a reply mailbox.
+    std::FILE* file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    const int fd = fileno(file);
+    ASSERT_EQ(ftruncate(fd, 4096), 0);
+    void* memory = mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ASSERT_NE(memory, MAP_FAILED);
+    auto* cells = static_cast<shared_atomic_optional<std::int32_t>*>(memory);
+    shared_atomic_optional<std::int32_t>& request = cells[0];
+    shared_atomic_optional<std::int32_t>& reply = cells[1];
+
+    // The child process answers every request with the request + 1, and stops at -1.
+    const int rounds = 2000;
+    const pid_t child = fork();
+    ASSERT_GE(child, 0);
+    if (child == 0)
+    {
+        for (;;)
+        {
+            const optional<std::int32_t> value = request.wait_take();
+            if (*value < 0)
+                _exit(0);
+            reply.store(*value + 1);
+        }
+    }
+
+    int wrong = 0;
+    for (std::int32_t i = 0; i < rounds; ++i)
+    {
+        request.store(i);
+        wrong += reply.wait_take() != i + 1;
+    }
+    request.store(-1);
+
+    int status = 0;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    EXPECT_EQ(wrong, 0);
+
+    // A second mapping of the file (at another address) wakes a waiter of the first one.
+    void* alias = mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ASSERT_NE(alias, MAP_FAILED);
+    ASSERT_NE(alias, memory);
+    std::thread writer([alias]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        static_cast<shared_atomic_optional<std::int32_t>*>(alias)->store(42);
+    });
+    EXPECT_EQ(request.wait_take_for(std::chrono::seconds(10)), 42);
+    writer.join();
+
+    munmap(alias, 4096);
+    munmap(memory, 4096);
+    std::fclose(file);
+}
+#endif
+
+namespace
+{
+    // Counts the live objects.
+    struct tracked
+    {
+        explicit tracked(int v)
+            : value(v)
+        {
+            ++live;
+        }
+
+        tracked(const tracked& other)
+            : value(other.value)
+        {
+            ++live;
+        }
+
+        ~tracked()
+        {
+            --live;
+        }
+
+        int value;
+        static int live;
+    };
+
+    int tracked::live = 0;
+}
+
+TEST(optional_atomic, Rcu)
+{
+    {
+        rcu_optional<tracked> cell;
+        EXPECT_FALSE(cell.has_value());
+        EXPECT_FALSE(cell.read());
+        EXPECT_EQ(cell.read().get(), nullopt);
+
+        cell.emplace(1);
+        EXPECT_TRUE(cell.has_value());
+        {
+            // A guard pins the value it read, even after the value was replaced.
+            const rcu_optional<tracked>::guard first = cell.read();
+            cell.emplace(2);
+            const rcu_optional<tracked>::guard second = cell.read();
+            EXPECT_EQ(first->value, 1);
+            EXPECT_EQ((*second).value, 2);
+            EXPECT_EQ(tracked::live, 2);
+
+            cell.reset();
+            EXPECT_FALSE(cell.read().has_value());
+            EXPECT_EQ(cell.reclaim(), 2u);
+            EXPECT_EQ(first.get()->value, 1);
+        }
+        // Nothing is pinned any more.
+        EXPECT_EQ(cell.reclaim(), 0u);
+        EXPECT_EQ(tracked::live, 0);
+
+        cell.store(tracked(3));
+        EXPECT_EQ(cell.load()->value, 3);
+        cell.store(nullopt);
+        EXPECT_EQ(cell.load(), nullopt);
+
+        rcu_optional<std::string> text(std::string("text"));
+        EXPECT_EQ(*text.read(), "text");
+        cell.emplace(4);
+    }
+    // The cell frees its value.
+    EXPECT_EQ(tracked::live, 0);
+}
+
+TEST(optional_atomic, RcuConcurrent)
+{
+    // A value whose words are all equal: readers must never see a torn or freed value
+    // (AddressSanitizer reports a use after free).
+    struct block
+    {
+        std::uint64_t words[16];
+    };
+
+    rcu_optional<block> cell;
+    std::atomic<bool> done(false);
+
+    std::thread writer([&]() {
+        block b;
+        for (std::uint64_t i = 1; i <= 5000; ++i)
+        {
+            if (i % 5 == 0)
+            {
+                cell.reset();
+                continue;
+            }
+            for (auto& w : b.words)
+                w = i;
+            cell.store(b);
+            if (i % 16 == 0)
+                std::this_thread::yield();
+        }
+        done = true;
+    });
+
+    std::vector<std::thread> readers;
+    std::atomic<std::size_t> torn(0);
+    for (int r = 0; r < 3; ++r)
+    {
+        readers.emplace_back([&]() {
+            std::uint64_t last = 0;
+            while (!done)
+            {
+                const rcu_optional<block>::guard b = cell.read();
+                if (!b)
+                    continue;
+                for (auto w : b->words)
+                    torn += w != b->words[0];
+                // Values never go back in time.
+                torn += b->words[0] < last;
+                last = b->words[0];
+            }
+        });
+    }
+
+    writer.join();
+    for (auto& r : readers)
+        r.join();
+    EXPECT_EQ(torn.load(), 0u);
+    EXPECT_EQ(cell.reclaim(), 0u);
+}
+
+TEST(optional_atomic, Versioned)
+{
+    versioned_optional<std::int32_t, 3> cell;
+    EXPECT_EQ(cell.capacity(), 3u);
+    EXPECT_EQ(cell.latest_version(), 0u);
+    EXPECT_EQ(cell.load(), nullopt);
+
+    EXPECT_TRUE(cell.store(10, 1));
+    EXPECT_TRUE(cell.reset(20));
+    EXPECT_TRUE(cell.store(30, 3));
+    EXPECT_EQ(cell.latest_version(), 30u);
+
+    // A version sees the newest entry at or below it.
+    EXPECT_EQ(cell.read_at(5), nullopt);
+    EXPECT_EQ(cell.read_at(10), 1);
+    EXPECT_EQ(cell.read_at(19), 1);
+    EXPECT_EQ(cell.read_at(20), nullopt);
+    EXPECT_EQ(cell.read_at(29), nullopt);
+    EXPECT_EQ(cell.read_at(1000), 3);
+    EXPECT_EQ(cell.load(), 3);
+
+    // The chain is full until the old entries are collected.
+    EXPECT_FALSE(cell.store(40, 4));
+    EXPECT_EQ(cell.collect(15), 0u);
+    EXPECT_EQ(cell.collect(25), 1u);
+    EXPECT_EQ(cell.read_at(25), nullopt);
+    EXPECT_TRUE(cell.store(40, 4));
+    EXPECT_EQ(cell.read_at(35), 3);
+    EXPECT_EQ(cell.collect(40), 2u);
+    EXPECT_EQ(cell.read_at(40), 4);
+}
+
+TEST(optional_atomic, VersionedConcurrent)
+{
+    // Version v holds a block whose words are all v (versions that are multiples of 7 are
+    // resets). Readers announce the version they read (like the snapshots of a database),
+    // and the writer never collects above the oldest announced version.
+    struct block
+    {
+        std::uint64_t words[6];
+    };
+
+    versioned_optional<block, 4> cell;
+    std::atomic<bool> done(false);
+    std::atomic<std::uint64_t> snapshots[2];
+    for (auto& s : snapshots)
+        s.store(0);
+
+    const auto low_water = [&]() {
+        std::uint64_t low = cell.latest_version();
+        for (auto& s : snapshots)
+        {
+            const std::uint64_t v = s.load();
+            if (v != 0 && v < low)
+                low = v;
+        }
+        return low;
+    };
+
+    std::thread writer([&]() {
+        block b;
+        for (std::uint64_t v = 1; v <= 2000; ++v)
+        {
+            for (auto& w : b.words)
+                w = v;
+            while (!cell.store(v, v % 7 ? optional<block>(b) : optional<block>()))
+            {
+                cell.collect(low_water());
+                std::this_thread::yield();
+            }
+        }
+        done = true;
+    });
+
+    std::atomic<std::size_t> wrong(0);
+    std::vector<std::thread> readers;
+    for (auto& snapshot : snapshots)
+    {
+        readers.emplace_back([&]() {
+            while (!done)
+            {
+                // Announce the snapshot, and check that the writer didn't move on in between.
+                std::uint64_t version = cell.latest_version();
+                snapshot.store(version);
+                if (version == 0 || cell.latest_version() != version)
+                    continue;
+
+                // The snapshot reads the same value every time.
+                for (int i = 0; i < 3; ++i)
+                {
+                    const optional<block> b = cell.read_at(version);
+                    if (version % 7 == 0)
+                    {
+                        wrong += b.has_value();
+                        continue;
+                    }
+                    if (!b)
+                    {
+                        ++wrong;
+                        continue;
+                    }
+                    for (auto w : b->words)
+                        wrong += w != version;
+                }
+                snapshot.store(0);
+                std::this_thread::yield();
+            }
+            snapshot.store(0);
+        });
+    }
+
+    writer.join();
+    for (auto& r : readers)
+        r.join();
+    EXPECT_EQ(wrong.load(), 0u);
+    EXPECT_EQ(cell.read_at(2000)->words[0], 2000u);
+}
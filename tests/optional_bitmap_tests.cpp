@@ -0,0 +1,413 @@
+#include <gtest/gtest.h>
+
+#include <optional_bitmap.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using namespace opt;
+
+static std::vector<bool> make_random_bits(std::size_t n, double fill, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::bernoulli_distribution set(fill);
+
+    std::vector<bool> bits(n);
+    for (std::size_t i = 0; i < n; ++i)
+        bits[i] = set(rng);
+    return bits;
+}
+
+// Stores 'bits' starting at bit 'offset' of the returned words. The other bits are random.
+static std::vector<std::uint64_t> make_words(const std::vector<bool>& bits, std::size_t offset, unsigned seed)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<std::uint64_t> words((offset + bits.size() + 63) / 64 + 1);
+    for (auto& w : words)
+        w = rng();
+
+    for (std::size_t i = 0; i < bits.size(); ++i)
+    {
+        const std::uint64_t bit = std::uint64_t(1) << ((offset + i) % 64);
+        if (bits[i])
+            words[(offset + i) / 64] |= bit;
+        else
+            words[(offset + i) / 64] &= ~bit;
+    }
+    return words;
+}
+
+TEST(optional_bitmap, Basic)
+{
+    validity_bitmap b(100);
+    EXPECT_EQ(b.size(), 100u);
+    EXPECT_EQ(b.word_count(), 2u);
+    EXPECT_EQ(b.count(), 0u);
+    EXPECT_EQ(b.find_first(), bitmap_npos);
+
+    b.set(3);
+    b.set(64);
+    b.set(99);
+    EXPECT_TRUE(b[3]);
+    EXPECT_FALSE(b[4]);
+    EXPECT_EQ(b.count(), 3u);
+    EXPECT_EQ(b.find_first(), 3u);
+    EXPECT_EQ(b.find_next(4), 64u);
+    EXPECT_EQ(b.find_next(65), 99u);
+    EXPECT_EQ(b.find_next(100), bitmap_npos);
+
+    b.reset(64);
+    EXPECT_EQ(b.count(), 2u);
+    EXPECT_EQ(b.find_next(4), 99u);
+
+    validity_bitmap all(100, true);
+    EXPECT_EQ(all.count(), 100u);
+    EXPECT_EQ(all.data()[1], (std::uint64_t(1) << 36) - 1);
+
+    EXPECT_EQ(validity_bitmap().count(), 0u);
+    EXPECT_EQ(validity_bitmap(64, true).count(), 64u);
+}
+
+TEST(optional_bitmap, Operations)
+{
+    for (std::size_t n : { 0, 1, 63, 64, 65, 300, 1000 })
+    {
+        const auto a = make_random_bits(n, 0.5, 1);
+        const auto b = make_random_bits(n, 0.3, 2);
+
+        // Views at every combination of aligned and unaligned offsets.
+        for (std::size_t a_offset : { 0, 5, 64, 127 })
+        {
+            for (std::size_t b_offset : { 0, 1, 63 })
+            {
+                const auto a_words = make_words(a, a_offset, 3);
+                const auto b_words = make_words(b, b_offset, 4);
+                const bitmap_view av(a_words.data(), n, a_offset);
+                const bitmap_view bv(b_words.data(), n, b_offset);
+
+                const validity_bitmap r_and = av & bv;
+                const validity_bitmap r_or = av | bv;
+                const validity_bitmap r_xor = av ^ bv;
+                const validity_bitmap r_and_not = and_not(av, bv);
+
+                std::size_t count = 0;
+                for (std::size_t i = 0; i < n; ++i)
+                {
+                    ASSERT_EQ(av[i], a[i]);
+                    ASSERT_EQ(r_and[i], a[i] && b[i]);
+                    ASSERT_EQ(r_or[i], a[i] || b[i]);
+                    ASSERT_EQ(r_xor[i], a[i] != b[i]);
+                    ASSERT_EQ(r_and_not[i], a[i] && !b[i]);
+                    count += a[i];
+                }
+                EXPECT_EQ(av.count(), count);
+                EXPECT_EQ(validity_bitmap(av).count(), count);
+                EXPECT_EQ(validity_bitmap(av), validity_bitmap(validity_bitmap(av).view()));
+
+                // The unused bits of the results are cleared.
+                if (n % 64 != 0)
+                {
+                    EXPECT_EQ(r_or.data()[n / 64] >> (n % 64), 0u);
+                }
+
+                // find_next visits the same bits as a linear scan.
+                std::size_t expected = 0;
+                for (std::size_t i = av.find_first(); i != bitmap_npos; i = av.find_next(i + 1))
+                {
+                    while (!a[expected])
+                        ++expected;
+                    ASSERT_EQ(i, expected++);
+                }
+                while (expected < n && !a[expected])
+                    ++expected;
+                EXPECT_EQ(expected, n);
+            }
+        }
+    }
+}
+
+TEST(optional_bitmap, Subview)
+{
+    const auto a = make_random_bits(500, 0.5, 5);
+    const auto words = make_words(a, 0, 6);
+    const bitmap_view v(words.data(), a.size());
+
+    const bitmap_view sub = v.subview(77, 300);
+    EXPECT_EQ(sub.size(), 300u);
+    for (std::size_t i = 0; i < sub.size(); ++i)
+        ASSERT_EQ(sub[i], a[77 + i]);
+
+    validity_bitmap m(sub);
+    m &= v.subview(13, 300);
+    for (std::size_t i = 0; i < m.size(); ++i)
+        ASSERT_EQ(m[i], a[77 + i] && a[13 + i]);
+}
+
+TEST(optional_bitmap, Convert)
+{
+    std::mt19937 rng(7);
+    std::bernoulli_distribution engaged(0.4);
+
+    for (std::size_t n : { 0, 10, 64, 200 })
+    {
+        std::vector<optional<std::string>> data(n);
+        for (auto& o : data)
+        {
+            if (engaged(rng))
+                o = std::string(20, 'x');
+        }
+
+        const validity_bitmap validity = to_validity_bitmap(span<const optional<std::string>>(data));
+        ASSERT_EQ(validity.size(), n);
+        for (std::size_t i = 0; i < n; ++i)
+            ASSERT_EQ(validity[i], data[i].has_value());
+
+        // Keep the engaged elements that are also in a second mask.
+        const auto b = make_random_bits(n, 0.5, 8);
+        const auto b_words = make_words(b, 3, 9);
+        const validity_bitmap keep = validity & bitmap_view(b_words.data(), n, 3);
+
+        auto masked = data;
+        apply_validity(keep, make_span(masked));
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            ASSERT_EQ(masked[i].has_value(), data[i].has_value() && b[i]);
+            if (masked[i])
+            {
+                ASSERT_EQ(*masked[i], *data[i]);
+            }
+        }
+
+        std::vector<optional<int>> ints(n, 1);
+        apply_validity(keep, make_span(ints));
+        EXPECT_EQ(to_validity_bitmap(span<const optional<int>>(ints)), keep);
+    }
+}
+
+template<typename T>
+static void test_transcode(sentinel_encoding<T> encoding, T valid_value)
+{
+    for (std::size_t n : { 0, 1, 64, 130, 1000 })
+    {
+        std::mt19937 rng(static_cast<unsigned>(n));
+        std::bernoulli_distribution engaged(0.6);
+
+        std::vector<optional<T>> aoo(n);
+        std::vector<T> sentinel(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            if (engaged(rng))
+                aoo[i] = static_cast<T>(valid_value + static_cast<T>(i % 100));
+            sentinel[i] = aoo[i] ? *aoo[i] : encoding.value;
+        }
+        // Disengaged elements with a stale value must not leak into the other layouts.
+        if (n > 0 && !aoo[0])
+        {
+            aoo[0] = valid_value;
+            aoo[0].reset();
+        }
+
+        // optional -> values + bitmap -> optional
+        std::vector<T> values(n);
+        validity_bitmap validity(n);
+        transcode(span<const optional<T>>(aoo), make_span(values), validity.data());
+        EXPECT_EQ(validity, to_validity_bitmap(span<const optional<T>>(aoo)));
+        for (std::size_t i = 0; i < n; ++i)
+            ASSERT_EQ(values[i], aoo[i] ? *aoo[i] : T());
+
+        std::vector<optional<T>> round_trip(n, valid_value);
+        transcode(span<const T>(values), validity.view(), make_span(round_trip));
+        EXPECT_EQ(round_trip, aoo);
+
+        // optional -> sentinel -> optional
+        std::vector<T> encoded(n);
+        transcode(span<const optional<T>>(aoo), make_span(encoded), encoding);
+        for (std::size_t i = 0; i < n; ++i)
+            ASSERT_TRUE(encoding.is_missing(encoded[i]) ? !aoo[i] : encoded[i] == *aoo[i]);
+
+        std::fill(round_trip.begin(), round_trip.end(), valid_value);
+        transcode(span<const T>(sentinel), encoding, make_span(round_trip));
+        EXPECT_EQ(round_trip, aoo);
+
+        // sentinel -> values + bitmap (in place) -> sentinel
+        std::vector<T> buffer = sentinel;
+        validity_bitmap decoded(n);
+        transcode(span<const T>(buffer), encoding, make_span(buffer), decoded.data());
+        EXPECT_EQ(decoded, validity);
+        EXPECT_EQ(buffer, values);
+
+        transcode(span<const T>(buffer), decoded.view(), make_span(buffer), encoding);
+        for (std::size_t i = 0; i < n; ++i)
+            ASSERT_TRUE(encoding.is_missing(buffer[i]) ? encoding.is_missing(sentinel[i]) : buffer[i] == sentinel[i]);
+    }
+}
+
+TEST(optional_bitmap, Transcode)
+{
+    test_transcode<std::int32_t>(default_sentinel<std::int32_t>(), 5);
+    test_transcode<std::int64_t>(make_sentinel<std::int64_t>(-1), 5);
+    test_transcode<float>(default_sentinel<float>(), 1.5f);
+    test_transcode<double>(make_sentinel(-999.0), 1.5);
+    test_transcode<float>(make_sentinel(-999.0f), 1.5f);
+    test_transcode<double>(default_sentinel<double>(), 1.5);
+    test_transcode<std::int32_t>(make_sentinel<std::int32_t>(0), 5);
+    test_transcode<std::uint32_t>(make_sentinel<std::uint32_t>(7), 8u);
+    test_transcode<std::uint64_t>(default_sentinel<std::uint64_t>(), 5u);
+    test_transcode<std::int16_t>(default_sentinel<std::int16_t>(), 5);
+
+    // Any NaN is missing if the sentinel is NaN.
+    EXPECT_TRUE(default_sentinel<double>().is_missing(-std::numeric_limits<double>::quiet_NaN()));
+    EXPECT_FALSE(default_sentinel<double>().is_missing(0.0));
+    EXPECT_TRUE(default_sentinel<int>().is_missing(std::numeric_limits<int>::min()));
+    EXPECT_FALSE(make_sentinel(-999.0).is_missing(std::numeric_limits<double>::quiet_NaN()));
+}
+
+TEST(optional_bitmap, BlockTranscoder)
+{
+    const std::size_t n = 1000;
+    std::vector<double> input(n);
+    for (std::size_t i = 0; i < n; ++i)
+        input[i] = (i % 3 == 0) ? std::numeric_limits<double>::quiet_NaN() : static_cast<double>(i);
+
+    // Decode in blocks of 128 values.
+    double buffer[128];
+    std::uint64_t words[2];
+    block_transcoder<double> transcoder(buffer, words);
+
+    std::size_t read_pos = 0;
+    std::vector<double> values;
+    std::vector<bool> valid;
+    const std::size_t decoded = transcoder.decode(
+        [&](span<double> block) {
+            const std::size_t count = std::min(block.size(), n - read_pos);
+            std::copy(input.begin() + read_pos, input.begin() + read_pos + count, block.begin());
+            read_pos += count;
+            return count;
+        },
+        [&](span<const double> block, bitmap_view validity) {
+            for (std::size_t i = 0; i < block.size(); ++i)
+            {
+                values.push_back(block[i]);
+                valid.push_back(validity[i]);
+            }
+        });
+
+    ASSERT_EQ(decoded, n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        ASSERT_EQ(valid[i], i % 3 != 0);
+        ASSERT_EQ(values[i], valid[i] ? static_cast<double>(i) : 0.0);
+    }
+
+    // Encode it again.
+    read_pos = 0;
+    std::vector<double> output;
+    const std::size_t encoded = transcoder.encode(
+        [&](span<double> block, std::uint64_t* validity) {
+            const std::size_t count = std::min(block.size(), n - read_pos);
+            std::fill(validity, validity + 2, 0);
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                block[i] = values[read_pos + i];
+                validity[i / 64] |= std::uint64_t(valid[read_pos + i]) << (i % 64);
+            }
+            read_pos += count;
+            return count;
+        },
+        [&](span<const double> block) {
+            output.insert(output.end(), block.begin(), block.end());
+        });
+
+    ASSERT_EQ(encoded, n);
+    for (std::size_t i = 0; i < n; ++i)
+        ASSERT_TRUE(std::isnan(input[i]) ? std::isnan(output[i]) : output[i] == input[i]);
+}
+
+// Counts the number of live instances.
+struct counted
+{
+    static int instances;
+
+    counted() { ++instances; }
+    counted(const counted&) { ++instances; }
+    ~counted() { --instances; }
+};
+
+int counted::instances = 0;
+
+TEST(optional_bitmap, ResetAll)
+{
+    const std::size_t n = 300;
+    const auto bits = make_random_bits(n, 0.1, 10);
+
+    std::vector<optional<counted>> data(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        if (bits[i])
+            data[i].emplace();
+    }
+    const validity_bitmap engaged = to_validity_bitmap(span<const optional<counted>>(data));
+    EXPECT_EQ(counted::instances, static_cast<int>(engaged.count()));
+
+    reset_all(make_span(data), engaged);
+    EXPECT_EQ(counted::instances, 0);
+    for (const auto& o : data)
+        ASSERT_FALSE(o.has_value());
+
+    std::vector<optional<int>> ints(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        if (bits[i])
+            ints[i] = static_cast<int>(i);
+    }
+    reset_all(make_span(ints), to_validity_bitmap(span<const optional<int>>(ints)));
+    EXPECT_EQ(ints, std::vector<optional<int>>(n));
+}
+
+TEST(optional_bitmap, DestroyEngaged)
+{
+    const std::size_t n = 300;
+    const auto bits = make_random_bits(n, 0.1, 11);
+
+    // An array of optionals in raw storage, as used by columnar containers.
+    typename std::aligned_storage<sizeof(optional<counted>), alignof(optional<counted>)>::type storage[n];
+    optional<counted>* data = reinterpret_cast<optional<counted>*>(storage);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        if (bits[i])
+            new (data + i) optional<counted>(in_place);
+        else
+            new (data + i) optional<counted>();
+    }
+
+    const validity_bitmap engaged = to_validity_bitmap(span<const optional<counted>>(data, n));
+    EXPECT_EQ(counted::instances, static_cast<int>(engaged.count()));
+
+    destroy_engaged(make_span(data, n), engaged);
+    EXPECT_EQ(counted::instances, 0);
+}
+
+TEST(optional_bitmap, DestroyEngagedTrivial)
+{
+    // Trivially destructible values are not visited at all (optional<T> itself never is
+    // trivially destructible).
+    EXPECT_FALSE(std::is_trivially_destructible<optional<int>>::value);
+    EXPECT_FALSE(detail::destroy_engaged_visits<int>::value);
+    EXPECT_TRUE(detail::destroy_engaged_visits<std::string>::value);
+
+    // A visit would assert that the (disengaged) elements are engaged.
+    const std::size_t n = 100;
+    typename std::aligned_storage<sizeof(optional<int>), alignof(optional<int>)>::type storage[n];
+    optional<int>* ints = reinterpret_cast<optional<int>*>(storage);
+    for (std::size_t i = 0; i < n; ++i)
+        new (ints + i) optional<int>();
+    const validity_bitmap all(n, true);
+    destroy_engaged(make_span(ints, n), all);
+}
@@ -0,0 +1,311 @@
+#include <gtest/gtest.h>
+
+#include <optional_channel.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace opt;
+
+TEST(optional_channel, Oneshot)
+{
+    auto channel = oneshot<std::string>::make();
+    oneshot_sender<std::string> tx = std::move(channel.first);
+    oneshot_receiver<std::string> rx = std::move(channel.second);
+    EXPECT_TRUE(tx);
+    EXPECT_FALSE(rx.ready());
+    EXPECT_FALSE(rx.closed());
+    EXPECT_EQ(rx.try_get(), nullopt);
+
+    tx.send(3, 'x');
+    EXPECT_FALSE(tx);
+    EXPECT_TRUE(rx.ready());
+    EXPECT_EQ(rx.try_get(), std::string("xxx"));
+
+    // The value is received once.
+    EXPECT_TRUE(rx.closed());
+    EXPECT_EQ(rx.try_get(), nullopt);
+    EXPECT_EQ(rx.wait(), nullopt);
+}
+
+TEST(optional_channel, OneshotClosed)
+{
+    // Destroying the sender without sending closes the channel.
+    auto channel = oneshot<std::unique_ptr<int>>::make();
+    oneshot_receiver<std::unique_ptr<int>> rx = std::move(channel.second);
+    {
+        oneshot_sender<std::unique_ptr<int>> tx = std::move(channel.first);
+    }
+    EXPECT_TRUE(rx.closed());
+    EXPECT_EQ(rx.wait(), nullopt);
+
+    // The receiver can go away first.
+    auto unused = oneshot<std::unique_ptr<int>>::make();
+    {
+        oneshot_receiver<std::unique_ptr<int>> gone = std::move(unused.second);
+    }
+    unused.first.send(new int(1));
+}
+
+TEST(optional_channel, OneshotIntrusive)
+{
+    oneshot<int> channel;
+    for (int i = 0; i < 3; ++i)
+    {
+        {
+            oneshot_sender<int> tx = channel.sender();
+            oneshot_receiver<int> rx = channel.receiver();
+            tx.send(i);
+            EXPECT_EQ(rx.wait(), i);
+        }
+        channel.reset();
+    }
+}
+
+TEST(optional_channel, OneshotWait)
+{
+    // The receiver blocks until the value arrives, or until the sender is destroyed.
+    for (bool send : { true, false })
+    {
+        auto channel = oneshot<std::vector<int>>::make();
+        std::thread sender([&]() {
+            oneshot_sender<std::vector<int>> tx = std::move(channel.first);
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            if (send)
+                tx.send(std::vector<int>{ 1, 2, 3 });
+        });
+
+        const optional<std::vector<int>> value = channel.second.wait();
+        sender.join();
+        if (send)
+        {
+            EXPECT_EQ(value, (std::vector<int>{ 1, 2, 3 }));
+        }
+        else
+        {
+            EXPECT_EQ(value, nullopt);
+        }
+    }
+
+    // Many short-lived channels between two threads.
+    std::vector<oneshot<int>> channels(2000);
+    std::vector<oneshot_sender<int>> senders;
+    for (auto& c : channels)
+        senders.push_back(c.sender());
+
+    std::thread sender([&]() {
+        for (std::size_t i = 0; i < senders.size(); ++i)
+            senders[i].send(static_cast<int>(i));
+    });
+    for (std::size_t i = 0; i < channels.size(); ++i)
+        ASSERT_EQ(channels[i].receiver().wait(), static_cast<int>(i));
+    sender.join();
+}
+
+namespace
+{
+    // Not default constructible: only constructed by the queues.
+    struct payload
+    {
+        explicit payload(int v)
+            : value(new int(v))
+        {}
+
+        std::unique_ptr<int> value;
+    };
+}
+
+template<typename Queue>
+static void check_queue()
+{
+    Queue q(5);
+    EXPECT_EQ(q.capacity(), 8u);
+    EXPECT_EQ(q.try_pop(), nullopt);
+
+    for (int i = 0; i < 8; ++i)
+        EXPECT_TRUE(q.try_emplace(i));
+    EXPECT_FALSE(q.try_emplace(8));
+
+    for (int i = 0; i < 8; ++i)
+    {
+        optional<payload> p = q.try_pop();
+        ASSERT_TRUE(p.has_value());
+        EXPECT_EQ(*p->value, i);
+    }
+    EXPECT_FALSE(q.try_pop().has_value());
+
+    // Batches wrap around the ring and stop when it is full (or empty).
+    std::vector<payload> in;
+    for (int i = 0; i < 12; ++i)
+        in.emplace_back(i);
+    EXPECT_EQ(q.try_push_n(std::make_move_iterator(in.begin()), 5), 5u);
+    EXPECT_EQ(q.try_push_n(std::make_move_iterator(in.begin() + 5), 7), 3u);
+    EXPECT_NE(in[8].value, nullptr);
+
+    std::vector<payload> out;
+    EXPECT_EQ(q.try_pop_n(std::back_inserter(out), 3), 3u);
+    EXPECT_EQ(q.try_pop_n(std::back_inserter(out), 10), 5u);
+    ASSERT_EQ(out.size(), 8u);
+    for (int i = 0; i < 8; ++i)
+        EXPECT_EQ(*out[i].value, i);
+
+    // Remaining values are destroyed with the queue.
+    EXPECT_TRUE(q.try_emplace(1));
+}
+
+TEST(optional_channel, Queue)
+{
+    check_queue<spsc_queue<payload>>();
+    check_queue<mpmc_queue<payload>>();
+
+    // Copies from lvalues.
+    spsc_queue<std::string> spsc(4);
+    mpmc_queue<std::string> mpmc(4);
+    const std::vector<std::string> strings = { "a", "b", "c" };
+    EXPECT_EQ(spsc.try_push_n(strings.begin(), strings.size()), 3u);
+    EXPECT_EQ(mpmc.try_push_n(strings.begin(), strings.size()), 3u);
+    EXPECT_TRUE(spsc.try_push(strings[0]));
+    EXPECT_TRUE(mpmc.try_push(strings[0]));
+    EXPECT_EQ(spsc.size_approx(), 4u);
+    EXPECT_EQ(spsc.try_pop(), std::string("a"));
+    EXPECT_EQ(mpmc.try_pop(), std::string("a"));
+}
+
+namespace
+{
+    // An output iterator that throws when a given number of values have been assigned.
+    struct throwing_output
+    {
+        std::vector<payload>* values;
+        std::size_t limit;
+
+        throwing_output& operator*()
+        {
+            return *this;
+        }
+
+        throwing_output& operator++()
+        {
+            return *this;
+        }
+
+        throwing_output& operator=(payload&& p)
+        {
+            if (values->size() == limit)
+                throw std::runtime_error("full");
+            values->push_back(std::move(p));
+            return *this;
+        }
+    };
+}
+
+TEST(optional_channel, QueuePopThrows)
+{
+    // spsc_queue: the values before the throw are removed, the rest stay in the queue.
+    spsc_queue<payload> spsc(8);
+    for (int i = 0; i < 5; ++i)
+        spsc.try_emplace(i);
+    std::vector<payload> out;
+    EXPECT_THROW(spsc.try_pop_n(throwing_output{ &out, 2 }, 5), std::runtime_error);
+    ASSERT_EQ(out.size(), 2u);
+    for (int i = 2; i < 5; ++i)
+        EXPECT_EQ(*spsc.try_pop()->value, i);
+    EXPECT_FALSE(spsc.try_pop().has_value());
+
+    // mpmc_queue: the rest of the batch is dropped, and the queue stays usable.
+    mpmc_queue<payload> mpmc(8);
+    for (int i = 0; i < 5; ++i)
+        mpmc.try_emplace(i);
+    out.clear();
+    EXPECT_THROW(mpmc.try_pop_n(throwing_output{ &out, 2 }, 5), std::runtime_error);
+    EXPECT_EQ(out.size(), 2u);
+    EXPECT_FALSE(mpmc.try_pop().has_value());
+    for (int i = 0; i < 8; ++i)
+        EXPECT_TRUE(mpmc.try_emplace(i));
+    EXPECT_EQ(*mpmc.try_pop()->value, 0);
+}
+
+template<typename Queue>
+static void check_queue_threads(int producers, int consumers, std::size_t batch)
+{
+    // Every value is popped exactly once, and the values of each producer in order.
+    const int per_producer = 20000;
+    Queue q(64);
+    std::atomic<int> popped(0);
+    std::vector<std::vector<int>> seen(consumers);
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&, p]() {
+            std::vector<int> values(per_producer);
+            std::iota(values.begin(), values.end(), p * per_producer);
+            for (std::size_t i = 0; i < values.size();)
+            {
+                const std::size_t n = q.try_push_n(values.begin() + i, std::min(batch, values.size() - i));
+                if (n == 0)
+                    std::this_thread::yield();
+                i += n;
+            }
+        });
+    }
+    for (int c = 0; c < consumers; ++c)
+    {
+        threads.emplace_back([&, c]() {
+            while (popped.load() < producers * per_producer)
+            {
+                std::size_t n = 0;
+                if (batch == 1)
+                {
+                    if (optional<int> v = q.try_pop())
+                    {
+                        seen[c].push_back(*v);
+                        n = 1;
+                    }
+                }
+                else
+                    n = q.try_pop_n(std::back_inserter(seen[c]), batch);
+
+                if (n == 0)
+                    std::this_thread::yield();
+                popped += static_cast<int>(n);
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    std::vector<int> all;
+    for (const auto& s : seen)
+    {
+        // Each consumer sees the values of a producer in increasing order.
+        std::vector<int> last(producers, -1);
+        for (int v : s)
+        {
+            ASSERT_GT(v, last[v / per_producer]);
+            last[v / per_producer] = v;
+        }
+        all.insert(all.end(), s.begin(), s.end());
+    }
+    std::sort(all.begin(), all.end());
+    ASSERT_EQ(all.size(), static_cast<std::size_t>(producers * per_producer));
+    for (std::size_t i = 0; i < all.size(); ++i)
+        ASSERT_EQ(all[i], static_cast<int>(i));
+}
+
+TEST(optional_channel, QueueThreads)
+{
+    check_queue_threads<spsc_queue<int>>(1, 1, 1);
+    check_queue_threads<spsc_queue<int>>(1, 1, 16);
+    check_queue_threads<mpmc_queue<int>>(3, 3, 1);
+    check_queue_threads<mpmc_queue<int>>(3, 3, 16);
+}
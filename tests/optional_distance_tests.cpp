@@ -0,0 +1,160 @@
+#include <gtest/gtest.h>
+
+#include <optional_distance.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+using namespace opt;
+
+// Disengaged elements hold NaN (a value that was reset), which must not leak into the results.
+static std::vector<optional<float>> make_vector(std::size_t n, double fill, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::bernoulli_distribution engaged(fill);
+    std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+
+    std::vector<optional<float>> v(n);
+    for (auto& o : v)
+    {
+        o = engaged(rng) ? value(rng) : std::numeric_limits<float>::quiet_NaN();
+        if (std::isnan(*o))
+            o.reset();
+    }
+    return v;
+}
+
+struct reference
+{
+    optional<float> dot, l2, cosine;
+};
+
+static reference naive(const std::vector<optional<float>>& a, const std::vector<optional<float>>& b)
+{
+    double ab = 0, aa = 0, bb = 0, dd = 0;
+    bool any = false;
+    for (std::size_t i = 0; i < a.size(); ++i)
+    {
+        if (a[i] && b[i])
+        {
+            ab += double(*a[i]) * *b[i];
+            aa += double(*a[i]) * *a[i];
+            bb += double(*b[i]) * *b[i];
+            dd += (double(*a[i]) - *b[i]) * (double(*a[i]) - *b[i]);
+            any = true;
+        }
+    }
+
+    reference r;
+    if (any)
+    {
+        r.dot = static_cast<float>(ab);
+        r.l2 = static_cast<float>(std::sqrt(dd));
+        if (aa > 0 && bb > 0)
+            r.cosine = static_cast<float>(ab / std::sqrt(aa * bb));
+    }
+    return r;
+}
+
+static void expect_near(optional<float> actual, optional<float> expected)
+{
+    ASSERT_EQ(actual.has_value(), expected.has_value());
+    if (actual)
+    {
+        EXPECT_NEAR(*actual, *expected, 1e-4f * (1.0f + std::fabs(*expected)));
+    }
+}
+
+TEST(optional_distance, Basic)
+{
+    const std::vector<optional<float>> a = { 1.0f, nullopt, 3.0f, 2.0f };
+    const std::vector<optional<float>> b = { 4.0f, 5.0f, nullopt, 6.0f };
+    span<const optional<float>> sa(a);
+    span<const optional<float>> sb(b);
+
+    EXPECT_EQ(masked_dot(sa, sb), 16.0f);
+    EXPECT_EQ(masked_l2(sa, sb), 5.0f);
+    EXPECT_NEAR(*masked_cosine(sa, sb), 16.0f / std::sqrt(5.0f * 52.0f), 1e-6f);
+
+    // No common engaged position.
+    const std::vector<optional<float>> c = { nullopt, 1.0f, nullopt, nullopt };
+    EXPECT_EQ(masked_dot(sa, span<const optional<float>>(c)), nullopt);
+    EXPECT_EQ(masked_l2(sa, span<const optional<float>>(c)), nullopt);
+    EXPECT_EQ(masked_dot(span<const optional<float>>(), span<const optional<float>>()), nullopt);
+
+    // The cosine similarity with a zero vector is undefined.
+    const std::vector<optional<float>> zero = { 0.0f, 0.0f, 0.0f, 0.0f };
+    EXPECT_EQ(masked_dot(sa, span<const optional<float>>(zero)), 0.0f);
+    EXPECT_EQ(masked_cosine(sa, span<const optional<float>>(zero)), nullopt);
+
+    const std::vector<optional<double>> d = { 1.0, 2.0, nullopt };
+    EXPECT_EQ(masked_dot(span<const optional<double>>(d), span<const optional<double>>(d)), 5.0);
+}
+
+TEST(optional_distance, Random)
+{
+    // Sizes around the SIMD block sizes (8 and 16) and longer vectors.
+    for (std::size_t n : { 1, 7, 8, 9, 15, 16, 17, 33, 128, 1000, 4096 })
+    {
+        for (double fill : { 0.05, 0.5, 1.0 })
+        {
+            const auto a = make_vector(n, fill, static_cast<unsigned>(n));
+            const auto b = make_vector(n, fill, static_cast<unsigned>(n + 1));
+            const reference expected = naive(a, b);
+            span<const optional<float>> sa(a);
+            span<const optional<float>> sb(b);
+
+            expect_near(masked_dot(sa, sb), expected.dot);
+            expect_near(masked_l2(sa, sb), expected.l2);
+            expect_near(masked_cosine(sa, sb), expected.cosine);
+
+            // Values with validity bitmaps (the bitmap of 'b' starts at an offset).
+            std::vector<float> va(n), vb(n);
+            std::vector<std::uint64_t> wa((n + 63) / 64), wb((n + 63) / 64 + 1);
+            transcode(sa, make_span(va), wa.data());
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                vb[i] = b[i] ? *b[i] : std::numeric_limits<float>::quiet_NaN();
+                if (b[i])
+                    wb[(i + 5) / 64] |= std::uint64_t(1) << ((i + 5) % 64);
+            }
+            const bitmap_view ba(wa.data(), n);
+            const bitmap_view bb(wb.data(), n, 5);
+            span<const float> fa(va);
+            span<const float> fb(vb);
+
+            expect_near(masked_dot(fa, ba, fb, bb), expected.dot);
+            expect_near(masked_l2(fa, ba, fb, bb), expected.l2);
+            expect_near(masked_cosine(fa, ba, fb, bb), expected.cosine);
+        }
+    }
+}
+
+TEST(optional_distance, Batch)
+{
+    for (std::size_t dim : { 5, 16, 130 })
+    {
+        const std::size_t rows = 20;
+        const auto query = make_vector(dim, 0.7, 1);
+        const auto matrix = make_vector(dim * rows, 0.7, 2);
+        span<const optional<float>> q(query);
+        span<const optional<float>> m(matrix);
+
+        std::vector<optional<float>> dots(rows), l2s(rows), cosines(rows);
+        masked_dot_batch(q, m, make_span(dots));
+        masked_l2_batch(q, m, make_span(l2s));
+        masked_cosine_batch(q, m, make_span(cosines));
+
+        for (std::size_t r = 0; r < rows; ++r)
+        {
+            const std::vector<optional<float>> row(matrix.begin() + r * dim, matrix.begin() + (r + 1) * dim);
+            const reference expected = naive(query, row);
+            expect_near(dots[r], expected.dot);
+            expect_near(l2s[r], expected.l2);
+            expect_near(cosines[r], expected.cosine);
+        }
+    }
+}
@@ -0,0 +1,337 @@
+#include <gtest/gtest.h>
+
+#include <optional_parallel.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace opt;
+
+template<typename T>
+static std::vector<optional<T>> make_random_optionals(std::size_t n, double fill, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::bernoulli_distribution engaged(fill);
+    std::uniform_real_distribution<double> value(-1000.0, 1000.0);
+
+    std::vector<optional<T>> v(n);
+    for (auto& o : v)
+    {
+        if (engaged(rng))
+            o = static_cast<T>(value(rng));
+    }
+    return v;
+}
+
+TEST(optional_parallel, ThreadPool)
+{
+    par::thread_pool pool(4);
+    EXPECT_EQ(pool.size(), 4u);
+
+    // Every chunk is executed exactly once.
+    std::vector<std::atomic<int>> counts(1000);
+    for (auto& c : counts)
+        c = 0;
+    pool.parallel_for(counts.size(), [&](std::size_t i) { ++counts[i]; });
+    for (auto& c : counts)
+        EXPECT_EQ(c.load(), 1);
+
+    // Nested calls run sequentially.
+    std::atomic<int> total(0);
+    pool.parallel_for(8, [&](std::size_t) {
+        pool.parallel_for(8, [&](std::size_t) { ++total; });
+    });
+    EXPECT_EQ(total.load(), 64);
+
+    // The first exception is rethrown.
+    EXPECT_THROW(pool.parallel_for(100, [](std::size_t i) {
+        if (i == 42)
+            throw std::runtime_error("42");
+    }), std::runtime_error);
+
+    // The pool is still usable after an exception.
+    total = 0;
+    pool.parallel_for(10, [&](std::size_t) { ++total; });
+    EXPECT_EQ(total.load(), 10);
+}
+
+TEST(optional_parallel, TransformReduce)
+{
+    const auto v = make_random_optionals<int>(1000000, 0.6, 1);
+    span<const optional<int>> in(v);
+
+    std::int64_t expected = 0;
+    for (auto& o : v)
+    {
+        if (o)
+            expected += static_cast<std::int64_t>(*o) * *o;
+    }
+
+    par::thread_pool pool(3);
+    auto square = [](int i) { return static_cast<std::int64_t>(i) * i; };
+    EXPECT_EQ(par::transform_reduce(pool, in, std::int64_t(0), std::plus<std::int64_t>(), square), expected);
+    EXPECT_EQ(par::transform_reduce(in, std::int64_t(0), std::plus<std::int64_t>(), square), expected);
+
+    // Empty and all-disengaged ranges return init.
+    std::vector<optional<int>> empty(100);
+    EXPECT_EQ(par::transform_reduce(pool, span<const optional<int>>(empty), 7, std::plus<int>(), square), 7);
+    EXPECT_EQ(par::transform_reduce(pool, span<const optional<int>>(), 7, std::plus<int>(), square), 7);
+}
+
+TEST(optional_parallel, TransformReduceDeterministic)
+{
+    // Floating point addition isn't associative, but the result must not
+    // depend on the number of threads.
+    const auto v = make_random_optionals<double>(1000000, 0.5, 2);
+    span<const optional<double>> in(v);
+    auto identity = [](double d) { return d; };
+
+    double expected = 0.0;
+    {
+        par::thread_pool pool(1);
+        expected = par::transform_reduce(pool, in, 0.0, std::plus<double>(), identity);
+    }
+    for (std::size_t threads : { 2, 3, 7 })
+    {
+        par::thread_pool pool(threads);
+        for (int i = 0; i < 3; ++i)
+            EXPECT_EQ(par::transform_reduce(pool, in, 0.0, std::plus<double>(), identity), expected);
+    }
+
+    // String concatenation is associative but not commutative.
+    std::vector<optional<int>> digits(100000);
+    for (std::size_t i = 0; i < digits.size(); i += 3)
+        digits[i] = static_cast<int>(i % 10);
+
+    std::string sequential;
+    for (auto& d : digits)
+    {
+        if (d)
+            sequential += std::to_string(*d);
+    }
+
+    par::thread_pool pool(4);
+    auto to_string = [](int i) { return std::to_string(i); };
+    auto concat = [](std::string a, const std::string& b) { return a + b; };
+    EXPECT_EQ(par::transform_reduce(pool, span<const optional<int>>(digits), std::string(), concat, to_string), sequential);
+}
+
+TEST(optional_parallel, ForEachEngaged)
+{
+    auto v = make_random_optionals<int>(500000, 0.3, 3);
+    auto expected = v;
+    for (auto& o : expected)
+    {
+        if (o)
+            *o *= 2;
+    }
+
+    par::thread_pool pool(4);
+    par::for_each_engaged(pool, make_span(v), [](int& i) { i *= 2; });
+    EXPECT_EQ(v, expected);
+
+    std::atomic<std::size_t> engaged(0);
+    par::for_each_engaged(pool, span<const optional<int>>(v), [&](const int&) { ++engaged; });
+    std::size_t count = 0;
+    for (auto& o : v)
+        count += o ? 1 : 0;
+    EXPECT_EQ(engaged.load(), count);
+}
+
+TEST(optional_parallel, Compact)
+{
+    par::thread_pool pool(4);
+
+    for (double fill : { 0.0, 0.01, 0.5, 1.0 })
+    {
+        const auto v = make_random_optionals<float>(1000003, fill, 4);
+        span<const optional<float>> in(v);
+        const std::vector<float> expected = compact(in);
+
+        EXPECT_EQ(par::compact(pool, in), expected);
+
+        std::vector<float> out(expected.size());
+        EXPECT_EQ(par::compact(pool, in, out.data()), expected.size());
+        EXPECT_EQ(out, expected);
+    }
+}
+
+template<typename T>
+static void split(const std::vector<optional<T>>& v, std::vector<T>& values, std::vector<std::uint64_t>& validity)
+{
+    values.assign(v.size(), T());
+    validity.assign((v.size() + 63) / 64, 0);
+    for (std::size_t i = 0; i < v.size(); ++i)
+    {
+        if (v[i])
+        {
+            values[i] = *v[i];
+            validity[i / 64] |= std::uint64_t(1) << (i % 64);
+        }
+    }
+}
+
+TEST(optional_parallel, Fill)
+{
+    par::thread_pool pool(4);
+
+    // Sparse inputs so that gaps span several chunks.
+    for (double fill : { 0.0, 0.0001, 0.001, 0.5 })
+    {
+        for (std::size_t max_gap : { std::size_t(0), std::size_t(3), std::size_t(5000), no_limit })
+        {
+            const auto in = make_random_optionals<double>(100003, fill, 6);
+
+            auto expected = in;
+            forward_fill(make_span(expected), max_gap);
+            auto actual = in;
+            par::forward_fill(pool, make_span(actual), max_gap);
+            EXPECT_EQ(actual, expected);
+
+            std::vector<double> values, expected_values;
+            std::vector<std::uint64_t> validity, expected_validity;
+            split(in, values, validity);
+            split(in, expected_values, expected_validity);
+            forward_fill(make_span(expected_values), expected_validity.data(), max_gap);
+            par::forward_fill(pool, make_span(values), validity.data(), max_gap);
+            EXPECT_EQ(values, expected_values);
+            EXPECT_EQ(validity, expected_validity);
+
+            expected = in;
+            backward_fill(make_span(expected), max_gap);
+            actual = in;
+            par::backward_fill(pool, make_span(actual), max_gap);
+            EXPECT_EQ(actual, expected);
+
+            split(in, values, validity);
+            split(in, expected_values, expected_validity);
+            backward_fill(make_span(expected_values), expected_validity.data(), max_gap);
+            par::backward_fill(pool, make_span(values), validity.data(), max_gap);
+            EXPECT_EQ(values, expected_values);
+            EXPECT_EQ(validity, expected_validity);
+        }
+    }
+}
+
+TEST(optional_parallel, GroupAggregate)
+{
+    par::thread_pool pool(4);
+
+    // Few groups (a hot partition) and many groups.
+    for (int range : { 10, 100000 })
+    {
+        std::mt19937 rng(static_cast<unsigned>(range));
+        std::bernoulli_distribution engaged(0.9);
+        std::uniform_int_distribution<std::int32_t> key(0, range);
+
+        std::vector<optional<std::int32_t>> keys(500003);
+        for (auto& k : keys)
+        {
+            if (engaged(rng))
+                k = key(rng);
+        }
+        const auto values = make_random_optionals<double>(keys.size(), 0.8, 7);
+        span<const optional<std::int32_t>> k(keys);
+        span<const optional<double>> v(values);
+
+        const auto expected = group_aggregate(k, v, agg::sum(), agg::mean(), agg::min(), agg::count());
+        const auto actual = par::group_aggregate(pool, k, v, agg::sum(), agg::mean(), agg::min(), agg::count());
+
+        // Identical, including the order of the groups and the rounding of the sums.
+        EXPECT_EQ(actual.keys, expected.keys);
+        EXPECT_EQ(std::get<0>(actual.aggregates), std::get<0>(expected.aggregates));
+        EXPECT_EQ(std::get<1>(actual.aggregates), std::get<1>(expected.aggregates));
+        EXPECT_EQ(std::get<2>(actual.aggregates), std::get<2>(expected.aggregates));
+        EXPECT_EQ(std::get<3>(actual.aggregates), std::get<3>(expected.aggregates));
+    }
+}
+
+TEST(optional_parallel, HashJoin)
+{
+    par::thread_pool pool(4);
+
+    std::mt19937 rng(11);
+    std::bernoulli_distribution engaged(0.9);
+    std::uniform_int_distribution<std::int32_t> key(0, 100000);
+    std::vector<optional<std::int32_t>> left(300007), right(200003);
+    for (auto* side : { &left, &right })
+    {
+        for (auto& k : *side)
+        {
+            if (engaged(rng))
+                k = key(rng);
+        }
+    }
+    span<const optional<std::int32_t>> l(left);
+    span<const optional<std::int32_t>> r(right);
+
+    // Identical, including the order of the matches.
+    const join_result expected = hash_join(l, r);
+    const join_result actual = par::hash_join(pool, l, r);
+    EXPECT_GT(expected.size(), 0u);
+    EXPECT_EQ(actual.left, expected.left);
+    EXPECT_EQ(actual.right, expected.right);
+}
+
+TEST(optional_parallel, ScanSkipNull)
+{
+    par::thread_pool pool(4);
+
+    for (null_output nulls : { null_output::running, null_output::null })
+    {
+        const auto in = make_random_optionals<double>(100003, 0.7, 12);
+        span<const optional<double>> s(in);
+
+        std::vector<optional<std::int64_t>> ints(in.size());
+        for (std::size_t i = 0; i < in.size(); ++i)
+        {
+            if (in[i])
+                ints[i] = static_cast<std::int64_t>(*in[i]);
+        }
+        span<const optional<std::int64_t>> si(ints);
+
+        // Integer sums, counts and extremes are identical to the sequential scans.
+        std::vector<optional<std::int64_t>> expected(in.size()), actual(in.size());
+        inclusive_scan_skip_null(si, make_span(expected), agg::sum(), nulls);
+        par::inclusive_scan_skip_null(pool, si, make_span(actual), agg::sum(), nulls);
+        EXPECT_EQ(actual, expected);
+        exclusive_scan_skip_null(si, make_span(expected), agg::max(), nulls);
+        par::exclusive_scan_skip_null(pool, si, make_span(actual), agg::max(), nulls);
+        EXPECT_EQ(actual, expected);
+
+        std::vector<optional<std::size_t>> expected_counts(in.size()), counts(in.size());
+        exclusive_scan_skip_null(s, make_span(expected_counts), agg::count(), nulls);
+        par::exclusive_scan_skip_null(pool, s, make_span(counts), agg::count(), nulls);
+        EXPECT_EQ(counts, expected_counts);
+
+        std::vector<optional<double>> expected_min(in.size()), min(in.size());
+        inclusive_scan_skip_null(s, make_span(expected_min), agg::min(), nulls);
+        par::inclusive_scan_skip_null(pool, s, make_span(min), agg::min(), nulls);
+        EXPECT_EQ(min, expected_min);
+
+        // Floating-point sums only differ by rounding.
+        std::vector<optional<double>> expected_sums(in.size()), sums(in.size());
+        inclusive_scan_skip_null(s, make_span(expected_sums), agg::sum(), nulls);
+        par::inclusive_scan_skip_null(pool, s, make_span(sums), agg::sum(), nulls);
+        for (std::size_t i = 0; i < in.size(); ++i)
+        {
+            ASSERT_EQ(sums[i].has_value(), expected_sums[i].has_value());
+            if (sums[i])
+            {
+                ASSERT_NEAR(*sums[i], *expected_sums[i], 1e-6);
+            }
+        }
+
+        // Independent of the number of threads.
+        par::thread_pool two(2);
+        std::vector<optional<double>> sums2(in.size()), sums4(in.size());
+        par::inclusive_scan_skip_null(two, s, make_span(sums2), agg::sum(), nulls);
+        par::inclusive_scan_skip_null(pool, s, make_span(sums4), agg::sum(), nulls);
+        EXPECT_EQ(sums2, sums4);
+    }
+}
@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+
+#include <optional_pool.hpp>
+
+#include <atomic>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace opt;
+
+namespace
+{
+    // Counts the live objects.
+    struct counted
+    {
+        explicit counted(int v)
+            : value(v)
+        {
+            if (v < 0)
+                throw std::invalid_argument("negative");
+            ++live;
+        }
+
+        ~counted()
+        {
+            --live;
+        }
+
+        int value;
+        static int live;
+    };
+
+    int counted::live = 0;
+}
+
+TEST(optional_pool, Basic)
+{
+    object_pool<std::string> pool(2);
+    EXPECT_EQ(pool.capacity(), 2u);
+
+    optional<object_pool<std::string>::handle> a = pool.acquire(3, 'a');
+    optional<object_pool<std::string>::handle> b = pool.acquire("b");
+    ASSERT_TRUE(a.has_value());
+    ASSERT_TRUE(b.has_value());
+    EXPECT_EQ(**a, "aaa");
+    EXPECT_EQ((*b)->size(), 1u);
+
+    // The pool is exhausted until a handle is destroyed.
+    EXPECT_FALSE(pool.acquire("c").has_value());
+    const std::string* kept = a->get();
+    a.reset();
+
+    // pool_release::keep hands out the same object, without constructing it again.
+    optional<object_pool<std::string>::handle> c = pool.acquire("c");
+    ASSERT_TRUE(c.has_value());
+    EXPECT_EQ(c->get(), kept);
+    EXPECT_EQ(**c, "aaa");
+
+    // Handles are move-only.
+    object_pool<std::string>::handle moved = std::move(*c);
+    EXPECT_FALSE(*c);
+    EXPECT_TRUE(moved);
+    EXPECT_EQ(c->get(), nullptr);
+    moved.reset();
+    EXPECT_FALSE(moved);
+    EXPECT_TRUE(pool.acquire("d").has_value());
+}
+
+TEST(optional_pool, Release)
+{
+    {
+        object_pool<counted, pool_release::reset> pool(3);
+        {
+            auto a = pool.acquire(1);
+            auto b = pool.acquire(2);
+            EXPECT_EQ(counted::live, 2);
+        }
+        // The objects are destroyed when they are returned.
+        EXPECT_EQ(counted::live, 0);
+        EXPECT_EQ((*pool.acquire(3))->value, 3);
+
+        // A constructor that throws leaves the slot free.
+        EXPECT_THROW(pool.acquire(-1), std::invalid_argument);
+        std::vector<object_pool<counted, pool_release::reset>::handle> all;
+        while (auto h = pool.acquire(4))
+            all.push_back(std::move(*h));
+        EXPECT_EQ(all.size(), 3u);
+    }
+    EXPECT_EQ(counted::live, 0);
+
+    {
+        object_pool<counted> pool(3);
+        {
+            auto a = pool.acquire(1);
+            auto b = pool.acquire(2);
+        }
+        // The objects are kept until the pool is destroyed.
+        EXPECT_EQ(counted::live, 2);
+    }
+    EXPECT_EQ(counted::live, 0);
+}
+
+TEST(optional_pool, Spill)
+{
+    // Releasing more objects than a cache holds spills them to the free list: every object
+    // is still handed out exactly once when the pool is drained again.
+    object_pool<int> pool(100);
+    std::set<const int*> objects;
+    for (int round = 0; round < 3; ++round)
+    {
+        std::vector<object_pool<int>::handle> all;
+        while (auto h = pool.acquire(round))
+            all.push_back(std::move(*h));
+        ASSERT_EQ(all.size(), 100u);
+
+        std::set<const int*> acquired;
+        for (auto& h : all)
+            acquired.insert(h.get());
+        EXPECT_EQ(acquired.size(), 100u);
+        if (round > 0)
+        {
+            EXPECT_EQ(acquired, objects);
+        }
+        objects = acquired;
+    }
+}
+
+TEST(optional_pool, Threads)
+{
+    // Threads acquire and release objects (often on another thread): an object is never
+    // handed out twice at the same time and the pool ends up with all its objects free.
+    const std::size_t capacity = 32;
+    object_pool<std::atomic<int>> pool(capacity);
+    std::atomic<int> failures(0);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            std::vector<object_pool<std::atomic<int>>::handle> held;
+            for (int i = 0; i < 20000; ++i)
+            {
+                if (auto h = pool.acquire(0))
+                {
+                    if ((*h)->exchange(t + 1) != 0)
+                        ++failures;
+                    held.push_back(std::move(*h));
+                }
+                if (held.size() > static_cast<std::size_t>(i % 7))
+                {
+                    if (held.back()->exchange(0) != t + 1)
+                        ++failures;
+                    held.pop_back();
+                }
+            }
+            for (auto& h : held)
+                h->store(0);
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    EXPECT_EQ(failures.load(), 0);
+    std::vector<object_pool<std::atomic<int>>::handle> all;
+    while (auto h = pool.acquire(0))
+        all.push_back(std::move(*h));
+    EXPECT_EQ(all.size(), capacity);
+}